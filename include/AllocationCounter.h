@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Macros.h"
+
+namespace VKRT {
+
+// Number of operator new calls made by the current thread. Only counted when built with
+// VKRT_TRACK_ALLOCATIONS, always 0 otherwise
+uint64_t GetThreadAllocationCount();
+
+}  // namespace VKRT
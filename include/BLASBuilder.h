@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "Mesh.h"
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+
+namespace VKRT {
+
+class Context;
+
+// Collects BLAS builds so they go to the device together, several geometries per build call with
+// their scratch carved out of the shared scratch pool. Builds are grouped by mesh build policy and
+// each group is timed, so the policies can be tuned against the main pass cost
+class BLASBuilder : public RefCountPtr {
+public:
+    BLASBuilder(ScopedRefPtr<Context> context);
+
+    void Enqueue(
+        Mesh* mesh,
+        vk::BuildAccelerationStructureModeKHR mode,
+        vk::DeviceSize scratchSize);
+    // Meshes released before their build are skipped
+    void Cancel(Mesh* mesh);
+
+    // Records every pending build, the scratch pool must be released once the submission completes
+    void RecordBuilds(vk::CommandBuffer commandBuffer);
+    // Builds everything pending in one submission and waits for it
+    void Flush();
+    // Call with the ticket of the submission the builds were recorded into, reads the timings of
+    // the submissions that completed
+    void Release(uint64_t ticket);
+
+    // Totals over the run
+    struct Statistics {
+        uint32_t buildCount;
+        uint32_t refitCount;
+        uint64_t triangleCount;
+        double milliseconds;
+    };
+    const Statistics& GetStatistics(Mesh::BuildPolicy buildPolicy) const {
+        return mStatistics[static_cast<uint32_t>(buildPolicy)];
+    }
+
+    ~BLASBuilder();
+
+private:
+    // Build calls are split so the scratch they need at once stays bounded
+    static constexpr vk::DeviceSize MaxScratchPerBuild = 128ull * 1024 * 1024;
+    static constexpr uint32_t PolicyCount = static_cast<uint32_t>(Mesh::BuildPolicy::Count);
+
+    struct Request {
+        Mesh* mesh;
+        vk::BuildAccelerationStructureModeKHR mode;
+        vk::DeviceSize scratchSize;
+    };
+
+    void RecordBuild(vk::CommandBuffer commandBuffer, size_t firstRequest, size_t requestCount);
+    // Adds the pending statistics of the frame slot to the totals, never waits for its queries
+    void ReadTimings(uint32_t frameSlot);
+
+    ScopedRefPtr<Context> mContext;
+    std::vector<Request> mRequests;
+    // Begin and end timestamp of each policy group, a range per frame slot so recording a frame
+    // doesn't wait for the queries of the ones in flight
+    vk::QueryPool mTimestampQueryPool;
+    double mTimestampPeriod;
+    uint64_t mTimestampMask;
+    struct PendingTimings {
+        // Per policy
+        std::array<Statistics, PolicyCount> statistics;
+        // Ticket of the submission the timestamps are written by, 0 until it is submitted
+        uint64_t ticket;
+        bool recorded;
+    };
+    std::vector<PendingTimings> mPendingTimings;
+    std::array<Statistics, PolicyCount> mStatistics;
+    std::vector<Mesh*> mBuiltMeshes;
+    // Kept across calls so the arrays handed to the device don't reallocate every batch
+    std::vector<vk::AccelerationStructureGeometryKHR> mGeometries;
+    // Index of the first geometry of each request in mGeometries and mRanges
+    std::vector<uint32_t> mFirstGeometries;
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> mBuildInfos;
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> mRanges;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> mRangePointers;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+class Mesh;
+
+// Serialized bottom level acceleration structures on disk, keyed by their geometry, build flags and
+// the device and driver that built them. Meshes found in the cache are deserialized instead of
+// built, the others are written once their final, compacted structure exists
+class BLASCache : public RefCountPtr {
+public:
+    using Key = uint64_t;
+    static constexpr Key NoKey = 0;
+
+    // An empty directory disables the cache
+    BLASCache(ScopedRefPtr<Context> context, const std::filesystem::path& directory);
+
+    bool IsEnabled() const { return !mDirectory.empty(); }
+    // Vertex and index data of every geometry, in build order
+    Key ComputeKey(
+        const std::vector<std::span<const uint8_t>>& geometryData,
+        vk::BuildAccelerationStructureFlagsKHR buildFlags) const;
+
+    // Reads the structure stored for the key if this device can deserialize it
+    bool Load(Key key, std::vector<uint8_t>& data);
+    // Size of the structure the serialized data turns into
+    static vk::DeviceSize GetDeserializedSize(std::span<const uint8_t> data);
+    // Writes serialized data that is already on the host, safe from any thread
+    bool Save(Key key, std::span<const uint8_t> data);
+    // Same on the cache's writer thread, the caller doesn't wait for the disk
+    void SaveAsync(Key key, std::vector<uint8_t>&& data);
+
+    // The mesh BLAS must already be created with the deserialized size
+    void EnqueueLoad(Mesh* mesh, std::vector<uint8_t>&& data);
+    bool HasPendingLoads() const { return !mLoads.empty(); }
+    // Mesh BLASes that won't change anymore, skipped for meshes without a key
+    void EnqueueStore(Mesh* mesh);
+    // Meshes released before their load or store are skipped
+    void Cancel(Mesh* mesh);
+
+    // Deserializes every pending load, recorded with the BLAS builds
+    void RecordLoads(vk::CommandBuffer commandBuffer);
+    // Copies out the structures whose serialization size was queried by an earlier submission,
+    // then queries the sizes of the newly stored ones. Record after the compaction copies
+    void RecordStores(vk::CommandBuffer commandBuffer);
+    // Call with the ticket of the submission the loads and stores were recorded into, hands the
+    // stores whose submission has completed to the writer thread
+    void Release(uint64_t ticket);
+
+    uint32_t GetLoadCount() const { return mLoadCount; }
+    uint32_t GetStoreCount() const { return mStoreCount; }
+
+    ~BLASCache();
+
+private:
+    static constexpr uint32_t QueriesPerPool = 256;
+    // driverUUID and compatibility UUID, then the serialized and deserialized sizes
+    static constexpr size_t HeaderSize = 2 * VK_UUID_SIZE + 2 * sizeof(uint64_t);
+
+    struct Load {
+        Mesh* mesh;
+        std::vector<uint8_t> data;
+    };
+    struct Store {
+        Mesh* mesh;
+        Key key;
+        ScopedRefPtr<VulkanBuffer> buffer;
+        // Ticket of the submission that copies it out, 0 until it is submitted
+        uint64_t ticket;
+    };
+
+    std::filesystem::path GetPath(Key key) const;
+    void RunWriter();
+
+    ScopedRefPtr<Context> mContext;
+    std::filesystem::path mDirectory;
+    Key mDeviceKey;
+
+    std::vector<Load> mLoads;
+    // Uploaded serialized data, read by the device until the submission completes
+    std::vector<ScopedRefPtr<VulkanBuffer>> mUploadBuffers;
+
+    std::vector<Mesh*> mPendingStores;
+    std::vector<vk::QueryPool> mQueryPools;
+    // Indexed by query, across the pools
+    std::vector<Mesh*> mQueriedMeshes;
+    std::vector<vk::DeviceSize> mSerializedSizes;
+    // Copies recorded into readback buffers, written to disk on release
+    std::vector<Store> mStores;
+
+    // Started by the first asynchronous save, writes until the queue is empty before stopping
+    std::thread mWriter;
+    std::mutex mWriteMutex;
+    std::condition_variable mWriteCondition;
+    std::vector<std::pair<Key, std::vector<uint8_t>>> mWrites;
+    bool mStopWriting;
+
+    uint32_t mLoadCount;
+    std::atomic<uint32_t> mStoreCount;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+class Mesh;
+
+// Shrinks bottom level acceleration structures built with eAllowCompaction. The compacted size is
+// queried with the build, the copy into a right-sized buffer is recorded in a later frame
+class BLASCompactor : public RefCountPtr {
+public:
+    BLASCompactor(ScopedRefPtr<Context> context);
+
+    // Record after the builds of the mesh BLASes, in the same command buffer
+    void RecordSizeQueries(vk::CommandBuffer commandBuffer, std::span<Mesh* const> meshes);
+    // Meshes released before their compaction are skipped
+    void Cancel(Mesh* mesh);
+
+    // Copies every BLAS whose size query completed into a compacted one, must be recorded before
+    // the TLAS build that references it
+    void RecordCompaction(vk::CommandBuffer commandBuffer);
+    // Call with the ticket of the submission the compactions were recorded into, destroys the
+    // replaced structures of the submissions that have completed
+    void Release(uint64_t ticket);
+
+    vk::DeviceSize GetSavedBytes() const { return mSavedBytes; }
+
+    ~BLASCompactor();
+
+private:
+    static constexpr uint32_t QueriesPerPool = 256;
+
+    struct Replaced {
+        vk::AccelerationStructureKHR accelerationStructure;
+        ScopedRefPtr<VulkanBuffer> buffer;
+        // Ticket of the submission that compacts it, 0 until it is submitted
+        uint64_t ticket;
+    };
+
+    ScopedRefPtr<Context> mContext;
+    std::vector<vk::QueryPool> mQueryPools;
+    // Indexed by query, across the pools
+    std::vector<Mesh*> mQueriedMeshes;
+    std::vector<vk::DeviceSize> mCompactedSizes;
+    // Original structures, the frames up to the one that compacts them still read them
+    std::vector<Replaced> mReplaced;
+    vk::DeviceSize mSavedBytes;
+};
+
+}  // namespace VKRT
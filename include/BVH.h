@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define VKRT_BVH_SSE
+#endif
+
+#include "glm/glm.hpp"
+
+namespace VKRT {
+
+struct BoundingBox {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void Extend(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void Extend(const BoundingBox& box) {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+    glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+    float GetHalfArea() const {
+        const glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+};
+
+// Four wide bounding volume hierarchy over boxes, for the CPU renderer. Built top down with binned
+// SAH, large subtrees in parallel, and traversed testing the four child boxes of a node at once
+class BVH4 {
+public:
+    // Replaces the hierarchy, primitives are referred to by their index in boxes
+    void Build(std::span<const BoundingBox> boxes);
+
+    const BoundingBox& GetBounds() const { return mBounds; }
+    uint32_t GetNodeCount() const { return mNodeCount; }
+    // Surface area heuristic estimate of the cost of a ray through the root box, in units of the
+    // given node and primitive test costs
+    float GetSAHCost(float traversalCost, float intersectionCost) const;
+
+    // Calls intersect(primitiveIndex, tMax) for the primitives whose leaves the ray reaches, it
+    // returns true on a hit and lowers tMax to it. Any hit stops at the first one
+    template <typename Intersector>
+    bool Traverse(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float tMin,
+        float& tMax,
+        bool anyHit,
+        Intersector&& intersect) const;
+
+private:
+    static constexpr uint32_t MaxLeafSize = 4;
+    static constexpr uint32_t BinCount = 16;
+    // Subtrees above this many primitives are built on their own thread
+    static constexpr uint32_t ParallelBuildSize = 16 * 1024;
+    static constexpr uint32_t MaxDepth = 64;
+    static constexpr uint32_t EmptyChild = ~0u;
+    static constexpr uint32_t LeafFlag = 1u << 31;
+
+    // Children as structure of arrays so one SIMD register holds a bound of all four
+    struct alignas(16) Node {
+        float minX[4];
+        float minY[4];
+        float minZ[4];
+        float maxX[4];
+        float maxY[4];
+        float maxZ[4];
+        // Inner nodes by index, leaves flagged with their first primitive and count
+        uint32_t children[4];
+        uint32_t counts[4];
+    };
+
+    struct Range {
+        uint32_t begin;
+        uint32_t end;
+        BoundingBox bounds;
+        BoundingBox centroidBounds;
+    };
+
+    Range MakeRange(uint32_t begin, uint32_t end) const;
+    // Binned SAH along each axis, the centroid median when no split is better than another
+    uint32_t Split(const Range& range);
+    void BuildNode(uint32_t nodeIndex, const Range& range, uint32_t depth);
+
+    std::span<const BoundingBox> mBoxes;
+    std::vector<glm::vec3> mCentroids;
+    std::vector<uint32_t> mPrimitiveIndices;
+    std::vector<Node> mNodes;
+    std::atomic<uint32_t> mNodeCount{0};
+    BoundingBox mBounds;
+};
+
+template <typename Intersector>
+bool BVH4::Traverse(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float tMin,
+    float& tMax,
+    bool anyHit,
+    Intersector&& intersect) const {
+    if (mNodeCount == 0) {
+        return false;
+    }
+    // Kept finite so empty child slots and axis aligned rays never produce NaNs
+    glm::vec3 inverseDirection;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float component = std::abs(direction[axis]) < 1e-20f
+                                    ? std::copysign(1e-20f, direction[axis])
+                                    : direction[axis];
+        inverseDirection[axis] = 1.0f / component;
+    }
+
+    uint32_t stack[MaxDepth * 3 + 1];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    bool hit = false;
+    while (stackSize > 0) {
+        const Node& node = mNodes[stack[--stackSize]];
+        alignas(16) float entry[4];
+        uint32_t hitMask = 0;
+#ifdef VKRT_BVH_SSE
+        {
+            const __m128 originX = _mm_set1_ps(origin.x);
+            const __m128 originY = _mm_set1_ps(origin.y);
+            const __m128 originZ = _mm_set1_ps(origin.z);
+            const __m128 inverseX = _mm_set1_ps(inverseDirection.x);
+            const __m128 inverseY = _mm_set1_ps(inverseDirection.y);
+            const __m128 inverseZ = _mm_set1_ps(inverseDirection.z);
+            const __m128 t0X = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), inverseX);
+            const __m128 t1X = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), inverseX);
+            const __m128 t0Y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), inverseY);
+            const __m128 t1Y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), inverseY);
+            const __m128 t0Z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), inverseZ);
+            const __m128 t1Z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), inverseZ);
+            const __m128 entryTimes = _mm_max_ps(
+                _mm_max_ps(_mm_min_ps(t0X, t1X), _mm_min_ps(t0Y, t1Y)),
+                _mm_max_ps(_mm_min_ps(t0Z, t1Z), _mm_set1_ps(tMin)));
+            const __m128 exitTimes = _mm_min_ps(
+                _mm_min_ps(_mm_max_ps(t0X, t1X), _mm_max_ps(t0Y, t1Y)),
+                _mm_min_ps(_mm_max_ps(t0Z, t1Z), _mm_set1_ps(tMax)));
+            hitMask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entryTimes, exitTimes)));
+            _mm_store_ps(entry, entryTimes);
+        }
+#else
+        for (int child = 0; child < 4; ++child) {
+            const glm::vec3 t0 =
+                (glm::vec3(node.minX[child], node.minY[child], node.minZ[child]) - origin) *
+                inverseDirection;
+            const glm::vec3 t1 =
+                (glm::vec3(node.maxX[child], node.maxY[child], node.maxZ[child]) - origin) *
+                inverseDirection;
+            const glm::vec3 slabEntry = glm::min(t0, t1);
+            const glm::vec3 slabExit = glm::max(t0, t1);
+            entry[child] =
+                std::max(std::max(slabEntry.x, slabEntry.y), std::max(slabEntry.z, tMin));
+            const float exit =
+                std::min(std::min(slabExit.x, slabExit.y), std::min(slabExit.z, tMax));
+            hitMask |= entry[child] <= exit ? 1u << child : 0u;
+        }
+#endif
+
+        // Leaves are tested nearest first, their hits lower tMax for everything still queued
+        uint32_t hitChildren[4];
+        uint32_t hitCount = 0;
+        for (uint32_t child = 0; child < 4; ++child) {
+            if ((hitMask & (1u << child)) != 0 && node.children[child] != EmptyChild) {
+                hitChildren[hitCount++] = child;
+            }
+        }
+        std::sort(hitChildren, hitChildren + hitCount, [&entry](uint32_t a, uint32_t b) {
+            return entry[a] < entry[b];
+        });
+        for (uint32_t index = 0; index < hitCount; ++index) {
+            const uint32_t reference = node.children[hitChildren[index]];
+            if ((reference & LeafFlag) == 0) {
+                continue;
+            }
+            const uint32_t first = reference & ~LeafFlag;
+            const uint32_t count = node.counts[hitChildren[index]];
+            for (uint32_t primitive = first; primitive < first + count; ++primitive) {
+                if (intersect(mPrimitiveIndices[primitive], tMax)) {
+                    hit = true;
+                    if (anyHit) {
+                        return true;
+                    }
+                }
+            }
+        }
+        // Farthest pushed first so the nearest inner node is popped next
+        for (uint32_t index = hitCount; index-- > 0;) {
+            const uint32_t reference = node.children[hitChildren[index]];
+            if ((reference & LeafFlag) == 0) {
+                stack[stackSize++] = reference;
+            }
+        }
+    }
+    return hit;
+}
+
+}  // namespace VKRT
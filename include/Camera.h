@@ -8,6 +8,8 @@ namespace VKRT {
 class Camera : public RefCountPtr, public InputEventListener {
 public:
     Camera(ScopedRefPtr<Window> window);
+    // Takes no input, for rendering without a window
+    Camera(double aspectRatio);
 
     void Update(float deltaTime);
 
@@ -32,6 +34,7 @@ private:
     void OnRightMouseButtonPressed() override;
     void OnRightMouseButtonReleased() override;
 
+    void SetProjection(double aspectRatio);
     void UpdateViewTransform();
 
     ScopedRefPtr<Window> mWindow;
@@ -12,19 +12,55 @@
 #include "Window.h"
 
 namespace VKRT {
+class BLASBuilder;
+class BLASCache;
+class BLASCompactor;
+class GeometryPool;
+class HostBLASBuilder;
+class ResidencyManager;
+class ScratchAllocator;
+
 class Context : public RefCountPtr {
 public:
+    static constexpr uint32_t MaxFramesInFlight = 3;
+
     Context(
         ScopedRefPtr<Window> window,
         ScopedRefPtr<Instance> instance,
         vk::SurfaceKHR surface,
         ScopedRefPtr<Device> device);
+    // Host only, creates no device: meshes and textures keep their data in host memory and nothing
+    // is uploaded or built. For the CPU renderer and the scene analyzer
+    Context();
+
+    bool IsHostOnly() const { return mHostOnly; }
 
     ScopedRefPtr<Window> GetWindow() { return mWindow; }
     ScopedRefPtr<Instance> GetInstance() { return mInstance; }
     const vk::SurfaceKHR& GetSurface() { return mSurface; }
     ScopedRefPtr<Device> GetDevice() { return mDevice; }
     ScopedRefPtr<Swapchain> GetSwapchain() { return mSwapchain; }
+    GeometryPool* GetGeometryPool() { return mGeometryPool.Get(); }
+    ScratchAllocator* GetScratchAllocator() { return mScratchAllocator.Get(); }
+    BLASBuilder* GetBLASBuilder() { return mBLASBuilder.Get(); }
+    BLASCache* GetBLASCache() { return mBLASCache.Get(); }
+    BLASCompactor* GetBLASCompactor() { return mBLASCompactor.Get(); }
+    HostBLASBuilder* GetHostBLASBuilder() { return mHostBLASBuilder.Get(); }
+    ResidencyManager* GetResidencyManager() { return mResidencyManager.Get(); }
+
+    // Meshes and textures created afterwards keep a copy of their data in host memory, for the
+    // CPU renderer
+    void SetRetainHostData(bool retainHostData) { mRetainHostData = retainHostData; }
+    bool RetainsHostData() const { return mRetainHostData; }
+
+    // Frames the renderer records ahead of the device, set before loading. Buffers the host writes
+    // for every frame have one copy per frame in flight
+    void SetFramesInFlight(uint32_t framesInFlight);
+    uint32_t GetFramesInFlight() const { return mFramesInFlight; }
+    // Copy of the per frame buffers the next frame uses, set by the renderer once the frame that
+    // last used it has completed
+    uint32_t GetFrameSlot() const { return mFrameSlot; }
+    void SetFrameSlot(uint32_t frameSlot) { mFrameSlot = frameSlot; }
 
     void Destroy();
 
@@ -36,6 +72,17 @@ private:
     ScopedRefPtr<Instance> mInstance;
     ScopedRefPtr<Device> mDevice;
     ScopedRefPtr<Swapchain> mSwapchain;
+    ScopedRefPtr<GeometryPool> mGeometryPool;
+    ScopedRefPtr<ScratchAllocator> mScratchAllocator;
+    ScopedRefPtr<BLASBuilder> mBLASBuilder;
+    ScopedRefPtr<BLASCache> mBLASCache;
+    ScopedRefPtr<BLASCompactor> mBLASCompactor;
+    ScopedRefPtr<HostBLASBuilder> mHostBLASBuilder;
+    ScopedRefPtr<ResidencyManager> mResidencyManager;
+    bool mHostOnly;
+    bool mRetainHostData;
+    uint32_t mFramesInFlight;
+    uint32_t mFrameSlot;
 };
 
 }  // namespace VKRT
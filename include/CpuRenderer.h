@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "BVH.h"
+#include "FrameArena.h"
+#include "Light.h"
+#include "Mesh.h"
+#include "RefCountPtr.h"
+#include "Scene.h"
+
+namespace VKRT {
+
+class Texture;
+
+// Traces the scene on the CPU with the Whitted shading of the ray tracing pipeline, for machines
+// without ray tracing hardware and for checking scenes against a reference. Reads the host copies
+// meshes and textures keep when the context retains host data
+class CpuRenderer : public RefCountPtr {
+public:
+    // No thread count uses every hardware thread
+    CpuRenderer(ScopedRefPtr<Scene> scene, uint32_t threadCount = 0);
+
+    // Takes in transforms, materials and lights, builds the BVHs of meshes it hasn't seen yet and
+    // the one over the instances
+    void Update();
+    // Camera matrices as in the ray generation shader, the image is RGBA8 in sRGB
+    void Render(
+        const glm::mat4& viewInverse,
+        const glm::mat4& projInverse,
+        uint32_t width,
+        uint32_t height);
+
+    const std::vector<uint32_t>& GetPixels() const { return mPixels; }
+    // Binary PPM
+    bool WriteImage(const std::string& path) const;
+
+    struct Statistics {
+        double buildMilliseconds;
+        double renderMilliseconds;
+        uint64_t rayCount;
+    };
+    const Statistics& GetStatistics() const { return mStatistics; }
+
+    ~CpuRenderer();
+
+private:
+    // Same limits as definitions.glsl
+    static constexpr uint32_t MaxRecursionLevel = 4;
+    static constexpr float TMin = 0.001f;
+    static constexpr float TMax = 1000.0f;
+    static constexpr float AmbientTerm = 0.01f;
+    static constexpr uint32_t TileSize = 16;
+
+    struct Triangle {
+        glm::vec3 vertex0;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+        uint32_t geometry;
+        uint32_t primitive;
+        bool alphaTested;
+    };
+    struct MeshData {
+        const Mesh* mesh;
+        std::vector<Triangle> triangles;
+        BVH4 bvh;
+    };
+    struct Instance {
+        glm::mat4 objectToWorld;
+        glm::mat4 worldToObject;
+        glm::mat3 normalMatrix;
+        // Null for the scene's analytic spheres, the unit sphere scaled by the transform
+        const MeshData* mesh;
+        uint32_t firstGeometry;
+        uint32_t mask;
+    };
+    struct Hit {
+        float t;
+        uint32_t instance;
+        uint32_t geometry;
+        uint32_t primitive;
+        // Texture coordinates for spheres
+        glm::vec2 barycentrics;
+    };
+    // Shared by a ray and everything it spawns, like the pipeline payload
+    struct Payload {
+        glm::vec3 color;
+        uint32_t depth;
+    };
+    const MeshData* GetMeshData(const Mesh* mesh);
+    bool Intersect(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float tMax,
+        uint32_t mask,
+        bool anyHit,
+        Hit& hit) const;
+    bool IntersectSphere(
+        const glm::vec3& objectOrigin,
+        const glm::vec3& objectDirection,
+        uint32_t instanceIndex,
+        float& tMax,
+        Hit& hit) const;
+    // The any-hit shader's test, for triangles import left partly cut out
+    bool IsCutOut(const Instance& instance, const Triangle& triangle, glm::vec2 barycentrics) const;
+    void TraceColor(const glm::vec3& origin, const glm::vec3& direction, Payload& payload) const;
+    float TraceShadow(const glm::vec3& origin, const glm::vec3& direction, float distance) const;
+    void ClosestHit(const Hit& hit, const glm::vec3& direction, Payload& payload) const;
+    glm::vec3 GetSkyColor(const glm::vec3& direction) const;
+    glm::vec4 Sample(int32_t textureIndex, glm::vec2 texCoord) const;
+    void RenderTile(uint32_t tileIndex, const glm::mat4& viewInverse, const glm::mat4& projInverse);
+
+    ScopedRefPtr<Scene> mScene;
+    uint32_t mThreadCount;
+    FrameArena mArena;
+
+    std::unordered_map<const Mesh*, std::unique_ptr<MeshData>> mMeshData;
+    std::vector<Instance> mInstances;
+    BVH4 mInstanceBVH;
+    std::vector<Scene::MaterialProxy> mMaterials;
+    std::vector<const Texture*> mTextures;
+    std::vector<Light::Proxy> mLights;
+    glm::vec3 mSunDirection;
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    std::vector<uint32_t> mPixels;
+    std::atomic<uint64_t> mRayCount;
+    Statistics mStatistics;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "RefCountPtr.h"
+
+namespace VKRT {
+
+// Objects whose last reference is gone but that may still be used by submitted GPU work. Retire is
+// lock free and can be called from any thread, Collect runs on the thread that submits work
+class DeletionQueue {
+public:
+    DeletionQueue();
+
+    // lastUseValue is the device timeline value after which the object is no longer used
+    void Retire(RefCountPtr* object, uint64_t lastUseValue);
+    // Deletes every object whose last use is at or before completedValue
+    void Collect(uint64_t completedValue);
+    bool IsEmpty() const;
+
+    ~DeletionQueue();
+
+private:
+    struct Node {
+        RefCountPtr* object;
+        uint64_t lastUseValue;
+        Node* next;
+    };
+
+    std::atomic<Node*> mHead;
+    // Only touched by Collect
+    std::vector<Node*> mPending;
+};
+
+}  // namespace VKRT
@@ -1,7 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <memory>
-
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "DeletionQueue.h"
+#include "MemoryAllocator.h"
+#include "MemoryTracker.h"
 #include "RefCountPtr.h"
 #include "Result.h"
 #include "VulkanBase.h"
@@ -26,25 +35,105 @@ public:
     void SetContext(ScopedRefPtr<Context> context);
 
     // Memory handling
+    enum class MemoryUsage { Upload, Readback, DeviceLocal, DeviceLocalHostVisible };
+    static MemoryUsage GetMemoryUsage(const vk::MemoryPropertyFlags& memoryFlags);
+
     vk::DeviceMemory AllocateMemory(
         const vk::MemoryPropertyFlags& memoryFlags,
         const vk::MemoryRequirements memoryRequirements,
-        const vk::MemoryAllocateFlags& memoryAllocateFlags = {});
+        const vk::MemoryAllocateFlags& memoryAllocateFlags = {},
+        const MemoryTag& tag = {});
+    void FreeMemory(vk::DeviceMemory memory);
+
+    // Buffer memory, device local memory that is never mapped comes out of the suballocator
+    MemoryAllocation AllocateBufferMemory(
+        const vk::MemoryPropertyFlags& memoryFlags,
+        const vk::MemoryRequirements memoryRequirements,
+        const vk::MemoryAllocateFlags& memoryAllocateFlags = {},
+        const MemoryTag& tag = {});
+    void FreeBufferMemory(const MemoryAllocation& allocation);
+    MemoryAllocator* GetMemoryAllocator() { return mMemoryAllocator.get(); }
+
+    struct HeapBudget {
+        vk::DeviceSize size;
+        // Budget and usage as reported by VK_EXT_memory_budget, they fall back to the heap size
+        // and to our own allocations when the extension is not available
+        vk::DeviceSize budget;
+        vk::DeviceSize usage;
+        // Bytes currently allocated through this device
+        vk::DeviceSize allocated;
+        bool isDeviceLocal;
+    };
+    std::vector<HeapBudget> GetMemoryBudget();
+    bool SupportsMemoryBudget() const { return mSupportsMemoryBudget; }
+
+    vk::MemoryPropertyFlags GetMemoryTypeFlags(uint32_t memoryTypeIndex) const {
+        return mMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    }
+
+    // Accounting of everything allocated through this device, per category and heap
+    const MemoryTracker& GetMemoryTracker() const { return mMemoryTracker; }
+    bool WriteMemorySnapshot(const std::string& path) const;
+    // True when the device exposes host visible device local memory beyond the legacy 256MB BAR
+    bool SupportsResizableBar() const { return mSupportsResizableBar; }
+    // accelerationStructureHostCommands, acceleration structures can be built on the CPU
+    bool SupportsHostAccelerationStructureCommands() const {
+        return mSupportsHostAccelerationStructureCommands;
+    }
 
     ScopedRefPtr<VulkanBuffer> CreateBuffer(
         const vk::DeviceSize& size,
         const vk::BufferUsageFlags& usageFlags,
         const vk::MemoryPropertyFlags& memoryFlags,
-        const vk::MemoryAllocateFlags& memoryAllocateFlags = {});
+        const vk::MemoryAllocateFlags& memoryAllocateFlags = {},
+        const MemoryTag& tag = {});
+
+    // Creates a device local buffer filled with data, written directly when the memory ends up
+    // host visible (ReBAR, unified memory) and through a staging buffer otherwise
+    ScopedRefPtr<VulkanBuffer> CreateDeviceLocalBuffer(
+        const uint8_t* data,
+        const vk::DeviceSize& size,
+        const vk::BufferUsageFlags& usageFlags,
+        const vk::MemoryAllocateFlags& memoryAllocateFlags = {},
+        const MemoryTag& tag = {});
+    // Doesn't wait for the copy, later submissions are ordered after it. Returns its ticket, 0
+    // when the buffer was written directly
+    uint64_t UploadToBuffer(
+        ScopedRefPtr<VulkanBuffer> buffer,
+        const uint8_t* data,
+        const vk::DeviceSize& size,
+        const vk::DeviceSize& offset = 0);
 
+    // Command buffers come from a pool owned by the calling thread. Destroying one hands it back
+    // to that pool, it is reused once the submissions made so far completed. Create and destroy
+    // on the same thread
     vk::CommandBuffer CreateCommandBuffer();
-    void SubmitCommand(const vk::CommandBuffer& commandBuffer, const vk::Fence& fence);
-    void SubmitCommandAndFlush(const vk::CommandBuffer& commandBuffer);
     void DestroyCommand(vk::CommandBuffer& commandBuffer);
+    static constexpr uint32_t MaxSubmitSemaphores = 8;
 
-    vk::Fence CreateFence();
-    void WaitForFence(vk::Fence& fence);
-    void DestroyFence(vk::Fence& fence);
+    // Every submission signals the device timeline. The value it completes with is its ticket,
+    // submitting is safe from any thread
+    uint64_t Submit(const vk::SubmitInfo& submitInfo);
+    uint64_t SubmitCommand(const vk::CommandBuffer& commandBuffer);
+    // Submits and waits, for work whose results are needed right away
+    void SubmitCommandAndFlush(const vk::CommandBuffer& commandBuffer);
+    bool IsComplete(uint64_t ticket);
+    void Wait(uint64_t ticket);
+
+    uint64_t GetCompletedTimelineValue();
+
+    // Command buffers recorded across calls that release objects, like a frame, are bracketed by
+    // these. Objects retired while one is open wait for the ticket of the last one to close
+    void BeginRecording();
+    void EndRecording(uint64_t ticket);
+    // Deletes the object once the submissions that may use it have completed: those made so far,
+    // and the open recordings once they are submitted
+    void Retire(RefCountPtr* object);
+    // Same for a structure whose buffer is kept alive by its own reference
+    void RetireAccelerationStructure(vk::AccelerationStructureKHR accelerationStructure);
+    void CollectRetired();
+    // Waits for the device to be idle and deletes everything retired
+    void FlushRetired();
 
     vk::Device& GetLogicalDevice() { return mLogicalDevice; }
     vk::DispatchLoaderDynamic& GetDispatcher() { return mDispatcher; }
@@ -58,17 +147,62 @@ public:
     SwapchainCapabilities GetSwapchainCapabilities(vk::SurfaceKHR surface);
 
     vk::PhysicalDeviceProperties GetDeviceProperties();
+    // Bits of the queue's timestamps that are valid, the ones above are undefined
+    uint64_t GetTimestampMask();
     vk::PhysicalDeviceRayTracingPipelinePropertiesKHR GetRayTracingProperties();
+    vk::PhysicalDeviceAccelerationStructurePropertiesKHR GetAccelerationStructureProperties();
 
     ~Device();
 
 private:
+    uint32_t FindMemoryType(
+        const vk::MemoryPropertyFlags& memoryFlags,
+        const vk::MemoryRequirements& memoryRequirements,
+        uint32_t excludedMemoryTypeBits);
+
+    struct RecycledCommandBuffer {
+        vk::CommandBuffer commandBuffer;
+        // Last submission it can be part of
+        uint64_t ticket;
+    };
+    struct CommandPool {
+        vk::CommandPool pool;
+        // Oldest first, tickets only grow
+        std::deque<RecycledCommandBuffer> recycled;
+    };
+    // Created on first use, command pools can't be used from several threads at once
+    CommandPool& GetThreadCommandPool();
+    void UpdateCompletedTimelineValue(uint64_t value);
+
     ScopedRefPtr<Context> mContext;
     vk::PhysicalDevice mPhysicalDevice;
     vk::Device mLogicalDevice;
+    uint32_t mQueueFamilyIndex;
     vk::Queue mGraphicsQueue;
-    vk::CommandPool mCommandPool;
     vk::DispatchLoaderDynamic mDispatcher;
+
+    std::mutex mCommandPoolMutex;
+    std::unordered_map<std::thread::id, CommandPool> mCommandPools;
+
+    vk::Semaphore mTimelineSemaphore;
+    // Guards the queue and the order of timeline values
+    std::mutex mSubmitMutex;
+    std::atomic<uint64_t> mSubmittedTimelineValue;
+    // Last value read from the semaphore, tickets at or below it need no driver call
+    std::atomic<uint64_t> mCompletedTimelineValue;
+    DeletionQueue mDeletionQueue;
+    // Retired while recordings are open, and the latest ticket of those submitted since
+    std::mutex mRecordingMutex;
+    uint32_t mOpenRecordingCount;
+    uint64_t mRecordingTicket;
+    std::vector<RefCountPtr*> mRecordingRetired;
+
+    vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+    bool mSupportsMemoryBudget;
+    bool mSupportsResizableBar;
+    bool mSupportsHostAccelerationStructureCommands;
+    MemoryTracker mMemoryTracker;
+    std::unique_ptr<MemoryAllocator> mMemoryAllocator;
 };
 
 }  // namespace VKRT
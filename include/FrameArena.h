@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace VKRT {
+
+// Bump allocator for data that only lives during a frame. Reset keeps the memory around and folds
+// the chunks a frame needed into a single one, so steady state frames never touch the heap
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity = 64 * 1024);
+
+    // Value initialized, only valid until the next Reset
+    template <typename T>
+    std::span<T> Allocate(size_t count) {
+        static_assert(
+            std::is_trivially_destructible_v<T>,
+            "Arena memory is released without running destructors");
+        if (count == 0) {
+            return {};
+        }
+        T* data = static_cast<T*>(AllocateBytes(sizeof(T) * count, alignof(T)));
+        for (size_t index = 0; index < count; ++index) {
+            new (data + index) T();
+        }
+        return std::span<T>(data, count);
+    }
+
+    void Reset();
+
+    size_t GetCapacity() const;
+    size_t GetUsedBytes() const { return mUsedBytes; }
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    void* AllocateBytes(size_t size, size_t alignment);
+
+    std::vector<Chunk> mChunks;
+    size_t mCurrentChunk;
+    size_t mOffset;
+    size_t mUsedBytes;
+};
+
+}  // namespace VKRT
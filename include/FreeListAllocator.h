@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+namespace VKRT {
+
+// Offset based sub-allocator for ranges of a larger resource, free ranges are kept sorted by
+// offset so neighbours get merged back when released
+class FreeListAllocator {
+public:
+    static constexpr uint64_t InvalidOffset = ~0ull;
+
+    explicit FreeListAllocator(uint64_t size = 0);
+
+    // Returns InvalidOffset when no free range can fit the request
+    uint64_t Allocate(uint64_t size, uint64_t alignment = 1);
+    void Free(uint64_t offset, uint64_t size);
+    void Grow(uint64_t newSize);
+
+    uint64_t GetSize() const { return mSize; }
+    uint64_t GetFreeSize() const { return mFreeSize; }
+    uint64_t GetLargestFreeRange() const;
+    uint32_t GetFreeRangeCount() const { return static_cast<uint32_t>(mFreeRanges.size()); }
+    bool IsEmpty() const { return mFreeSize == mSize; }
+
+private:
+    uint64_t mSize;
+    uint64_t mFreeSize;
+    // Offset to size
+    std::map<uint64_t, uint64_t> mFreeRanges;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "FreeListAllocator.h"
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+
+// Scene wide vertex and index megabuffers, meshes get element ranges in them instead of owning
+// their own buffers
+class GeometryPool : public RefCountPtr {
+public:
+    GeometryPool(ScopedRefPtr<Context> context);
+
+    struct Allocation {
+        uint32_t vertexOffset;
+        uint32_t vertexCount;
+        uint32_t triangleOffset;
+        uint32_t triangleCount;
+    };
+    Allocation Allocate(
+        const uint8_t* vertexData,
+        uint32_t vertexCount,
+        const glm::uvec3* triangles,
+        uint32_t triangleCount);
+    void Free(const Allocation& allocation);
+    // Frees the ranges once the submissions that may still read them have completed
+    void Retire(const Allocation& allocation);
+    // Vertex range without triangles, written by the GPU after the initial upload
+    uint32_t AllocateVertices(const uint8_t* vertexData, uint32_t vertexCount);
+    void FreeVertices(uint32_t vertexOffset, uint32_t vertexCount);
+
+    vk::DeviceAddress GetVertexAddress(uint32_t vertexOffset);
+    vk::DeviceAddress GetIndexAddress(uint32_t triangleOffset);
+
+    ScopedRefPtr<VulkanBuffer> GetVertexBuffer() { return mVertices.buffer; }
+    ScopedRefPtr<VulkanBuffer> GetIndexBuffer() { return mIndices.buffer; }
+
+    ~GeometryPool();
+
+private:
+    struct Pool {
+        ScopedRefPtr<VulkanBuffer> buffer;
+        FreeListAllocator allocator;
+        vk::DeviceSize elementSize;
+    };
+    void CreatePool(Pool& pool, vk::DeviceSize elementSize, uint32_t capacity);
+    uint32_t AllocateFromPool(Pool& pool, const uint8_t* data, uint32_t elementCount);
+    void GrowPool(Pool& pool, uint32_t minimumCapacity);
+
+    ScopedRefPtr<Context> mContext;
+    Pool mVertices;
+    Pool mIndices;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BLASCache.h"
+#include "Mesh.h"
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+
+// Builds static mesh BLASes on the CPU with VK_KHR_deferred_host_operations, the device only
+// deserializes the compacted result. Keeps large imports off the queue the frames go through.
+// Builds and serialization run on persistent worker threads, the buffers they use are created and
+// released by the thread that enqueues and collects, the allocator isn't shared
+class HostBLASBuilder : public RefCountPtr {
+public:
+    HostBLASBuilder(ScopedRefPtr<Context> context);
+
+    // Off by default. Needs accelerationStructureHostCommands, meshes are built on the device
+    // otherwise. Can't be turned off while builds are pending
+    bool IsEnabled() const { return mEnabled; }
+    void SetEnabled(bool enabled);
+
+    // The geometry is copied, the pool one lives in device local memory
+    void Enqueue(Mesh* mesh, const std::vector<Mesh::Primitive>& primitives);
+    bool HasPendingBuilds() const;
+    // Meshes released before their build are skipped
+    void Cancel(Mesh* mesh);
+
+    // Takes what the workers finished without waiting for the rest: built structures get their
+    // compacted copy, serialized ones their device BLAS and a BLAS cache load. Call before the
+    // cache loads are recorded
+    void Collect();
+    // Collects until every pending build is queued as a cache load
+    void Wait();
+
+    // Totals over the run, the time is spent on the workers
+    uint32_t GetBuildCount() const { return mBuildCount; }
+    uint64_t GetTriangleCount() const { return mTriangleCount; }
+    double GetMilliseconds() const;
+
+    ~HostBLASBuilder();
+
+private:
+    // Workers take the requests in Build and Serialize, the caller of Collect the others
+    enum class Stage { Build, Building, Built, Serialize, Serializing, Serialized };
+    struct Request {
+        // Null once cancelled
+        Mesh* mesh;
+        Stage stage;
+        std::string name;
+        uint32_t triangleCount;
+        BLASCache::Key cacheKey;
+        std::vector<Mesh::Primitive> primitives;
+        std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+        vk::AccelerationStructureBuildGeometryInfoKHR buildInfo;
+        ScopedRefPtr<VulkanBuffer> buffer;
+        vk::AccelerationStructureKHR structure;
+        std::vector<uint8_t> scratch;
+        ScopedRefPtr<VulkanBuffer> compactedBuffer;
+        vk::AccelerationStructureKHR compacted;
+        std::vector<uint8_t> serialized;
+    };
+
+    // Host commands read and write acceleration structures through host visible memory
+    vk::AccelerationStructureKHR CreateHostStructure(
+        vk::DeviceSize size,
+        const std::string& name,
+        ScopedRefPtr<VulkanBuffer>& buffer);
+    void DestroyHostStructures(Request& request);
+    bool HasCollectableRequests() const;
+
+    void StartWorkers();
+    void StopWorkers();
+    void RunWorker();
+    // Builds the batch with one deferred operation that the idle workers join
+    void BuildDeferred(std::unique_lock<std::mutex>& lock, const std::vector<Request*>& batch);
+    void JoinDeferred(vk::DeferredOperationKHR operation);
+    // Compacts into the copy created by Collect, serializes it and writes the cache entry
+    void Serialize(Request& request);
+
+    ScopedRefPtr<Context> mContext;
+    bool mEnabled;
+    // Owned by the thread that enqueues, the stages are shared with the workers
+    std::vector<std::unique_ptr<Request>> mRequests;
+
+    mutable std::mutex mMutex;
+    // Signaled on new work, finished stages and workers leaving a deferred operation
+    std::condition_variable mCondition;
+    std::vector<std::thread> mWorkers;
+    bool mStopping;
+    // Deferred operation the idle workers join, a new generation for each
+    vk::DeferredOperationKHR mOperation;
+    uint64_t mOperationGeneration;
+    uint32_t mJoiningCount;
+    bool mBatchBuilding;
+    double mMilliseconds;
+
+    uint32_t mBuildCount;
+    uint64_t mTriangleCount;
+};
+
+}  // namespace VKRT
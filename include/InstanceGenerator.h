@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+
+// Expands compact transforms and per-instance BLAS references into TLAS instance records on the
+// GPU. The host only writes what changed, one transform covers every instance of an object
+class InstanceGenerator : public RefCountPtr {
+public:
+    // Matches instances.comp. Custom index and mask, SBT offset and flags are packed like in the
+    // instance record
+    struct Template {
+        uint32_t transformIndex;
+        uint32_t customIndexAndMask;
+        uint32_t sbtOffsetAndFlags;
+        uint32_t padding;
+        vk::DeviceAddress blasAddress;
+    };
+
+    InstanceGenerator(ScopedRefPtr<Context> context);
+
+    // Reallocates, every transform and template has to be set again
+    void Resize(uint32_t transformCount, uint32_t instanceCount);
+    uint32_t GetTransformCount() const { return mTransforms.count; }
+    uint32_t GetInstanceCount() const { return mTemplates.count; }
+
+    void SetTransform(uint32_t transformIndex, const glm::mat4& transform);
+    void SetTemplate(uint32_t instanceIndex, const Template& instanceTemplate);
+
+    // Copies what was set since the last call and expands every instance when anything was.
+    // Record before the TLAS build that reads them
+    void Record(vk::CommandBuffer commandBuffer);
+    // Drops what was set since the last Record, for frames that don't record. The writes are in
+    // this frame slot's staging copy, a later frame would copy them out of another one
+    void DiscardWrites();
+    vk::DeviceAddress GetInstanceAddress() const { return mInstanceBuffer->GetDeviceAddress(); }
+
+    ~InstanceGenerator();
+
+private:
+    static constexpr uint32_t WorkgroupSize = 64;
+
+    // Matches the push constant block of instances.comp
+    struct Parameters {
+        vk::DeviceAddress templates;
+        vk::DeviceAddress transforms;
+        vk::DeviceAddress instances;
+        uint32_t instanceCount;
+    };
+
+    // Writes land in the mapped staging copy of the frame slot, the copy regions take them to the
+    // device local buffer. Earlier frames may still copy out of the other slots
+    struct UploadBuffer {
+        std::vector<ScopedRefPtr<VulkanBuffer>> staging;
+        std::vector<uint8_t*> mapped;
+        ScopedRefPtr<VulkanBuffer> buffer;
+        uint32_t count;
+        vk::DeviceSize elementSize;
+        std::vector<vk::BufferCopy> regions;
+    };
+    void Allocate(
+        UploadBuffer& upload,
+        uint32_t count,
+        vk::DeviceSize elementSize,
+        const char* name);
+    void Write(UploadBuffer& upload, uint32_t index, const void* data);
+
+    ScopedRefPtr<Context> mContext;
+    vk::ShaderModule mShader;
+    vk::PipelineLayout mLayout;
+    vk::Pipeline mPipeline;
+
+    UploadBuffer mTransforms;
+    UploadBuffer mTemplates;
+    ScopedRefPtr<VulkanBuffer> mInstanceBuffer;
+};
+
+}  // namespace VKRT
@@ -30,13 +30,16 @@ public:
     const float GetRoughness() const { return mRoughness; }
     const float GetMetallic() const { return mMetallic; }
     const float GetIndexOfRefraction() const { return mIndexOfRefraction; }
-    const ScopedRefPtr<Texture> GetAlbedoTexture() const { return mAlbedoTexture; }
-    const ScopedRefPtr<Texture> GetRoughnessTexture() const { return mRoughnessTexture; }
+    const ScopedRefPtr<Texture>& GetAlbedoTexture() const { return mAlbedoTexture; }
+    const ScopedRefPtr<Texture>& GetRoughnessTexture() const { return mRoughnessTexture; }
+    // Hits where the albedo texture's alpha is below the cutoff are ignored, 0 disables the test
+    float GetAlphaCutoff() const { return mAlphaCutoff; }
 
     void SetAlbedo(const glm::vec3& albedo) { mAlbedo = albedo; }
     void SetRoughness(float roughness) { mRoughness = roughness; }
     void SetMetallic(float metallic) { mMetallic = metallic; }
     void SetIndexOfRefraction(float indexOfRefraction) { mIndexOfRefraction = indexOfRefraction; }
+    void SetAlphaCutoff(float alphaCutoff) { mAlphaCutoff = alphaCutoff; }
 
     ~Material();
 
@@ -45,6 +48,7 @@ private:
     float mRoughness;
     float mMetallic;
     float mIndexOfRefraction;
+    float mAlphaCutoff;
 
     ScopedRefPtr<Texture> mAlbedoTexture;
     ScopedRefPtr<Texture> mRoughnessTexture;
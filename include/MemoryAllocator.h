@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "FreeListAllocator.h"
+#include "VulkanBase.h"
+
+namespace VKRT {
+
+class Device;
+class VulkanBuffer;
+
+struct MemoryAllocation {
+    static constexpr uint32_t DedicatedBlock = ~0u;
+
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t blockId = DedicatedBlock;
+    // Key in the memory tracker, stays the same when the allocation is moved
+    uint64_t trackingId = 0;
+};
+
+// Suballocates device local buffer memory out of large blocks, and incrementally moves buffers
+// between blocks so sparse ones can be released
+class MemoryAllocator {
+public:
+    static constexpr vk::DeviceSize BlockSize = 64ull * 1024 * 1024;
+    // Anything bigger gets its own allocation, moving it around would cost more than it saves
+    static constexpr vk::DeviceSize MaxSuballocationSize = BlockSize / 4;
+
+    struct Statistics {
+        uint32_t blockCount = 0;
+        vk::DeviceSize committedBytes = 0;
+        vk::DeviceSize usedBytes = 0;
+        uint32_t freeRangeCount = 0;
+        vk::DeviceSize largestFreeRange = 0;
+        // 0 when all free memory is one contiguous range, close to 1 when it is scattered
+        float fragmentation = 0.0f;
+        uint64_t movedBytes = 0;
+        uint64_t moveCount = 0;
+        uint64_t releasedBlockCount = 0;
+    };
+
+    MemoryAllocator(Device* device, const vk::PhysicalDeviceMemoryProperties& memoryProperties);
+
+    bool Allocate(
+        uint32_t memoryTypeIndex,
+        const vk::MemoryRequirements& memoryRequirements,
+        MemoryAllocation& allocation);
+    void Free(const MemoryAllocation& allocation);
+    void SetOwner(const MemoryAllocation& allocation, VulkanBuffer* buffer);
+
+    // Moves up to byteBudget bytes of buffers out of the sparsest blocks with GPU copies and
+    // releases blocks left empty. Waits for the device first when anything moves, frames in
+    // flight may still use the buffers
+    void Defragment(vk::DeviceSize byteBudget);
+
+    Statistics GetStatistics() const;
+    // Committed but unused bytes per heap, not visible to the memory tracker
+    vk::DeviceSize GetUnusedBytes(uint32_t heapIndex) const;
+
+    ~MemoryAllocator();
+
+private:
+    struct Resource {
+        vk::DeviceSize size;
+        vk::DeviceSize alignment;
+        VulkanBuffer* owner;
+    };
+    struct Block {
+        vk::DeviceMemory memory;
+        uint32_t memoryTypeIndex;
+        FreeListAllocator allocator;
+        // Keyed by offset
+        std::map<vk::DeviceSize, Resource> resources;
+    };
+    struct Move {
+        VulkanBuffer* buffer;
+        MemoryAllocation source;
+        MemoryAllocation destination;
+        vk::Buffer destinationHandle;
+    };
+
+    uint32_t CreateBlock(uint32_t memoryTypeIndex);
+    void ReleaseEmptyBlocks();
+    bool FindMoveDestination(
+        uint32_t sourceBlockId,
+        vk::DeviceSize sourceOffset,
+        const Resource& resource,
+        MemoryAllocation& destination);
+
+    Device* mDevice;
+    vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+    std::unordered_map<uint32_t, Block> mBlocks;
+    uint32_t mNextBlockId;
+    uint64_t mNextTrackingId;
+    uint64_t mMovedBytes;
+    uint64_t mMoveCount;
+    uint64_t mReleasedBlockCount;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace VKRT {
+
+enum class MemoryCategory : uint32_t {
+    Geometry = 0,
+    AccelerationStructure,
+    Scratch,
+    Instance,
+    ShaderBindingTable,
+    Uniform,
+    Texture,
+    Staging,
+    Other,
+    Count
+};
+
+struct MemoryTag {
+    MemoryCategory category = MemoryCategory::Other;
+    // Who the allocation belongs to, e.g. a mesh name or a texture source
+    std::string owner;
+};
+
+// Keeps live allocations and per category/heap counters of everything allocated through Device
+class MemoryTracker {
+public:
+    struct Counters {
+        uint64_t allocatedBytes = 0;
+        uint64_t peakBytes = 0;
+        uint32_t allocationCount = 0;
+        uint32_t peakAllocationCount = 0;
+        uint64_t totalAllocationCount = 0;
+    };
+
+    struct Allocation {
+        uint32_t memoryTypeIndex;
+        uint32_t heapIndex;
+        uint64_t size;
+        MemoryTag tag;
+    };
+
+    explicit MemoryTracker(uint32_t heapCount = 0);
+
+    void TrackAllocation(uint64_t id, const Allocation& allocation);
+    void TrackFree(uint64_t id);
+    bool FindAllocation(uint64_t id, Allocation& allocation) const;
+
+    Counters GetTotalCounters() const;
+    Counters GetCategoryCounters(MemoryCategory category) const;
+    Counters GetHeapCounters(uint32_t heapIndex) const;
+    Counters GetCounters(MemoryCategory category, uint32_t heapIndex) const;
+    uint32_t GetHeapCount() const { return static_cast<uint32_t>(mHeapCounters.size()); }
+
+    std::string ToJson() const;
+    std::string ToCsv() const;
+    // Format is picked from the extension, .csv writes CSV and anything else JSON
+    bool WriteSnapshot(const std::string& path) const;
+
+    static const char* GetCategoryName(MemoryCategory category);
+
+private:
+    static void AddToCounters(Counters& counters, uint64_t size);
+    static void RemoveFromCounters(Counters& counters, uint64_t size);
+
+    static constexpr size_t CategoryCount = static_cast<size_t>(MemoryCategory::Count);
+
+    mutable std::mutex mMutex;
+    std::unordered_map<uint64_t, Allocation> mAllocations;
+    Counters mTotalCounters;
+    std::array<Counters, CategoryCount> mCategoryCounters;
+    std::vector<Counters> mHeapCounters;
+    // Indexed by category * heapCount + heapIndex
+    std::vector<Counters> mCategoryHeapCounters;
+};
+
+}  // namespace VKRT
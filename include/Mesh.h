@@ -1,52 +1,207 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "glm/glm.hpp"
 
 #include "Context.h"
+#include "GeometryPool.h"
 #include "Material.h"
 #include "RefCountPtr.h"
+#include "Skin.h"
 #include "VulkanBase.h"
 #include "VulkanBuffer.h"
 
 namespace VKRT {
 
-class Mesh : public RefCountPtr {
+class BLASBuilder;
+class BLASCache;
+class BLASCompactor;
+class HostBLASBuilder;
+class ResidencyManager;
+class SkinningPass;
+
+class Mesh : public RefCountPtr, public VulkanBuffer::RelocationListener {
 public:
     struct Vertex {
         glm::vec3 position;
         glm::vec3 normal;
         glm::vec2 texCoord;
     };
+
+    // How the BLAS changes over the lifetime of the mesh, picks its build flags
+    enum class BuildPolicy : uint32_t {
+        // Built once, traced for the whole run: best trace quality, then compacted
+        Static,
+        // Rebuilt from scratch often: cheapest build
+        Rebuilt,
+        // Vertices move in place: refitted instead of rebuilt
+        Deformable,
+        Count
+    };
+    static const char* GetBuildPolicyName(BuildPolicy buildPolicy);
+
+    // Up to four joints per vertex, unused ones have a zero weight
+    struct JointInfluence {
+        glm::uvec4 joints;
+        glm::vec4 weights;
+    };
+
+    // One geometry of the BLAS, with its own material
+    struct Primitive {
+        std::vector<Vertex> vertices;
+        std::vector<glm::uvec3> indices;
+        ScopedRefPtr<Material> material;
+        // Triangles the material's alpha test may cut out, the others are opaque. Only these
+        // run the any-hit shader
+        bool alphaTested = false;
+    };
+
     Mesh(
         ScopedRefPtr<Context> context,
+        const std::string& name,
         const std::vector<Vertex>& vertices,
         const std::vector<glm::uvec3>& indices,
-        ScopedRefPtr<Material> material);
+        ScopedRefPtr<Material> material,
+        BuildPolicy buildPolicy = BuildPolicy::Static,
+        ScopedRefPtr<Skin> skin = nullptr,
+        const std::vector<JointInfluence>& influences = {});
+    // Primitives sharing a transform go into a single BLAS, hits tell them apart by geometry
+    // index. Skinned meshes have a single primitive
+    Mesh(
+        ScopedRefPtr<Context> context,
+        const std::string& name,
+        const std::vector<Primitive>& primitives,
+        BuildPolicy buildPolicy = BuildPolicy::Static,
+        ScopedRefPtr<Skin> skin = nullptr,
+        const std::vector<JointInfluence>& influences = {});
 
+    // Element offsets into the geometry pool buffers, indices are relative to vertexOffset
     struct Description {
-        vk::DeviceAddress vertexBufferAddress;
-        vk::DeviceAddress indexBufferAddress;
+        uint32_t vertexOffset;
+        uint32_t indexOffset;
     };
-    Description GetDescription() const;
+    Description GetDescription(uint32_t geometryIndex) const;
+    uint32_t GetGeometryCount() const { return static_cast<uint32_t>(mGeometries.size()); }
 
+    const std::string& GetName() const { return mName; }
     vk::DeviceAddress GetBLASAddress() const { return mBLASAddress; }
-    const ScopedRefPtr<Material> GetMaterial() const { return mMaterial; }
-    ScopedRefPtr<Material> GetMaterial() { return mMaterial; }
+    // 0 while the BLAS is still being built on the host
+    vk::DeviceSize GetBLASSize() const {
+        return mBLASBuffer != nullptr ? mBLASBuffer->GetBufferSize() : 0;
+    }
+    // Bytes given back by compaction, 0 until the BLAS has been compacted
+    vk::DeviceSize GetCompactionSavedBytes() const { return mCompactionSavedBytes; }
+    const ScopedRefPtr<Material>& GetMaterial(uint32_t geometryIndex = 0) const {
+        return mMaterials[geometryIndex];
+    }
+    const std::vector<ScopedRefPtr<Material>>& GetMaterials() const { return mMaterials; }
+    BuildPolicy GetBuildPolicy() const { return mBuildPolicy; }
+    uint32_t GetTriangleCount() const { return mTriangleCount; }
+    const ScopedRefPtr<Skin>& GetSkin() const { return mSkin; }
+    // Empty unless the context retains host data or the mesh can be evicted, skinned meshes keep
+    // their bind pose
+    const std::vector<Primitive>& GetHostPrimitives() const { return mHostPrimitives; }
+    // Evicted meshes have no BLAS or pool geometry until the residency manager streams them in
+    bool IsResident() const { return mResident; }
+    // Resident and built, instances of other meshes are left inactive
+    bool IsTraceable() const { return mResident && mBuilt; }
+
+    // Queues a build of the BLAS from the current geometry, a refit for deformable meshes that
+    // were built before. Static meshes are compacted and can't be rebuilt
+    void Rebuild();
+
+    void RecordRelocation(
+        vk::CommandBuffer commandBuffer,
+        VulkanBuffer* buffer,
+        vk::Buffer newBufferHandle) override;
+    void OnRelocated(VulkanBuffer* buffer) override;
 
     ~Mesh();
 
 private:
+    friend class BLASBuilder;
+    friend class BLASCache;
+    friend class BLASCompactor;
+    friend class HostBLASBuilder;
+    friend class ResidencyManager;
+    friend class SkinningPass;
+
+    // Meshes that aren't compacted trade some trace speed for a smaller structure above this
+    static constexpr uint32_t LowMemoryTriangleCount = 64 * 1024;
+
+    static vk::BuildAccelerationStructureFlagsKHR GetBuildFlags(
+        BuildPolicy buildPolicy,
+        uint32_t triangleCount);
+
+    void OnLastReference() override;
+    // Copies the primitives into the geometry pool
+    void Upload(const std::vector<Primitive>& primitives);
+    // Loads the BLAS from the cache or queues its build
+    void CreateAccelerationStructure(const std::vector<Primitive>& primitives);
+    void CreateBLAS(vk::DeviceSize size);
+    // Device memory of the BLAS and the pool geometry
+    vk::DeviceSize GetResidentSize() const;
+    // Called by the residency manager, between frames
+    void Evict();
+    void StreamIn();
+    // Appends a geometry and a build range per primitive
+    void GetBuildGeometries(
+        std::vector<vk::AccelerationStructureGeometryKHR>& geometries,
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& ranges);
+    // Same layout for device builds from the pool and host builds from a copy of the geometry
+    static vk::AccelerationStructureGeometryKHR MakeBuildGeometry(
+        vk::DeviceOrHostAddressConstKHR vertexData,
+        vk::DeviceOrHostAddressConstKHR indexData,
+        uint32_t vertexCount,
+        bool alphaTested);
+    uint32_t GetTracedVertexOffset(uint32_t geometryIndex) const;
+    void UpdateBLASAddress();
+    void SetCompactedBLAS(
+        ScopedRefPtr<VulkanBuffer> buffer,
+        vk::AccelerationStructureKHR blas,
+        vk::DeviceSize savedBytes);
+
     ScopedRefPtr<Context> mContext;
+    std::string mName;
 
-    ScopedRefPtr<VulkanBuffer> mVertexBuffer;
-    ScopedRefPtr<VulkanBuffer> mIndexBuffer;
-    ScopedRefPtr<VulkanBuffer> mTransformBuffer;
+    // One allocation, material and alpha tested flag per primitive
+    std::vector<GeometryPool::Allocation> mGeometries;
+    std::vector<ScopedRefPtr<Material>> mMaterials;
+    std::vector<uint8_t> mAlphaTested;
+    uint32_t mTriangleCount;
+    std::vector<Primitive> mHostPrimitives;
+    BuildPolicy mBuildPolicy;
+    vk::BuildAccelerationStructureFlagsKHR mBuildFlags;
+    vk::DeviceSize mBuildScratchSize;
+    vk::DeviceSize mUpdateScratchSize;
+    // Skinned meshes are traced from their own deformed copy of the vertices
+    ScopedRefPtr<Skin> mSkin;
+    ScopedRefPtr<VulkanBuffer> mInfluenceBuffer;
+    uint32_t mSkinnedVertexOffset;
+    // Skin version the deformed vertices were written from
+    uint64_t mSkinnedVersion;
+    // Key of the geometry in the cache, to load the BLAS again after an eviction
+    uint64_t mGeometryKey;
+    // Set while the BLAS still has to be written to the cache
+    uint64_t mCacheKey;
+    // Set by the builder once a full build was recorded, refits need one to start from
+    bool mBuilt;
+    bool mBuildPending;
 
     ScopedRefPtr<VulkanBuffer> mBLASBuffer;
     vk::AccelerationStructureKHR mBLAS;
+    // Clone of mBLAS while the defragmenter moves its buffer
+    vk::AccelerationStructureKHR mRelocatedBLAS;
     vk::DeviceAddress mBLASAddress;
+    vk::DeviceSize mCompactionSavedBytes;
 
-    ScopedRefPtr<Material> mMaterial;
+    // Set for meshes the residency manager may evict
+    uint32_t mResidencyIndex;
+    bool mResident;
+    // Around the object space origin, how far instances reach
+    float mBoundingRadius;
 };
 
 }  // namespace VKRT
\ No newline at end of file
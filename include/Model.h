@@ -1,11 +1,14 @@
 #pragma once
 
+#include <optional>
+
 #include "glm/glm.hpp"
 
 #include "Context.h"
 #include "Material.h"
 #include "Mesh.h"
 #include "RefCountPtr.h"
+#include "Skin.h"
 #include "VulkanBase.h"
 #include "VulkanBuffer.h"
 
@@ -13,18 +16,32 @@ namespace VKRT {
 
 class Model : public RefCountPtr {
 public:
-    static Model* Load(ScopedRefPtr<Context>, const std::string& path);
-
-    Model(ScopedRefPtr<Context>, const std::vector<ScopedRefPtr<Mesh>>& meshes);
+    // Skinned and morphed meshes are deformable, or rebuilt when their animation or targets move
+    // vertices far, everything else static unless overridden. Skinned meshes are never static
+    static Model* Load(
+        ScopedRefPtr<Context>,
+        const std::string& path,
+        std::optional<Mesh::BuildPolicy> buildPolicy = std::nullopt);
+
+    Model(
+        ScopedRefPtr<Context>,
+        const std::vector<ScopedRefPtr<Mesh>>& meshes,
+        ScopedRefPtr<Skin> skin = nullptr);
 
     const std::vector<ScopedRefPtr<Mesh>>& GetMeshes() const { return mMeshes; }
+    const ScopedRefPtr<Skin>& GetSkin() const { return mSkin; }
+    // Poses the skin, if any, the skinning pass deforms the meshes on the next frame
+    void Animate(float seconds);
     std::vector<Mesh::Description> GetDescriptions() const;
+    // Every material of every mesh, in description order
+    std::vector<Material*> GetMaterials() const;
 
     ~Model();
 
 private:
     ScopedRefPtr<Context> mContext;
     std::vector<ScopedRefPtr<Mesh>> mMeshes;
+    ScopedRefPtr<Skin> mSkin;
 };
 
 }  // namespace VKRT
\ No newline at end of file
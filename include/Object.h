@@ -10,8 +10,10 @@ class Object : public RefCountPtr {
 public:
     Object(ScopedRefPtr<Model> model);
 
-    const ScopedRefPtr<Model> GetModel() const { return mModel; }
-    const glm::mat4& GetTransform() const { return mTransform; }
+    const ScopedRefPtr<Model>& GetModel() const { return mModel; }
+    const glm::mat4& GetTransform() const;
+    // Bumped by every change to the transform
+    uint64_t GetVersion() const { return mVersion; }
 
     void SetTranslation(const glm::vec3& position);
     void Translate(const glm::vec3& delta);
@@ -24,10 +26,13 @@ public:
     ~Object();
 
 private:
-    void UpdateTransform();
+    void MarkDirty();
 
     ScopedRefPtr<Model> mModel;
-    glm::mat4 mTransform;
+    // Recomputed on first use after a change
+    mutable glm::mat4 mTransform;
+    mutable bool mTransformDirty;
+    uint64_t mVersion;
     glm::vec3 mEulerRotation;
     glm::vec3 mScale;
     glm::vec3 mPosition;
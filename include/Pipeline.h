@@ -14,7 +14,9 @@ namespace VKRT {
 
 class Context;
 
-enum class RayTracingStage { Generate = 0, Hit, Miss, ShadowMiss };
+// AnyHit joins the Hit group, it doesn't get a group of its own. Intersection adds a procedural
+// hit group right after the triangle one, sharing its closest hit shader
+enum class RayTracingStage { Generate = 0, Hit, Intersection, Miss, ShadowMiss, AnyHit };
 
 class Pipeline : public RefCountPtr {
 public:
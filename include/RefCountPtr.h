@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 
@@ -15,9 +16,14 @@ public:
 
 protected:
     virtual ~RefCountPtr() = default;
+    // Runs when the last reference is released, objects owning GPU resources override it to defer
+    // their deletion until the GPU is done with them
+    virtual void OnLastReference();
 
 private:
-    uint32_t refCount;
+    friend class DeletionQueue;
+
+    std::atomic<uint32_t> refCount;
 };
 
 template <class T>
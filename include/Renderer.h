@@ -1,57 +1,100 @@
 #pragma once
 
+#include <vector>
+
 #include "Camera.h"
 #include "Context.h"
+#include "FrameArena.h"
 #include "Pipeline.h"
 #include "ProbeGrid.h"
 #include "RefCountPtr.h"
 #include "Scene.h"
+#include "SkinningPass.h"
 
 namespace VKRT {
 class Renderer : public RefCountPtr {
 public:
     Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene);
 
+    // Submits the frame without waiting for it. Returns once the oldest frame in flight has
+    // completed, so the host can write the per frame buffers of the next one
     void Render(Camera* camera);
 
+    // GPU timings of the last completed frame, the frames in flight behind the one rendered
+    struct FrameStatistics {
+        double mainPassMilliseconds;
+        double primaryRaysPerSecond;
+        double tlasBuildMilliseconds;
+        // False when the TLAS was only refit, or not touched at all
+        bool tlasRebuilt;
+        uint32_t dirtyInstanceCount;
+    };
+    const FrameStatistics& GetFrameStatistics() const { return mFrameStatistics; }
+
     ~Renderer();
 
 private:
+    // Everything the host writes for a frame, reused once the frame that last used it completed
+    struct Frame {
+        vk::CommandBuffer commandBuffer;
+        // Signaled once the swapchain image can be written
+        vk::Semaphore acquireSemaphore;
+        // Of the last submission, 0 once it has been waited for
+        uint64_t ticket;
+        ScopedRefPtr<VulkanBuffer> cameraUniformBuffer;
+        ScopedRefPtr<VulkanBuffer> sceneUniformBuffer;
+        // Residency version the descriptions were written at
+        uint64_t meshDescriptionVersion;
+        ScopedRefPtr<VulkanBuffer> lightMetadataUniformBuffer;
+        ScopedRefPtr<VulkanBuffer> lightUniformBuffer;
+        ScopedRefPtr<VulkanBuffer> materialsBuffer;
+        vk::DescriptorSet descriptorSet;
+        vk::DescriptorSet probeDescriptorSet;
+    };
+
     void CreateStorageImage();
-    void CreateUniformBuffer();
+    void CreateUniformBuffer(Frame& frame);
     void CreateMaterialUniforms();
     void CreateDescriptors(const Scene::SceneMaterials& materialInfo);
-    void UpdateDescriptors(const Scene::SceneMaterials& materialInfo);
+    void UpdateDescriptors(Frame& frame, const Scene::SceneMaterials& materialInfo);
     struct UniformData {
         glm::mat4 viewInverse;
         glm::mat4 projInverse;
     };
 
-    void UpdateCameraUniforms(Camera* camera);
-    void UpdateLightUniforms();
-    void UpdateMaterialUniforms(const Scene::SceneMaterials& materialInfo);
+    void UpdateCameraUniforms(Frame& frame, Camera* camera);
+    void UpdateLightUniforms(Frame& frame);
+    void UpdateMaterialUniforms(Frame& frame, const Scene::SceneMaterials& materialInfo);
+    // Geometry pool offsets of every mesh, written again when streaming moves them
+    void WriteMeshDescriptions(Frame& frame);
+    void ReadTimestamps(uint32_t frameSlot);
 
     ScopedRefPtr<Context> mContext;
     ScopedRefPtr<Scene> mScene;
 
     ScopedRefPtr<Texture> mStorageTexture;
 
-    ScopedRefPtr<VulkanBuffer> mCameraUniformBuffer;
-    ScopedRefPtr<VulkanBuffer> mSceneUniformBuffer;
-    ScopedRefPtr<VulkanBuffer> mLightMetadataUniformBuffer;
-    ScopedRefPtr<VulkanBuffer> mLightUniformBuffer;
-    ScopedRefPtr<VulkanBuffer> mMaterialsBuffer;
-
     ScopedRefPtr<Pipeline> mMainPassPipeline;
     vk::DescriptorPool mDescriptorPool;
-    vk::DescriptorSet mDescriptorSet;
 
     vk::Sampler mTextureSampler;
 
     ScopedRefPtr<Pipeline> mProbeUpdatePipeline;
     ScopedRefPtr<ProbeGrid> mProbeGrid;
+    ScopedRefPtr<SkinningPass> mSkinningPass;
     vk::DescriptorPool mProbeDescriptorPool;
-    vk::DescriptorSet mProbeDescriptorSet;
+
+    // A range of queries per frame slot
+    vk::QueryPool mTimestampQueryPool;
+    double mTimestampPeriod;
+    uint64_t mTimestampMask;
+    FrameStatistics mFrameStatistics;
+
+    // Reused every frame so steady state rendering doesn't allocate
+    FrameArena mFrameArena;
+    // Indexed by the context frame slot
+    std::vector<Frame> mFrames;
+    uint64_t mFrameIndex;
 };
 
 }  // namespace VKRT
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+
+namespace VKRT {
+
+class Context;
+class Mesh;
+
+// Keeps the device memory of static meshes under a budget. Meshes with an instance within reach
+// of the view are marked in use every frame. Over budget, the meshes unused for longest give their
+// BLAS and pool geometry back and their instances go inactive. Once an instance comes near again
+// they are streamed in from their host copy, deserialized from the BLAS cache or rebuilt
+class ResidencyManager : public RefCountPtr {
+public:
+    static constexpr uint32_t NoEntry = ~0u;
+
+    ResidencyManager(ScopedRefPtr<Context> context);
+
+    // 0 keeps every mesh resident. Set before loading, only meshes created afterwards keep the
+    // host copy they are streamed in from
+    void SetBudget(vk::DeviceSize budget) { mBudget = budget; }
+    vk::DeviceSize GetBudget() const { return mBudget; }
+    bool IsEnabled() const { return mBudget > 0; }
+    // Instances farther from the view than this don't keep their mesh in use
+    void SetStreamingDistance(float distance) { mStreamingDistance = distance; }
+    void SetViewPosition(const glm::vec3& position) { mViewPosition = position; }
+
+    // Returns whether the mesh fits and can be loaded right away, it starts evicted otherwise
+    bool Register(Mesh* mesh, vk::DeviceSize size);
+    void Unregister(Mesh* mesh);
+    // Marks the mesh in use when the instance with this transform is within reach
+    void Touch(const Mesh* mesh, const glm::mat4& transform);
+
+    // Evicts cold meshes and streams in the nearest wanted ones. Call at the start of a frame,
+    // inside the frame's recording, before the BLAS builds are recorded
+    void Update();
+    // Changes whenever meshes move in the geometry pool, their descriptions must be written again
+    uint64_t GetVersion() const { return mVersion; }
+
+    vk::DeviceSize GetResidentBytes() const { return mResidentBytes; }
+    uint32_t GetMeshCount() const { return static_cast<uint32_t>(mEntries.size()); }
+    uint32_t GetResidentMeshCount() const { return mResidentMeshCount; }
+    // Totals over the run
+    uint32_t GetEvictionCount() const { return mEvictionCount; }
+    uint32_t GetStreamCount() const { return mStreamCount; }
+
+    ~ResidencyManager();
+
+private:
+    // Meshes stay resident for a while after their last use, so turning around doesn't stream
+    static constexpr uint64_t EvictionDelayFrames = 120;
+    // Uploads and BLAS builds are spread over frames, at least one mesh goes in per frame
+    static constexpr vk::DeviceSize MaxStreamBytesPerFrame = 64ull * 1024 * 1024;
+
+    struct Entry {
+        Mesh* mesh;
+        // Measured while resident, what streaming it back in is expected to take
+        vk::DeviceSize size;
+        uint64_t lastUsedFrame;
+        // Nearest instance since the last update
+        float distance;
+    };
+
+    // Evicts cold meshes until the size fits, false if too much is in use
+    bool MakeRoom(vk::DeviceSize size);
+    void Evict(Entry& entry);
+
+    ScopedRefPtr<Context> mContext;
+    vk::DeviceSize mBudget;
+    float mStreamingDistance;
+    glm::vec3 mViewPosition;
+    uint64_t mFrame;
+    uint64_t mVersion;
+
+    std::vector<Entry> mEntries;
+    // Reused every update, indices into mEntries
+    std::vector<uint32_t> mStreamQueue;
+    std::vector<uint32_t> mEvictionQueue;
+    size_t mNextEviction;
+
+    vk::DeviceSize mResidentBytes;
+    uint32_t mResidentMeshCount;
+    uint32_t mEvictionCount;
+    uint32_t mStreamCount;
+};
+
+}  // namespace VKRT
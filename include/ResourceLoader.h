@@ -19,7 +19,11 @@ struct Resource {
         ProbeGenShader,
         ProbeHitShader,
         ProbeMissShader,
-        ProbeShadowMissShader
+        ProbeShadowMissShader,
+        SkinningShader,
+        AlphaTestShader,
+        SphereIntersectionShader,
+        InstancesShader
     };
 };
 
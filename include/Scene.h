@@ -1,8 +1,12 @@
 #pragma once
 
+#include <span>
 #include <vector>
 
+#include "FrameArena.h"
+#include "InstanceGenerator.h"
 #include "Light.h"
+#include "Material.h"
 #include "Object.h"
 #include "RefCountPtr.h"
 #include "VulkanBase.h"
@@ -18,11 +22,31 @@ public:
 
     void AddObject(ScopedRefPtr<Object> object);
     void AddLight(ScopedRefPtr<Light> light);
+    const std::vector<ScopedRefPtr<Object>>& GetObjects() const { return mObjects; }
+
+    // Analytic spheres for particles and markers. Each is an instance scaling one shared
+    // single-box BLAS that the intersection shader solves exactly, no vertices or BLAS of its own
+    struct Sphere {
+        glm::vec3 center;
+        float radius;
+        // Into GetSphereMaterials, their slots follow the mesh geometries
+        uint32_t materialIndex;
+    };
+    uint32_t AddSphere(const glm::vec3& center, float radius, ScopedRefPtr<Material> material);
+    void SetSphere(uint32_t sphereIndex, const glm::vec3& center, float radius);
+    const std::vector<Sphere>& GetSpheres() const { return mSpheres; }
+    const std::vector<ScopedRefPtr<Material>>& GetSphereMaterials() const {
+        return mSphereMaterials;
+    }
+
+    // Poses every skinned model at the given time since the start
+    void Animate(float seconds);
 
     const vk::AccelerationStructureKHR& GetTLAS() const { return mTLAS; }
 
-    std::vector<Mesh::Description> GetDescriptions();
-    std::vector<Light::Proxy> GetLightDescriptions();
+    // Results live in the arena, valid until it is reset
+    std::span<Mesh::Description> GetDescriptions(FrameArena& arena);
+    std::span<Light::Proxy> GetLightDescriptions(FrameArena& arena);
 
     struct MaterialProxy {
         glm::vec3 albedo;
@@ -31,27 +55,90 @@ public:
         float indexOfRefraction;
         int32_t albedoTextureIndex;
         int32_t roughnessTextureIndex;
+        float alphaCutoff;
     };
     struct SceneMaterials {
-        std::vector<MaterialProxy> materials;
-        std::vector<ScopedRefPtr<Texture>> textures;
+        std::span<MaterialProxy> materials;
+        std::span<Texture*> textures;
     };
-    SceneMaterials GetMaterialProxies();
+    SceneMaterials GetMaterialProxies(FrameArena& arena);
 
+    // Expands the instance records with a compute pass from per-object transforms instead of
+    // writing them on the host, for scenes where that loop dominates. Off by default
+    void SetDeviceInstanceGeneration(bool enabled);
+    bool IsDeviceInstanceGenerationEnabled() const { return mInstanceGenerator != nullptr; }
+
+    // Writes the instances of changed objects, then refits the TLAS or rebuilds it when instances
+    // changed or refits degraded it too much. Skipped entirely when nothing changed
     void Update(vk::CommandBuffer& commandBuffer);
+    bool WasTLASRebuilt() const { return mTLASRebuilt; }
+    uint32_t GetDirtyInstanceCount() const { return mDirtyInstanceCount; }
+    uint32_t GetInstanceCount() const { return static_cast<uint32_t>(mInstanceStates.size()); }
 
     ~Scene();
 
 private:
+    // Refits keep the tree topology, instances that moved far make it loose
+    static constexpr uint32_t MaxRefitCount = 256;
+    static constexpr float RebuildMotionThreshold = 16.0f;
+    static constexpr uint64_t NoVersion = ~0ull;
+    // Pipelines put the sphere intersection hit group right after the triangle one
+    static constexpr uint32_t SphereHitGroupOffset = 1;
+
+    struct InstanceState {
+        glm::vec3 position;
+        vk::DeviceAddress blasAddress;
+        uint32_t mask;
+        uint32_t firstGeometry;
+    };
+
+    void OnLastReference() override;
+    uint32_t GetMeshCount() const;
+    uint32_t GetGeometryCount() const;
+    // Created with the first sphere, built by the first update that has spheres
+    void CreateSphereBLAS();
+    void RecordSphereBLASBuild(vk::CommandBuffer& commandBuffer);
+
     ScopedRefPtr<Context> mContext;
 
     std::vector<ScopedRefPtr<Object>> mObjects;
     std::vector<ScopedRefPtr<Light>> mLights;
 
-    ScopedRefPtr<VulkanBuffer> mInstanceBuffer;
+    std::vector<Sphere> mSpheres;
+    std::vector<ScopedRefPtr<Material>> mSphereMaterials;
+    // Spheres moved since their instance record was written
+    std::vector<uint8_t> mDirtySpheres;
+    ScopedRefPtr<VulkanBuffer> mSphereAABBBuffer;
+    ScopedRefPtr<VulkanBuffer> mSphereBLASBuffer;
+    vk::AccelerationStructureKHR mSphereBLAS;
+    vk::DeviceAddress mSphereBLASAddress;
+    vk::AccelerationStructureBuildSizesInfoKHR mSphereBLASSizes;
+    bool mSphereBLASBuilt;
+
+    // Persistently mapped copy of the host written instances for one frame slot
+    struct InstanceBuffer {
+        ScopedRefPtr<VulkanBuffer> buffer;
+        vk::AccelerationStructureInstanceKHR* mapped;
+        // Records changed since the copy was last written, empty while first is past last
+        uint32_t firstDirty;
+        uint32_t lastDirty;
+    };
+    // Host written instances, unused with the generator. Copied into the buffer of the frame
+    // slot, earlier frames in flight still build from theirs
+    std::vector<vk::AccelerationStructureInstanceKHR> mInstances;
+    std::vector<InstanceBuffer> mInstanceBuffers;
+    ScopedRefPtr<InstanceGenerator> mInstanceGenerator;
     ScopedRefPtr<VulkanBuffer> mTLASBuffer;
-    ScopedRefPtr<VulkanBuffer> mScratchBuffer;
     vk::AccelerationStructureKHR mTLAS;
     vk::DeviceAddress mTLASAddress;
+
+    // State of each instance when its record was last written
+    std::vector<InstanceState> mInstanceStates;
+    // Object versions the instance records were written from
+    std::vector<uint64_t> mObjectVersions;
+    uint32_t mRefitCount;
+    float mAccumulatedMotion;
+    bool mTLASRebuilt;
+    uint32_t mDirtyInstanceCount;
 };
 }  // namespace VKRT
\ No newline at end of file
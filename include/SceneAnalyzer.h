@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "Mesh.h"
+#include "RefCountPtr.h"
+#include "Scene.h"
+
+namespace VKRT {
+
+// Rates how well the scene's meshes and instances suit ray tracing. Driver structures are opaque,
+// so the costs come from a CPU reference BVH over the host copies the context retains when asked.
+// Needs no device, a host only context is enough
+class SceneAnalyzer {
+public:
+    // Limits assets are checked against, 0 turns a check off
+    struct Budget {
+        float maxMeshSAHCost = 0.0f;
+        float maxSceneSAHCost = 0.0f;
+        float maxSliverFraction = 0.1f;
+        float maxInstanceOverlap = 4.0f;
+        uint64_t maxBLASBytes = 0;
+
+        // JSON with the member names as keys, missing keys keep their defaults
+        static bool Load(const std::string& path, Budget& budget);
+    };
+
+    struct MeshReport {
+        std::string name;
+        std::string buildPolicy;
+        uint32_t geometryCount;
+        uint32_t triangleCount;
+        // Triangles running the any-hit shader
+        uint32_t alphaTestedTriangleCount;
+        uint32_t instanceCount;
+        // Estimated from the reference BVH when there is no device structure
+        uint64_t blasBytes;
+        bool blasBytesEstimated;
+        uint64_t compactionSavedBytes;
+        uint32_t referenceNodeCount;
+        float sahCost;
+        float minTriangleArea;
+        float meanTriangleArea;
+        float maxTriangleArea;
+        uint32_t degenerateTriangleCount;
+        uint32_t sliverTriangleCount;
+        std::vector<std::string> exceededBudgets;
+    };
+
+    struct InstanceReport {
+        // Sphere AABB instances have no object or mesh, the index is into the scene's spheres
+        bool isSphere;
+        uint32_t objectIndex;
+        std::string meshName;
+        BoundingBox bounds;
+        // Summed surface of the other instance boxes inside this one, relative to its own: about
+        // how many more BLASes a ray entering this instance has to enter too
+        float overlap;
+        uint32_t overlappingInstanceCount;
+        std::vector<std::string> exceededBudgets;
+    };
+
+    struct Report {
+        // Sorted so the assets most likely to slow traversal come first
+        std::vector<MeshReport> meshes;
+        std::vector<InstanceReport> instances;
+        float sceneSAHCost;
+        std::vector<std::string> exceededBudgets;
+        uint32_t exceededBudgetCount;
+    };
+
+    SceneAnalyzer(ScopedRefPtr<Scene> scene, const Budget& budget = Budget());
+
+    const Report& Analyze();
+    const Report& GetReport() const { return mReport; }
+    bool IsWithinBudget() const { return mReport.exceededBudgetCount == 0; }
+
+    std::string ToJson() const;
+    bool WriteReport(const std::string& path) const;
+
+private:
+    // Same unit for node and triangle tests, both are a handful of SIMD operations
+    static constexpr float TraversalCost = 1.0f;
+    static constexpr float IntersectionCost = 1.0f;
+    // Longest edge over the height on it
+    static constexpr float SliverAspectRatio = 20.0f;
+    // Typical driver footprint of a 4 wide node with its child boxes and of a triangle leaf
+    static constexpr uint64_t EstimatedNodeBytes = 128;
+    static constexpr uint64_t EstimatedTriangleBytes = 48;
+
+    MeshReport AnalyzeMesh(const Mesh* mesh, BoundingBox& bounds) const;
+    void CheckBudgets();
+
+    ScopedRefPtr<Scene> mScene;
+    Budget mBudget;
+    Report mReport;
+};
+
+}  // namespace VKRT
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+
+// Acceleration structure build scratch out of one pooled buffer. Regions are handed out linearly
+// for a submission and all of them are reused by the next one, so the pool only grows to the
+// largest amount of scratch a single submission needs
+class ScratchAllocator : public RefCountPtr {
+public:
+    ScratchAllocator(ScopedRefPtr<Context> context);
+
+    // Valid until Release, builds recorded in the same submission get disjoint regions
+    vk::DeviceAddress Allocate(vk::DeviceSize size);
+    // Call once the submission that used the scratch is submitted. The next submission must order
+    // its builds after it, frames start with a barrier on everything before them
+    void Release();
+    // Hands the regions out again within the same submission, the caller puts a barrier between
+    // the builds that used them and the next ones
+    void Rewind() { mOffset = 0; }
+
+    vk::DeviceSize GetCapacity() const;
+    vk::DeviceSize GetPeakUsage() const { return mPeakUsage; }
+
+    ~ScratchAllocator();
+
+private:
+    // Offset into the current buffer of the first aligned region at or past offset
+    vk::DeviceSize GetAlignedOffset(vk::DeviceSize offset) const;
+
+    ScopedRefPtr<Context> mContext;
+    ScopedRefPtr<VulkanBuffer> mBuffer;
+    // Buffers outgrown during a submission, still referenced by recorded builds until Release
+    std::vector<ScopedRefPtr<VulkanBuffer>> mRetiredBuffers;
+    vk::DeviceSize mAlignment;
+    vk::DeviceSize mOffset;
+    vk::DeviceSize mPeakUsage;
+};
+
+}  // namespace VKRT
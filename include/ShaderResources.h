@@ -6,3 +6,7 @@
 #define VKRT_RESOURCE_RAYTRACE_PROBE_HIT_SHADER 1006
 #define VKRT_RESOURCE_RAYTRACE_PROBE_MISS_SHADER 1007
 #define VKRT_RESOURCE_RAYTRACE_PROBE_SHADOW_MISS_SHADER 1008
+#define VKRT_RESOURCE_SKINNING_SHADER 1009
+#define VKRT_RESOURCE_ALPHA_TEST_SHADER 1010
+#define VKRT_RESOURCE_SPHERE_INTERSECTION_SHADER 1011
+#define VKRT_RESOURCE_INSTANCES_SHADER 1012
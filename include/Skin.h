@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+class Context;
+
+// Joint hierarchy of a skinned model and the looping animation that poses it. Joint matrices live
+// in host visible buffers the skinning pass reads through their device address, one per frame in
+// flight so posing doesn't write the matrices an earlier frame is still skinning with
+class Skin : public RefCountPtr {
+public:
+    struct Node {
+        // -1 for roots
+        int32_t parent;
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+    };
+
+    enum class Path { Translation, Rotation, Scale };
+    struct Channel {
+        uint32_t node;
+        Path path;
+        bool step;
+        std::vector<float> times;
+        // xyz for translation and scale, xyzw for rotation
+        std::vector<glm::vec4> values;
+    };
+
+    Skin(
+        ScopedRefPtr<Context> context,
+        const std::vector<Node>& nodes,
+        const std::vector<uint32_t>& joints,
+        const std::vector<glm::mat4>& inverseBindMatrices,
+        const std::vector<Channel>& channels);
+
+    // Poses the joints at an absolute time, so models shared by several objects advance once
+    void SetTime(float seconds);
+
+    // Bumped every time the joint matrices change
+    uint64_t GetVersion() const { return mVersion; }
+    uint32_t GetJointCount() const { return static_cast<uint32_t>(mJoints.size()); }
+    // Copy written by the last pose
+    vk::DeviceAddress GetJointMatricesAddress() const {
+        return mJointMatrices[mJointMatricesSlot]->GetDeviceAddress();
+    }
+
+    ~Skin();
+
+private:
+    glm::vec4 Sample(const Channel& channel, float time) const;
+    void UpdateJointMatrices();
+
+    ScopedRefPtr<Context> mContext;
+    std::vector<Node> mNodes;
+    // Parents come before their children
+    std::vector<uint32_t> mNodeOrder;
+    std::vector<glm::mat4> mGlobalTransforms;
+    std::vector<uint32_t> mJoints;
+    std::vector<glm::mat4> mInverseBindMatrices;
+    std::vector<Channel> mChannels;
+    float mDuration;
+    float mTime;
+    uint64_t mVersion;
+
+    // Per frame slot, persistently mapped
+    std::vector<ScopedRefPtr<VulkanBuffer>> mJointMatrices;
+    std::vector<glm::mat4*> mMappedJointMatrices;
+    uint32_t mJointMatricesSlot;
+};
+
+}  // namespace VKRT
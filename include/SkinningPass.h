@@ -0,0 +1,41 @@
+#pragma once
+
+#include "RefCountPtr.h"
+#include "VulkanBase.h"
+
+namespace VKRT {
+
+class Context;
+class Scene;
+
+// Deforms the vertices of skinned meshes on the GPU, then queues a refit of their BLAS so the
+// builds recorded after it in the frame pick the new positions up
+class SkinningPass : public RefCountPtr {
+public:
+    SkinningPass(ScopedRefPtr<Context> context);
+
+    // Only meshes whose skin was posed since their last skinning are dispatched. Record before
+    // the BLAS builds
+    void Record(vk::CommandBuffer commandBuffer, Scene* scene);
+
+    ~SkinningPass();
+
+private:
+    static constexpr uint32_t WorkgroupSize = 64;
+
+    // Matches the push constant block of skinning.comp
+    struct Parameters {
+        vk::DeviceAddress sourceVertices;
+        vk::DeviceAddress targetVertices;
+        vk::DeviceAddress influences;
+        vk::DeviceAddress jointMatrices;
+        uint32_t vertexCount;
+    };
+
+    ScopedRefPtr<Context> mContext;
+    vk::ShaderModule mShader;
+    vk::PipelineLayout mLayout;
+    vk::Pipeline mPipeline;
+};
+
+}  // namespace VKRT
@@ -20,11 +20,12 @@ public:
 
     Texture* GetCurrentImage() { return mImages[mCurrentImageIndex]; }
 
-    void AcquireNextImage();
+    // Signals the semaphore once the image can be written, frames in flight each bring their own
+    void AcquireNextImage(vk::Semaphore acquireSemaphore);
+    // Waits for the render semaphore of the current image
     void Present();
 
-    vk::Semaphore& GetPresentSemaphore() { return mPresentSemaphore; }
-    vk::Semaphore& GetRenderSemaphore() { return mRenderSemaphore; }
+    vk::Semaphore& GetRenderSemaphore() { return mRenderSemaphores[mCurrentImageIndex]; }
 
     ~Swapchain();
 
@@ -34,8 +35,8 @@ private:
     vk::Format mFormat;
     vk::Extent2D mExtent;
     std::vector<ScopedRefPtr<Texture>> mImages;
-    vk::Semaphore mPresentSemaphore;
-    vk::Semaphore mRenderSemaphore;
+    // Per image, the presentation engine may still hold the one of an earlier frame
+    std::vector<vk::Semaphore> mRenderSemaphores;
     uint32_t mCurrentImageIndex;
 };
 }  // namespace VKRT
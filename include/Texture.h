@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "Context.h"
 #include "RefCountPtr.h"
 #include "VulkanBase.h"
@@ -16,7 +19,8 @@ public:
         uint32_t layers,
         vk::Format format,
         vk::ImageUsageFlags usageFlags,
-        vk::Image image = nullptr);
+        vk::Image image = nullptr,
+        const std::string& name = {});
 
     Texture(
         ScopedRefPtr<Context> context,
@@ -24,7 +28,8 @@ public:
         uint32_t height,
         vk::Format format,
         vk::ImageUsageFlags usageFlags,
-        vk::Image image = nullptr);
+        vk::Image image = nullptr,
+        const std::string& name = {});
 
     Texture(
         ScopedRefPtr<Context> context,
@@ -32,10 +37,15 @@ public:
         uint32_t height,
         vk::Format format,
         const uint8_t* buffer,
-        size_t bufferSize);
+        size_t bufferSize,
+        const std::string& name = {});
 
     const vk::ImageView& GetImageView() const { return mImageView; }
     const vk::Image& GetImage() const { return mImage; }
+    uint32_t GetWidth() const { return mWidth; }
+    uint32_t GetHeight() const { return mHeight; }
+    // RGBA8 texels, empty unless the context retains host data
+    const std::vector<uint8_t>& GetHostPixels() const { return mHostPixels; }
 
     void SetImageLayout(
         vk::CommandBuffer& commandBuffer,
@@ -47,6 +57,7 @@ public:
     ~Texture();
 
 private:
+    void OnLastReference() override;
     ScopedRefPtr<Context> mContext;
 
     vk::Image mImage;
@@ -54,5 +65,6 @@ private:
     vk::ImageView mImageView;
     bool ownsImage;
     uint32_t mWidth, mHeight, mLayers;
+    std::vector<uint8_t> mHostPixels;
 };
 }  // namespace VKRT
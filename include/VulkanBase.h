@@ -8,7 +8,8 @@
 #define VULKAN_HPP_ASSERT(condition)
 #endif
 
-#ifdef VKRT_DEBUG
+// Validation layers allocate on the application heap and would trip the allocation tracking
+#if defined(VKRT_DEBUG) && !defined(VKRT_TRACK_ALLOCATIONS)
 #define VKRT_ENABLE_VALIDATION
 #endif
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Context.h"
+#include "MemoryAllocator.h"
+#include "MemoryTracker.h"
 #include "RefCountPtr.h"
 #include "VulkanBase.h"
 
@@ -9,12 +11,24 @@ class Device;
 
 class VulkanBuffer : public RefCountPtr {
 public:
+    // Objects bound to the buffer memory (acceleration structures) can't be moved with a plain
+    // copy, their owner copies them into the new buffer instead
+    class RelocationListener {
+    public:
+        virtual void RecordRelocation(
+            vk::CommandBuffer commandBuffer,
+            VulkanBuffer* buffer,
+            vk::Buffer newBufferHandle) = 0;
+        virtual void OnRelocated(VulkanBuffer* buffer) = 0;
+    };
+
     static ScopedRefPtr<VulkanBuffer> Create(
         ScopedRefPtr<Context> context,
         const vk::DeviceSize& size,
         const vk::BufferUsageFlags& usageFlags,
         const vk::MemoryPropertyFlags& memoryFlags,
-        const vk::MemoryAllocateFlags& memoryAllocateFlags = {});
+        const vk::MemoryAllocateFlags& memoryAllocateFlags = {},
+        const MemoryTag& tag = {});
 
     const vk::DeviceSize& GetBufferSize() const { return mSize; }
     const vk::Buffer& GetBufferHandle() const { return mBufferHandle; }
@@ -22,23 +36,42 @@ public:
 
     uint8_t* MapBuffer();
     void UnmapBuffer();
+    // Makes host writes visible to the device, only needed for non coherent memory
+    void FlushBuffer(vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+
+    bool IsHostVisible() const;
 
+    // The handle and device address change when the defragmenter moves the buffer, don't keep
+    // them across frames
     vk::DeviceAddress GetDeviceAddress();
 
+    const MemoryAllocation& GetAllocation() const { return mAllocation; }
+    void SetRelocationListener(RelocationListener* listener) { mRelocationListener = listener; }
+    bool IsMovable() const;
+
 private:
+    friend class MemoryAllocator;
+
     VulkanBuffer(
         ScopedRefPtr<Context> context,
         vk::DeviceSize size,
+        vk::BufferUsageFlags usageFlags,
         vk::Buffer bufferHandle,
-        vk::DeviceMemory memoryHandle,
-        vk::DescriptorBufferInfo descriptorInfo);
+        const MemoryAllocation& allocation);
 
     ~VulkanBuffer() override;
+    void OnLastReference() override;
+
+    vk::Buffer CreateHandle(const MemoryAllocation& allocation);
+    void RecordRelocation(vk::CommandBuffer commandBuffer, vk::Buffer newBufferHandle);
+    void CompleteRelocation(vk::Buffer newBufferHandle, const MemoryAllocation& allocation);
 
     ScopedRefPtr<Context> mContext;
     vk::DeviceSize mSize;
+    vk::BufferUsageFlags mUsageFlags;
     vk::Buffer mBufferHandle;
-    vk::DeviceMemory mMemoryHandle;
+    MemoryAllocation mAllocation;
     vk::DescriptorBufferInfo mDescriptorInfo;
+    RelocationListener* mRelocationListener;
 };
 }  // namespace VKRT
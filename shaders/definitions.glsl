@@ -20,13 +20,16 @@ const float Pi = 3.14159265359f;
 
 const uint MaxRecursionLevel = 4;
 
+// Reported by the sphere intersection shader, triangle hits use the front and back facing kinds
+const uint SphereHitKind = 0;
+
 const uint OpaqueMask = 0xF0;
 const uint RefractiveMask = 0x0F;
 const uint AllMask = OpaqueMask | RefractiveMask;
 
 struct MeshDescription {
-    uint64_t vertexBufferAddress;
-    uint64_t indexBufferAddress;
+    uint vertexOffset;
+    uint indexOffset;
 };
 
 struct Vertex {
@@ -51,6 +54,7 @@ struct Material {
     float indexOfRefraction;
     int albedoTextureIndex;
     int roughnessTextureIndex;
+    float alphaCutoff;
 };
 
 struct RayPayload {
@@ -0,0 +1,52 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace VKRT {
+
+static thread_local uint64_t sThreadAllocationCount = 0;
+
+uint64_t GetThreadAllocationCount() {
+    return sThreadAllocationCount;
+}
+
+#ifdef VKRT_TRACK_ALLOCATIONS
+static void* CountedAllocate(std::size_t size) {
+    ++sThreadAllocationCount;
+    void* ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+#endif
+
+}  // namespace VKRT
+
+#ifdef VKRT_TRACK_ALLOCATIONS
+// Over-aligned allocations go through the align_val_t overloads and are not counted
+void* operator new(std::size_t size) {
+    return VKRT::CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return VKRT::CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
@@ -0,0 +1,284 @@
+#include "BLASBuilder.h"
+
+#include <algorithm>
+
+#include "BLASCache.h"
+#include "BLASCompactor.h"
+#include "Context.h"
+#include "DebugUtils.h"
+#include "HostBLASBuilder.h"
+#include "Mesh.h"
+#include "ScratchAllocator.h"
+
+#undef MemoryBarrier
+
+namespace VKRT {
+
+BLASBuilder::BLASBuilder(ScopedRefPtr<Context> context)
+    : mContext(context),
+      mPendingTimings(Context::MaxFramesInFlight, PendingTimings{}),
+      mStatistics{} {
+    vk::QueryPoolCreateInfo queryPoolCreateInfo =
+        vk::QueryPoolCreateInfo()
+            .setQueryType(vk::QueryType::eTimestamp)
+            .setQueryCount(PolicyCount * 2 * static_cast<uint32_t>(mPendingTimings.size()));
+    mTimestampQueryPool = VKRT_ASSERT_VK(
+        mContext->GetDevice()->GetLogicalDevice().createQueryPool(queryPoolCreateInfo));
+    const vk::PhysicalDeviceLimits limits = mContext->GetDevice()->GetDeviceProperties().limits;
+    mTimestampPeriod = static_cast<double>(limits.timestampPeriod);
+    mTimestampMask = mContext->GetDevice()->GetTimestampMask();
+}
+
+void BLASBuilder::Enqueue(
+    Mesh* mesh,
+    vk::BuildAccelerationStructureModeKHR mode,
+    vk::DeviceSize scratchSize) {
+    mRequests.push_back(Request{.mesh = mesh, .mode = mode, .scratchSize = scratchSize});
+}
+
+void BLASBuilder::Cancel(Mesh* mesh) {
+    for (Request& request : mRequests) {
+        if (request.mesh == mesh) {
+            request.mesh = nullptr;
+        }
+    }
+}
+
+void BLASBuilder::RecordBuilds(vk::CommandBuffer commandBuffer) {
+    // Host built structures reach the device through the cache loads, once the workers are done
+    mContext->GetHostBLASBuilder()->Collect();
+    // Cached structures only need a copy, they are ready before the builds
+    mContext->GetBLASCache()->RecordLoads(commandBuffer);
+    std::erase_if(mRequests, [](const Request& request) { return request.mesh == nullptr; });
+    if (mRequests.empty()) {
+        return;
+    }
+
+    // Grouped by policy so each group gets its own timestamps
+    std::sort(mRequests.begin(), mRequests.end(), [](const Request& a, const Request& b) {
+        return a.mesh->mBuildPolicy < b.mesh->mBuildPolicy;
+    });
+    // The slot's previous frame has completed before it is recorded again, its timings are
+    // normally read already
+    const uint32_t frameSlot = mContext->GetFrameSlot();
+    ReadTimings(frameSlot);
+    PendingTimings& pending = mPendingTimings[frameSlot];
+    pending.ticket = 0;
+    pending.recorded = true;
+    const uint32_t firstQuery = frameSlot * PolicyCount * 2;
+    commandBuffer.resetQueryPool(mTimestampQueryPool, firstQuery, PolicyCount * 2);
+
+    ScratchAllocator* scratchAllocator = mContext->GetScratchAllocator();
+    size_t firstRequest = 0;
+    while (firstRequest < mRequests.size()) {
+        const Mesh::BuildPolicy buildPolicy = mRequests[firstRequest].mesh->mBuildPolicy;
+        const uint32_t policyIndex = static_cast<uint32_t>(buildPolicy);
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            mTimestampQueryPool,
+            firstQuery + policyIndex * 2);
+
+        while (firstRequest < mRequests.size() &&
+               mRequests[firstRequest].mesh->mBuildPolicy == buildPolicy) {
+            size_t requestCount = 0;
+            vk::DeviceSize scratchSize = 0;
+            while (firstRequest + requestCount < mRequests.size()) {
+                const Request& request = mRequests[firstRequest + requestCount];
+                if (request.mesh->mBuildPolicy != buildPolicy ||
+                    (requestCount > 0 && scratchSize + request.scratchSize > MaxScratchPerBuild)) {
+                    break;
+                }
+                scratchSize += request.scratchSize;
+                ++requestCount;
+            }
+
+            if (firstRequest > 0) {
+                // The previous call has to be done with the scratch before this one reuses it
+                const vk::MemoryBarrier barrier =
+                    vk::MemoryBarrier()
+                        .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+                        .setDstAccessMask(
+                            vk::AccessFlagBits::eAccelerationStructureReadKHR |
+                            vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+                commandBuffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                    {},
+                    barrier,
+                    {},
+                    {});
+                scratchAllocator->Rewind();
+            }
+            RecordBuild(commandBuffer, firstRequest, requestCount);
+            firstRequest += requestCount;
+        }
+
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            mTimestampQueryPool,
+            firstQuery + policyIndex * 2 + 1);
+    }
+
+    mBuiltMeshes.clear();
+    for (const Request& request : mRequests) {
+        Mesh* mesh = request.mesh;
+        Statistics& statistics = pending.statistics[static_cast<uint32_t>(mesh->mBuildPolicy)];
+        if (request.mode == vk::BuildAccelerationStructureModeKHR::eUpdate) {
+            ++statistics.refitCount;
+        } else {
+            ++statistics.buildCount;
+        }
+        statistics.triangleCount += mesh->GetTriangleCount();
+        // Only static meshes are compacted, the others would lose their storage on a rebuild
+        if (mesh->mBuildPolicy == Mesh::BuildPolicy::Static) {
+            mBuiltMeshes.push_back(mesh);
+        }
+        mesh->mBuilt = true;
+        mesh->mBuildPending = false;
+        // Only a built structure can be cloned when the defragmenter moves it
+        mesh->mBLASBuffer->SetRelocationListener(mesh);
+    }
+    mRequests.clear();
+    mContext->GetBLASCompactor()->RecordSizeQueries(commandBuffer, mBuiltMeshes);
+
+    // TLAS builds and traces read the structures, later builds may reuse the scratch
+    const vk::MemoryBarrier barrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(
+                vk::AccessFlagBits::eAccelerationStructureReadKHR |
+                vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {},
+        barrier,
+        {},
+        {});
+}
+
+void BLASBuilder::RecordBuild(
+    vk::CommandBuffer commandBuffer,
+    size_t firstRequest,
+    size_t requestCount) {
+    // Build infos point into the geometry and range arrays, both are filled first so they don't
+    // reallocate underneath them
+    mGeometries.clear();
+    mRanges.clear();
+    mFirstGeometries.resize(requestCount);
+    for (size_t index = 0; index < requestCount; ++index) {
+        mFirstGeometries[index] = static_cast<uint32_t>(mGeometries.size());
+        mRequests[firstRequest + index].mesh->GetBuildGeometries(mGeometries, mRanges);
+    }
+    mBuildInfos.resize(requestCount);
+    mRangePointers.resize(requestCount);
+
+    ScratchAllocator* scratchAllocator = mContext->GetScratchAllocator();
+    for (size_t index = 0; index < requestCount; ++index) {
+        const Request& request = mRequests[firstRequest + index];
+        Mesh* mesh = request.mesh;
+        const uint32_t firstGeometry = mFirstGeometries[index];
+        // Refits read the previous structure in place
+        mBuildInfos[index] =
+            vk::AccelerationStructureBuildGeometryInfoKHR()
+                .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+                .setFlags(mesh->mBuildFlags)
+                .setMode(request.mode)
+                .setSrcAccelerationStructure(
+                    request.mode == vk::BuildAccelerationStructureModeKHR::eUpdate
+                        ? mesh->mBLAS
+                        : vk::AccelerationStructureKHR())
+                .setDstAccelerationStructure(mesh->mBLAS)
+                .setGeometryCount(mesh->GetGeometryCount())
+                .setPGeometries(&mGeometries[firstGeometry])
+                .setScratchData(scratchAllocator->Allocate(request.scratchSize));
+        mRangePointers[index] = &mRanges[firstGeometry];
+    }
+
+    commandBuffer.buildAccelerationStructuresKHR(
+        mBuildInfos,
+        mRangePointers,
+        mContext->GetDevice()->GetDispatcher());
+}
+
+void BLASBuilder::Flush() {
+    BLASCache* cache = mContext->GetBLASCache();
+    // Their cache loads go in the same submission
+    mContext->GetHostBLASBuilder()->Wait();
+    if (mRequests.empty() && !cache->HasPendingLoads()) {
+        return;
+    }
+    Device* device = mContext->GetDevice();
+    device->BeginRecording();
+    vk::CommandBuffer commandBuffer = device->CreateCommandBuffer();
+    VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
+    RecordBuilds(commandBuffer);
+    VKRT_ASSERT_VK(commandBuffer.end());
+    const uint64_t ticket = device->SubmitCommand(commandBuffer);
+    device->EndRecording(ticket);
+    device->Wait(ticket);
+    device->CollectRetired();
+    device->DestroyCommand(commandBuffer);
+    mContext->GetScratchAllocator()->Release();
+    cache->Release(ticket);
+    Release(ticket);
+}
+
+void BLASBuilder::Release(uint64_t ticket) {
+    const uint64_t completedValue = mContext->GetDevice()->GetCompletedTimelineValue();
+    for (uint32_t frameSlot = 0; frameSlot < mPendingTimings.size(); ++frameSlot) {
+        PendingTimings& pending = mPendingTimings[frameSlot];
+        if (!pending.recorded) {
+            continue;
+        }
+        if (pending.ticket == 0) {
+            pending.ticket = ticket;
+        }
+        if (pending.ticket <= completedValue) {
+            ReadTimings(frameSlot);
+        }
+    }
+}
+
+void BLASBuilder::ReadTimings(uint32_t frameSlot) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    PendingTimings& pendingTimings = mPendingTimings[frameSlot];
+    for (uint32_t policyIndex = 0; policyIndex < PolicyCount; ++policyIndex) {
+        Statistics& pending = pendingTimings.statistics[policyIndex];
+        if (pending.buildCount + pending.refitCount == 0) {
+            continue;
+        }
+        // Read per group, groups without builds leave their queries unavailable
+        std::array<uint64_t, 2> timestamps;
+        const vk::Result result = logicalDevice.getQueryPoolResults(
+            mTimestampQueryPool,
+            (frameSlot * PolicyCount + policyIndex) * 2,
+            2,
+            sizeof(timestamps),
+            timestamps.data(),
+            sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64);
+        if (result == vk::Result::eSuccess) {
+            // Masked again so a counter wrapping between the two still gives the elapsed ticks
+            const uint64_t ticks =
+                ((timestamps[1] & mTimestampMask) - (timestamps[0] & mTimestampMask)) &
+                mTimestampMask;
+            pending.milliseconds = static_cast<double>(ticks) * mTimestampPeriod / 1000000.0;
+        }
+
+        Statistics& statistics = mStatistics[policyIndex];
+        statistics.buildCount += pending.buildCount;
+        statistics.refitCount += pending.refitCount;
+        statistics.triangleCount += pending.triangleCount;
+        statistics.milliseconds += pending.milliseconds;
+        pending = Statistics{};
+    }
+    pendingTimings.recorded = false;
+}
+
+BLASBuilder::~BLASBuilder() {
+    mContext->GetDevice()->GetLogicalDevice().destroyQueryPool(mTimestampQueryPool);
+}
+
+}  // namespace VKRT
@@ -0,0 +1,366 @@
+#include "BLASCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "Context.h"
+#include "DebugUtils.h"
+#include "Mesh.h"
+
+#undef MemoryBarrier
+
+namespace VKRT {
+
+// 64 bit FNV-1a
+static constexpr uint64_t HashBasis = 14695981039346656037ull;
+static uint64_t Hash(uint64_t hash, std::span<const uint8_t> data) {
+    for (const uint8_t byte : data) {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t HashValue(uint64_t hash, const T& value) {
+    return Hash(hash, std::span(reinterpret_cast<const uint8_t*>(&value), sizeof(T)));
+}
+
+BLASCache::BLASCache(ScopedRefPtr<Context> context, const std::filesystem::path& directory)
+    : mContext(context),
+      mDirectory(directory),
+      mStopWriting(false),
+      mLoadCount(0),
+      mStoreCount(0) {
+    // The serialized header is checked against the driver on load, keying by device too keeps
+    // the files of several GPUs apart
+    const vk::PhysicalDeviceProperties properties = mContext->GetDevice()->GetDeviceProperties();
+    mDeviceKey = HashValue(HashBasis, properties.vendorID);
+    mDeviceKey = HashValue(mDeviceKey, properties.deviceID);
+    mDeviceKey = HashValue(mDeviceKey, properties.driverVersion);
+    mDeviceKey = HashValue(mDeviceKey, properties.pipelineCacheUUID);
+
+    if (IsEnabled()) {
+        std::error_code error;
+        std::filesystem::create_directories(mDirectory, error);
+        if (error) {
+            VKRT_LOG("BLAS cache disabled, can't create " << mDirectory << ": " << error.message());
+            mDirectory.clear();
+        }
+    }
+}
+
+BLASCache::Key BLASCache::ComputeKey(
+    const std::vector<std::span<const uint8_t>>& geometryData,
+    vk::BuildAccelerationStructureFlagsKHR buildFlags) const {
+    Key key = mDeviceKey;
+    for (std::span<const uint8_t> data : geometryData) {
+        // Sizes too, the same bytes split into other geometries are another structure
+        key = HashValue(key, static_cast<uint64_t>(data.size()));
+        key = Hash(key, data);
+    }
+    key = HashValue(key, static_cast<VkBuildAccelerationStructureFlagsKHR>(buildFlags));
+    return key == NoKey ? NoKey + 1 : key;
+}
+
+std::filesystem::path BLASCache::GetPath(Key key) const {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".blas";
+    return mDirectory / name.str();
+}
+
+bool BLASCache::Load(Key key, std::vector<uint8_t>& data) {
+    if (!IsEnabled()) {
+        return false;
+    }
+    std::ifstream file(GetPath(key), std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    const std::streamsize size = file.tellg();
+    if (size < static_cast<std::streamsize>(HeaderSize)) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), size)) {
+        return false;
+    }
+    // The header records the serialized size, a truncated or padded write is rebuilt
+    uint64_t serializedSize = 0;
+    std::memcpy(&serializedSize, data.data() + 2 * VK_UUID_SIZE, sizeof(serializedSize));
+    if (serializedSize != static_cast<uint64_t>(size)) {
+        VKRT_LOG(
+            "BLAS cache entry " << GetPath(key) << " is " << size << " bytes, expected "
+                                << serializedSize);
+        return false;
+    }
+
+    // Structures from another driver version are rebuilt and overwritten
+    const vk::AccelerationStructureVersionInfoKHR versionInfo =
+        vk::AccelerationStructureVersionInfoKHR().setPVersionData(data.data());
+    const vk::AccelerationStructureCompatibilityKHR compatibility =
+        mContext->GetDevice()->GetLogicalDevice().getAccelerationStructureCompatibilityKHR(
+            versionInfo,
+            mContext->GetDevice()->GetDispatcher());
+    return compatibility == vk::AccelerationStructureCompatibilityKHR::eCompatible;
+}
+
+vk::DeviceSize BLASCache::GetDeserializedSize(std::span<const uint8_t> data) {
+    VKRT_ASSERT(data.size() >= HeaderSize);
+    uint64_t deserializedSize = 0;
+    std::memcpy(
+        &deserializedSize,
+        data.data() + 2 * VK_UUID_SIZE + sizeof(uint64_t),
+        sizeof(deserializedSize));
+    return deserializedSize;
+}
+
+void BLASCache::EnqueueLoad(Mesh* mesh, std::vector<uint8_t>&& data) {
+    mLoads.push_back(Load{.mesh = mesh, .data = std::move(data)});
+}
+
+void BLASCache::EnqueueStore(Mesh* mesh) {
+    if (mesh->mCacheKey != NoKey) {
+        mPendingStores.push_back(mesh);
+    }
+}
+
+void BLASCache::Cancel(Mesh* mesh) {
+    std::erase_if(mLoads, [mesh](const Load& load) { return load.mesh == mesh; });
+    std::erase(mPendingStores, mesh);
+    std::replace(mQueriedMeshes.begin(), mQueriedMeshes.end(), mesh, static_cast<Mesh*>(nullptr));
+    for (Store& store : mStores) {
+        if (store.mesh == mesh) {
+            // The copy is recorded already, the file can still be written
+            store.mesh = nullptr;
+        }
+    }
+}
+
+void BLASCache::RecordLoads(vk::CommandBuffer commandBuffer) {
+    if (mLoads.empty()) {
+        return;
+    }
+
+    for (Load& load : mLoads) {
+        ScopedRefPtr<VulkanBuffer> buffer = mContext->GetDevice()->CreateBuffer(
+            load.data.size(),
+            vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::Staging, load.mesh->GetName()});
+        std::copy(load.data.begin(), load.data.end(), buffer->MapBuffer());
+        buffer->UnmapBuffer();
+
+        const vk::CopyMemoryToAccelerationStructureInfoKHR copyInfo =
+            vk::CopyMemoryToAccelerationStructureInfoKHR()
+                .setSrc(buffer->GetDeviceAddress())
+                .setDst(load.mesh->mBLAS)
+                .setMode(vk::CopyAccelerationStructureModeKHR::eDeserialize);
+        commandBuffer.copyMemoryToAccelerationStructureKHR(
+            copyInfo,
+            mContext->GetDevice()->GetDispatcher());
+        mUploadBuffers.push_back(buffer);
+
+        load.mesh->mBuilt = true;
+        load.mesh->mBuildPending = false;
+        load.mesh->mBLASBuffer->SetRelocationListener(load.mesh);
+        ++mLoadCount;
+    }
+    mLoads.clear();
+
+    const vk::MemoryBarrier barrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {},
+        barrier,
+        {},
+        {});
+}
+
+void BLASCache::RecordStores(vk::CommandBuffer commandBuffer) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const uint32_t queryCount = static_cast<uint32_t>(mQueriedMeshes.size());
+    mSerializedSizes.resize(queryCount);
+    for (uint32_t firstQuery = 0; firstQuery < queryCount; firstQuery += QueriesPerPool) {
+        const uint32_t count = std::min(QueriesPerPool, queryCount - firstQuery);
+        VKRT_ASSERT_VK(logicalDevice.getQueryPoolResults(
+            mQueryPools[firstQuery / QueriesPerPool],
+            0,
+            count,
+            count * sizeof(vk::DeviceSize),
+            mSerializedSizes.data() + firstQuery,
+            sizeof(vk::DeviceSize),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait));
+    }
+
+    const size_t firstStore = mStores.size();
+    for (uint32_t queryIndex = 0; queryIndex < queryCount; ++queryIndex) {
+        Mesh* mesh = mQueriedMeshes[queryIndex];
+        const vk::DeviceSize serializedSize = mSerializedSizes[queryIndex];
+        if (mesh == nullptr || serializedSize < HeaderSize) {
+            continue;
+        }
+        ScopedRefPtr<VulkanBuffer> buffer = mContext->GetDevice()->CreateBuffer(
+            serializedSize,
+            vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::Staging, mesh->GetName()});
+        const vk::CopyAccelerationStructureToMemoryInfoKHR copyInfo =
+            vk::CopyAccelerationStructureToMemoryInfoKHR()
+                .setSrc(mesh->mBLAS)
+                .setDst(buffer->GetDeviceAddress())
+                .setMode(vk::CopyAccelerationStructureModeKHR::eSerialize);
+        commandBuffer.copyAccelerationStructureToMemoryKHR(
+            copyInfo,
+            mContext->GetDevice()->GetDispatcher());
+        mStores.push_back(Store{
+            .mesh = mesh,
+            .key = mesh->mCacheKey,
+            .buffer = buffer,
+            .ticket = 0});
+    }
+    mQueriedMeshes.clear();
+
+    if (mStores.size() > firstStore) {
+        const vk::MemoryBarrier barrier = vk::MemoryBarrier()
+                                              .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                              .setDstAccessMask(vk::AccessFlagBits::eHostRead);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eHost,
+            {},
+            barrier,
+            {},
+            {});
+    }
+
+    for (Mesh* mesh : mPendingStores) {
+        const uint32_t queryIndex = static_cast<uint32_t>(mQueriedMeshes.size());
+        if (queryIndex / QueriesPerPool >= mQueryPools.size()) {
+            vk::QueryPoolCreateInfo queryPoolCreateInfo =
+                vk::QueryPoolCreateInfo()
+                    .setQueryType(vk::QueryType::eAccelerationStructureSerializationSizeKHR)
+                    .setQueryCount(QueriesPerPool);
+            mQueryPools.push_back(
+                VKRT_ASSERT_VK(logicalDevice.createQueryPool(queryPoolCreateInfo)));
+        }
+        const vk::QueryPool queryPool = mQueryPools[queryIndex / QueriesPerPool];
+        const uint32_t query = queryIndex % QueriesPerPool;
+        commandBuffer.resetQueryPool(queryPool, query, 1);
+        commandBuffer.writeAccelerationStructuresPropertiesKHR(
+            mesh->mBLAS,
+            vk::QueryType::eAccelerationStructureSerializationSizeKHR,
+            queryPool,
+            query,
+            mContext->GetDevice()->GetDispatcher());
+        mQueriedMeshes.push_back(mesh);
+    }
+    mPendingStores.clear();
+}
+
+bool BLASCache::Save(Key key, std::span<const uint8_t> data) {
+    if (!IsEnabled() || key == NoKey) {
+        return false;
+    }
+    // Written aside and renamed, a crash mid-write doesn't leave a truncated entry
+    const std::filesystem::path path = GetPath(key);
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(
+            reinterpret_cast<const char*>(data.data()),
+            static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            VKRT_LOG("Failed to write BLAS cache entry " << temporaryPath);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        return false;
+    }
+    ++mStoreCount;
+    return true;
+}
+
+void BLASCache::SaveAsync(Key key, std::vector<uint8_t>&& data) {
+    if (!IsEnabled() || key == NoKey) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mWriteMutex);
+        mWrites.emplace_back(key, std::move(data));
+    }
+    if (!mWriter.joinable()) {
+        mWriter = std::thread([this]() { RunWriter(); });
+    }
+    mWriteCondition.notify_one();
+}
+
+void BLASCache::RunWriter() {
+    std::vector<std::pair<Key, std::vector<uint8_t>>> writes;
+    std::unique_lock<std::mutex> lock(mWriteMutex);
+    while (true) {
+        mWriteCondition.wait(lock, [this]() { return mStopWriting || !mWrites.empty(); });
+        if (mWrites.empty()) {
+            return;
+        }
+        writes.swap(mWrites);
+        lock.unlock();
+        for (const auto& [key, data] : writes) {
+            Save(key, data);
+        }
+        writes.clear();
+        lock.lock();
+    }
+}
+
+void BLASCache::Release(uint64_t ticket) {
+    mUploadBuffers.clear();
+    // Later frames may still be copying theirs out
+    const uint64_t completedValue = mContext->GetDevice()->GetCompletedTimelineValue();
+    std::erase_if(mStores, [&](Store& store) {
+        if (store.ticket == 0) {
+            store.ticket = ticket;
+        }
+        if (store.ticket > completedValue) {
+            return false;
+        }
+        const uint8_t* data = store.buffer->MapBuffer();
+        SaveAsync(store.key, std::vector<uint8_t>(data, data + store.buffer->GetBufferSize()));
+        store.buffer->UnmapBuffer();
+        return true;
+    });
+}
+
+BLASCache::~BLASCache() {
+    // Outlives every submission, the device is idle by now
+    Release(0);
+    if (mWriter.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mWriteMutex);
+            mStopWriting = true;
+        }
+        mWriteCondition.notify_one();
+        mWriter.join();
+    }
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    for (vk::QueryPool queryPool : mQueryPools) {
+        logicalDevice.destroyQueryPool(queryPool);
+    }
+}
+
+}  // namespace VKRT
@@ -0,0 +1,179 @@
+#include "BLASCompactor.h"
+
+#include <algorithm>
+
+#include "BLASCache.h"
+#include "Context.h"
+#include "DebugUtils.h"
+#include "Mesh.h"
+
+#undef MemoryBarrier
+
+namespace VKRT {
+
+BLASCompactor::BLASCompactor(ScopedRefPtr<Context> context) : mContext(context), mSavedBytes(0) {}
+
+void BLASCompactor::RecordSizeQueries(
+    vk::CommandBuffer commandBuffer,
+    std::span<Mesh* const> meshes) {
+    const vk::MemoryBarrier barrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        {},
+        barrier,
+        {},
+        {});
+
+    for (Mesh* mesh : meshes) {
+        const uint32_t queryIndex = static_cast<uint32_t>(mQueriedMeshes.size());
+        if (queryIndex / QueriesPerPool >= mQueryPools.size()) {
+            vk::QueryPoolCreateInfo queryPoolCreateInfo =
+                vk::QueryPoolCreateInfo()
+                    .setQueryType(vk::QueryType::eAccelerationStructureCompactedSizeKHR)
+                    .setQueryCount(QueriesPerPool);
+            mQueryPools.push_back(VKRT_ASSERT_VK(
+                mContext->GetDevice()->GetLogicalDevice().createQueryPool(queryPoolCreateInfo)));
+        }
+        const vk::QueryPool queryPool = mQueryPools[queryIndex / QueriesPerPool];
+        const uint32_t query = queryIndex % QueriesPerPool;
+        commandBuffer.resetQueryPool(queryPool, query, 1);
+        commandBuffer.writeAccelerationStructuresPropertiesKHR(
+            mesh->mBLAS,
+            vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+            queryPool,
+            query,
+            mContext->GetDevice()->GetDispatcher());
+        mQueriedMeshes.push_back(mesh);
+    }
+}
+
+void BLASCompactor::Cancel(Mesh* mesh) {
+    std::replace(mQueriedMeshes.begin(), mQueriedMeshes.end(), mesh, static_cast<Mesh*>(nullptr));
+}
+
+void BLASCompactor::RecordCompaction(vk::CommandBuffer commandBuffer) {
+    if (mQueriedMeshes.empty()) {
+        return;
+    }
+
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const uint32_t queryCount = static_cast<uint32_t>(mQueriedMeshes.size());
+    mCompactedSizes.resize(queryCount);
+    for (uint32_t firstQuery = 0; firstQuery < queryCount; firstQuery += QueriesPerPool) {
+        const uint32_t count = std::min(QueriesPerPool, queryCount - firstQuery);
+        VKRT_ASSERT_VK(logicalDevice.getQueryPoolResults(
+            mQueryPools[firstQuery / QueriesPerPool],
+            0,
+            count,
+            count * sizeof(vk::DeviceSize),
+            mCompactedSizes.data() + firstQuery,
+            sizeof(vk::DeviceSize),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait));
+    }
+
+    BLASCache* cache = mContext->GetBLASCache();
+    bool hasCopies = false;
+    for (uint32_t queryIndex = 0; queryIndex < queryCount; ++queryIndex) {
+        Mesh* mesh = mQueriedMeshes[queryIndex];
+        if (mesh == nullptr) {
+            continue;
+        }
+        // Either way the structure is final now, compacted or not
+        cache->EnqueueStore(mesh);
+        const vk::DeviceSize compactedSize = mCompactedSizes[queryIndex];
+        if (compactedSize == 0 || compactedSize >= mesh->mBLASBuffer->GetBufferSize()) {
+            continue;
+        }
+
+        ScopedRefPtr<VulkanBuffer> buffer = mContext->GetDevice()->CreateBuffer(
+            compactedSize,
+            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryPropertyFlagBits::eDeviceLocal,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::AccelerationStructure, mesh->GetName()});
+
+        vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
+            vk::AccelerationStructureCreateInfoKHR()
+                .setBuffer(buffer->GetBufferHandle())
+                .setSize(compactedSize)
+                .setType(vk::AccelerationStructureTypeKHR::eBottomLevel);
+        vk::AccelerationStructureKHR compactedBLAS =
+            VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
+                accelerationStructureCreateInfo,
+                nullptr,
+                mContext->GetDevice()->GetDispatcher()));
+
+        vk::CopyAccelerationStructureInfoKHR copyInfo =
+            vk::CopyAccelerationStructureInfoKHR()
+                .setSrc(mesh->mBLAS)
+                .setDst(compactedBLAS)
+                .setMode(vk::CopyAccelerationStructureModeKHR::eCompact);
+        commandBuffer.copyAccelerationStructureKHR(
+            copyInfo,
+            mContext->GetDevice()->GetDispatcher());
+
+        const vk::DeviceSize originalSize = mesh->mBLASBuffer->GetBufferSize();
+        mReplaced.push_back(Replaced{
+            .accelerationStructure = mesh->mBLAS,
+            .buffer = mesh->mBLASBuffer,
+            .ticket = 0});
+        mesh->mBLASBuffer->SetRelocationListener(nullptr);
+        mesh->SetCompactedBLAS(buffer, compactedBLAS, originalSize - compactedSize);
+        mSavedBytes += originalSize - compactedSize;
+        hasCopies = true;
+
+        VKRT_LOG(
+            "Compacted BLAS of " << mesh->GetName() << " from " << originalSize << " to "
+                                 << compactedSize << " bytes");
+    }
+    mQueriedMeshes.clear();
+
+    if (hasCopies) {
+        const vk::MemoryBarrier barrier =
+            vk::MemoryBarrier()
+                .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+                .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+                vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+            {},
+            barrier,
+            {},
+            {});
+    }
+}
+
+void BLASCompactor::Release(uint64_t ticket) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const uint64_t completedValue = mContext->GetDevice()->GetCompletedTimelineValue();
+    std::erase_if(mReplaced, [&](Replaced& replaced) {
+        if (replaced.ticket == 0) {
+            replaced.ticket = ticket;
+        }
+        if (replaced.ticket > completedValue) {
+            return false;
+        }
+        logicalDevice.destroyAccelerationStructureKHR(
+            replaced.accelerationStructure,
+            nullptr,
+            mContext->GetDevice()->GetDispatcher());
+        return true;
+    });
+}
+
+BLASCompactor::~BLASCompactor() {
+    // Outlives every submission, the device is idle by now
+    Release(0);
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    for (vk::QueryPool queryPool : mQueryPools) {
+        logicalDevice.destroyQueryPool(queryPool);
+    }
+}
+
+}  // namespace VKRT
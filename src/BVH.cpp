@@ -0,0 +1,201 @@
+#include "BVH.h"
+
+#include <array>
+#include <future>
+#include <numeric>
+
+namespace VKRT {
+
+void BVH4::Build(std::span<const BoundingBox> boxes) {
+    mBoxes = boxes;
+    const uint32_t primitiveCount = static_cast<uint32_t>(boxes.size());
+    mCentroids.resize(primitiveCount);
+    for (uint32_t primitive = 0; primitive < primitiveCount; ++primitive) {
+        mCentroids[primitive] = boxes[primitive].GetCenter();
+    }
+    mPrimitiveIndices.resize(primitiveCount);
+    std::iota(mPrimitiveIndices.begin(), mPrimitiveIndices.end(), 0u);
+
+    // Every inner node splits its primitives at least in two, so there are fewer than primitives
+    mNodes.resize(std::max(primitiveCount, 1u));
+    mNodeCount = 0;
+    mBounds = BoundingBox();
+    if (primitiveCount == 0) {
+        return;
+    }
+    const Range root = MakeRange(0, primitiveCount);
+    mBounds = root.bounds;
+    mNodeCount = 1;
+    BuildNode(0, root, 0);
+    mNodes.resize(mNodeCount);
+    mCentroids.clear();
+    mBoxes = {};
+}
+
+float BVH4::GetSAHCost(float traversalCost, float intersectionCost) const {
+    const float rootArea = mBounds.GetHalfArea();
+    if (mNodeCount == 0 || rootArea <= 0.0f) {
+        return 0.0f;
+    }
+    // Each child box is reached with the probability of its area relative to the root's
+    float cost = traversalCost;
+    for (uint32_t nodeIndex = 0; nodeIndex < mNodeCount; ++nodeIndex) {
+        const Node& node = mNodes[nodeIndex];
+        for (uint32_t child = 0; child < 4; ++child) {
+            if (node.children[child] == EmptyChild) {
+                continue;
+            }
+            BoundingBox box;
+            box.min = glm::vec3(node.minX[child], node.minY[child], node.minZ[child]);
+            box.max = glm::vec3(node.maxX[child], node.maxY[child], node.maxZ[child]);
+            const float probability = box.GetHalfArea() / rootArea;
+            cost += (node.children[child] & LeafFlag) != 0
+                        ? probability * node.counts[child] * intersectionCost
+                        : probability * traversalCost;
+        }
+    }
+    return cost;
+}
+
+BVH4::Range BVH4::MakeRange(uint32_t begin, uint32_t end) const {
+    Range range{.begin = begin, .end = end};
+    for (uint32_t index = begin; index < end; ++index) {
+        const uint32_t primitive = mPrimitiveIndices[index];
+        range.bounds.Extend(mBoxes[primitive]);
+        range.centroidBounds.Extend(mCentroids[primitive]);
+    }
+    return range;
+}
+
+uint32_t BVH4::Split(const Range& range) {
+    const glm::vec3 extent = range.centroidBounds.max - range.centroidBounds.min;
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestBin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f) {
+            continue;
+        }
+        const float scale = BinCount / extent[axis];
+        std::array<BoundingBox, BinCount> binBounds;
+        std::array<uint32_t, BinCount> binCounts{};
+        for (uint32_t index = range.begin; index < range.end; ++index) {
+            const uint32_t primitive = mPrimitiveIndices[index];
+            const uint32_t bin = std::min(
+                static_cast<uint32_t>(
+                    (mCentroids[primitive][axis] - range.centroidBounds.min[axis]) * scale),
+                BinCount - 1);
+            binBounds[bin].Extend(mBoxes[primitive]);
+            ++binCounts[bin];
+        }
+
+        // Sweep from the right first, then evaluate every plane from the left
+        std::array<float, BinCount> rightCosts;
+        BoundingBox rightBounds;
+        uint32_t rightCount = 0;
+        for (uint32_t bin = BinCount - 1; bin > 0; --bin) {
+            rightBounds.Extend(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightCosts[bin] = rightCount > 0 ? rightBounds.GetHalfArea() * rightCount : 0.0f;
+        }
+        BoundingBox leftBounds;
+        uint32_t leftCount = 0;
+        for (uint32_t bin = 0; bin < BinCount - 1; ++bin) {
+            leftBounds.Extend(binBounds[bin]);
+            leftCount += binCounts[bin];
+            const float cost =
+                (leftCount > 0 ? leftBounds.GetHalfArea() * leftCount : 0.0f) + rightCosts[bin + 1];
+            if (leftCount > 0 && leftCount < range.end - range.begin && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
+            }
+        }
+    }
+
+    const uint32_t middle = range.begin + (range.end - range.begin) / 2;
+    if (bestAxis < 0) {
+        // Every centroid in the same place, any split is as good
+        return middle;
+    }
+    const float scale = BinCount / extent[bestAxis];
+    const float minimum = range.centroidBounds.min[bestAxis];
+    const auto split = std::partition(
+        mPrimitiveIndices.begin() + range.begin,
+        mPrimitiveIndices.begin() + range.end,
+        [&](uint32_t primitive) {
+            const uint32_t bin = std::min(
+                static_cast<uint32_t>((mCentroids[primitive][bestAxis] - minimum) * scale),
+                BinCount - 1);
+            return bin <= bestBin;
+        });
+    return static_cast<uint32_t>(split - mPrimitiveIndices.begin());
+}
+
+void BVH4::BuildNode(uint32_t nodeIndex, const Range& range, uint32_t depth) {
+    // Two binary SAH splits give the up to four children of the node
+    std::array<Range, 4> children;
+    uint32_t childCount = 1;
+    children[0] = range;
+    while (childCount < 4) {
+        // Largest splittable child first, it has the most to gain
+        int largest = -1;
+        for (uint32_t child = 0; child < childCount; ++child) {
+            const uint32_t count = children[child].end - children[child].begin;
+            if (count > MaxLeafSize &&
+                (largest < 0 || count > children[largest].end - children[largest].begin)) {
+                largest = static_cast<int>(child);
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        const Range parent = children[largest];
+        const uint32_t middle = Split(parent);
+        children[largest] = MakeRange(parent.begin, middle);
+        children[childCount++] = MakeRange(middle, parent.end);
+    }
+
+    Node& node = mNodes[nodeIndex];
+    std::vector<std::future<void>> subtrees;
+    for (uint32_t child = 0; child < 4; ++child) {
+        if (child >= childCount) {
+            node.minX[child] = node.minY[child] = node.minZ[child] = FLT_MAX;
+            node.maxX[child] = node.maxY[child] = node.maxZ[child] = -FLT_MAX;
+            node.children[child] = EmptyChild;
+            node.counts[child] = 0;
+            continue;
+        }
+        const Range& childRange = children[child];
+        node.minX[child] = childRange.bounds.min.x;
+        node.minY[child] = childRange.bounds.min.y;
+        node.minZ[child] = childRange.bounds.min.z;
+        node.maxX[child] = childRange.bounds.max.x;
+        node.maxY[child] = childRange.bounds.max.y;
+        node.maxZ[child] = childRange.bounds.max.z;
+
+        const uint32_t count = childRange.end - childRange.begin;
+        // Past the depth limit degenerate inputs end up in larger leaves
+        if (count <= MaxLeafSize || depth + 1 >= MaxDepth) {
+            node.children[child] = childRange.begin | LeafFlag;
+            node.counts[child] = count;
+            continue;
+        }
+        const uint32_t childIndex = mNodeCount.fetch_add(1);
+        node.children[child] = childIndex;
+        node.counts[child] = 0;
+        if (count >= ParallelBuildSize) {
+            subtrees.push_back(
+                std::async(std::launch::async, [this, childIndex, childRange, depth]() {
+                    BuildNode(childIndex, childRange, depth + 1);
+                }));
+        } else {
+            BuildNode(childIndex, childRange, depth + 1);
+        }
+    }
+    for (std::future<void>& subtree : subtrees) {
+        subtree.get();
+    }
+}
+
+}  // namespace VKRT
@@ -18,11 +18,22 @@ Camera::Camera(ScopedRefPtr<Window> window)
     mEulerRotation = glm::vec3(0.0);
     mPosition = glm::vec3(0.0);
     auto windowSize = mWindow->GetSize();
-    mProjectionTransform = glm::perspective(
-        glm::radians(60.0),
-        static_cast<double>(windowSize.width) / static_cast<double>(windowSize.height),
-        0.01,
-        1000.0);
+    SetProjection(static_cast<double>(windowSize.width) / static_cast<double>(windowSize.height));
+}
+
+Camera::Camera(double aspectRatio)
+    : mMovementSpeed(2.0f),
+      mRotationSpeed(100.0f),
+      mActive(false),
+      mSpeedModifierActive(false),
+      mCurrentMousePos(0.0, 0.0) {
+    mEulerRotation = glm::vec3(0.0);
+    mPosition = glm::vec3(0.0);
+    SetProjection(aspectRatio);
+}
+
+void Camera::SetProjection(double aspectRatio) {
+    mProjectionTransform = glm::perspective(glm::radians(60.0), aspectRatio, 0.01, 1000.0);
     mProjectionTransform[1][1] *= -1.0f;
 }
 
@@ -124,6 +135,9 @@ void Camera::OnMouseMoved(glm::vec2 newPos) {
 
 void Camera::OnLeftMouseButtonPressed() {
     mActive = !mActive;
+    if (mWindow == nullptr) {
+        return;
+    }
     InputManager* inputManager = mWindow->GetInputManager();
     inputManager->SetCursorMode(
         mActive ? InputManager::CursorMode::Disabled : InputManager::CursorMode::Normal);
@@ -136,7 +150,9 @@ void Camera::OnRightMouseButtonPressed() {}
 void Camera::OnRightMouseButtonReleased() {}
 
 Camera::~Camera() {
-    InputManager* inputManager = mWindow->GetInputManager();
-    inputManager->Unsuscribe(this);
+    if (mWindow != nullptr) {
+        InputManager* inputManager = mWindow->GetInputManager();
+        inputManager->Unsuscribe(this);
+    }
 }
 }  // namespace VKRT
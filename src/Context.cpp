@@ -2,26 +2,64 @@
 
 #include <GLFW/glfw3.h>
 
+#include "BLASBuilder.h"
+#include "BLASCache.h"
+#include "BLASCompactor.h"
 #include "DebugUtils.h"
+#include "GeometryPool.h"
+#include "HostBLASBuilder.h"
+#include "ResidencyManager.h"
+#include "ScratchAllocator.h"
 
 namespace VKRT {
 
+// Relative to the working directory, next to the assets the structures come from
+static constexpr const char* BLASCacheDirectory = "BLASCache";
+
 Context::Context(
     ScopedRefPtr<Window> window,
     ScopedRefPtr<Instance> instance,
     vk::SurfaceKHR surface,
-    ScopedRefPtr<Device> device) {
+    ScopedRefPtr<Device> device)
+    : mHostOnly(false), mRetainHostData(false), mFramesInFlight(1), mFrameSlot(0) {
     mWindow = window;
     mInstance = instance;
     mSurface = surface;
     mDevice = device;
     mDevice->SetContext(this);
     mSwapchain = new Swapchain(this);
+    mGeometryPool = new GeometryPool(this);
+    mScratchAllocator = new ScratchAllocator(this);
+    mBLASBuilder = new BLASBuilder(this);
+    mBLASCache = new BLASCache(this, BLASCacheDirectory);
+    mBLASCompactor = new BLASCompactor(this);
+    mHostBLASBuilder = new HostBLASBuilder(this);
+    mResidencyManager = new ResidencyManager(this);
+}
+
+Context::Context() : mHostOnly(true), mRetainHostData(true), mFramesInFlight(1), mFrameSlot(0) {}
+
+void Context::SetFramesInFlight(uint32_t framesInFlight) {
+    VKRT_ASSERT(framesInFlight >= 1 && framesInFlight <= MaxFramesInFlight);
+    mFramesInFlight = framesInFlight;
+    mFrameSlot = 0;
 }
 
 void Context::Destroy() {
+    if (mHostOnly) {
+        return;
+    }
     VKRT_ASSERT_VK(mDevice->GetLogicalDevice().waitIdle());
     mSwapchain = nullptr;
+    mResidencyManager = nullptr;
+    mGeometryPool = nullptr;
+    mScratchAllocator = nullptr;
+    mHostBLASBuilder = nullptr;
+    mBLASBuilder = nullptr;
+    mBLASCompactor = nullptr;
+    mBLASCache = nullptr;
+    // Retired objects still reach the device through the context when deleted
+    mDevice->FlushRetired();
     mInstance->DestroySurface(mSurface);
     mDevice = nullptr;
     mInstance = nullptr;
@@ -0,0 +1,659 @@
+#include "CpuRenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "DebugUtils.h"
+#include "Material.h"
+#include "Model.h"
+#include "Object.h"
+#include "Texture.h"
+
+namespace VKRT {
+
+namespace {
+
+// Rays traced by the worker, summed once its tiles are done
+thread_local uint64_t tRayCount = 0;
+
+constexpr float Pi = 3.14159265359f;
+
+// GLSL smoothstep, equal edges make it a step like on the GPU
+float SmoothStep(float edge0, float edge1, float x) {
+    if (edge0 == edge1) {
+        return x < edge0 ? 0.0f : 1.0f;
+    }
+    const float t = std::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+glm::vec3 FresnelSchlick(float cosTheta, const glm::vec3& f0) {
+    return f0 + (1.0f - f0) * std::pow(std::clamp(1.0f - cosTheta, 0.0f, 1.0f), 5.0f);
+}
+
+float DistributionGGX(const glm::vec3& n, const glm::vec3& h, float roughness) {
+    const float a = roughness * roughness;
+    const float a2 = a * a;
+    const float nDotH = std::max(glm::dot(n, h), 0.0f);
+    const float denominator = nDotH * nDotH * (a2 - 1.0f) + 1.0f;
+    return a2 / (Pi * denominator * denominator);
+}
+
+float GeometrySchlickGGX(float nDotV, float roughness) {
+    const float r = roughness + 1.0f;
+    const float k = (r * r) / 8.0f;
+    return nDotV / (nDotV * (1.0f - k) + k);
+}
+
+float GeometrySmith(
+    const glm::vec3& n,
+    const glm::vec3& v,
+    const glm::vec3& l,
+    float roughness) {
+    return GeometrySchlickGGX(std::max(glm::dot(n, l), 0.0f), roughness) *
+           GeometrySchlickGGX(std::max(glm::dot(n, v), 0.0f), roughness);
+}
+
+float Fresnel(const glm::vec3& incident, const glm::vec3& normal, float ior) {
+    float cosIncident = glm::dot(incident, normal);
+    const float etaIncident = cosIncident > 0.0f ? ior : 1.0f;
+    const float etaTrans = cosIncident > 0.0f ? 1.0f : ior;
+    const float sinTrans =
+        etaIncident / etaTrans * std::sqrt(std::max(0.0f, 1.0f - cosIncident * cosIncident));
+    if (sinTrans >= 1.0f) {
+        return 1.0f;
+    }
+    const float cosTrans = std::sqrt(std::max(0.0f, 1.0f - sinTrans * sinTrans));
+    cosIncident = std::abs(cosIncident);
+    const float rS = ((etaTrans * cosIncident) - (etaIncident * cosTrans)) /
+                     ((etaTrans * cosIncident) + (etaIncident * cosTrans));
+    const float rP = ((etaIncident * cosIncident) - (etaTrans * cosTrans)) /
+                     ((etaIncident * cosIncident) + (etaTrans * cosTrans));
+    return (rS * rS + rP * rP) / 2.0f;
+}
+
+float LinearToSRGB(float linear) {
+    return linear < 0.0031308f ? linear * 12.92f
+                               : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+// Same bytes as an imageStore to the rgba8 storage image, alpha included
+uint32_t PackColor(const glm::vec3& color) {
+    uint32_t packed = 0;
+    for (int channel = 0; channel < 3; ++channel) {
+        const float value = std::clamp(LinearToSRGB(color[channel]), 0.0f, 1.0f);
+        packed |= static_cast<uint32_t>(value * 255.0f + 0.5f) << (channel * 8);
+    }
+    return packed;
+}
+
+}  // namespace
+
+CpuRenderer::CpuRenderer(ScopedRefPtr<Scene> scene, uint32_t threadCount)
+    : mScene(scene),
+      mThreadCount(threadCount > 0 ? threadCount
+                                   : std::max(1u, std::thread::hardware_concurrency())),
+      mSunDirection(0.0f, -1.0f, 0.0f),
+      mWidth(0),
+      mHeight(0),
+      mRayCount(0),
+      mStatistics{} {}
+
+const CpuRenderer::MeshData* CpuRenderer::GetMeshData(const Mesh* mesh) {
+    auto it = mMeshData.find(mesh);
+    if (it != mMeshData.end()) {
+        return it->second.get();
+    }
+    const std::vector<Mesh::Primitive>& primitives = mesh->GetHostPrimitives();
+    if (primitives.empty()) {
+        VKRT_LOG("No host geometry for " << mesh->GetName() << ", retain host data before loading");
+        mMeshData.emplace(mesh, nullptr);
+        return nullptr;
+    }
+
+    auto meshData = std::make_unique<MeshData>();
+    meshData->mesh = mesh;
+    meshData->triangles.reserve(mesh->GetTriangleCount());
+    std::vector<BoundingBox> boxes;
+    boxes.reserve(mesh->GetTriangleCount());
+    for (uint32_t geometry = 0; geometry < primitives.size(); ++geometry) {
+        const Mesh::Primitive& primitive = primitives[geometry];
+        for (uint32_t index = 0; index < primitive.indices.size(); ++index) {
+            const glm::uvec3& triangle = primitive.indices[index];
+            const glm::vec3& p0 = primitive.vertices[triangle.x].position;
+            const glm::vec3& p1 = primitive.vertices[triangle.y].position;
+            const glm::vec3& p2 = primitive.vertices[triangle.z].position;
+            meshData->triangles.push_back(Triangle{
+                .vertex0 = p0,
+                .edge1 = p1 - p0,
+                .edge2 = p2 - p0,
+                .geometry = geometry,
+                .primitive = index,
+                .alphaTested = primitive.alphaTested});
+            BoundingBox& box = boxes.emplace_back();
+            box.Extend(p0);
+            box.Extend(p1);
+            box.Extend(p2);
+        }
+    }
+    meshData->bvh.Build(boxes);
+    return mMeshData.emplace(mesh, std::move(meshData)).first->second.get();
+}
+
+void CpuRenderer::Update() {
+    const auto beginTime = std::chrono::steady_clock::now();
+
+    mArena.Reset();
+    const Scene::SceneMaterials sceneMaterials = mScene->GetMaterialProxies(mArena);
+    mMaterials.assign(sceneMaterials.materials.begin(), sceneMaterials.materials.end());
+    mTextures.assign(sceneMaterials.textures.begin(), sceneMaterials.textures.end());
+    const std::span<Light::Proxy> lights = mScene->GetLightDescriptions(mArena);
+    mLights.assign(lights.begin(), lights.end());
+    // The miss shader takes the sky's sun from the first directional light
+    auto sunIt = std::find_if(mLights.begin(), mLights.end(), [](const Light::Proxy& proxy) {
+        return proxy.type == Light::Type::Directional;
+    });
+    mSunDirection =
+        sunIt != mLights.end() ? sunIt->directionOrPosition : glm::vec3(0.0f, -1.0f, 0.0f);
+
+    // Instances as the scene lays them out, their geometries index the materials from firstGeometry
+    mInstances.clear();
+    std::vector<BoundingBox> instanceBounds;
+    uint32_t firstGeometry = 0;
+    for (const Object* object : mScene->GetObjects()) {
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            const MeshData* meshData = GetMeshData(mesh);
+            if (meshData != nullptr && !meshData->triangles.empty()) {
+                uint32_t mask = 0;
+                for (const Material* material : mesh->GetMaterials()) {
+                    const bool isRefractive = material->GetIndexOfRefraction() > 0.0f;
+                    mask |= isRefractive ? Material::RefractiveMask : Material::OpaqueMask;
+                }
+                const glm::mat4& transform = object->GetTransform();
+                mInstances.push_back(Instance{
+                    .objectToWorld = transform,
+                    .worldToObject = glm::inverse(transform),
+                    .normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform))),
+                    .mesh = meshData,
+                    .firstGeometry = firstGeometry,
+                    .mask = mask});
+
+                const BoundingBox& bounds = meshData->bvh.GetBounds();
+                BoundingBox& worldBounds = instanceBounds.emplace_back();
+                for (uint32_t corner = 0; corner < 8; ++corner) {
+                    const glm::vec3 point(
+                        (corner & 1) != 0 ? bounds.max.x : bounds.min.x,
+                        (corner & 2) != 0 ? bounds.max.y : bounds.min.y,
+                        (corner & 4) != 0 ? bounds.max.z : bounds.min.z);
+                    worldBounds.Extend(glm::vec3(transform * glm::vec4(point, 1.0f)));
+                }
+            }
+            firstGeometry += mesh->GetGeometryCount();
+        }
+    }
+    // Sphere material slots follow the mesh geometries like in the scene's instances
+    const std::vector<ScopedRefPtr<Material>>& sphereMaterials = mScene->GetSphereMaterials();
+    for (const Scene::Sphere& sphere : mScene->GetSpheres()) {
+        const bool isRefractive =
+            sphereMaterials[sphere.materialIndex]->GetIndexOfRefraction() > 0.0f;
+        const glm::mat4 transform = glm::scale(
+            glm::translate(glm::mat4(1.0f), sphere.center),
+            glm::vec3(sphere.radius));
+        mInstances.push_back(Instance{
+            .objectToWorld = transform,
+            .worldToObject = glm::inverse(transform),
+            .normalMatrix = glm::mat3(1.0f),
+            .mesh = nullptr,
+            .firstGeometry = firstGeometry + sphere.materialIndex,
+            .mask = isRefractive ? Material::RefractiveMask : Material::OpaqueMask});
+        BoundingBox& worldBounds = instanceBounds.emplace_back();
+        worldBounds.Extend(sphere.center - sphere.radius);
+        worldBounds.Extend(sphere.center + sphere.radius);
+    }
+    mInstanceBVH.Build(instanceBounds);
+
+    mStatistics.buildMilliseconds =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beginTime)
+            .count();
+}
+
+bool CpuRenderer::Intersect(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float tMax,
+    uint32_t mask,
+    bool anyHit,
+    Hit& hit) const {
+    ++tRayCount;
+    return mInstanceBVH.Traverse(
+        origin,
+        direction,
+        TMin,
+        tMax,
+        anyHit,
+        [&](uint32_t instanceIndex, float& instanceTMax) {
+            const Instance& instance = mInstances[instanceIndex];
+            if ((instance.mask & mask) == 0) {
+                return false;
+            }
+            // Untouched length keeps t the same in both spaces
+            const glm::vec3 objectOrigin =
+                glm::vec3(instance.worldToObject * glm::vec4(origin, 1.0f));
+            const glm::vec3 objectDirection =
+                glm::vec3(instance.worldToObject * glm::vec4(direction, 0.0f));
+            if (instance.mesh == nullptr) {
+                return IntersectSphere(
+                    objectOrigin,
+                    objectDirection,
+                    instanceIndex,
+                    instanceTMax,
+                    hit);
+            }
+            const MeshData& meshData = *instance.mesh;
+            return meshData.bvh.Traverse(
+                objectOrigin,
+                objectDirection,
+                TMin,
+                instanceTMax,
+                anyHit,
+                [&](uint32_t triangleIndex, float& triangleTMax) {
+                    // Möller-Trumbore, both faces like the instances with culling disabled
+                    const Triangle& triangle = meshData.triangles[triangleIndex];
+                    const glm::vec3 p = glm::cross(objectDirection, triangle.edge2);
+                    const float determinant = glm::dot(triangle.edge1, p);
+                    if (determinant == 0.0f) {
+                        return false;
+                    }
+                    const float inverseDeterminant = 1.0f / determinant;
+                    const glm::vec3 s = objectOrigin - triangle.vertex0;
+                    const float u = glm::dot(s, p) * inverseDeterminant;
+                    if (u < 0.0f || u > 1.0f) {
+                        return false;
+                    }
+                    const glm::vec3 q = glm::cross(s, triangle.edge1);
+                    const float v = glm::dot(objectDirection, q) * inverseDeterminant;
+                    if (v < 0.0f || u + v > 1.0f) {
+                        return false;
+                    }
+                    const float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+                    if (t < TMin || t > triangleTMax) {
+                        return false;
+                    }
+                    if (triangle.alphaTested && IsCutOut(instance, triangle, glm::vec2(u, v))) {
+                        return false;
+                    }
+                    triangleTMax = t;
+                    hit = Hit{
+                        .t = t,
+                        .instance = instanceIndex,
+                        .geometry = triangle.geometry,
+                        .primitive = triangle.primitive,
+                        .barycentrics = glm::vec2(u, v)};
+                    return true;
+                });
+        });
+}
+
+bool CpuRenderer::IntersectSphere(
+    const glm::vec3& objectOrigin,
+    const glm::vec3& objectDirection,
+    uint32_t instanceIndex,
+    float& tMax,
+    Hit& hit) const {
+    // Same solution as sphere.rint, unit sphere at the origin
+    const float a = glm::dot(objectDirection, objectDirection);
+    const float halfB = glm::dot(objectOrigin, objectDirection);
+    const float c = glm::dot(objectOrigin, objectOrigin) - 1.0f;
+    const float discriminant = halfB * halfB - a * c;
+    if (discriminant < 0.0f) {
+        return false;
+    }
+    const float root = std::sqrt(discriminant);
+    float t = (-halfB - root) / a;
+    if (t < TMin) {
+        t = (-halfB + root) / a;
+    }
+    if (t < TMin || t > tMax) {
+        return false;
+    }
+    tMax = t;
+    const glm::vec3 normal = glm::normalize(objectOrigin + objectDirection * t);
+    hit = Hit{
+        .t = t,
+        .instance = instanceIndex,
+        .geometry = 0,
+        .primitive = 0,
+        .barycentrics = glm::vec2(
+            std::atan2(normal.z, normal.x) / (2.0f * Pi) + 0.5f,
+            std::acos(std::clamp(normal.y, -1.0f, 1.0f)) / Pi)};
+    return true;
+}
+
+bool CpuRenderer::IsCutOut(
+    const Instance& instance,
+    const Triangle& triangle,
+    glm::vec2 barycentrics) const {
+    const Scene::MaterialProxy& material = mMaterials[instance.firstGeometry + triangle.geometry];
+    if (material.albedoTextureIndex < 0 || material.alphaCutoff <= 0.0f) {
+        return false;
+    }
+    const Mesh::Primitive& primitive =
+        instance.mesh->mesh->GetHostPrimitives()[triangle.geometry];
+    const glm::uvec3& indices = primitive.indices[triangle.primitive];
+    const glm::vec2 texCoord =
+        primitive.vertices[indices.x].texCoord * (1.0f - barycentrics.x - barycentrics.y) +
+        primitive.vertices[indices.y].texCoord * barycentrics.x +
+        primitive.vertices[indices.z].texCoord * barycentrics.y;
+    return Sample(material.albedoTextureIndex, texCoord).a < material.alphaCutoff;
+}
+
+void CpuRenderer::TraceColor(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    Payload& payload) const {
+    Hit hit;
+    if (Intersect(origin, direction, TMax, Material::AllMask, false, hit)) {
+        ClosestHit(hit, direction, payload);
+    } else {
+        payload.color += GetSkyColor(direction);
+    }
+}
+
+float CpuRenderer::TraceShadow(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float distance) const {
+    Hit hit;
+    return Intersect(origin, direction, distance, Material::OpaqueMask, true, hit) ? 0.0f : 1.0f;
+}
+
+glm::vec3 CpuRenderer::GetSkyColor(const glm::vec3& direction) const {
+    // initSkyShaderParameters and getProceduralSkyColor from proceduralSky.glsl, the miss shader
+    // passes no angular pixel size
+    const glm::vec3 directionToLight = -mSunDirection;
+    const glm::vec3 skyColor(0.17f, 0.37f, 0.65f);
+    const glm::vec3 horizonColor(0.50f, 0.70f, 0.92f);
+    const glm::vec3 groundColor(0.62f, 0.59f, 0.55f);
+    const glm::vec3 directionUp(0.0f, 1.0f, 0.0f);
+    constexpr float angularSizeOfLight = 0.059f;
+    constexpr float horizonSize = 0.5f;
+    constexpr float glowSize = 0.091f;
+    constexpr float glowIntensity = 0.9f;
+    constexpr float glowSharpness = 4.0f;
+
+    const float elevation = std::asin(std::clamp(glm::dot(direction, directionUp), -1.0f, 1.0f));
+    const float top = SmoothStep(0.0f, horizonSize, elevation);
+    const float bottom = SmoothStep(0.0f, horizonSize, -elevation);
+    const glm::vec3 environment =
+        glm::mix(glm::mix(horizonColor, groundColor, bottom), skyColor, top);
+
+    const float angleToLight =
+        std::acos(std::clamp(glm::dot(direction, directionToLight), 0.0f, 1.0f));
+    const float halfAngularSize = angularSizeOfLight * 0.5f;
+    const float lightIntensity = std::pow(
+        std::clamp(1.0f - SmoothStep(halfAngularSize, halfAngularSize, angleToLight), 0.0f, 1.0f),
+        4.0f);
+    const float glowInput = std::clamp(
+        2.0f * (1.0f - SmoothStep(
+                           halfAngularSize - glowSize,
+                           halfAngularSize + glowSize,
+                           angleToLight)),
+        0.0f,
+        1.0f);
+    const float glow = glowIntensity * std::pow(glowInput, glowSharpness);
+    return environment + glm::vec3(std::max(lightIntensity, glow));
+}
+
+glm::vec4 CpuRenderer::Sample(int32_t textureIndex, glm::vec2 texCoord) const {
+    const Texture* texture = mTextures[textureIndex];
+    const std::vector<uint8_t>& pixels = texture->GetHostPixels();
+    if (pixels.empty()) {
+        return glm::vec4(1.0f);
+    }
+    // Bilinear with repeat addressing on the base level, what ray tracing stages sample
+    const int32_t width = static_cast<int32_t>(texture->GetWidth());
+    const int32_t height = static_cast<int32_t>(texture->GetHeight());
+    const glm::vec2 position = texCoord * glm::vec2(width, height) - 0.5f;
+    const glm::vec2 floorPosition = glm::floor(position);
+    const glm::vec2 fraction = position - floorPosition;
+    const auto fetch = [&](int32_t x, int32_t y) {
+        const int32_t wrappedX = ((x % width) + width) % width;
+        const int32_t wrappedY = ((y % height) + height) % height;
+        const uint8_t* texel = &pixels[(static_cast<size_t>(wrappedY) * width + wrappedX) * 4];
+        return glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+    };
+    const int32_t x = static_cast<int32_t>(floorPosition.x);
+    const int32_t y = static_cast<int32_t>(floorPosition.y);
+    return glm::mix(
+        glm::mix(fetch(x, y), fetch(x + 1, y), fraction.x),
+        glm::mix(fetch(x, y + 1), fetch(x + 1, y + 1), fraction.x),
+        fraction.y);
+}
+
+void CpuRenderer::ClosestHit(
+    const Hit& hit,
+    const glm::vec3& rayDirection,
+    Payload& payload) const {
+    // Follows raytrace.rchit line by line, images should match up to filtering differences
+    if (payload.depth > MaxRecursionLevel) {
+        payload.color = glm::vec3(0.0f);
+        return;
+    }
+    payload.depth += 1;
+
+    const Instance& instance = mInstances[hit.instance];
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+    if (instance.mesh == nullptr) {
+        // Back from the texture coordinates to the point on the unit sphere
+        texCoord = hit.barycentrics;
+        const float longitude = (texCoord.x - 0.5f) * 2.0f * Pi;
+        const float colatitude = texCoord.y * Pi;
+        normal = glm::vec3(
+            std::sin(colatitude) * std::cos(longitude),
+            std::cos(colatitude),
+            std::sin(colatitude) * std::sin(longitude));
+        position = normal;
+    } else {
+        const Mesh::Primitive& primitive =
+            instance.mesh->mesh->GetHostPrimitives()[hit.geometry];
+        const glm::uvec3& triangle = primitive.indices[hit.primitive];
+        const Mesh::Vertex& v0 = primitive.vertices[triangle.x];
+        const Mesh::Vertex& v1 = primitive.vertices[triangle.y];
+        const Mesh::Vertex& v2 = primitive.vertices[triangle.z];
+        const glm::vec3 barycentrics(
+            1.0f - hit.barycentrics.x - hit.barycentrics.y,
+            hit.barycentrics.x,
+            hit.barycentrics.y);
+        position = v0.position * barycentrics.x + v1.position * barycentrics.y +
+                   v2.position * barycentrics.z;
+        normal =
+            v0.normal * barycentrics.x + v1.normal * barycentrics.y + v2.normal * barycentrics.z;
+        texCoord = v0.texCoord * barycentrics.x + v1.texCoord * barycentrics.y +
+                   v2.texCoord * barycentrics.z;
+    }
+    const glm::vec3 worldPosition = glm::vec3(instance.objectToWorld * glm::vec4(position, 1.0f));
+
+    const Scene::MaterialProxy& material = mMaterials[instance.firstGeometry + hit.geometry];
+    glm::vec3 albedo = material.albedo;
+    if (material.albedoTextureIndex >= 0) {
+        albedo = glm::vec3(Sample(material.albedoTextureIndex, texCoord));
+    }
+    float roughness = material.roughness;
+    float metallic = material.metallic;
+    if (material.roughnessTextureIndex >= 0) {
+        const glm::vec4 textureSample = Sample(material.roughnessTextureIndex, texCoord);
+        metallic = textureSample.b;
+        roughness = textureSample.g;
+    }
+    const float indexOfRefraction = material.indexOfRefraction;
+
+    const glm::vec3 D = glm::normalize(rayDirection);
+    const glm::vec3 N = glm::normalize(instance.normalMatrix * normal);
+    const glm::vec3 V = -D;
+
+    const glm::vec3 f0 = glm::mix(glm::vec3(0.04f), albedo, metallic);
+    const glm::vec3 diffuseColor = albedo * (1.0f - f0) * (1.0f - metallic);
+    glm::vec3 color(0.0f);
+    if (indexOfRefraction < 0.0f) {
+        color += diffuseColor * AmbientTerm;
+        for (const Light::Proxy& light : mLights) {
+            glm::vec3 L;
+            float lightIntensity = light.intensity;
+            float lightDistance = TMax;
+            if (light.type == Light::Type::Directional) {
+                L = -light.directionOrPosition;
+            } else {
+                L = light.directionOrPosition - worldPosition;
+                lightDistance = glm::length(L);
+                lightIntensity = lightIntensity / (lightDistance * lightDistance);
+                L = L / lightDistance;
+            }
+            const glm::vec3 H = glm::normalize(V + L);
+            const float nDotL = std::max(glm::dot(N, L), 0.0f);
+            if (nDotL > 0.0f) {
+                const float shadowAttenuation = TraceShadow(worldPosition, L, lightDistance);
+                const float NDF = DistributionGGX(N, H, roughness);
+                const float G = GeometrySmith(N, V, L, roughness);
+                const glm::vec3 F = FresnelSchlick(std::max(glm::dot(H, V), 0.0f), f0);
+                const glm::vec3 kD = (glm::vec3(1.0f) - F) * (1.0f - metallic);
+                const float denominator =
+                    4.0f * std::max(glm::dot(N, V), 0.0f) * std::max(glm::dot(N, L), 0.0f) +
+                    0.0001f;
+                const glm::vec3 specular = NDF * G * F / denominator;
+                color += shadowAttenuation * nDotL * lightIntensity *
+                         (kD * diffuseColor / Pi + specular);
+            }
+        }
+    }
+
+    // Secondary rays reuse the payload, the depth they reached carries on like on the GPU
+    if (metallic > 0.0f) {
+        TraceColor(worldPosition, glm::reflect(D, N), payload);
+        color += metallic * (1.0f - roughness) * (1.0f - roughness) * payload.color;
+    } else if (indexOfRefraction > 0.0f) {
+        const float nDotD = glm::dot(N, D);
+        const glm::vec3 refractionNormal = nDotD > 0.0f ? -N : N;
+        const float refractionEta = nDotD > 0.0f ? indexOfRefraction : 1.0f / indexOfRefraction;
+        const float fresnelTerm = Fresnel(D, N, indexOfRefraction);
+        glm::vec3 refractionColor(0.0f);
+        glm::vec3 reflectionColor(0.0f);
+        if (nDotD < 0.0f && fresnelTerm > 0.0f) {
+            TraceColor(worldPosition, glm::reflect(D, N), payload);
+            reflectionColor = payload.color;
+        }
+        if (fresnelTerm < 1.0f) {
+            TraceColor(worldPosition, glm::refract(D, refractionNormal, refractionEta), payload);
+            refractionColor = payload.color;
+        }
+        color += glm::mix(refractionColor, reflectionColor, fresnelTerm);
+    }
+
+    payload.color = color;
+}
+
+void CpuRenderer::RenderTile(
+    uint32_t tileIndex,
+    const glm::mat4& viewInverse,
+    const glm::mat4& projInverse) {
+    const uint32_t tilesX = (mWidth + TileSize - 1) / TileSize;
+    const uint32_t beginX = (tileIndex % tilesX) * TileSize;
+    const uint32_t beginY = (tileIndex / tilesX) * TileSize;
+    const uint32_t endX = std::min(beginX + TileSize, mWidth);
+    const uint32_t endY = std::min(beginY + TileSize, mHeight);
+
+    // Camera rays of raytrace.rgen
+    const glm::vec3 origin = glm::vec3(viewInverse * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    for (uint32_t y = beginY; y < endY; ++y) {
+        for (uint32_t x = beginX; x < endX; ++x) {
+            const glm::vec2 pixelCenter = glm::vec2(x, y) + glm::vec2(0.5f);
+            const glm::vec2 d = pixelCenter / glm::vec2(mWidth, mHeight) * 2.0f - 1.0f;
+            const glm::vec4 target = projInverse * glm::vec4(d.x, d.y, 1.0f, 1.0f);
+            const glm::vec3 direction =
+                glm::vec3(viewInverse * glm::vec4(glm::normalize(glm::vec3(target)), 0.0f));
+
+            Payload payload{.color = glm::vec3(0.0f), .depth = 0};
+            TraceColor(origin, direction, payload);
+            mPixels[y * mWidth + x] = PackColor(payload.color);
+        }
+    }
+}
+
+void CpuRenderer::Render(
+    const glm::mat4& viewInverse,
+    const glm::mat4& projInverse,
+    uint32_t width,
+    uint32_t height) {
+    const auto beginTime = std::chrono::steady_clock::now();
+    mWidth = width;
+    mHeight = height;
+    mPixels.assign(static_cast<size_t>(width) * height, 0);
+    mRayCount = 0;
+
+    // Every worker starts on its own run of neighbouring tiles, which share most BVH nodes. Once
+    // it is through, it steals the remaining tiles of the other runs
+    struct alignas(64) TileRun {
+        std::atomic<uint32_t> next;
+        uint32_t end;
+    };
+    const uint32_t tileCount =
+        ((width + TileSize - 1) / TileSize) * ((height + TileSize - 1) / TileSize);
+    std::vector<TileRun> runs(mThreadCount);
+    for (uint32_t workerIndex = 0; workerIndex < mThreadCount; ++workerIndex) {
+        runs[workerIndex].next = static_cast<uint32_t>(
+            static_cast<uint64_t>(tileCount) * workerIndex / mThreadCount);
+        runs[workerIndex].end = static_cast<uint32_t>(
+            static_cast<uint64_t>(tileCount) * (workerIndex + 1) / mThreadCount);
+    }
+    const auto work = [&](uint32_t workerIndex) {
+        tRayCount = 0;
+        for (uint32_t offset = 0; offset < mThreadCount; ++offset) {
+            TileRun& run = runs[(workerIndex + offset) % mThreadCount];
+            for (uint32_t tile = run.next++; tile < run.end; tile = run.next++) {
+                RenderTile(tile, viewInverse, projInverse);
+            }
+        }
+        mRayCount += tRayCount;
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(mThreadCount - 1);
+    for (uint32_t workerIndex = 1; workerIndex < mThreadCount; ++workerIndex) {
+        workers.emplace_back(work, workerIndex);
+    }
+    work(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    mStatistics.renderMilliseconds =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beginTime)
+            .count();
+    mStatistics.rayCount = mRayCount;
+}
+
+bool CpuRenderer::WriteImage(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        VKRT_LOG("Failed to write " << path);
+        return false;
+    }
+    file << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+    std::vector<uint8_t> rgb;
+    rgb.reserve(mPixels.size() * 3);
+    for (const uint32_t pixel : mPixels) {
+        rgb.push_back(static_cast<uint8_t>(pixel));
+        rgb.push_back(static_cast<uint8_t>(pixel >> 8));
+        rgb.push_back(static_cast<uint8_t>(pixel >> 16));
+    }
+    file.write(reinterpret_cast<const char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+    return static_cast<bool>(file);
+}
+
+CpuRenderer::~CpuRenderer() {}
+
+}  // namespace VKRT
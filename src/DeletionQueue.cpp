@@ -0,0 +1,48 @@
+#include "DeletionQueue.h"
+
+#include "DebugUtils.h"
+
+namespace VKRT {
+
+DeletionQueue::DeletionQueue() : mHead(nullptr) {}
+
+void DeletionQueue::Retire(RefCountPtr* object, uint64_t lastUseValue) {
+    Node* node = new Node{.object = object, .lastUseValue = lastUseValue, .next = nullptr};
+    node->next = mHead.load(std::memory_order_relaxed);
+    while (!mHead.compare_exchange_weak(
+        node->next,
+        node,
+        std::memory_order_release,
+        std::memory_order_relaxed)) {
+    }
+}
+
+void DeletionQueue::Collect(uint64_t completedValue) {
+    for (Node* node = mHead.exchange(nullptr, std::memory_order_acquire); node != nullptr;) {
+        Node* next = node->next;
+        mPending.push_back(node);
+        node = next;
+    }
+
+    // Deleting an object can retire the ones it owns, those are picked up on the next call
+    std::vector<Node*> pending;
+    pending.swap(mPending);
+    for (Node* node : pending) {
+        if (node->lastUseValue <= completedValue) {
+            delete node->object;
+            delete node;
+        } else {
+            mPending.push_back(node);
+        }
+    }
+}
+
+bool DeletionQueue::IsEmpty() const {
+    return mPending.empty() && mHead.load(std::memory_order_acquire) == nullptr;
+}
+
+DeletionQueue::~DeletionQueue() {
+    VKRT_ASSERT_MSG(IsEmpty(), "Deletion queue destroyed with objects still retired");
+}
+
+}  // namespace VKRT
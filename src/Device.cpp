@@ -1,6 +1,8 @@
 #include "Device.h"
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <limits>
 
 #include "DebugUtils.h"
@@ -25,7 +27,18 @@ Device::Device(
     ScopedRefPtr<Instance> instance,
     vk::PhysicalDevice physicalDevice,
     const vk::SurfaceKHR& surface)
-    : mContext(nullptr), mPhysicalDevice(physicalDevice) {
+    : mContext(nullptr),
+      mPhysicalDevice(physicalDevice),
+      mQueueFamilyIndex(0),
+      mSubmittedTimelineValue(0),
+      mCompletedTimelineValue(0),
+      mOpenRecordingCount(0),
+      mRecordingTicket(0),
+      mMemoryProperties(physicalDevice.getMemoryProperties()),
+      mSupportsMemoryBudget(false),
+      mSupportsResizableBar(false),
+      mSupportsHostAccelerationStructureCommands(false),
+      mMemoryTracker(mMemoryProperties.memoryHeapCount) {
     const std::vector<vk::QueueFamilyProperties> queueFamiliesProperties =
         mPhysicalDevice.getQueueFamilyProperties();
     uint32_t queueFamilyIndex = 0;
@@ -49,9 +62,19 @@ Device::Device(
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingFeatures =
         vk::PhysicalDeviceRayTracingPipelineFeaturesKHR().setRayTracingPipeline(true);
 
+    // Host builds are optional, only enabled where the driver implements them
+    {
+        const auto supportedFeatures = mPhysicalDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
+        mSupportsHostAccelerationStructureCommands =
+            supportedFeatures.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>()
+                .accelerationStructureHostCommands == VK_TRUE;
+    }
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures =
         vk::PhysicalDeviceAccelerationStructureFeaturesKHR()
             .setAccelerationStructure(true)
+            .setAccelerationStructureHostCommands(mSupportsHostAccelerationStructureCommands)
             .setPNext(&rayTracingFeatures);
 
     vk::PhysicalDeviceVulkan12Features enabledFeatures12 =
@@ -61,108 +84,568 @@ Device::Device(
             .setDescriptorIndexing(true)
             .setRuntimeDescriptorArray(true)
             .setDescriptorBindingVariableDescriptorCount(true)
+            .setTimelineSemaphore(true)
             .setPNext(&accelerationStructureFeatures);
 
+    std::vector<const char*> enabledExtensions = Instance::sRequiredDeviceExtensions;
+    {
+        const std::vector<vk::ExtensionProperties> deviceExtensions =
+            VKRT_ASSERT_VK(mPhysicalDevice.enumerateDeviceExtensionProperties());
+        mSupportsMemoryBudget =
+            std::find_if(
+                deviceExtensions.begin(),
+                deviceExtensions.end(),
+                [](const vk::ExtensionProperties& presentExtension) {
+                    return std::string(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) ==
+                           std::string(presentExtension.extensionName.data());
+                }) != deviceExtensions.end();
+        if (mSupportsMemoryBudget) {
+            enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+    }
+
     const vk::DeviceCreateInfo deviceCreateInfo =
         vk::DeviceCreateInfo()
             .setQueueCreateInfos(queueCreateInfo)
-            .setPEnabledExtensionNames(Instance::sRequiredDeviceExtensions)
+            .setPEnabledExtensionNames(enabledExtensions)
             .setPEnabledFeatures(&enabledFeatures)
             .setPNext(&enabledFeatures12);
     mLogicalDevice = VKRT_ASSERT_VK(mPhysicalDevice.createDevice(deviceCreateInfo));
 
+    mQueueFamilyIndex = queueFamilyIndex;
     mGraphicsQueue = mLogicalDevice.getQueue(queueFamilyIndex, 0);
 
-    const vk::CommandPoolCreateInfo commandPoolCreateInfo =
-        vk::CommandPoolCreateInfo()
-            .setQueueFamilyIndex(queueFamilyIndex)
-            .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
-    mCommandPool = VKRT_ASSERT_VK(mLogicalDevice.createCommandPool(commandPoolCreateInfo));
-
     mDispatcher = vk::DispatchLoaderDynamic(
         instance->GetHandle(),
         vkGetInstanceProcAddr,
         mLogicalDevice,
         vkGetDeviceProcAddr);
+
+    mMemoryAllocator = std::make_unique<MemoryAllocator>(this, mMemoryProperties);
+
+    vk::SemaphoreTypeCreateInfo timelineCreateInfo =
+        vk::SemaphoreTypeCreateInfo()
+            .setSemaphoreType(vk::SemaphoreType::eTimeline)
+            .setInitialValue(0);
+    mTimelineSemaphore = VKRT_ASSERT_VK(
+        mLogicalDevice.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&timelineCreateInfo)));
+
+    constexpr vk::DeviceSize legacyBarSize = 256 * 1024 * 1024;
+    const vk::MemoryPropertyFlags barFlags =
+        vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible;
+    for (uint32_t memoryIndex = 0; memoryIndex < mMemoryProperties.memoryTypeCount;
+         ++memoryIndex) {
+        const vk::MemoryType& memoryType = mMemoryProperties.memoryTypes[memoryIndex];
+        if ((memoryType.propertyFlags & barFlags) == barFlags &&
+            mMemoryProperties.memoryHeaps[memoryType.heapIndex].size > legacyBarSize) {
+            mSupportsResizableBar = true;
+        }
+    }
 }
 
 void Device::SetContext(ScopedRefPtr<Context> context) {
     mContext = context;
 }
 
-vk::DeviceMemory Device::AllocateMemory(
+static uint64_t GetMemoryId(vk::DeviceMemory memory) {
+    return reinterpret_cast<uint64_t>(static_cast<VkDeviceMemory>(memory));
+}
+
+Device::MemoryUsage Device::GetMemoryUsage(const vk::MemoryPropertyFlags& memoryFlags) {
+    const bool isHostVisible =
+        static_cast<bool>(memoryFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+    const bool isDeviceLocal =
+        static_cast<bool>(memoryFlags & vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (isHostVisible && isDeviceLocal) {
+        return MemoryUsage::DeviceLocalHostVisible;
+    }
+    if (isHostVisible && (memoryFlags & vk::MemoryPropertyFlagBits::eHostCached)) {
+        return MemoryUsage::Readback;
+    }
+    if (isHostVisible) {
+        return MemoryUsage::Upload;
+    }
+    return MemoryUsage::DeviceLocal;
+}
+
+struct MemoryPolicy {
+    vk::MemoryPropertyFlags required;
+    vk::MemoryPropertyFlags preferred;
+    vk::MemoryPropertyFlags avoided;
+};
+
+static MemoryPolicy GetMemoryPolicy(Device::MemoryUsage usage) {
+    // Types we never want unless explicitly asked for
+    const vk::MemoryPropertyFlags unusedFlags = vk::MemoryPropertyFlagBits::eProtected |
+                                                vk::MemoryPropertyFlagBits::eLazilyAllocated |
+                                                vk::MemoryPropertyFlagBits::eDeviceCoherentAMD;
+    switch (usage) {
+        case Device::MemoryUsage::Upload:
+            // Write-combined system memory, keep device local host visible memory (ReBAR) free
+            return MemoryPolicy{
+                .required = vk::MemoryPropertyFlagBits::eHostVisible,
+                .preferred = vk::MemoryPropertyFlagBits::eHostCoherent,
+                .avoided = unusedFlags | vk::MemoryPropertyFlagBits::eHostCached |
+                           vk::MemoryPropertyFlagBits::eDeviceLocal};
+        case Device::MemoryUsage::Readback:
+            return MemoryPolicy{
+                .required = vk::MemoryPropertyFlagBits::eHostVisible,
+                .preferred = vk::MemoryPropertyFlagBits::eHostCached |
+                             vk::MemoryPropertyFlagBits::eHostCoherent,
+                .avoided = unusedFlags | vk::MemoryPropertyFlagBits::eDeviceLocal};
+        case Device::MemoryUsage::DeviceLocal:
+            return MemoryPolicy{
+                .required = vk::MemoryPropertyFlagBits::eDeviceLocal,
+                .preferred = {},
+                .avoided = unusedFlags | vk::MemoryPropertyFlagBits::eHostVisible};
+        case Device::MemoryUsage::DeviceLocalHostVisible:
+            return MemoryPolicy{
+                .required = vk::MemoryPropertyFlagBits::eDeviceLocal |
+                            vk::MemoryPropertyFlagBits::eHostVisible,
+                .preferred = vk::MemoryPropertyFlagBits::eHostCoherent,
+                .avoided = unusedFlags | vk::MemoryPropertyFlagBits::eHostCached};
+    }
+    return MemoryPolicy{};
+}
+
+uint32_t Device::FindMemoryType(
     const vk::MemoryPropertyFlags& memoryFlags,
-    const vk::MemoryRequirements memoryRequirements,
-    const vk::MemoryAllocateFlags& memoryAllocateFlags) {
-    // Find suitable memory to allocate the buffer in
-    const vk::PhysicalDeviceMemoryProperties memoryProperties =
-        mPhysicalDevice.getMemoryProperties();
-    uint32_t selectedMemoryIndex = 0;
-    for (uint32_t memoryIndex = 0; memoryIndex < memoryProperties.memoryTypeCount; ++memoryIndex) {
-        if (memoryRequirements.memoryTypeBits & (1 << memoryIndex) &&
-            (memoryProperties.memoryTypes[memoryIndex].propertyFlags & memoryFlags)) {
+    const vk::MemoryRequirements& memoryRequirements,
+    uint32_t excludedMemoryTypeBits) {
+    MemoryPolicy policy = GetMemoryPolicy(GetMemoryUsage(memoryFlags));
+    // Whatever the caller asks for is mandatory
+    policy.required |= memoryFlags;
+    policy.preferred &= ~policy.required;
+    policy.avoided &= ~policy.required;
+
+    const std::vector<HeapBudget> heapBudgets = GetMemoryBudget();
+    constexpr uint32_t invalidMemoryIndex = std::numeric_limits<uint32_t>::max();
+    uint32_t selectedMemoryIndex = invalidMemoryIndex;
+    int32_t selectedScore = std::numeric_limits<int32_t>::min();
+    for (uint32_t memoryIndex = 0; memoryIndex < mMemoryProperties.memoryTypeCount;
+         ++memoryIndex) {
+        const uint32_t memoryBit = 1u << memoryIndex;
+        if (!(memoryRequirements.memoryTypeBits & memoryBit) ||
+            (excludedMemoryTypeBits & memoryBit)) {
+            continue;
+        }
+        const vk::MemoryType& memoryType = mMemoryProperties.memoryTypes[memoryIndex];
+        if ((memoryType.propertyFlags & policy.required) != policy.required) {
+            continue;
+        }
+
+        const auto preferredCount = std::popcount(
+            static_cast<VkMemoryPropertyFlags>(memoryType.propertyFlags & policy.preferred));
+        const auto avoidedCount = std::popcount(
+            static_cast<VkMemoryPropertyFlags>(memoryType.propertyFlags & policy.avoided));
+        int32_t score = static_cast<int32_t>(preferredCount) * 10 -
+                        static_cast<int32_t>(avoidedCount) * 100;
+
+        // Going over budget makes the driver page memory out, only do it if there is no choice
+        const HeapBudget& heapBudget = heapBudgets[memoryType.heapIndex];
+        if (heapBudget.usage + memoryRequirements.size > heapBudget.budget) {
+            score -= 10000;
+        }
+
+        if (score > selectedScore) {
             selectedMemoryIndex = memoryIndex;
-            break;
+            selectedScore = score;
         }
     }
+    return selectedMemoryIndex;
+}
 
-    // Allocate memory for the buffer
+vk::DeviceMemory Device::AllocateMemory(
+    const vk::MemoryPropertyFlags& memoryFlags,
+    const vk::MemoryRequirements memoryRequirements,
+    const vk::MemoryAllocateFlags& memoryAllocateFlags,
+    const MemoryTag& tag) {
     vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo =
         vk::MemoryAllocateFlagsInfo().setFlags(memoryAllocateFlags);
-    vk::MemoryAllocateInfo allocateInfo = vk::MemoryAllocateInfo()
-                                              .setAllocationSize(memoryRequirements.size)
-                                              .setMemoryTypeIndex(selectedMemoryIndex);
+    vk::MemoryAllocateInfo allocateInfo =
+        vk::MemoryAllocateInfo().setAllocationSize(memoryRequirements.size);
     if (memoryAllocateFlags != vk::MemoryAllocateFlags()) {
         allocateInfo.setPNext(&memoryAllocateFlagsInfo);
     }
-    return VKRT_ASSERT_VK(mLogicalDevice.allocateMemory(allocateInfo));
+
+    // Try the best scoring type first, fall back to the next one if its heap is exhausted
+    uint32_t excludedMemoryTypeBits = 0;
+    uint32_t memoryIndex = FindMemoryType(memoryFlags, memoryRequirements, excludedMemoryTypeBits);
+    while (memoryIndex != std::numeric_limits<uint32_t>::max()) {
+        allocateInfo.setMemoryTypeIndex(memoryIndex);
+        auto [result, memory] = mLogicalDevice.allocateMemory(allocateInfo);
+        if (result == vk::Result::eSuccess) {
+            mMemoryTracker.TrackAllocation(
+                GetMemoryId(memory),
+                MemoryTracker::Allocation{
+                    .memoryTypeIndex = memoryIndex,
+                    .heapIndex = mMemoryProperties.memoryTypes[memoryIndex].heapIndex,
+                    .size = memoryRequirements.size,
+                    .tag = tag});
+            return memory;
+        }
+        VKRT_ASSERT_MSG(
+            result == vk::Result::eErrorOutOfDeviceMemory ||
+                result == vk::Result::eErrorOutOfHostMemory,
+            "Vulkan error " << vk::to_string(result));
+        excludedMemoryTypeBits |= 1u << memoryIndex;
+        memoryIndex = FindMemoryType(memoryFlags, memoryRequirements, excludedMemoryTypeBits);
+    }
+    VKRT_ASSERT_MSG(false, "No memory type can fit an allocation of " << memoryRequirements.size);
+    return nullptr;
+}
+
+void Device::FreeMemory(vk::DeviceMemory memory) {
+    mMemoryTracker.TrackFree(GetMemoryId(memory));
+    mLogicalDevice.freeMemory(memory);
+}
+
+MemoryAllocation Device::AllocateBufferMemory(
+    const vk::MemoryPropertyFlags& memoryFlags,
+    const vk::MemoryRequirements memoryRequirements,
+    const vk::MemoryAllocateFlags& memoryAllocateFlags,
+    const MemoryTag& tag) {
+    // Host visible memory stays dedicated, blocks would have to be persistently mapped to hand out
+    // mapped ranges
+    const uint32_t memoryIndex = FindMemoryType(memoryFlags, memoryRequirements, 0);
+    if (memoryIndex != std::numeric_limits<uint32_t>::max()) {
+        const vk::MemoryType& memoryType = mMemoryProperties.memoryTypes[memoryIndex];
+        MemoryAllocation allocation;
+        if (!(memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) &&
+            mMemoryAllocator->Allocate(memoryIndex, memoryRequirements, allocation)) {
+            mMemoryTracker.TrackAllocation(
+                allocation.trackingId,
+                MemoryTracker::Allocation{
+                    .memoryTypeIndex = memoryIndex,
+                    .heapIndex = memoryType.heapIndex,
+                    .size = memoryRequirements.size,
+                    .tag = tag});
+            return allocation;
+        }
+    }
+
+    const vk::DeviceMemory memory =
+        AllocateMemory(memoryFlags, memoryRequirements, memoryAllocateFlags, tag);
+    MemoryTracker::Allocation trackedAllocation{};
+    mMemoryTracker.FindAllocation(GetMemoryId(memory), trackedAllocation);
+    return MemoryAllocation{
+        .memory = memory,
+        .offset = 0,
+        .size = memoryRequirements.size,
+        .memoryTypeIndex = trackedAllocation.memoryTypeIndex,
+        .trackingId = GetMemoryId(memory)};
+}
+
+void Device::FreeBufferMemory(const MemoryAllocation& allocation) {
+    if (allocation.blockId == MemoryAllocation::DedicatedBlock) {
+        FreeMemory(allocation.memory);
+        return;
+    }
+    mMemoryTracker.TrackFree(allocation.trackingId);
+    mMemoryAllocator->Free(allocation);
+}
+
+bool Device::WriteMemorySnapshot(const std::string& path) const {
+    return mMemoryTracker.WriteSnapshot(path);
+}
+
+std::vector<Device::HeapBudget> Device::GetMemoryBudget() {
+    std::vector<HeapBudget> heapBudgets;
+    heapBudgets.reserve(mMemoryProperties.memoryHeapCount);
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    if (mSupportsMemoryBudget) {
+        auto properties = mPhysicalDevice.getMemoryProperties2<
+            vk::PhysicalDeviceMemoryProperties2,
+            vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        budgetProperties = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    }
+    for (uint32_t heapIndex = 0; heapIndex < mMemoryProperties.memoryHeapCount; ++heapIndex) {
+        const vk::MemoryHeap& heap = mMemoryProperties.memoryHeaps[heapIndex];
+        const MemoryTracker::Counters heapCounters = mMemoryTracker.GetHeapCounters(heapIndex);
+        // The tracker sees buffers, free space in suballocator blocks is committed as well
+        const vk::DeviceSize allocatedBytes =
+            heapCounters.allocatedBytes + mMemoryAllocator->GetUnusedBytes(heapIndex);
+        HeapBudget heapBudget{
+            .size = heap.size,
+            .budget = heap.size,
+            .usage = allocatedBytes,
+            .allocated = allocatedBytes,
+            .isDeviceLocal =
+                static_cast<bool>(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal)};
+        if (mSupportsMemoryBudget) {
+            heapBudget.budget = budgetProperties.heapBudget[heapIndex];
+            heapBudget.usage = budgetProperties.heapUsage[heapIndex];
+        }
+        heapBudgets.push_back(heapBudget);
+    }
+    return heapBudgets;
 }
 
 ScopedRefPtr<VulkanBuffer> Device::CreateBuffer(
     const vk::DeviceSize& size,
     const vk::BufferUsageFlags& usageFlags,
     const vk::MemoryPropertyFlags& memoryFlags,
-    const vk::MemoryAllocateFlags& memoryAllocateFlags) {
+    const vk::MemoryAllocateFlags& memoryAllocateFlags,
+    const MemoryTag& tag) {
     VKRT_ASSERT(mContext != nullptr);
-    return VulkanBuffer::Create(mContext, size, usageFlags, memoryFlags, memoryAllocateFlags);
+    return VulkanBuffer::Create(mContext, size, usageFlags, memoryFlags, memoryAllocateFlags, tag);
+}
+
+ScopedRefPtr<VulkanBuffer> Device::CreateDeviceLocalBuffer(
+    const uint8_t* data,
+    const vk::DeviceSize& size,
+    const vk::BufferUsageFlags& usageFlags,
+    const vk::MemoryAllocateFlags& memoryAllocateFlags,
+    const MemoryTag& tag) {
+    vk::MemoryPropertyFlags memoryFlags = vk::MemoryPropertyFlagBits::eDeviceLocal;
+    if (mSupportsResizableBar) {
+        memoryFlags |= vk::MemoryPropertyFlagBits::eHostVisible;
+    }
+    ScopedRefPtr<VulkanBuffer> buffer = CreateBuffer(
+        size,
+        usageFlags | vk::BufferUsageFlagBits::eTransferDst,
+        memoryFlags,
+        memoryAllocateFlags,
+        tag);
+    UploadToBuffer(buffer, data, size);
+    return buffer;
+}
+
+uint64_t Device::UploadToBuffer(
+    ScopedRefPtr<VulkanBuffer> buffer,
+    const uint8_t* data,
+    const vk::DeviceSize& size,
+    const vk::DeviceSize& offset) {
+    VKRT_ASSERT(offset + size <= buffer->GetBufferSize());
+    if (buffer->IsHostVisible()) {
+        uint8_t* bufferData = buffer->MapBuffer();
+        std::copy_n(data, size, bufferData + offset);
+        buffer->FlushBuffer();
+        buffer->UnmapBuffer();
+        return 0;
+    }
+
+    ScopedRefPtr<VulkanBuffer> stagingBuffer = CreateBuffer(
+        size,
+        vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        {},
+        {MemoryCategory::Staging, "Device upload"});
+    uint8_t* stagingData = stagingBuffer->MapBuffer();
+    std::copy_n(data, size, stagingData);
+    stagingBuffer->FlushBuffer();
+    stagingBuffer->UnmapBuffer();
+
+    vk::CommandBuffer commandBuffer = CreateCommandBuffer();
+    VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
+    const vk::BufferCopy copyRegion =
+        vk::BufferCopy().setSrcOffset(0).setDstOffset(offset).setSize(size);
+    commandBuffer.copyBuffer(
+        stagingBuffer->GetBufferHandle(),
+        buffer->GetBufferHandle(),
+        copyRegion);
+    const vk::MemoryBarrier barrier = vk::MemoryBarrier()
+                                          .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                          .setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eAllCommands,
+        {},
+        barrier,
+        {},
+        {});
+    VKRT_ASSERT_VK(commandBuffer.end());
+    const uint64_t ticket = SubmitCommand(commandBuffer);
+    DestroyCommand(commandBuffer);
+    // The staging buffer goes once the copy completed, earlier ones may be done already
+    CollectRetired();
+    return ticket;
+}
+
+Device::CommandPool& Device::GetThreadCommandPool() {
+    std::lock_guard<std::mutex> lock(mCommandPoolMutex);
+    auto [entry, inserted] = mCommandPools.try_emplace(std::this_thread::get_id());
+    if (inserted) {
+        const vk::CommandPoolCreateInfo commandPoolCreateInfo =
+            vk::CommandPoolCreateInfo()
+                .setQueueFamilyIndex(mQueueFamilyIndex)
+                .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+        entry->second.pool =
+            VKRT_ASSERT_VK(mLogicalDevice.createCommandPool(commandPoolCreateInfo));
+    }
+    return entry->second;
 }
 
 vk::CommandBuffer Device::CreateCommandBuffer() {
+    CommandPool& commandPool = GetThreadCommandPool();
+    // Beginning it again resets it, the pool allows resetting single command buffers
+    if (!commandPool.recycled.empty() && IsComplete(commandPool.recycled.front().ticket)) {
+        const vk::CommandBuffer commandBuffer = commandPool.recycled.front().commandBuffer;
+        commandPool.recycled.pop_front();
+        return commandBuffer;
+    }
     vk::CommandBufferAllocateInfo commandInfo = vk::CommandBufferAllocateInfo()
                                                     .setCommandBufferCount(1)
-                                                    .setCommandPool(mCommandPool)
+                                                    .setCommandPool(commandPool.pool)
                                                     .setLevel(vk::CommandBufferLevel::ePrimary);
     return VKRT_ASSERT_VK(mLogicalDevice.allocateCommandBuffers(commandInfo))[0];
 }
 
-void Device::SubmitCommand(const vk::CommandBuffer& commandBuffer, const vk::Fence& fence) {
-    const vk::SubmitInfo submitInfo = vk::SubmitInfo().setCommandBuffers(commandBuffer);
-    VKRT_ASSERT_VK(mGraphicsQueue.submit(submitInfo, fence));
+void Device::DestroyCommand(vk::CommandBuffer& commandBuffer) {
+    // Any submission it was part of came before this call
+    GetThreadCommandPool().recycled.push_back(RecycledCommandBuffer{
+        .commandBuffer = commandBuffer,
+        .ticket = mSubmittedTimelineValue});
+}
+
+uint64_t Device::Submit(const vk::SubmitInfo& submitInfo) {
+    std::lock_guard<std::mutex> lock(mSubmitMutex);
+    const uint64_t timelineValue = mSubmittedTimelineValue + 1;
+
+    // Submitted every frame, stays off the heap
+    const uint32_t signalCount = submitInfo.signalSemaphoreCount + 1;
+    VKRT_ASSERT(signalCount <= MaxSubmitSemaphores);
+    VKRT_ASSERT(submitInfo.waitSemaphoreCount <= MaxSubmitSemaphores);
+    std::array<vk::Semaphore, MaxSubmitSemaphores> signalSemaphores;
+    std::copy_n(
+        submitInfo.pSignalSemaphores,
+        submitInfo.signalSemaphoreCount,
+        signalSemaphores.begin());
+    signalSemaphores[signalCount - 1] = mTimelineSemaphore;
+    // Values of binary semaphores are ignored
+    std::array<uint64_t, MaxSubmitSemaphores> signalValues{};
+    signalValues[signalCount - 1] = timelineValue;
+    const std::array<uint64_t, MaxSubmitSemaphores> waitValues{};
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo =
+        vk::TimelineSemaphoreSubmitInfo()
+            .setWaitSemaphoreValueCount(submitInfo.waitSemaphoreCount)
+            .setPWaitSemaphoreValues(waitValues.data())
+            .setSignalSemaphoreValueCount(signalCount)
+            .setPSignalSemaphoreValues(signalValues.data());
+
+    // Chained in front of whatever the caller passes
+    timelineSubmitInfo.setPNext(submitInfo.pNext);
+    vk::SubmitInfo timelineSubmit = submitInfo;
+    timelineSubmit.setSignalSemaphoreCount(signalCount)
+        .setPSignalSemaphores(signalSemaphores.data())
+        .setPNext(&timelineSubmitInfo);
+    VKRT_ASSERT_VK(mGraphicsQueue.submit(timelineSubmit, nullptr));
+    mSubmittedTimelineValue = timelineValue;
+    return timelineValue;
+}
+
+uint64_t Device::SubmitCommand(const vk::CommandBuffer& commandBuffer) {
+    return Submit(vk::SubmitInfo().setCommandBuffers(commandBuffer));
 }
 
 void Device::SubmitCommandAndFlush(const vk::CommandBuffer& commandBuffer) {
-    vk::Fence fence = CreateFence();
-    SubmitCommand(commandBuffer, fence);
-    WaitForFence(fence);
-    DestroyFence(fence);
+    Wait(SubmitCommand(commandBuffer));
+    CollectRetired();
 }
 
-void Device::DestroyCommand(vk::CommandBuffer& commandBuffer) {
-    mLogicalDevice.freeCommandBuffers(mCommandPool, commandBuffer);
+bool Device::IsComplete(uint64_t ticket) {
+    return ticket <= mCompletedTimelineValue || ticket <= GetCompletedTimelineValue();
 }
 
-vk::Fence Device::CreateFence() {
-    const vk::FenceCreateInfo fenceInfo = vk::FenceCreateInfo();
-    return VKRT_ASSERT_VK(mLogicalDevice.createFence(fenceInfo));
+void Device::Wait(uint64_t ticket) {
+    if (IsComplete(ticket)) {
+        return;
+    }
+    VKRT_ASSERT(ticket <= mSubmittedTimelineValue);
+    const vk::SemaphoreWaitInfo waitInfo =
+        vk::SemaphoreWaitInfo().setSemaphores(mTimelineSemaphore).setValues(ticket);
+    VKRT_ASSERT_VK(mLogicalDevice.waitSemaphores(waitInfo, std::numeric_limits<uint64_t>::max()));
+    UpdateCompletedTimelineValue(ticket);
 }
 
-void Device::WaitForFence(vk::Fence& fence) {
-    VKRT_ASSERT_VK(
-        mLogicalDevice.waitForFences(fence, true, (std::numeric_limits<uint64_t>::max)()));
+uint64_t Device::GetCompletedTimelineValue() {
+    const uint64_t completedValue =
+        VKRT_ASSERT_VK(mLogicalDevice.getSemaphoreCounterValue(mTimelineSemaphore));
+    UpdateCompletedTimelineValue(completedValue);
+    return completedValue;
 }
 
-void Device::DestroyFence(vk::Fence& fence) {
-    mLogicalDevice.destroyFence(fence);
+void Device::UpdateCompletedTimelineValue(uint64_t value) {
+    // Other threads may have seen a later value meanwhile
+    uint64_t knownValue = mCompletedTimelineValue;
+    while (knownValue < value &&
+           !mCompletedTimelineValue.compare_exchange_weak(knownValue, value)) {
+    }
+}
+
+void Device::BeginRecording() {
+    std::lock_guard<std::mutex> lock(mRecordingMutex);
+    ++mOpenRecordingCount;
+}
+
+void Device::EndRecording(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(mRecordingMutex);
+    VKRT_ASSERT(mOpenRecordingCount > 0);
+    mRecordingTicket = std::max(mRecordingTicket, ticket);
+    if (--mOpenRecordingCount > 0) {
+        return;
+    }
+    for (RefCountPtr* object : mRecordingRetired) {
+        mDeletionQueue.Retire(object, mRecordingTicket);
+    }
+    mRecordingRetired.clear();
+    mRecordingTicket = 0;
+}
+
+void Device::Retire(RefCountPtr* object) {
+    std::lock_guard<std::mutex> lock(mRecordingMutex);
+    if (mOpenRecordingCount > 0) {
+        mRecordingRetired.push_back(object);
+        return;
+    }
+    // Whoever submitted work using it still held a reference then
+    mDeletionQueue.Retire(object, mSubmittedTimelineValue);
+}
+
+// Owns the handle so it goes through the deletion queue like any other object
+class RetiredAccelerationStructure : public RefCountPtr {
+public:
+    RetiredAccelerationStructure(
+        Device* device,
+        vk::AccelerationStructureKHR accelerationStructure)
+        : mDevice(device), mAccelerationStructure(accelerationStructure) {}
+
+protected:
+    ~RetiredAccelerationStructure() override {
+        mDevice->GetLogicalDevice().destroyAccelerationStructureKHR(
+            mAccelerationStructure,
+            nullptr,
+            mDevice->GetDispatcher());
+    }
+
+private:
+    Device* mDevice;
+    vk::AccelerationStructureKHR mAccelerationStructure;
+};
+
+void Device::RetireAccelerationStructure(vk::AccelerationStructureKHR accelerationStructure) {
+    if (accelerationStructure) {
+        Retire(new RetiredAccelerationStructure(this, accelerationStructure));
+    }
+}
+
+void Device::CollectRetired() {
+    mDeletionQueue.Collect(GetCompletedTimelineValue());
+}
+
+void Device::FlushRetired() {
+    VKRT_ASSERT_VK(mLogicalDevice.waitIdle());
+    UpdateCompletedTimelineValue(mSubmittedTimelineValue);
+    {
+        std::lock_guard<std::mutex> lock(mRecordingMutex);
+        for (RefCountPtr* object : mRecordingRetired) {
+            mDeletionQueue.Retire(object, 0);
+        }
+        mRecordingRetired.clear();
+    }
+    while (!mDeletionQueue.IsEmpty()) {
+        mDeletionQueue.Collect(std::numeric_limits<uint64_t>::max());
+    }
 }
 
 Device::SwapchainCapabilities Device::GetSwapchainCapabilities(vk::SurfaceKHR surface) {
@@ -178,6 +661,13 @@ vk::PhysicalDeviceProperties Device::GetDeviceProperties() {
     return mPhysicalDevice.getProperties();
 }
 
+uint64_t Device::GetTimestampMask() {
+    const uint32_t validBits =
+        mPhysicalDevice.getQueueFamilyProperties()[mQueueFamilyIndex].timestampValidBits;
+    VKRT_ASSERT_MSG(validBits > 0, "The queue doesn't support timestamps");
+    return validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+}
+
 vk::PhysicalDeviceRayTracingPipelinePropertiesKHR Device::GetRayTracingProperties() {
     auto result = mPhysicalDevice.getProperties2<
         vk::PhysicalDeviceProperties2,
@@ -185,8 +675,21 @@ vk::PhysicalDeviceRayTracingPipelinePropertiesKHR Device::GetRayTracingPropertie
     return result.get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
 }
 
+vk::PhysicalDeviceAccelerationStructurePropertiesKHR Device::GetAccelerationStructureProperties() {
+    auto result = mPhysicalDevice.getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+    return result.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
+}
+
 Device::~Device() {
-    mLogicalDevice.destroyCommandPool(mCommandPool);
+    FlushRetired();
+    mMemoryAllocator.reset();
+    mLogicalDevice.destroySemaphore(mTimelineSemaphore);
+    // Frees the command buffers still allocated from them
+    for (auto& [threadId, commandPool] : mCommandPools) {
+        mLogicalDevice.destroyCommandPool(commandPool.pool);
+    }
     mLogicalDevice.destroy();
 }
 
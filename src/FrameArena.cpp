@@ -0,0 +1,52 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+
+namespace VKRT {
+
+FrameArena::FrameArena(size_t capacity) : mCurrentChunk(0), mOffset(0), mUsedBytes(0) {
+    mChunks.push_back(Chunk{.data = std::make_unique<uint8_t[]>(capacity), .size = capacity});
+}
+
+void* FrameArena::AllocateBytes(size_t size, size_t alignment) {
+    while (true) {
+        Chunk& chunk = mChunks[mCurrentChunk];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data.get());
+        const uintptr_t aligned = (base + mOffset + alignment - 1) / alignment * alignment;
+        const size_t alignedOffset = static_cast<size_t>(aligned - base);
+        if (alignedOffset + size <= chunk.size) {
+            mUsedBytes += alignedOffset + size - mOffset;
+            mOffset = alignedOffset + size;
+            return chunk.data.get() + alignedOffset;
+        }
+
+        ++mCurrentChunk;
+        mOffset = 0;
+        if (mCurrentChunk == mChunks.size()) {
+            const size_t chunkSize = std::max(chunk.size * 2, size + alignment);
+            mChunks.push_back(
+                Chunk{.data = std::make_unique<uint8_t[]>(chunkSize), .size = chunkSize});
+        }
+    }
+}
+
+void FrameArena::Reset() {
+    if (mChunks.size() > 1) {
+        const size_t capacity = GetCapacity();
+        mChunks.clear();
+        mChunks.push_back(Chunk{.data = std::make_unique<uint8_t[]>(capacity), .size = capacity});
+    }
+    mCurrentChunk = 0;
+    mOffset = 0;
+    mUsedBytes = 0;
+}
+
+size_t FrameArena::GetCapacity() const {
+    size_t capacity = 0;
+    for (const Chunk& chunk : mChunks) {
+        capacity += chunk.size;
+    }
+    return capacity;
+}
+
+}  // namespace VKRT
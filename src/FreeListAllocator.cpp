@@ -0,0 +1,87 @@
+#include "FreeListAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "DebugUtils.h"
+
+namespace VKRT {
+
+FreeListAllocator::FreeListAllocator(uint64_t size) : mSize(size), mFreeSize(size) {
+    if (size > 0) {
+        mFreeRanges.emplace(0, size);
+    }
+}
+
+uint64_t FreeListAllocator::Allocate(uint64_t size, uint64_t alignment) {
+    if (size == 0 || alignment == 0) {
+        return InvalidOffset;
+    }
+    for (auto it = mFreeRanges.begin(); it != mFreeRanges.end(); ++it) {
+        const uint64_t rangeOffset = it->first;
+        const uint64_t rangeSize = it->second;
+        const uint64_t alignedOffset = (rangeOffset + alignment - 1) / alignment * alignment;
+        const uint64_t padding = alignedOffset - rangeOffset;
+        if (padding + size > rangeSize) {
+            continue;
+        }
+
+        mFreeRanges.erase(it);
+        if (padding > 0) {
+            mFreeRanges.emplace(rangeOffset, padding);
+        }
+        const uint64_t remainingSize = rangeSize - padding - size;
+        if (remainingSize > 0) {
+            mFreeRanges.emplace(alignedOffset + size, remainingSize);
+        }
+        mFreeSize -= size;
+        return alignedOffset;
+    }
+    return InvalidOffset;
+}
+
+void FreeListAllocator::Free(uint64_t offset, uint64_t size) {
+    VKRT_ASSERT(offset + size <= mSize);
+    if (size == 0) {
+        return;
+    }
+    mFreeSize += size;
+
+    auto next = mFreeRanges.lower_bound(offset);
+    if (next != mFreeRanges.begin()) {
+        auto previous = std::prev(next);
+        VKRT_ASSERT(previous->first + previous->second <= offset);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            mFreeRanges.erase(previous);
+        }
+    }
+    if (next != mFreeRanges.end()) {
+        VKRT_ASSERT(offset + size <= next->first);
+        if (offset + size == next->first) {
+            size += next->second;
+            mFreeRanges.erase(next);
+        }
+    }
+    mFreeRanges.emplace(offset, size);
+}
+
+void FreeListAllocator::Grow(uint64_t newSize) {
+    if (newSize <= mSize) {
+        return;
+    }
+    const uint64_t oldSize = mSize;
+    mSize = newSize;
+    Free(oldSize, newSize - oldSize);
+}
+
+uint64_t FreeListAllocator::GetLargestFreeRange() const {
+    uint64_t largestRange = 0;
+    for (const auto& range : mFreeRanges) {
+        largestRange = std::max(largestRange, range.second);
+    }
+    return largestRange;
+}
+
+}  // namespace VKRT
@@ -0,0 +1,138 @@
+#include "GeometryPool.h"
+
+#include <algorithm>
+
+#include "Context.h"
+#include "DebugUtils.h"
+#include "Mesh.h"
+
+namespace VKRT {
+
+static constexpr uint32_t InitialVertexCapacity = 1 << 20;
+static constexpr uint32_t InitialTriangleCapacity = 1 << 20;
+
+GeometryPool::GeometryPool(ScopedRefPtr<Context> context) : mContext(context) {
+    CreatePool(mVertices, sizeof(Mesh::Vertex), InitialVertexCapacity);
+    CreatePool(mIndices, sizeof(glm::uvec3), InitialTriangleCapacity);
+}
+
+void GeometryPool::CreatePool(Pool& pool, vk::DeviceSize elementSize, uint32_t capacity) {
+    pool.elementSize = elementSize;
+    pool.allocator = FreeListAllocator(capacity);
+    pool.buffer = mContext->GetDevice()->CreateBuffer(
+        elementSize * capacity,
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst |
+            vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::Geometry, "Geometry pool"});
+}
+
+GeometryPool::Allocation GeometryPool::Allocate(
+    const uint8_t* vertexData,
+    uint32_t vertexCount,
+    const glm::uvec3* triangles,
+    uint32_t triangleCount) {
+    return Allocation{
+        .vertexOffset = AllocateFromPool(mVertices, vertexData, vertexCount),
+        .vertexCount = vertexCount,
+        .triangleOffset = AllocateFromPool(
+            mIndices,
+            reinterpret_cast<const uint8_t*>(triangles),
+            triangleCount),
+        .triangleCount = triangleCount};
+}
+
+uint32_t GeometryPool::AllocateFromPool(Pool& pool, const uint8_t* data, uint32_t elementCount) {
+    uint64_t offset = pool.allocator.Allocate(elementCount);
+    if (offset == FreeListAllocator::InvalidOffset) {
+        GrowPool(pool, static_cast<uint32_t>(pool.allocator.GetSize()) + elementCount);
+        offset = pool.allocator.Allocate(elementCount);
+    }
+    VKRT_ASSERT(offset != FreeListAllocator::InvalidOffset);
+    mContext->GetDevice()->UploadToBuffer(
+        pool.buffer,
+        data,
+        pool.elementSize * elementCount,
+        pool.elementSize * offset);
+    return static_cast<uint32_t>(offset);
+}
+
+void GeometryPool::GrowPool(Pool& pool, uint32_t minimumCapacity) {
+    const uint32_t oldCapacity = static_cast<uint32_t>(pool.allocator.GetSize());
+    const uint32_t newCapacity = std::max(oldCapacity * 2, minimumCapacity);
+    ScopedRefPtr<VulkanBuffer> oldBuffer = pool.buffer;
+    FreeListAllocator allocator = pool.allocator;
+    CreatePool(pool, pool.elementSize, newCapacity);
+    allocator.Grow(newCapacity);
+    pool.allocator = allocator;
+
+    // Offsets stay valid, only the backing buffer changes
+    vk::CommandBuffer commandBuffer = mContext->GetDevice()->CreateCommandBuffer();
+    VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
+    const vk::BufferCopy copyRegion =
+        vk::BufferCopy().setSrcOffset(0).setDstOffset(0).setSize(oldBuffer->GetBufferSize());
+    commandBuffer.copyBuffer(
+        oldBuffer->GetBufferHandle(),
+        pool.buffer->GetBufferHandle(),
+        copyRegion);
+    const vk::MemoryBarrier barrier = vk::MemoryBarrier()
+                                          .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                          .setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eAllCommands,
+        {},
+        barrier,
+        {},
+        {});
+    VKRT_ASSERT_VK(commandBuffer.end());
+    // The old buffer is retired past the copy, nothing to wait for
+    mContext->GetDevice()->SubmitCommand(commandBuffer);
+    mContext->GetDevice()->DestroyCommand(commandBuffer);
+}
+
+void GeometryPool::Free(const Allocation& allocation) {
+    mVertices.allocator.Free(allocation.vertexOffset, allocation.vertexCount);
+    mIndices.allocator.Free(allocation.triangleOffset, allocation.triangleCount);
+}
+
+// Holds the ranges back from the allocator while they go through the deletion queue
+class RetiredAllocation : public RefCountPtr {
+public:
+    RetiredAllocation(GeometryPool* pool, const GeometryPool::Allocation& allocation)
+        : mPool(pool), mAllocation(allocation) {}
+
+protected:
+    ~RetiredAllocation() override { mPool->Free(mAllocation); }
+
+private:
+    ScopedRefPtr<GeometryPool> mPool;
+    GeometryPool::Allocation mAllocation;
+};
+
+void GeometryPool::Retire(const Allocation& allocation) {
+    mContext->GetDevice()->Retire(new RetiredAllocation(this, allocation));
+}
+
+uint32_t GeometryPool::AllocateVertices(const uint8_t* vertexData, uint32_t vertexCount) {
+    return AllocateFromPool(mVertices, vertexData, vertexCount);
+}
+
+void GeometryPool::FreeVertices(uint32_t vertexOffset, uint32_t vertexCount) {
+    mVertices.allocator.Free(vertexOffset, vertexCount);
+}
+
+vk::DeviceAddress GeometryPool::GetVertexAddress(uint32_t vertexOffset) {
+    return mVertices.buffer->GetDeviceAddress() + mVertices.elementSize * vertexOffset;
+}
+
+vk::DeviceAddress GeometryPool::GetIndexAddress(uint32_t triangleOffset) {
+    return mIndices.buffer->GetDeviceAddress() + mIndices.elementSize * triangleOffset;
+}
+
+GeometryPool::~GeometryPool() {}
+
+}  // namespace VKRT
@@ -0,0 +1,401 @@
+#include "HostBLASBuilder.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Context.h"
+#include "DebugUtils.h"
+
+namespace VKRT {
+
+HostBLASBuilder::HostBLASBuilder(ScopedRefPtr<Context> context)
+    : mContext(context),
+      mEnabled(false),
+      mStopping(false),
+      mOperation(nullptr),
+      mOperationGeneration(0),
+      mJoiningCount(0),
+      mBatchBuilding(false),
+      mMilliseconds(0.0),
+      mBuildCount(0),
+      mTriangleCount(0) {}
+
+void HostBLASBuilder::SetEnabled(bool enabled) {
+    enabled = enabled && mContext->GetDevice()->SupportsHostAccelerationStructureCommands();
+    if (enabled == mEnabled) {
+        return;
+    }
+    VKRT_ASSERT_MSG(mRequests.empty(), "Host BLAS builds are still pending");
+    mEnabled = enabled;
+    if (mEnabled) {
+        StartWorkers();
+    } else {
+        StopWorkers();
+    }
+}
+
+void HostBLASBuilder::Enqueue(Mesh* mesh, const std::vector<Mesh::Primitive>& primitives) {
+    VKRT_ASSERT(mEnabled);
+    std::unique_ptr<Request> request = std::make_unique<Request>();
+    request->mesh = mesh;
+    request->stage = Stage::Build;
+    request->name = mesh->GetName();
+    request->triangleCount = mesh->GetTriangleCount();
+    request->cacheKey = mesh->mCacheKey;
+    request->primitives = primitives;
+
+    // Sized and created here, the workers only run host commands on them
+    std::vector<uint32_t> triangleCounts;
+    for (const Mesh::Primitive& primitive : request->primitives) {
+        const uint32_t triangleCount = static_cast<uint32_t>(primitive.indices.size());
+        request->geometries.push_back(Mesh::MakeBuildGeometry(
+            vk::DeviceOrHostAddressConstKHR().setHostAddress(primitive.vertices.data()),
+            vk::DeviceOrHostAddressConstKHR().setHostAddress(primitive.indices.data()),
+            static_cast<uint32_t>(primitive.vertices.size()),
+            primitive.alphaTested));
+        request->ranges.push_back(
+            vk::AccelerationStructureBuildRangeInfoKHR().setPrimitiveCount(triangleCount));
+        triangleCounts.push_back(triangleCount);
+    }
+    request->buildInfo = vk::AccelerationStructureBuildGeometryInfoKHR()
+                             .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+                             .setFlags(mesh->mBuildFlags)
+                             .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+                             .setGeometries(request->geometries);
+    // Host and device structures can differ in size, ask for the host one
+    const vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo =
+        mContext->GetDevice()->GetLogicalDevice().getAccelerationStructureBuildSizesKHR(
+            vk::AccelerationStructureBuildTypeKHR::eHost,
+            request->buildInfo,
+            triangleCounts,
+            mContext->GetDevice()->GetDispatcher());
+    request->structure = CreateHostStructure(
+        buildSizesInfo.accelerationStructureSize,
+        request->name,
+        request->buffer);
+    request->scratch.resize(buildSizesInfo.buildScratchSize);
+    request->buildInfo.setDstAccelerationStructure(request->structure)
+        .setScratchData(vk::DeviceOrHostAddressKHR().setHostAddress(request->scratch.data()));
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.push_back(std::move(request));
+    }
+    mCondition.notify_all();
+}
+
+bool HostBLASBuilder::HasPendingBuilds() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return !mRequests.empty();
+}
+
+void HostBLASBuilder::Cancel(Mesh* mesh) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (std::unique_ptr<Request>& request : mRequests) {
+        if (request->mesh == mesh) {
+            request->mesh = nullptr;
+        }
+    }
+}
+
+vk::AccelerationStructureKHR HostBLASBuilder::CreateHostStructure(
+    vk::DeviceSize size,
+    const std::string& name,
+    ScopedRefPtr<VulkanBuffer>& buffer) {
+    buffer = mContext->GetDevice()->CreateBuffer(
+        size,
+        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        {},
+        {MemoryCategory::Staging, name});
+    vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
+        vk::AccelerationStructureCreateInfoKHR()
+            .setBuffer(buffer->GetBufferHandle())
+            .setSize(size)
+            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel);
+    return VKRT_ASSERT_VK(mContext->GetDevice()->GetLogicalDevice().createAccelerationStructureKHR(
+        accelerationStructureCreateInfo,
+        nullptr,
+        mContext->GetDevice()->GetDispatcher()));
+}
+
+void HostBLASBuilder::DestroyHostStructures(Request& request) {
+    // Never used by the device, released right away
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::DispatchLoaderDynamic& dispatcher = mContext->GetDevice()->GetDispatcher();
+    if (request.compacted) {
+        logicalDevice.destroyAccelerationStructureKHR(request.compacted, nullptr, dispatcher);
+    }
+    logicalDevice.destroyAccelerationStructureKHR(request.structure, nullptr, dispatcher);
+    request.compacted = nullptr;
+    request.structure = nullptr;
+    request.compactedBuffer = nullptr;
+    request.buffer = nullptr;
+}
+
+bool HostBLASBuilder::HasCollectableRequests() const {
+    return std::any_of(
+        mRequests.begin(),
+        mRequests.end(),
+        [](const std::unique_ptr<Request>& request) {
+            return request->stage == Stage::Built || request->stage == Stage::Serialized;
+        });
+}
+
+void HostBLASBuilder::Collect() {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::DispatchLoaderDynamic& dispatcher = mContext->GetDevice()->GetDispatcher();
+    BLASCache* cache = mContext->GetBLASCache();
+    bool hasWork = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::erase_if(mRequests, [&](std::unique_ptr<Request>& request) {
+            Mesh* mesh = request->mesh;
+            if (request->stage == Stage::Built && mesh != nullptr) {
+                // Static meshes are compacted like the device built ones, the copy is sized here
+                vk::DeviceSize compactedSize = 0;
+                VKRT_ASSERT_VK(logicalDevice.writeAccelerationStructuresPropertiesKHR(
+                    1,
+                    &request->structure,
+                    vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+                    sizeof(compactedSize),
+                    &compactedSize,
+                    sizeof(compactedSize),
+                    dispatcher));
+                request->compacted =
+                    CreateHostStructure(compactedSize, request->name, request->compactedBuffer);
+                request->stage = Stage::Serialize;
+                hasWork = true;
+                return false;
+            }
+            if (request->stage != Stage::Built && request->stage != Stage::Serialized) {
+                return false;
+            }
+            if (mesh == nullptr) {
+                DestroyHostStructures(*request);
+                return true;
+            }
+
+            mesh->mCompactionSavedBytes =
+                request->buffer->GetBufferSize() - request->compactedBuffer->GetBufferSize();
+            DestroyHostStructures(*request);
+            mesh->CreateBLAS(BLASCache::GetDeserializedSize(request->serialized));
+            // Written to disk by the worker already
+            mesh->mCacheKey = BLASCache::NoKey;
+            cache->EnqueueLoad(mesh, std::move(request->serialized));
+            ++mBuildCount;
+            mTriangleCount += request->triangleCount;
+            return true;
+        });
+    }
+    if (hasWork) {
+        mCondition.notify_all();
+    }
+}
+
+void HostBLASBuilder::Wait() {
+    while (HasPendingBuilds()) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return HasCollectableRequests(); });
+        }
+        Collect();
+    }
+}
+
+double HostBLASBuilder::GetMilliseconds() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMilliseconds;
+}
+
+void HostBLASBuilder::StartWorkers() {
+    // Every worker joins the deferred builds, the render thread never does
+    const uint32_t threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    mStopping = false;
+    for (uint32_t workerIndex = 0; workerIndex < threadCount; ++workerIndex) {
+        mWorkers.emplace_back([this]() { RunWorker(); });
+    }
+}
+
+void HostBLASBuilder::StopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+    mWorkers.clear();
+}
+
+void HostBLASBuilder::RunWorker() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    uint64_t joinedGeneration = 0;
+    std::vector<Request*> batch;
+    while (!mStopping) {
+        if (mOperation && joinedGeneration != mOperationGeneration) {
+            joinedGeneration = mOperationGeneration;
+            const vk::DeferredOperationKHR operation = mOperation;
+            ++mJoiningCount;
+            lock.unlock();
+            JoinDeferred(operation);
+            lock.lock();
+            --mJoiningCount;
+            mCondition.notify_all();
+            continue;
+        }
+
+        // Everything waiting goes into one deferred operation, one batch at a time
+        batch.clear();
+        if (!mBatchBuilding) {
+            for (std::unique_ptr<Request>& request : mRequests) {
+                if (request->stage != Stage::Build) {
+                    continue;
+                }
+                if (request->mesh == nullptr) {
+                    request->stage = Stage::Serialized;
+                    continue;
+                }
+                request->stage = Stage::Building;
+                batch.push_back(request.get());
+            }
+        }
+        if (!batch.empty()) {
+            mBatchBuilding = true;
+            BuildDeferred(lock, batch);
+            for (Request* request : batch) {
+                request->stage = Stage::Built;
+            }
+            mBatchBuilding = false;
+            mCondition.notify_all();
+            continue;
+        }
+
+        const auto serialize = std::find_if(
+            mRequests.begin(),
+            mRequests.end(),
+            [](const std::unique_ptr<Request>& request) {
+                return request->stage == Stage::Serialize;
+            });
+        if (serialize != mRequests.end()) {
+            Request& request = **serialize;
+            request.stage = Stage::Serializing;
+            lock.unlock();
+            const auto beginTime = std::chrono::steady_clock::now();
+            Serialize(request);
+            const double milliseconds = std::chrono::duration<double, std::milli>(
+                                            std::chrono::steady_clock::now() - beginTime)
+                                            .count();
+            lock.lock();
+            mMilliseconds += milliseconds;
+            request.stage = Stage::Serialized;
+            mCondition.notify_all();
+            continue;
+        }
+
+        mCondition.wait(lock);
+    }
+}
+
+void HostBLASBuilder::BuildDeferred(
+    std::unique_lock<std::mutex>& lock,
+    const std::vector<Request*>& batch) {
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildInfos;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> rangePointers;
+    for (const Request* request : batch) {
+        buildInfos.push_back(request->buildInfo);
+        rangePointers.push_back(request->ranges.data());
+    }
+    lock.unlock();
+    const auto beginTime = std::chrono::steady_clock::now();
+
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::DispatchLoaderDynamic& dispatcher = mContext->GetDevice()->GetDispatcher();
+    const vk::DeferredOperationKHR operation =
+        VKRT_ASSERT_VK(logicalDevice.createDeferredOperationKHR(nullptr, dispatcher));
+    vk::Result result = logicalDevice.buildAccelerationStructuresKHR(
+        operation,
+        static_cast<uint32_t>(buildInfos.size()),
+        buildInfos.data(),
+        rangePointers.data(),
+        dispatcher);
+    if (result == vk::Result::eOperationDeferredKHR) {
+        lock.lock();
+        mOperation = operation;
+        ++mOperationGeneration;
+        lock.unlock();
+        mCondition.notify_all();
+        JoinDeferred(operation);
+        lock.lock();
+        // No worker joins after this, the ones still inside have to leave before it is destroyed
+        mOperation = nullptr;
+        mCondition.wait(lock, [this]() { return mJoiningCount == 0; });
+        lock.unlock();
+        result = logicalDevice.getDeferredOperationResultKHR(operation, dispatcher);
+    } else if (result == vk::Result::eOperationNotDeferredKHR) {
+        result = vk::Result::eSuccess;
+    }
+    VKRT_ASSERT_VK(result);
+    logicalDevice.destroyDeferredOperationKHR(operation, nullptr, dispatcher);
+
+    const double milliseconds =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beginTime)
+            .count();
+    lock.lock();
+    mMilliseconds += milliseconds;
+}
+
+void HostBLASBuilder::JoinDeferred(vk::DeferredOperationKHR operation) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::DispatchLoaderDynamic& dispatcher = mContext->GetDevice()->GetDispatcher();
+    // Idle joins mean the work left can't be split right now, not that it is done
+    vk::Result joinResult;
+    do {
+        joinResult = logicalDevice.deferredOperationJoinKHR(operation, dispatcher);
+        if (joinResult == vk::Result::eThreadIdleKHR) {
+            std::this_thread::yield();
+        }
+    } while (joinResult == vk::Result::eThreadIdleKHR);
+}
+
+void HostBLASBuilder::Serialize(Request& request) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::DispatchLoaderDynamic& dispatcher = mContext->GetDevice()->GetDispatcher();
+    VKRT_ASSERT_VK(logicalDevice.copyAccelerationStructureKHR(
+        nullptr,
+        vk::CopyAccelerationStructureInfoKHR()
+            .setSrc(request.structure)
+            .setDst(request.compacted)
+            .setMode(vk::CopyAccelerationStructureModeKHR::eCompact),
+        dispatcher));
+
+    // The serialized form is what the device and the disk cache both take
+    vk::DeviceSize serializedSize = 0;
+    VKRT_ASSERT_VK(logicalDevice.writeAccelerationStructuresPropertiesKHR(
+        1,
+        &request.compacted,
+        vk::QueryType::eAccelerationStructureSerializationSizeKHR,
+        sizeof(serializedSize),
+        &serializedSize,
+        sizeof(serializedSize),
+        dispatcher));
+    request.serialized.resize(serializedSize);
+    VKRT_ASSERT_VK(logicalDevice.copyAccelerationStructureToMemoryKHR(
+        nullptr,
+        vk::CopyAccelerationStructureToMemoryInfoKHR()
+            .setSrc(request.compacted)
+            .setDst(vk::DeviceOrHostAddressKHR().setHostAddress(request.serialized.data()))
+            .setMode(vk::CopyAccelerationStructureModeKHR::eSerialize),
+        dispatcher));
+    mContext->GetBLASCache()->Save(request.cacheKey, request.serialized);
+}
+
+HostBLASBuilder::~HostBLASBuilder() {
+    StopWorkers();
+    for (std::unique_ptr<Request>& request : mRequests) {
+        DestroyHostStructures(*request);
+    }
+}
+
+}  // namespace VKRT
@@ -0,0 +1,198 @@
+#include "InstanceGenerator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Context.h"
+#include "DebugUtils.h"
+#include "Device.h"
+#include "ResourceLoader.h"
+
+#undef MemoryBarrier
+
+namespace VKRT {
+
+InstanceGenerator::InstanceGenerator(ScopedRefPtr<Context> context)
+    : mContext(context), mTransforms{}, mTemplates{}, mInstanceBuffer(nullptr) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+
+    Resource shaderResource = ResourceLoader::Load(Resource::Id::InstancesShader);
+    vk::ShaderModuleCreateInfo shaderCreateInfo =
+        vk::ShaderModuleCreateInfo()
+            .setCodeSize(shaderResource.size * sizeof(uint8_t))
+            .setPCode(reinterpret_cast<const uint32_t*>(shaderResource.buffer));
+    mShader = VKRT_ASSERT_VK(logicalDevice.createShaderModule(shaderCreateInfo));
+    ResourceLoader::CleanUp(shaderResource);
+
+    const vk::PushConstantRange pushConstantRange =
+        vk::PushConstantRange()
+            .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+            .setOffset(0)
+            .setSize(sizeof(Parameters));
+    vk::PipelineLayoutCreateInfo layoutCreateInfo =
+        vk::PipelineLayoutCreateInfo().setPushConstantRanges(pushConstantRange);
+    mLayout = VKRT_ASSERT_VK(logicalDevice.createPipelineLayout(layoutCreateInfo));
+
+    vk::ComputePipelineCreateInfo pipelineCreateInfo =
+        vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                          .setStage(vk::ShaderStageFlagBits::eCompute)
+                          .setModule(mShader)
+                          .setPName("main"))
+            .setLayout(mLayout);
+    mPipeline = VKRT_ASSERT_VK(logicalDevice.createComputePipeline({}, pipelineCreateInfo));
+}
+
+void InstanceGenerator::Allocate(
+    UploadBuffer& upload,
+    uint32_t count,
+    vk::DeviceSize elementSize,
+    const char* name) {
+    for (VulkanBuffer* staging : upload.staging) {
+        staging->UnmapBuffer();
+    }
+    upload.staging.clear();
+    upload.mapped.clear();
+    const vk::DeviceSize size = std::max<vk::DeviceSize>(count, 1) * elementSize;
+    for (uint32_t slot = 0; slot < mContext->GetFramesInFlight(); ++slot) {
+        ScopedRefPtr<VulkanBuffer> staging = mContext->GetDevice()->CreateBuffer(
+            size,
+            vk::BufferUsageFlagBits::eTransferSrc,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            {},
+            {MemoryCategory::Staging, name});
+        upload.mapped.push_back(staging->MapBuffer());
+        upload.staging.push_back(staging);
+    }
+    upload.buffer = mContext->GetDevice()->CreateBuffer(
+        size,
+        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::Instance, name});
+    upload.count = count;
+    upload.elementSize = elementSize;
+    upload.regions.clear();
+}
+
+void InstanceGenerator::Resize(uint32_t transformCount, uint32_t instanceCount) {
+    Allocate(mTransforms, transformCount, sizeof(vk::TransformMatrixKHR), "Instance transforms");
+    Allocate(mTemplates, instanceCount, sizeof(Template), "Instance templates");
+    mInstanceBuffer = mContext->GetDevice()->CreateBuffer(
+        std::max(instanceCount, 1u) * sizeof(vk::AccelerationStructureInstanceKHR),
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::Instance, "Generated instances"});
+}
+
+void InstanceGenerator::Write(UploadBuffer& upload, uint32_t index, const void* data) {
+    VKRT_ASSERT(index < upload.count);
+    const vk::DeviceSize offset = index * upload.elementSize;
+    std::memcpy(upload.mapped[mContext->GetFrameSlot()] + offset, data, upload.elementSize);
+    // Neighbours written in order share a region, like the objects of a moving group
+    if (!upload.regions.empty()) {
+        vk::BufferCopy& last = upload.regions.back();
+        if (last.dstOffset + last.size == offset) {
+            last.size += upload.elementSize;
+            return;
+        }
+    }
+    upload.regions.push_back(vk::BufferCopy()
+                                 .setSrcOffset(offset)
+                                 .setDstOffset(offset)
+                                 .setSize(upload.elementSize));
+}
+
+void InstanceGenerator::SetTransform(uint32_t transformIndex, const glm::mat4& transform) {
+    // The first three rows of the transpose are the row major 3x4 matrix
+    const glm::mat4 rows = glm::transpose(transform);
+    Write(mTransforms, transformIndex, &rows);
+}
+
+void InstanceGenerator::SetTemplate(uint32_t instanceIndex, const Template& instanceTemplate) {
+    Write(mTemplates, instanceIndex, &instanceTemplate);
+}
+
+void InstanceGenerator::Record(vk::CommandBuffer commandBuffer) {
+    if (mTransforms.regions.empty() && mTemplates.regions.empty()) {
+        return;
+    }
+
+    // Last frame's expansion and TLAS build are done with the buffers about to be written
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+        {},
+        {},
+        {},
+        {});
+    const uint32_t frameSlot = mContext->GetFrameSlot();
+    for (UploadBuffer* upload : {&mTransforms, &mTemplates}) {
+        if (!upload->regions.empty()) {
+            commandBuffer.copyBuffer(
+                upload->staging[frameSlot]->GetBufferHandle(),
+                upload->buffer->GetBufferHandle(),
+                upload->regions);
+            upload->regions.clear();
+        }
+    }
+    const vk::MemoryBarrier uploadBarrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader,
+        {},
+        uploadBarrier,
+        {},
+        {});
+
+    const Parameters parameters{
+        .templates = mTemplates.buffer->GetDeviceAddress(),
+        .transforms = mTransforms.buffer->GetDeviceAddress(),
+        .instances = mInstanceBuffer->GetDeviceAddress(),
+        .instanceCount = mTemplates.count};
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, mPipeline);
+    commandBuffer.pushConstants(
+        mLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(Parameters),
+        &parameters);
+    commandBuffer.dispatch((mTemplates.count + WorkgroupSize - 1) / WorkgroupSize, 1, 1);
+
+    // Build inputs are shader reads of the build stage
+    const vk::MemoryBarrier expandBarrier = vk::MemoryBarrier()
+                                                .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                                                .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        {},
+        expandBarrier,
+        {},
+        {});
+}
+
+void InstanceGenerator::DiscardWrites() {
+    mTransforms.regions.clear();
+    mTemplates.regions.clear();
+}
+
+InstanceGenerator::~InstanceGenerator() {
+    for (UploadBuffer* upload : {&mTransforms, &mTemplates}) {
+        for (VulkanBuffer* staging : upload->staging) {
+            staging->UnmapBuffer();
+        }
+    }
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    logicalDevice.destroyPipeline(mPipeline);
+    logicalDevice.destroyPipelineLayout(mLayout);
+    logicalDevice.destroyShaderModule(mShader);
+}
+
+}  // namespace VKRT
@@ -18,6 +18,7 @@ Material::Material(
       mRoughness(roughness),
       mMetallic(metallic),
       mIndexOfRefraction(indexOfRefraction),
+      mAlphaCutoff(0.0f),
       mAlbedoTexture(albedoTexture),
       mRoughnessTexture(roughnessTexture) {}
 
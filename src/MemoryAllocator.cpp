@@ -0,0 +1,302 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "DebugUtils.h"
+#include "Device.h"
+#include "VulkanBuffer.h"
+
+namespace VKRT {
+
+// Tracking ids of suballocations must not collide with the ids of dedicated allocations, which
+// are their memory handles
+static constexpr uint64_t SuballocationTrackingBit = 1ull << 63;
+
+static vk::DeviceSize GetUsedBytes(const FreeListAllocator& allocator) {
+    return allocator.GetSize() - allocator.GetFreeSize();
+}
+
+MemoryAllocator::MemoryAllocator(
+    Device* device,
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties)
+    : mDevice(device),
+      mMemoryProperties(memoryProperties),
+      mNextBlockId(0),
+      mNextTrackingId(0),
+      mMovedBytes(0),
+      mMoveCount(0),
+      mReleasedBlockCount(0) {}
+
+uint32_t MemoryAllocator::CreateBlock(uint32_t memoryTypeIndex) {
+    // Suballocated buffers may ask for device addresses, every block allows them
+    vk::MemoryAllocateFlagsInfo memoryAllocateFlagsInfo =
+        vk::MemoryAllocateFlagsInfo().setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
+    const vk::MemoryAllocateInfo allocateInfo = vk::MemoryAllocateInfo()
+                                                    .setAllocationSize(BlockSize)
+                                                    .setMemoryTypeIndex(memoryTypeIndex)
+                                                    .setPNext(&memoryAllocateFlagsInfo);
+    auto [result, memory] = mDevice->GetLogicalDevice().allocateMemory(allocateInfo);
+    if (result != vk::Result::eSuccess) {
+        VKRT_ASSERT_MSG(
+            result == vk::Result::eErrorOutOfDeviceMemory ||
+                result == vk::Result::eErrorOutOfHostMemory,
+            "Vulkan error " << vk::to_string(result));
+        return MemoryAllocation::DedicatedBlock;
+    }
+    const uint32_t blockId = mNextBlockId++;
+    mBlocks.emplace(
+        blockId,
+        Block{
+            .memory = memory,
+            .memoryTypeIndex = memoryTypeIndex,
+            .allocator = FreeListAllocator(BlockSize),
+            .resources = {}});
+    return blockId;
+}
+
+bool MemoryAllocator::Allocate(
+    uint32_t memoryTypeIndex,
+    const vk::MemoryRequirements& memoryRequirements,
+    MemoryAllocation& allocation) {
+    if (memoryRequirements.size > MaxSuballocationSize) {
+        return false;
+    }
+
+    auto tryAllocate = [&](uint32_t blockId, Block& block) {
+        const uint64_t offset =
+            block.allocator.Allocate(memoryRequirements.size, memoryRequirements.alignment);
+        if (offset == FreeListAllocator::InvalidOffset) {
+            return false;
+        }
+        block.resources.emplace(
+            offset,
+            Resource{
+                .size = memoryRequirements.size,
+                .alignment = memoryRequirements.alignment,
+                .owner = nullptr});
+        allocation = MemoryAllocation{
+            .memory = block.memory,
+            .offset = offset,
+            .size = memoryRequirements.size,
+            .memoryTypeIndex = memoryTypeIndex,
+            .blockId = blockId,
+            .trackingId = SuballocationTrackingBit | mNextTrackingId++};
+        return true;
+    };
+
+    for (auto& [blockId, block] : mBlocks) {
+        if (block.memoryTypeIndex == memoryTypeIndex && tryAllocate(blockId, block)) {
+            return true;
+        }
+    }
+
+    const uint32_t blockId = CreateBlock(memoryTypeIndex);
+    if (blockId == MemoryAllocation::DedicatedBlock) {
+        return false;
+    }
+    return tryAllocate(blockId, mBlocks.at(blockId));
+}
+
+void MemoryAllocator::Free(const MemoryAllocation& allocation) {
+    auto blockIt = mBlocks.find(allocation.blockId);
+    VKRT_ASSERT(blockIt != mBlocks.end());
+    Block& block = blockIt->second;
+    auto resourceIt = block.resources.find(allocation.offset);
+    VKRT_ASSERT(resourceIt != block.resources.end());
+    block.allocator.Free(allocation.offset, resourceIt->second.size);
+    block.resources.erase(resourceIt);
+}
+
+void MemoryAllocator::SetOwner(const MemoryAllocation& allocation, VulkanBuffer* buffer) {
+    Block& block = mBlocks.at(allocation.blockId);
+    block.resources.at(allocation.offset).owner = buffer;
+}
+
+bool MemoryAllocator::FindMoveDestination(
+    uint32_t sourceBlockId,
+    vk::DeviceSize sourceOffset,
+    const Resource& resource,
+    MemoryAllocation& destination) {
+    const Block& sourceBlock = mBlocks.at(sourceBlockId);
+    const vk::DeviceSize sourceUsedBytes = GetUsedBytes(sourceBlock.allocator);
+
+    // Fill the fullest blocks first so the sparse ones end up empty
+    std::vector<uint32_t> candidates;
+    for (const auto& [blockId, block] : mBlocks) {
+        if (blockId != sourceBlockId && block.memoryTypeIndex == sourceBlock.memoryTypeIndex &&
+            GetUsedBytes(block.allocator) >= sourceUsedBytes) {
+            candidates.push_back(blockId);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+        return GetUsedBytes(mBlocks.at(a).allocator) > GetUsedBytes(mBlocks.at(b).allocator);
+    });
+
+    for (uint32_t blockId : candidates) {
+        Block& block = mBlocks.at(blockId);
+        const uint64_t offset = block.allocator.Allocate(resource.size, resource.alignment);
+        if (offset != FreeListAllocator::InvalidOffset) {
+            destination = MemoryAllocation{
+                .memory = block.memory,
+                .offset = offset,
+                .size = resource.size,
+                .memoryTypeIndex = block.memoryTypeIndex,
+                .blockId = blockId};
+            return true;
+        }
+    }
+
+    // Otherwise compact within the block, only worth it when the buffer moves down
+    Block& block = mBlocks.at(sourceBlockId);
+    const uint64_t offset = block.allocator.Allocate(resource.size, resource.alignment);
+    if (offset == FreeListAllocator::InvalidOffset) {
+        return false;
+    }
+    if (offset > sourceOffset) {
+        block.allocator.Free(offset, resource.size);
+        return false;
+    }
+    destination = MemoryAllocation{
+        .memory = block.memory,
+        .offset = offset,
+        .size = resource.size,
+        .memoryTypeIndex = block.memoryTypeIndex,
+        .blockId = sourceBlockId};
+    return true;
+}
+
+void MemoryAllocator::Defragment(vk::DeviceSize byteBudget) {
+    std::vector<uint32_t> sourceBlocks;
+    for (const auto& [blockId, block] : mBlocks) {
+        sourceBlocks.push_back(blockId);
+    }
+    std::sort(sourceBlocks.begin(), sourceBlocks.end(), [this](uint32_t a, uint32_t b) {
+        return GetUsedBytes(mBlocks.at(a).allocator) < GetUsedBytes(mBlocks.at(b).allocator);
+    });
+
+    std::vector<Move> moves;
+    std::unordered_set<uint32_t> destinationBlocks;
+    vk::DeviceSize budgetLeft = byteBudget;
+    for (uint32_t sourceBlockId : sourceBlocks) {
+        // Don't shuffle what this pass just moved in
+        if (destinationBlocks.count(sourceBlockId) > 0) {
+            continue;
+        }
+        const Block& sourceBlock = mBlocks.at(sourceBlockId);
+        for (const auto& [offset, resource] : sourceBlock.resources) {
+            if (resource.size > budgetLeft) {
+                break;
+            }
+            if (resource.owner == nullptr || !resource.owner->IsMovable()) {
+                continue;
+            }
+            MemoryAllocation destination;
+            if (!FindMoveDestination(sourceBlockId, offset, resource, destination)) {
+                continue;
+            }
+            destination.trackingId = resource.owner->GetAllocation().trackingId;
+            if (destination.blockId != sourceBlockId) {
+                destinationBlocks.insert(destination.blockId);
+            }
+            moves.push_back(Move{
+                .buffer = resource.owner,
+                .source = resource.owner->GetAllocation(),
+                .destination = destination,
+                .destinationHandle = resource.owner->CreateHandle(destination)});
+            budgetLeft -= resource.size;
+        }
+    }
+
+    if (!moves.empty()) {
+        VKRT_ASSERT_VK(mDevice->GetLogicalDevice().waitIdle());
+        vk::CommandBuffer commandBuffer = mDevice->CreateCommandBuffer();
+        VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
+        for (const Move& move : moves) {
+            move.buffer->RecordRelocation(commandBuffer, move.destinationHandle);
+        }
+        const vk::MemoryBarrier barrier =
+            vk::MemoryBarrier()
+                .setSrcAccessMask(
+                    vk::AccessFlagBits::eTransferWrite |
+                    vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+                .setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer |
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eAllCommands,
+            {},
+            barrier,
+            {},
+            {});
+        VKRT_ASSERT_VK(commandBuffer.end());
+        mDevice->SubmitCommandAndFlush(commandBuffer);
+        mDevice->DestroyCommand(commandBuffer);
+
+        for (const Move& move : moves) {
+            Block& destinationBlock = mBlocks.at(move.destination.blockId);
+            const Resource& resource =
+                mBlocks.at(move.source.blockId).resources.at(move.source.offset);
+            destinationBlock.resources.emplace(move.destination.offset, resource);
+            Free(move.source);
+            move.buffer->CompleteRelocation(move.destinationHandle, move.destination);
+            mMovedBytes += move.source.size;
+            ++mMoveCount;
+        }
+    }
+
+    ReleaseEmptyBlocks();
+}
+
+void MemoryAllocator::ReleaseEmptyBlocks() {
+    for (auto it = mBlocks.begin(); it != mBlocks.end();) {
+        if (it->second.resources.empty()) {
+            mDevice->GetLogicalDevice().freeMemory(it->second.memory);
+            it = mBlocks.erase(it);
+            ++mReleasedBlockCount;
+        } else {
+            ++it;
+        }
+    }
+}
+
+MemoryAllocator::Statistics MemoryAllocator::GetStatistics() const {
+    Statistics statistics{
+        .movedBytes = mMovedBytes,
+        .moveCount = mMoveCount,
+        .releasedBlockCount = mReleasedBlockCount};
+    vk::DeviceSize freeBytes = 0;
+    for (const auto& [blockId, block] : mBlocks) {
+        ++statistics.blockCount;
+        statistics.committedBytes += block.allocator.GetSize();
+        statistics.usedBytes += GetUsedBytes(block.allocator);
+        statistics.freeRangeCount += block.allocator.GetFreeRangeCount();
+        statistics.largestFreeRange =
+            std::max(statistics.largestFreeRange, block.allocator.GetLargestFreeRange());
+        freeBytes += block.allocator.GetFreeSize();
+    }
+    if (freeBytes > 0) {
+        statistics.fragmentation =
+            1.0f - static_cast<float>(statistics.largestFreeRange) / static_cast<float>(freeBytes);
+    }
+    return statistics;
+}
+
+vk::DeviceSize MemoryAllocator::GetUnusedBytes(uint32_t heapIndex) const {
+    vk::DeviceSize unusedBytes = 0;
+    for (const auto& [blockId, block] : mBlocks) {
+        if (mMemoryProperties.memoryTypes[block.memoryTypeIndex].heapIndex == heapIndex) {
+            unusedBytes += block.allocator.GetFreeSize();
+        }
+    }
+    return unusedBytes;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    for (auto& [blockId, block] : mBlocks) {
+        VKRT_ASSERT_MSG(block.resources.empty(), "Memory block released with live buffers");
+        mDevice->GetLogicalDevice().freeMemory(block.memory);
+    }
+}
+
+}  // namespace VKRT
@@ -0,0 +1,205 @@
+#include "MemoryTracker.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "nlohmann/json.hpp"
+
+namespace VKRT {
+
+MemoryTracker::MemoryTracker(uint32_t heapCount)
+    : mTotalCounters{},
+      mCategoryCounters{},
+      mHeapCounters(heapCount),
+      mCategoryHeapCounters(heapCount * CategoryCount) {}
+
+void MemoryTracker::AddToCounters(Counters& counters, uint64_t size) {
+    counters.allocatedBytes += size;
+    counters.peakBytes = std::max(counters.peakBytes, counters.allocatedBytes);
+    ++counters.allocationCount;
+    counters.peakAllocationCount = std::max(counters.peakAllocationCount, counters.allocationCount);
+    ++counters.totalAllocationCount;
+}
+
+void MemoryTracker::RemoveFromCounters(Counters& counters, uint64_t size) {
+    counters.allocatedBytes -= size;
+    --counters.allocationCount;
+}
+
+void MemoryTracker::TrackAllocation(uint64_t id, const Allocation& allocation) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const size_t categoryIndex = static_cast<size_t>(allocation.tag.category);
+    AddToCounters(mTotalCounters, allocation.size);
+    AddToCounters(mCategoryCounters[categoryIndex], allocation.size);
+    AddToCounters(mHeapCounters[allocation.heapIndex], allocation.size);
+    AddToCounters(
+        mCategoryHeapCounters[categoryIndex * mHeapCounters.size() + allocation.heapIndex],
+        allocation.size);
+    mAllocations[id] = allocation;
+}
+
+void MemoryTracker::TrackFree(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mAllocations.find(id);
+    if (it != mAllocations.end()) {
+        const Allocation& allocation = it->second;
+        const size_t categoryIndex = static_cast<size_t>(allocation.tag.category);
+        RemoveFromCounters(mTotalCounters, allocation.size);
+        RemoveFromCounters(mCategoryCounters[categoryIndex], allocation.size);
+        RemoveFromCounters(mHeapCounters[allocation.heapIndex], allocation.size);
+        RemoveFromCounters(
+            mCategoryHeapCounters[categoryIndex * mHeapCounters.size() + allocation.heapIndex],
+            allocation.size);
+        mAllocations.erase(it);
+    }
+}
+
+bool MemoryTracker::FindAllocation(uint64_t id, Allocation& allocation) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mAllocations.find(id);
+    if (it != mAllocations.end()) {
+        allocation = it->second;
+        return true;
+    }
+    return false;
+}
+
+MemoryTracker::Counters MemoryTracker::GetTotalCounters() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTotalCounters;
+}
+
+MemoryTracker::Counters MemoryTracker::GetCategoryCounters(MemoryCategory category) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCategoryCounters[static_cast<size_t>(category)];
+}
+
+MemoryTracker::Counters MemoryTracker::GetHeapCounters(uint32_t heapIndex) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mHeapCounters[heapIndex];
+}
+
+MemoryTracker::Counters MemoryTracker::GetCounters(MemoryCategory category, uint32_t heapIndex)
+    const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCategoryHeapCounters[static_cast<size_t>(category) * mHeapCounters.size() + heapIndex];
+}
+
+const char* MemoryTracker::GetCategoryName(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::Geometry:
+            return "Geometry";
+        case MemoryCategory::AccelerationStructure:
+            return "AccelerationStructure";
+        case MemoryCategory::Scratch:
+            return "Scratch";
+        case MemoryCategory::Instance:
+            return "Instance";
+        case MemoryCategory::ShaderBindingTable:
+            return "ShaderBindingTable";
+        case MemoryCategory::Uniform:
+            return "Uniform";
+        case MemoryCategory::Texture:
+            return "Texture";
+        case MemoryCategory::Staging:
+            return "Staging";
+        default:
+            return "Other";
+    }
+}
+
+static nlohmann::json CountersToJson(const MemoryTracker::Counters& counters) {
+    return nlohmann::json{
+        {"allocatedBytes", counters.allocatedBytes},
+        {"peakBytes", counters.peakBytes},
+        {"allocationCount", counters.allocationCount},
+        {"peakAllocationCount", counters.peakAllocationCount},
+        {"totalAllocationCount", counters.totalAllocationCount},
+    };
+}
+
+std::string MemoryTracker::ToJson() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const size_t heapCount = mHeapCounters.size();
+    nlohmann::json snapshot;
+    snapshot["total"] = CountersToJson(mTotalCounters);
+
+    nlohmann::json heaps = nlohmann::json::array();
+    for (size_t heapIndex = 0; heapIndex < heapCount; ++heapIndex) {
+        nlohmann::json heap = CountersToJson(mHeapCounters[heapIndex]);
+        heap["heap"] = heapIndex;
+        heaps.push_back(heap);
+    }
+    snapshot["heaps"] = heaps;
+
+    nlohmann::json categories = nlohmann::json::object();
+    for (size_t categoryIndex = 0; categoryIndex < CategoryCount; ++categoryIndex) {
+        nlohmann::json category = CountersToJson(mCategoryCounters[categoryIndex]);
+        nlohmann::json categoryHeaps = nlohmann::json::array();
+        for (size_t heapIndex = 0; heapIndex < heapCount; ++heapIndex) {
+            nlohmann::json heap =
+                CountersToJson(mCategoryHeapCounters[categoryIndex * heapCount + heapIndex]);
+            heap["heap"] = heapIndex;
+            categoryHeaps.push_back(heap);
+        }
+        category["heaps"] = categoryHeaps;
+        categories[GetCategoryName(static_cast<MemoryCategory>(categoryIndex))] = category;
+    }
+    snapshot["categories"] = categories;
+
+    // Sorted by size so the biggest consumers show up first
+    std::vector<const Allocation*> allocations;
+    allocations.reserve(mAllocations.size());
+    for (const auto& entry : mAllocations) {
+        allocations.push_back(&entry.second);
+    }
+    std::sort(allocations.begin(), allocations.end(), [](const auto* a, const auto* b) {
+        return a->size > b->size;
+    });
+    nlohmann::json liveAllocations = nlohmann::json::array();
+    for (const Allocation* allocation : allocations) {
+        liveAllocations.push_back(nlohmann::json{
+            {"category", GetCategoryName(allocation->tag.category)},
+            {"owner", allocation->tag.owner},
+            {"heap", allocation->heapIndex},
+            {"memoryType", allocation->memoryTypeIndex},
+            {"size", allocation->size},
+        });
+    }
+    snapshot["allocations"] = liveAllocations;
+
+    return snapshot.dump(4);
+}
+
+std::string MemoryTracker::ToCsv() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const size_t heapCount = mHeapCounters.size();
+    std::ostringstream csv;
+    csv << "category,heap,allocatedBytes,peakBytes,allocationCount,peakAllocationCount,"
+           "totalAllocationCount\n";
+    for (size_t categoryIndex = 0; categoryIndex < CategoryCount; ++categoryIndex) {
+        for (size_t heapIndex = 0; heapIndex < heapCount; ++heapIndex) {
+            const Counters& counters = mCategoryHeapCounters[categoryIndex * heapCount + heapIndex];
+            if (counters.totalAllocationCount == 0) {
+                continue;
+            }
+            csv << GetCategoryName(static_cast<MemoryCategory>(categoryIndex)) << ","
+                << heapIndex << "," << counters.allocatedBytes << "," << counters.peakBytes << ","
+                << counters.allocationCount << "," << counters.peakAllocationCount << ","
+                << counters.totalAllocationCount << "\n";
+        }
+    }
+    return csv.str();
+}
+
+bool MemoryTracker::WriteSnapshot(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << (path.ends_with(".csv") ? ToCsv() : ToJson());
+    return file.good();
+}
+
+}  // namespace VKRT
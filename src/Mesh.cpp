@@ -1,163 +1,463 @@
 #include "Mesh.h"
 
+#include <algorithm>
+#include <span>
+
+#include "BLASBuilder.h"
+#include "BLASCache.h"
+#include "BLASCompactor.h"
 #include "DebugUtils.h"
+#include "HostBLASBuilder.h"
 #include "Material.h"
+#include "ResidencyManager.h"
 #include "Texture.h"
 
 namespace VKRT {
 
 Mesh::Mesh(
     ScopedRefPtr<Context> context,
+    const std::string& name,
     const std::vector<Vertex>& vertices,
     const std::vector<glm::uvec3>& indices,
-    ScopedRefPtr<Material> material)
-    : mContext(context), mMaterial(material) {
-    uint32_t triangleCount = indices.size();
-    VkTransformMatrixKHR transformMatrix =
-        {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f};
-
-    {
-        const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-        mVertexBuffer = mContext->GetDevice()->CreateBuffer(
-            vertexBufferSize,
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
-        uint8_t* bufferData = mVertexBuffer->MapBuffer();
-        std::copy_n(
-            reinterpret_cast<uint8_t const*>(vertices.data()),
-            vertexBufferSize,
-            bufferData);
-        mVertexBuffer->UnmapBuffer();
-    }
-
-    {
-        const size_t indexBufferSize = indices.size() * sizeof(glm::uvec3);
-        mIndexBuffer = mContext->GetDevice()->CreateBuffer(
-            indexBufferSize,
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
-        uint8_t* bufferData = mIndexBuffer->MapBuffer();
-        std::copy_n(reinterpret_cast<uint8_t const*>(indices.data()), indexBufferSize, bufferData);
-        mIndexBuffer->UnmapBuffer();
-    }
-
-    {
-        mTransformBuffer = mContext->GetDevice()->CreateBuffer(
-            sizeof(vk::TransformMatrixKHR),
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
-        uint8_t* bufferData = mTransformBuffer->MapBuffer();
-        std::copy_n(
-            reinterpret_cast<uint8_t*>(&transformMatrix),
-            sizeof(vk::TransformMatrixKHR),
-            bufferData);
-        mTransformBuffer->UnmapBuffer();
+    ScopedRefPtr<Material> material,
+    BuildPolicy buildPolicy,
+    ScopedRefPtr<Skin> skin,
+    const std::vector<JointInfluence>& influences)
+    : Mesh(
+          context,
+          name,
+          {Primitive{.vertices = vertices, .indices = indices, .material = material}},
+          buildPolicy,
+          skin,
+          influences) {}
+
+Mesh::Mesh(
+    ScopedRefPtr<Context> context,
+    const std::string& name,
+    const std::vector<Primitive>& primitives,
+    BuildPolicy buildPolicy,
+    ScopedRefPtr<Skin> skin,
+    const std::vector<JointInfluence>& influences)
+    : mContext(context),
+      mName(name),
+      mTriangleCount(0),
+      mBuildPolicy(buildPolicy),
+      mSkin(skin),
+      mInfluenceBuffer(nullptr),
+      mSkinnedVertexOffset(0),
+      mSkinnedVersion(0),
+      mGeometryKey(BLASCache::NoKey),
+      mCacheKey(BLASCache::NoKey),
+      mBuilt(false),
+      mBuildPending(false),
+      mBLASBuffer(nullptr),
+      mBLAS(nullptr),
+      mRelocatedBLAS(nullptr),
+      mBLASAddress(0),
+      mCompactionSavedBytes(0),
+      mResidencyIndex(ResidencyManager::NoEntry),
+      mResident(true),
+      mBoundingRadius(0.0f) {
+    VKRT_ASSERT(!primitives.empty());
+    if (mSkin != nullptr && mBuildPolicy == BuildPolicy::Static) {
+        // Skinned meshes are refit every frame, a static structure couldn't follow them
+        VKRT_LOG("Skinned mesh " << mName << " can't be static, it is deformable instead");
+        mBuildPolicy = BuildPolicy::Deformable;
+    }
+    for (const Primitive& primitive : primitives) {
+        const uint32_t triangleCount = static_cast<uint32_t>(primitive.indices.size());
+        // Offsets are set when uploaded
+        mGeometries.push_back(GeometryPool::Allocation{
+            .vertexOffset = 0,
+            .vertexCount = static_cast<uint32_t>(primitive.vertices.size()),
+            .triangleOffset = 0,
+            .triangleCount = triangleCount});
+        mMaterials.push_back(primitive.material);
+        mAlphaTested.push_back(primitive.alphaTested ? 1 : 0);
+        mTriangleCount += triangleCount;
     }
+    mBuildFlags = GetBuildFlags(mBuildPolicy, mTriangleCount);
 
-    vk::AccelerationStructureGeometryTrianglesDataKHR triangleData =
-        vk::AccelerationStructureGeometryTrianglesDataKHR()
-            .setVertexFormat(vk::Format::eR32G32B32A32Sfloat)
-            .setVertexData(mVertexBuffer->GetDeviceAddress())
-            .setMaxVertex(vertices.size())
-            .setVertexStride(sizeof(Vertex))
-            .setIndexType(vk::IndexType::eUint32)
-            .setIndexData(mIndexBuffer->GetDeviceAddress())
-            .setTransformData(mTransformBuffer->GetDeviceAddress());
+    if (mContext->IsHostOnly()) {
+        // Never resident, the host copy is all there is
+        mHostPrimitives = primitives;
+        mResident = false;
+        return;
+    }
 
-    vk::AccelerationStructureGeometryKHR accelerationStructureGeometry =
-        vk::AccelerationStructureGeometryKHR()
-            .setFlags(vk::GeometryFlagBitsKHR::eOpaque)
-            .setGeometryType(vk::GeometryTypeKHR::eTriangles)
-            .setGeometry(triangleData);
+    // Only static structures can be dropped and built again the same, the others change
+    ResidencyManager* residency = mContext->GetResidencyManager();
+    const bool evictable =
+        mBuildPolicy == BuildPolicy::Static && mSkin == nullptr && residency->IsEnabled();
+    if (mContext->RetainsHostData() || evictable) {
+        mHostPrimitives = primitives;
+    }
 
+    // Only static structures are final after their build, the others are rebuilt or refit
+    BLASCache* cache = mContext->GetBLASCache();
+    if (mBuildPolicy == BuildPolicy::Static && cache->IsEnabled()) {
+        // Opacity is a geometry flag of the structure, it is part of the key too
+        std::vector<std::span<const uint8_t>> geometryData{std::span(mAlphaTested)};
+        for (const Primitive& primitive : primitives) {
+            geometryData.push_back(std::span(
+                reinterpret_cast<const uint8_t*>(primitive.vertices.data()),
+                primitive.vertices.size() * sizeof(Vertex)));
+            geometryData.push_back(std::span(
+                reinterpret_cast<const uint8_t*>(primitive.indices.data()),
+                primitive.indices.size() * sizeof(glm::uvec3)));
+        }
+        mGeometryKey = cache->ComputeKey(geometryData, mBuildFlags);
+    }
+
+    if (evictable) {
+        for (const Primitive& primitive : primitives) {
+            for (const Vertex& vertex : primitive.vertices) {
+                mBoundingRadius = std::max(mBoundingRadius, glm::length(vertex.position));
+            }
+        }
+        // The structure isn't sized yet, about as large as its geometry
+        if (!residency->Register(this, 2 * GetResidentSize())) {
+            mResident = false;
+            return;
+        }
+    }
+
+    Upload(primitives);
+    if (mSkin != nullptr) {
+        VKRT_ASSERT(primitives.size() == 1);
+        const std::vector<Vertex>& vertices = primitives[0].vertices;
+        VKRT_ASSERT(influences.size() == vertices.size());
+        // Starts as the bind pose so the first build has valid positions before any skinning
+        mSkinnedVertexOffset = mContext->GetGeometryPool()->AllocateVertices(
+            reinterpret_cast<const uint8_t*>(vertices.data()),
+            mGeometries[0].vertexCount);
+        mInfluenceBuffer = mContext->GetDevice()->CreateDeviceLocalBuffer(
+            reinterpret_cast<const uint8_t*>(influences.data()),
+            influences.size() * sizeof(JointInfluence),
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::Geometry, mName + " joint influences"});
+    }
+    CreateAccelerationStructure(primitives);
+}
+
+void Mesh::Upload(const std::vector<Primitive>& primitives) {
+    GeometryPool* geometryPool = mContext->GetGeometryPool();
+    for (size_t geometryIndex = 0; geometryIndex < primitives.size(); ++geometryIndex) {
+        const Primitive& primitive = primitives[geometryIndex];
+        mGeometries[geometryIndex] = geometryPool->Allocate(
+            reinterpret_cast<const uint8_t*>(primitive.vertices.data()),
+            static_cast<uint32_t>(primitive.vertices.size()),
+            primitive.indices.data(),
+            static_cast<uint32_t>(primitive.indices.size()));
+    }
+}
+
+void Mesh::CreateAccelerationStructure(const std::vector<Primitive>& primitives) {
+    BLASCache* cache = mContext->GetBLASCache();
+    if (mGeometryKey != BLASCache::NoKey) {
+        std::vector<uint8_t> serialized;
+        if (cache->Load(mGeometryKey, serialized)) {
+            // Already compacted when it was stored, nothing to write back either
+            mCacheKey = BLASCache::NoKey;
+            mBuildScratchSize = 0;
+            mUpdateScratchSize = 0;
+            CreateBLAS(BLASCache::GetDeserializedSize(serialized));
+            mBuildPending = true;
+            cache->EnqueueLoad(this, std::move(serialized));
+            return;
+        }
+        mCacheKey = mGeometryKey;
+    }
+
+    // Built on the CPU, the BLAS is created once its final size is known
+    HostBLASBuilder* hostBuilder = mContext->GetHostBLASBuilder();
+    if (mBuildPolicy == BuildPolicy::Static && hostBuilder->IsEnabled()) {
+        mBuildScratchSize = 0;
+        mUpdateScratchSize = 0;
+        mBuildPending = true;
+        hostBuilder->Enqueue(this, primitives);
+        return;
+    }
+
+    std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+    GetBuildGeometries(geometries, ranges);
+    std::vector<uint32_t> triangleCounts;
+    for (const GeometryPool::Allocation& geometry : mGeometries) {
+        triangleCounts.push_back(geometry.triangleCount);
+    }
     vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo =
         vk::AccelerationStructureBuildGeometryInfoKHR()
             .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
-            .setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
-            .setGeometries(accelerationStructureGeometry);
+            .setFlags(mBuildFlags)
+            .setGeometries(geometries);
 
-    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo =
-        logicalDevice.getAccelerationStructureBuildSizesKHR(
+        mContext->GetDevice()->GetLogicalDevice().getAccelerationStructureBuildSizesKHR(
             vk::AccelerationStructureBuildTypeKHR::eDevice,
             accelerationStructureBuildGeometryInfo,
-            triangleCount,
+            triangleCounts,
             mContext->GetDevice()->GetDispatcher());
+    mBuildScratchSize = buildSizesInfo.buildScratchSize;
+    mUpdateScratchSize = buildSizesInfo.updateScratchSize;
+    CreateBLAS(buildSizesInfo.accelerationStructureSize);
 
+    // The address is valid already, the build itself is batched with the other meshes
+    Rebuild();
+}
+
+void Mesh::CreateBLAS(vk::DeviceSize size) {
     mBLASBuffer = mContext->GetDevice()->CreateBuffer(
-        buildSizesInfo.accelerationStructureSize,
+        size,
         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
             vk::BufferUsageFlagBits::eShaderDeviceAddress,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        vk::MemoryAllocateFlagBits::eDeviceAddress);
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::AccelerationStructure, mName});
 
     vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
         vk::AccelerationStructureCreateInfoKHR()
             .setBuffer(mBLASBuffer->GetBufferHandle())
-            .setSize(buildSizesInfo.accelerationStructureSize)
+            .setSize(size)
             .setType(vk::AccelerationStructureTypeKHR::eBottomLevel);
-    mBLAS = VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
+    mBLAS = VKRT_ASSERT_VK(mContext->GetDevice()->GetLogicalDevice().createAccelerationStructureKHR(
         accelerationStructureCreateInfo,
         nullptr,
         mContext->GetDevice()->GetDispatcher()));
+    UpdateBLASAddress();
+}
 
-    ScopedRefPtr<VulkanBuffer> scratchBuffer = mContext->GetDevice()->CreateBuffer(
-        buildSizesInfo.buildScratchSize,
-        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-        vk::MemoryPropertyFlagBits::eDeviceLocal,
-        vk::MemoryAllocateFlagBits::eDeviceAddress);
+const char* Mesh::GetBuildPolicyName(BuildPolicy buildPolicy) {
+    switch (buildPolicy) {
+        case BuildPolicy::Static:
+            return "static";
+        case BuildPolicy::Rebuilt:
+            return "rebuilt";
+        case BuildPolicy::Deformable:
+            return "deformable";
+        default:
+            return "unknown";
+    }
+}
 
-    vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo =
-        vk::AccelerationStructureBuildGeometryInfoKHR()
-            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
-            .setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
-            .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
-            .setDstAccelerationStructure(mBLAS)
-            .setGeometries(accelerationStructureGeometry)
-            .setScratchData(scratchBuffer->GetDeviceAddress());
-
-    vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo =
-        vk::AccelerationStructureBuildRangeInfoKHR()
-            .setPrimitiveCount(triangleCount)
-            .setPrimitiveOffset(0)
-            .setFirstVertex(0)
-            .setTransformOffset(0);
-
-    vk::CommandBuffer commandBuffer = mContext->GetDevice()->CreateCommandBuffer();
-    VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
-    commandBuffer.buildAccelerationStructuresKHR(
-        accelerationBuildGeometryInfo,
-        &accelerationStructureBuildRangeInfo,
-        mContext->GetDevice()->GetDispatcher());
-    VKRT_ASSERT_VK(commandBuffer.end());
-    mContext->GetDevice()->SubmitCommandAndFlush(commandBuffer);
-    mContext->GetDevice()->DestroyCommand(commandBuffer);
+vk::BuildAccelerationStructureFlagsKHR Mesh::GetBuildFlags(
+    BuildPolicy buildPolicy,
+    uint32_t triangleCount) {
+    vk::BuildAccelerationStructureFlagsKHR flags;
+    switch (buildPolicy) {
+        case BuildPolicy::Static:
+            // Compaction gives back what fast trace costs in memory
+            return vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                   vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+        case BuildPolicy::Rebuilt:
+            flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild;
+            break;
+        case BuildPolicy::Deformable:
+            flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                    vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+            break;
+        default:
+            VKRT_ASSERT_MSG(false, "Unknown build policy");
+    }
+    if (triangleCount >= LowMemoryTriangleCount) {
+        flags |= vk::BuildAccelerationStructureFlagBitsKHR::eLowMemory;
+    }
+    return flags;
+}
+
+void Mesh::Rebuild() {
+    VKRT_ASSERT_MSG(
+        mBuildPolicy != BuildPolicy::Static || !mBuilt,
+        "Static meshes are built once, " << mName);
+    if (mBuildPending) {
+        return;
+    }
+    const bool refit = mBuildPolicy == BuildPolicy::Deformable && mBuilt;
+    mContext->GetBLASBuilder()->Enqueue(
+        this,
+        refit ? vk::BuildAccelerationStructureModeKHR::eUpdate
+              : vk::BuildAccelerationStructureModeKHR::eBuild,
+        refit ? mUpdateScratchSize : mBuildScratchSize);
+    mBuildPending = true;
+}
+
+void Mesh::GetBuildGeometries(
+    std::vector<vk::AccelerationStructureGeometryKHR>& geometries,
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR>& ranges) {
+    // Pool addresses change when it grows, only valid for builds recorded right away
+    GeometryPool* geometryPool = mContext->GetGeometryPool();
+    for (uint32_t geometryIndex = 0; geometryIndex < GetGeometryCount(); ++geometryIndex) {
+        const GeometryPool::Allocation& geometry = mGeometries[geometryIndex];
+        geometries.push_back(MakeBuildGeometry(
+            geometryPool->GetVertexAddress(GetTracedVertexOffset(geometryIndex)),
+            geometryPool->GetIndexAddress(geometry.triangleOffset),
+            geometry.vertexCount,
+            mAlphaTested[geometryIndex] != 0));
+        ranges.push_back(
+            vk::AccelerationStructureBuildRangeInfoKHR().setPrimitiveCount(geometry.triangleCount));
+    }
+}
+
+vk::AccelerationStructureGeometryKHR Mesh::MakeBuildGeometry(
+    vk::DeviceOrHostAddressConstKHR vertexData,
+    vk::DeviceOrHostAddressConstKHR indexData,
+    uint32_t vertexCount,
+    bool alphaTested) {
+    vk::AccelerationStructureGeometryTrianglesDataKHR triangleData =
+        vk::AccelerationStructureGeometryTrianglesDataKHR()
+            .setVertexFormat(vk::Format::eR32G32B32A32Sfloat)
+            .setVertexData(vertexData)
+            .setMaxVertex(vertexCount)
+            .setVertexStride(sizeof(Vertex))
+            .setIndexType(vk::IndexType::eUint32)
+            .setIndexData(indexData);
+
+    // The alpha test gives the same answer every time, duplicate any-hit calls are harmless
+    return vk::AccelerationStructureGeometryKHR()
+        .setFlags(alphaTested ? vk::GeometryFlagsKHR() : vk::GeometryFlagBitsKHR::eOpaque)
+        .setGeometryType(vk::GeometryTypeKHR::eTriangles)
+        .setGeometry(triangleData);
+}
 
+void Mesh::UpdateBLASAddress() {
     vk::AccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo =
         vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(mBLAS);
-    mBLASAddress = logicalDevice.getAccelerationStructureAddressKHR(
+    mBLASAddress = mContext->GetDevice()->GetLogicalDevice().getAccelerationStructureAddressKHR(
         accelerationDeviceAddressInfo,
         mContext->GetDevice()->GetDispatcher());
 }
 
-Mesh::Description Mesh::GetDescription() const {
+void Mesh::SetCompactedBLAS(
+    ScopedRefPtr<VulkanBuffer> buffer,
+    vk::AccelerationStructureKHR blas,
+    vk::DeviceSize savedBytes) {
+    // The compactor keeps the original structure alive until the copy completes
+    mBLASBuffer = buffer;
+    mBLAS = blas;
+    mCompactionSavedBytes = savedBytes;
+    UpdateBLASAddress();
+    mBLASBuffer->SetRelocationListener(this);
+}
+
+void Mesh::RecordRelocation(
+    vk::CommandBuffer commandBuffer,
+    VulkanBuffer* buffer,
+    vk::Buffer newBufferHandle) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
+        vk::AccelerationStructureCreateInfoKHR()
+            .setBuffer(newBufferHandle)
+            .setSize(buffer->GetBufferSize())
+            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel);
+    mRelocatedBLAS = VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
+        accelerationStructureCreateInfo,
+        nullptr,
+        mContext->GetDevice()->GetDispatcher()));
+
+    vk::CopyAccelerationStructureInfoKHR copyInfo =
+        vk::CopyAccelerationStructureInfoKHR()
+            .setSrc(mBLAS)
+            .setDst(mRelocatedBLAS)
+            .setMode(vk::CopyAccelerationStructureModeKHR::eClone);
+    commandBuffer.copyAccelerationStructureKHR(copyInfo, mContext->GetDevice()->GetDispatcher());
+}
+
+void Mesh::OnRelocated(VulkanBuffer* buffer) {
+    // The TLAS picks the new address up on its next build
+    mContext->GetDevice()->GetLogicalDevice().destroyAccelerationStructureKHR(
+        mBLAS,
+        nullptr,
+        mContext->GetDevice()->GetDispatcher());
+    mBLAS = mRelocatedBLAS;
+    mRelocatedBLAS = nullptr;
+    UpdateBLASAddress();
+}
+
+vk::DeviceSize Mesh::GetResidentSize() const {
+    vk::DeviceSize size = GetBLASSize();
+    for (const GeometryPool::Allocation& geometry : mGeometries) {
+        size += geometry.vertexCount * sizeof(Vertex) + geometry.triangleCount * sizeof(glm::uvec3);
+    }
+    return size;
+}
+
+void Mesh::Evict() {
+    VKRT_ASSERT(mResident);
+    // Work still queued for the structure goes with it, a store is retried by the next build
+    mContext->GetBLASBuilder()->Cancel(this);
+    mContext->GetBLASCompactor()->Cancel(this);
+    mContext->GetBLASCache()->Cancel(this);
+    mContext->GetHostBLASBuilder()->Cancel(this);
+    if (mBLASBuffer != nullptr) {
+        mBLASBuffer->SetRelocationListener(nullptr);
+    }
+    // Frames in flight may still trace them, they go once those complete. The buffer goes with
+    // its last reference
+    mContext->GetDevice()->RetireAccelerationStructure(mBLAS);
+    mBLAS = nullptr;
+    mBLASBuffer = nullptr;
+    mBLASAddress = 0;
+    mCompactionSavedBytes = 0;
+    for (const GeometryPool::Allocation& geometry : mGeometries) {
+        mContext->GetGeometryPool()->Retire(geometry);
+    }
+    mBuilt = false;
+    mBuildPending = false;
+    mResident = false;
+}
+
+void Mesh::StreamIn() {
+    VKRT_ASSERT(!mResident);
+    mResident = true;
+    Upload(mHostPrimitives);
+    CreateAccelerationStructure(mHostPrimitives);
+}
+
+uint32_t Mesh::GetTracedVertexOffset(uint32_t geometryIndex) const {
+    return mSkin != nullptr ? mSkinnedVertexOffset : mGeometries[geometryIndex].vertexOffset;
+}
+
+Mesh::Description Mesh::GetDescription(uint32_t geometryIndex) const {
     return Mesh::Description{
-        .vertexBufferAddress = mVertexBuffer->GetDeviceAddress(),
-        .indexBufferAddress = mIndexBuffer->GetDeviceAddress()};
+        .vertexOffset = GetTracedVertexOffset(geometryIndex),
+        .indexOffset = mGeometries[geometryIndex].triangleOffset};
+}
+
+void Mesh::OnLastReference() {
+    if (mContext->IsHostOnly()) {
+        RefCountPtr::OnLastReference();
+        return;
+    }
+    mContext->GetDevice()->Retire(this);
 }
 
 Mesh::~Mesh() {
+    if (mResidencyIndex != ResidencyManager::NoEntry) {
+        mContext->GetResidencyManager()->Unregister(this);
+    }
+    if (!mResident) {
+        return;
+    }
+    mContext->GetBLASBuilder()->Cancel(this);
+    mContext->GetBLASCompactor()->Cancel(this);
+    mContext->GetBLASCache()->Cancel(this);
+    mContext->GetHostBLASBuilder()->Cancel(this);
+    if (mBLASBuffer != nullptr) {
+        mBLASBuffer->SetRelocationListener(nullptr);
+    }
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     logicalDevice.destroyAccelerationStructureKHR(
         mBLAS,
         nullptr,
         mContext->GetDevice()->GetDispatcher());
+    for (const GeometryPool::Allocation& geometry : mGeometries) {
+        mContext->GetGeometryPool()->Free(geometry);
+    }
+    if (mSkin != nullptr) {
+        mContext->GetGeometryPool()->FreeVertices(mSkinnedVertexOffset, mGeometries[0].vertexCount);
+    }
 }
 
 }  // namespace VKRT
\ No newline at end of file
@@ -1,5 +1,12 @@
 #include "Model.h"
 
+#include <algorithm>
+#include <array>
+#include <cfloat>
+
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
+
 #include "nlohmann/json.hpp"
 #include "tiny_gltf.h"
 
@@ -9,7 +16,353 @@
 
 namespace VKRT {
 
-Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
+static const uint8_t* GetAccessorElement(
+    const tinygltf::Model& model,
+    const tinygltf::Accessor& accessor,
+    size_t elementIndex) {
+    const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+    const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+    const size_t stride = accessor.ByteStride(bufferView);
+    return &buffer.data[bufferView.byteOffset + accessor.byteOffset + stride * elementIndex];
+}
+
+// Integer components are normalized when the accessor says so, read as is otherwise
+static float ReadAccessorComponent(
+    const tinygltf::Model& model,
+    const tinygltf::Accessor& accessor,
+    size_t elementIndex,
+    uint32_t componentIndex) {
+    const uint8_t* element = GetAccessorElement(model, accessor, elementIndex);
+    switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+            return reinterpret_cast<const float*>(element)[componentIndex];
+        case TINYGLTF_COMPONENT_TYPE_BYTE: {
+            const float value = reinterpret_cast<const int8_t*>(element)[componentIndex];
+            return accessor.normalized ? std::max(value / 127.0f, -1.0f) : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_SHORT: {
+            const float value = reinterpret_cast<const int16_t*>(element)[componentIndex];
+            return accessor.normalized ? std::max(value / 32767.0f, -1.0f) : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+            const float value = reinterpret_cast<const uint8_t*>(element)[componentIndex];
+            return accessor.normalized ? value / 255.0f : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            const float value = reinterpret_cast<const uint16_t*>(element)[componentIndex];
+            return accessor.normalized ? value / 65535.0f : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+            return static_cast<float>(reinterpret_cast<const uint32_t*>(element)[componentIndex]);
+        default:
+            return 0.0f;
+    }
+}
+
+// What an alpha test at the cutoff can do to a triangle wherever it is hit
+enum class Coverage { Opaque, Transparent, Mixed };
+
+// Conservative, looks at every base level texel bilinear filtering may read inside the
+// triangle's texture coordinate bounds. Large footprints fall back to the whole image
+static Coverage ClassifyTriangle(
+    const tinygltf::Image& image,
+    const std::array<glm::vec2, 3>& texCoords,
+    float cutoff,
+    uint8_t imageMinAlpha,
+    uint8_t imageMaxAlpha) {
+    constexpr int32_t MaxFootprintTexels = 64 * 64;
+    const glm::vec2 size(image.width, image.height);
+    const glm::vec2 minTexel =
+        glm::floor(glm::min(texCoords[0], glm::min(texCoords[1], texCoords[2])) * size - 0.5f);
+    const glm::vec2 maxTexel =
+        glm::floor(glm::max(texCoords[0], glm::max(texCoords[1], texCoords[2])) * size - 0.5f) +
+        1.0f;
+    const glm::vec2 extent = maxTexel - minTexel + 1.0f;
+
+    uint8_t minAlpha = imageMinAlpha;
+    uint8_t maxAlpha = imageMaxAlpha;
+    if (extent.x < size.x && extent.y < size.y && extent.x * extent.y <= MaxFootprintTexels) {
+        minAlpha = 255;
+        maxAlpha = 0;
+        const glm::ivec2 first(minTexel);
+        const glm::ivec2 last(maxTexel);
+        for (int32_t y = first.y; y <= last.y; ++y) {
+            const int32_t wrappedY = ((y % image.height) + image.height) % image.height;
+            for (int32_t x = first.x; x <= last.x; ++x) {
+                const int32_t wrappedX = ((x % image.width) + image.width) % image.width;
+                const uint8_t alpha =
+                    image.image[(static_cast<size_t>(wrappedY) * image.width + wrappedX) * 4 + 3];
+                minAlpha = std::min(minAlpha, alpha);
+                maxAlpha = std::max(maxAlpha, alpha);
+            }
+        }
+    }
+    if (minAlpha / 255.0f >= cutoff) {
+        return Coverage::Opaque;
+    }
+    if (maxAlpha / 255.0f < cutoff) {
+        return Coverage::Transparent;
+    }
+    return Coverage::Mixed;
+}
+
+// Triangles of the source with only the vertices they use
+static Mesh::Primitive GatherTriangles(
+    const Mesh::Primitive& source,
+    const std::vector<glm::uvec3>& triangles) {
+    Mesh::Primitive primitive{.material = source.material};
+    std::vector<uint32_t> remap(source.vertices.size(), UINT32_MAX);
+    primitive.indices.reserve(triangles.size());
+    for (const glm::uvec3& triangle : triangles) {
+        glm::uvec3& indices = primitive.indices.emplace_back();
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t& index = remap[triangle[corner]];
+            if (index == UINT32_MAX) {
+                index = static_cast<uint32_t>(primitive.vertices.size());
+                primitive.vertices.push_back(source.vertices[triangle[corner]]);
+            }
+            indices[corner] = index;
+        }
+    }
+    return primitive;
+}
+
+// Drops the triangles an alpha-masked material always cuts out and splits the rest into an
+// opaque primitive and one the any-hit shader tests. Skinned primitives keep their vertices,
+// their influences follow them
+static std::vector<Mesh::Primitive> SplitByCoverage(
+    Mesh::Primitive&& primitive,
+    const tinygltf::Image& image,
+    float cutoff,
+    bool keepVertices) {
+    if (image.component != 4 || image.bits != 8 || image.width <= 0 || image.height <= 0) {
+        primitive.alphaTested = true;
+        return {std::move(primitive)};
+    }
+    uint8_t imageMinAlpha = 255;
+    uint8_t imageMaxAlpha = 0;
+    for (size_t texel = 3; texel < image.image.size(); texel += 4) {
+        imageMinAlpha = std::min(imageMinAlpha, image.image[texel]);
+        imageMaxAlpha = std::max(imageMaxAlpha, image.image[texel]);
+    }
+
+    std::array<std::vector<glm::uvec3>, 3> triangles;
+    for (const glm::uvec3& triangle : primitive.indices) {
+        const Coverage coverage = ClassifyTriangle(
+            image,
+            {primitive.vertices[triangle.x].texCoord,
+             primitive.vertices[triangle.y].texCoord,
+             primitive.vertices[triangle.z].texCoord},
+            cutoff,
+            imageMinAlpha,
+            imageMaxAlpha);
+        triangles[static_cast<size_t>(coverage)].push_back(triangle);
+    }
+    const std::vector<glm::uvec3>& opaque = triangles[static_cast<size_t>(Coverage::Opaque)];
+    const std::vector<glm::uvec3>& mixed = triangles[static_cast<size_t>(Coverage::Mixed)];
+
+    std::vector<Mesh::Primitive> primitives;
+    if (keepVertices) {
+        if (!opaque.empty() || !mixed.empty()) {
+            primitive.alphaTested = !mixed.empty();
+            primitive.indices = opaque;
+            primitive.indices.insert(primitive.indices.end(), mixed.begin(), mixed.end());
+            primitives.push_back(std::move(primitive));
+        }
+        return primitives;
+    }
+    if (!opaque.empty()) {
+        primitives.push_back(GatherTriangles(primitive, opaque));
+    }
+    if (!mixed.empty()) {
+        primitives.push_back(GatherTriangles(primitive, mixed));
+        primitives.back().alphaTested = true;
+    }
+    return primitives;
+}
+
+static ScopedRefPtr<Skin> LoadSkin(
+    ScopedRefPtr<Context> context,
+    const tinygltf::Model& model,
+    const tinygltf::Skin& gltfSkin) {
+    std::vector<Skin::Node> nodes(model.nodes.size());
+    for (size_t nodeIndex = 0; nodeIndex < model.nodes.size(); ++nodeIndex) {
+        const tinygltf::Node& gltfNode = model.nodes[nodeIndex];
+        Skin::Node& node = nodes[nodeIndex];
+        node.parent = -1;
+        node.translation = glm::vec3(0.0f);
+        node.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        node.scale = glm::vec3(1.0f);
+        if (gltfNode.matrix.size() == 16) {
+            glm::vec3 skew;
+            glm::vec4 perspective;
+            glm::decompose(
+                glm::mat4(glm::make_mat4(gltfNode.matrix.data())),
+                node.scale,
+                node.rotation,
+                node.translation,
+                skew,
+                perspective);
+        }
+        if (gltfNode.translation.size() == 3) {
+            node.translation = glm::vec3(glm::make_vec3(gltfNode.translation.data()));
+        }
+        if (gltfNode.rotation.size() == 4) {
+            const std::vector<double>& rotation = gltfNode.rotation;
+            node.rotation = glm::quat(rotation[3], rotation[0], rotation[1], rotation[2]);
+        }
+        if (gltfNode.scale.size() == 3) {
+            node.scale = glm::vec3(glm::make_vec3(gltfNode.scale.data()));
+        }
+    }
+    for (size_t nodeIndex = 0; nodeIndex < model.nodes.size(); ++nodeIndex) {
+        for (int32_t child : model.nodes[nodeIndex].children) {
+            nodes[child].parent = static_cast<int32_t>(nodeIndex);
+        }
+    }
+
+    std::vector<uint32_t> joints(gltfSkin.joints.begin(), gltfSkin.joints.end());
+    std::vector<glm::mat4> inverseBindMatrices(joints.size(), glm::mat4(1.0f));
+    if (gltfSkin.inverseBindMatrices >= 0) {
+        const tinygltf::Accessor& accessor = model.accessors[gltfSkin.inverseBindMatrices];
+        for (size_t jointIndex = 0; jointIndex < joints.size(); ++jointIndex) {
+            inverseBindMatrices[jointIndex] = glm::make_mat4(
+                reinterpret_cast<const float*>(GetAccessorElement(model, accessor, jointIndex)));
+        }
+    }
+
+    // The first animation of the file loops, morph target weights aren't animated
+    std::vector<Skin::Channel> channels;
+    if (!model.animations.empty()) {
+        const tinygltf::Animation& animation = model.animations.front();
+        for (const tinygltf::AnimationChannel& gltfChannel : animation.channels) {
+            Skin::Channel channel;
+            if (gltfChannel.target_path == "translation") {
+                channel.path = Skin::Path::Translation;
+            } else if (gltfChannel.target_path == "rotation") {
+                channel.path = Skin::Path::Rotation;
+            } else if (gltfChannel.target_path == "scale") {
+                channel.path = Skin::Path::Scale;
+            } else {
+                continue;
+            }
+            channel.node = static_cast<uint32_t>(gltfChannel.target_node);
+
+            const tinygltf::AnimationSampler& sampler = animation.samplers[gltfChannel.sampler];
+            channel.step = sampler.interpolation == "STEP";
+            // Cubic splines store in-tangent, value, out-tangent per key, only values are kept
+            const bool cubicSpline = sampler.interpolation == "CUBICSPLINE";
+            const tinygltf::Accessor& inputAccessor = model.accessors[sampler.input];
+            const tinygltf::Accessor& outputAccessor = model.accessors[sampler.output];
+            const uint32_t componentCount = channel.path == Skin::Path::Rotation ? 4 : 3;
+            channel.times.resize(inputAccessor.count);
+            channel.values.resize(inputAccessor.count, glm::vec4(0.0f));
+            for (size_t key = 0; key < inputAccessor.count; ++key) {
+                channel.times[key] = ReadAccessorComponent(model, inputAccessor, key, 0);
+                const size_t valueIndex = cubicSpline ? key * 3 + 1 : key;
+                for (uint32_t component = 0; component < componentCount; ++component) {
+                    channel.values[key][component] =
+                        ReadAccessorComponent(model, outputAccessor, valueIndex, component);
+                }
+            }
+            channels.push_back(channel);
+        }
+    }
+
+    return new Skin(context, nodes, joints, inverseBindMatrices, channels);
+}
+
+// Refits keep the tree of the first build. Once vertices travel about half the mesh size from where
+// they were built, the loosened boxes cost more trace time than a fast rebuild every frame
+static constexpr float RebuildDeformation = 0.5f;
+
+// Farthest the vertices get from their rest positions, relative to the primitive's radius. Joints
+// count by how far the animation translates or scales them within the skeleton, rotations swing
+// limbs around their joints, which refits follow well. Root joints move the mesh as a whole
+static float MeasureDeformation(
+    const tinygltf::Model& model,
+    const tinygltf::Primitive& primitive,
+    const std::vector<glm::vec3>& positions,
+    const tinygltf::Skin* gltfSkin) {
+    glm::vec3 minimum(FLT_MAX);
+    glm::vec3 maximum(-FLT_MAX);
+    for (const glm::vec3& position : positions) {
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+    const float radius = positions.empty() ? 0.0f : 0.5f * glm::length(maximum - minimum);
+    if (radius <= 0.0f) {
+        return 0.0f;
+    }
+
+    float displacement = 0.0f;
+    for (const std::map<std::string, int>& target : primitive.targets) {
+        const auto positionTarget = target.find("POSITION");
+        if (positionTarget == target.end()) {
+            continue;
+        }
+        const tinygltf::Accessor& accessor = model.accessors[positionTarget->second];
+        for (size_t vertexIndex = 0; vertexIndex < accessor.count; ++vertexIndex) {
+            const glm::vec3 offset(
+                ReadAccessorComponent(model, accessor, vertexIndex, 0),
+                ReadAccessorComponent(model, accessor, vertexIndex, 1),
+                ReadAccessorComponent(model, accessor, vertexIndex, 2));
+            displacement = std::max(displacement, glm::length(offset));
+        }
+    }
+
+    // Only the first animation is played, see LoadSkin
+    if (gltfSkin != nullptr && !model.animations.empty()) {
+        std::vector<int32_t> parents(model.nodes.size(), -1);
+        for (size_t nodeIndex = 0; nodeIndex < model.nodes.size(); ++nodeIndex) {
+            for (int32_t child : model.nodes[nodeIndex].children) {
+                parents[child] = static_cast<int32_t>(nodeIndex);
+            }
+        }
+        const std::vector<int>& joints = gltfSkin->joints;
+        const auto isJoint = [&](int32_t node) {
+            return std::find(joints.begin(), joints.end(), node) != joints.end();
+        };
+        const tinygltf::Animation& animation = model.animations.front();
+        for (const tinygltf::AnimationChannel& channel : animation.channels) {
+            const bool isTranslation = channel.target_path == "translation";
+            if ((!isTranslation && channel.target_path != "scale") ||
+                !isJoint(channel.target_node) || !isJoint(parents[channel.target_node])) {
+                continue;
+            }
+            const tinygltf::Node& node = model.nodes[channel.target_node];
+            const std::vector<double>& restValue = isTranslation ? node.translation : node.scale;
+            glm::vec3 rest(isTranslation ? 0.0f : 1.0f);
+            if (restValue.size() == 3) {
+                rest = glm::vec3(glm::make_vec3(restValue.data()));
+            } else if (isTranslation && node.matrix.size() == 16) {
+                rest = glm::vec3(node.matrix[12], node.matrix[13], node.matrix[14]);
+            }
+
+            const tinygltf::AnimationSampler& sampler = animation.samplers[channel.sampler];
+            const tinygltf::Accessor& accessor = model.accessors[sampler.output];
+            // Cubic splines store in-tangent, value, out-tangent per key
+            const size_t stride = sampler.interpolation == "CUBICSPLINE" ? 3 : 1;
+            for (size_t valueIndex = stride / 2; valueIndex < accessor.count;
+                 valueIndex += stride) {
+                const glm::vec3 value(
+                    ReadAccessorComponent(model, accessor, valueIndex, 0),
+                    ReadAccessorComponent(model, accessor, valueIndex, 1),
+                    ReadAccessorComponent(model, accessor, valueIndex, 2));
+                // A scaled joint moves what it carries by up to the change times the radius
+                const float distance = isTranslation ? glm::length(value - rest)
+                                                     : glm::length(value - rest) * radius;
+                displacement = std::max(displacement, distance);
+            }
+        }
+    }
+    return displacement / radius;
+}
+
+Model* Model::Load(
+    ScopedRefPtr<Context> context,
+    const std::string& path,
+    std::optional<Mesh::BuildPolicy> buildPolicy) {
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
     std::string err;
@@ -22,6 +375,7 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
     }
     constexpr int32_t invalidIndex = -1;
     std::vector<ScopedRefPtr<Mesh>> meshes;
+    ScopedRefPtr<Skin> skin = nullptr;
     if (isProperlyLoaded) {
         if (!model.nodes.empty()) {
             int32_t meshIndex = -1;
@@ -32,6 +386,11 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
                 meshIndex = it->mesh;
             }
             const tinygltf::Mesh& mesh = model.meshes[meshIndex];
+            const bool isSkinned = it->skin >= 0;
+            // A static override doesn't apply to the skinned meshes, they fall back to deformable
+            if (isSkinned) {
+                skin = LoadSkin(context, model, model.skins[it->skin]);
+            }
             for (const tinygltf::Primitive& primitive : mesh.primitives) {
                 const std::string positionName = "POSITION";
                 const std::string normalName = "NORMAL";
@@ -146,6 +505,7 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
 
                 const int32_t materialIndex = primitive.material;
                 ScopedRefPtr<Material> material = nullptr;
+                const tinygltf::Image* albedoImage = nullptr;
                 if (materialIndex >= 0) {
                     const tinygltf::Material& gltfMaterial = model.materials[materialIndex];
 
@@ -160,13 +520,15 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
                     if (albedoTextureIndex >= 0) {
                         const tinygltf::Texture& texture = model.textures[albedoTextureIndex];
                         const tinygltf::Image& image = model.images[texture.source];
+                        albedoImage = &image;
                         albedoTexture = new Texture(
                             context,
                             image.width,
                             image.height,
                             vk::Format::eR8G8B8A8Unorm,
                             image.image.data(),
-                            image.image.size());
+                            image.image.size(),
+                            path + ":" + (image.uri.empty() ? image.name : image.uri));
                     }
 
                     const int32_t roughnessTextureIndex =
@@ -182,7 +544,8 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
                             image.height,
                             vk::Format::eR8G8B8A8Unorm,
                             image.image.data(),
-                            image.image.size());
+                            image.image.size(),
+                            path + ":" + (image.uri.empty() ? image.name : image.uri));
                     }
 
                     material = new Material(
@@ -192,31 +555,136 @@ Model* Model::Load(ScopedRefPtr<Context> context, const std::string& path) {
                         -1.0f,
                         albedoTexture,
                         roughnessTexture);
+
+                    // BLEND is traced opaque. The factor scales the texture's alpha, the shaders
+                    // compare the texture's alone
+                    if (gltfMaterial.alphaMode == "MASK") {
+                        const float alphaCutoff = static_cast<float>(gltfMaterial.alphaCutoff);
+                        const float alphaFactor = static_cast<float>(baseColor[3]);
+                        if (alphaFactor < alphaCutoff && albedoTexture == nullptr) {
+                            continue;
+                        }
+                        if (albedoTexture != nullptr) {
+                            material->SetAlphaCutoff(
+                                alphaFactor > 0.0f ? alphaCutoff / alphaFactor : FLT_MAX);
+                        }
+                    }
                 } else {
                     material = new Material();
                 }
 
-                ScopedRefPtr<Mesh> mesh = new Mesh(context, vertices, indices, material);
+                const std::string meshName =
+                    path + ":" + mesh.name + "#" + std::to_string(meshes.size());
+                const std::string jointsName = "JOINTS_0";
+                const std::string weightsName = "WEIGHTS_0";
+                const bool hasInfluences = attributes.find(jointsName) != attributes.end() &&
+                                           attributes.find(weightsName) != attributes.end();
+                std::vector<Mesh::JointInfluence> influences;
+                if (skin != nullptr && hasInfluences) {
+                    const tinygltf::Accessor& jointsAccessor =
+                        model.accessors[attributes.at(jointsName)];
+                    const tinygltf::Accessor& weightsAccessor =
+                        model.accessors[attributes.at(weightsName)];
+                    influences.resize(vertices.size());
+                    for (size_t vertexIndex = 0; vertexIndex < vertices.size(); ++vertexIndex) {
+                        for (uint32_t component = 0; component < 4; ++component) {
+                            influences[vertexIndex].joints[component] =
+                                static_cast<uint32_t>(ReadAccessorComponent(
+                                    model,
+                                    jointsAccessor,
+                                    vertexIndex,
+                                    component));
+                            influences[vertexIndex].weights[component] = ReadAccessorComponent(
+                                model,
+                                weightsAccessor,
+                                vertexIndex,
+                                component);
+                        }
+                    }
+                }
+
+                Mesh::Primitive meshPrimitive{
+                    .vertices = std::move(vertices),
+                    .indices = std::move(indices),
+                    .material = material};
+                std::vector<Mesh::Primitive> meshPrimitives;
+                if (material->GetAlphaCutoff() > 0.0f) {
+                    meshPrimitives = SplitByCoverage(
+                        std::move(meshPrimitive),
+                        *albedoImage,
+                        material->GetAlphaCutoff(),
+                        !influences.empty());
+                } else {
+                    meshPrimitives.push_back(std::move(meshPrimitive));
+                }
+                if (meshPrimitives.empty()) {
+                    continue;
+                }
+
+                const bool isDeformable = isSkinned || !primitive.targets.empty() ||
+                                          attributes.find(jointsName) != attributes.end();
+                Mesh::BuildPolicy meshBuildPolicy = Mesh::BuildPolicy::Static;
+                if (buildPolicy.has_value()) {
+                    meshBuildPolicy = *buildPolicy;
+                } else if (isDeformable) {
+                    const float deformation = MeasureDeformation(
+                        model,
+                        primitive,
+                        positions,
+                        isSkinned && hasInfluences ? &model.skins[it->skin] : nullptr);
+                    meshBuildPolicy = deformation > RebuildDeformation
+                                          ? Mesh::BuildPolicy::Rebuilt
+                                          : Mesh::BuildPolicy::Deformable;
+                }
+                ScopedRefPtr<Mesh> mesh = new Mesh(
+                    context,
+                    meshName,
+                    meshPrimitives,
+                    meshBuildPolicy,
+                    influences.empty() ? ScopedRefPtr<Skin>(nullptr) : skin,
+                    influences);
                 meshes.push_back(mesh);
             }
         }
 
-        return new Model(context, meshes);
+        return new Model(context, meshes, skin);
     }
     return nullptr;
 }
 
-Model::Model(ScopedRefPtr<Context> context, const std::vector<ScopedRefPtr<Mesh>>& meshes)
-    : mContext(context), mMeshes(meshes) {}
+Model::Model(
+    ScopedRefPtr<Context> context,
+    const std::vector<ScopedRefPtr<Mesh>>& meshes,
+    ScopedRefPtr<Skin> skin)
+    : mContext(context), mMeshes(meshes), mSkin(skin) {}
+
+void Model::Animate(float seconds) {
+    if (mSkin != nullptr) {
+        mSkin->SetTime(seconds);
+    }
+}
 
 std::vector<Mesh::Description> Model::GetDescriptions() const {
     std::vector<Mesh::Description> descriptions;
     for (const ScopedRefPtr<Mesh>& mesh : mMeshes) {
-        descriptions.push_back(mesh->GetDescription());
+        for (uint32_t geometryIndex = 0; geometryIndex < mesh->GetGeometryCount();
+             ++geometryIndex) {
+            descriptions.push_back(mesh->GetDescription(geometryIndex));
+        }
     }
     return descriptions;
 }
 
+std::vector<Material*> Model::GetMaterials() const {
+    std::vector<Material*> materials;
+    for (const ScopedRefPtr<Mesh>& mesh : mMeshes) {
+        for (const ScopedRefPtr<Material>& material : mesh->GetMaterials()) {
+            materials.push_back(material.Get());
+        }
+    }
+    return materials;
+}
+
 Model::~Model() {}
 
 }  // namespace VKRT
\ No newline at end of file
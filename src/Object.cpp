@@ -11,6 +11,8 @@ namespace VKRT {
 Object::Object(ScopedRefPtr<Model> model)
     : mModel(model),
       mTransform(1.0f),
+      mTransformDirty(false),
+      mVersion(0),
       mPosition(0.0f),
       mEulerRotation(0.0f),
       mScale(1.0f, 1.0f, 1.0f) {
@@ -19,30 +21,38 @@ Object::Object(ScopedRefPtr<Model> model)
 
 void Object::SetTranslation(const glm::vec3& position) {
     mPosition = position;
-    UpdateTransform();
+    MarkDirty();
 }
 
 void Object::Translate(const glm::vec3& delta) {
     mPosition += delta;
-    UpdateTransform();
+    MarkDirty();
 }
 
 void Object::Rotate(const glm::vec3& delta) {
     mEulerRotation += delta;
-    UpdateTransform();
+    MarkDirty();
 }
 
 void Object::Scale(const glm::vec3& delta) {
     mScale += delta;
-    UpdateTransform();
+    MarkDirty();
 }
 
 void Object::SetScale(const glm::vec3& scale) {
     mScale = scale;
-    UpdateTransform();
+    MarkDirty();
 }
 
-void Object::UpdateTransform() {
+void Object::MarkDirty() {
+    mTransformDirty = true;
+    ++mVersion;
+}
+
+const glm::mat4& Object::GetTransform() const {
+    if (!mTransformDirty) {
+        return mTransform;
+    }
     glm::mat4 translate = glm::translate(glm::mat4(1.0f), mPosition);
     glm::mat4 rotate = glm::eulerAngleYXZ(
         glm::radians(mEulerRotation.y),
@@ -50,6 +60,8 @@ void Object::UpdateTransform() {
         glm::radians(mEulerRotation.z));
     glm::mat4 scale = glm::scale(glm::mat4(1.0f), mScale);
     mTransform = translate * rotate * scale;
+    mTransformDirty = false;
+    return mTransform;
 }
 
 Object::~Object() {}
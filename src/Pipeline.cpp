@@ -1,5 +1,7 @@
 #include "Pipeline.h"
 
+#include <algorithm>
+#include <array>
 #include <unordered_map>
 
 #include "Context.h"
@@ -65,26 +67,44 @@ Pipeline::Pipeline(
     static const std::unordered_map<RayTracingStage, vk::ShaderStageFlagBits> rayTracingStageFlags{
         {RayTracingStage::Generate, vk::ShaderStageFlagBits::eRaygenKHR},
         {RayTracingStage::Hit, vk::ShaderStageFlagBits::eClosestHitKHR},
+        {RayTracingStage::Intersection, vk::ShaderStageFlagBits::eIntersectionKHR},
         {RayTracingStage::Miss, vk::ShaderStageFlagBits::eMissKHR},
         {RayTracingStage::ShadowMiss, vk::ShaderStageFlagBits::eMissKHR},
+        {RayTracingStage::AnyHit, vk::ShaderStageFlagBits::eAnyHitKHR},
     };
 
-    std::array<RayTracingStage, 4> stageOrder{
+    // Group order is what the tables below expect, the any-hit stage comes last without one
+    std::array<RayTracingStage, 6> stageOrder{
         RayTracingStage::Generate,
         RayTracingStage::Hit,
+        RayTracingStage::Intersection,
         RayTracingStage::Miss,
         RayTracingStage::ShadowMiss,
+        RayTracingStage::AnyHit,
     };
 
     std::vector<vk::PipelineShaderStageCreateInfo> stageCreateInfos;
     std::vector<vk::RayTracingShaderGroupCreateInfoKHR> rayTracingGroupCreateInfos;
     uint32_t shaderIndex = 0;
+    uint32_t closestHitShaderIndex = VK_SHADER_UNUSED_KHR;
+    uint32_t hitGroupCount = 0;
     for (const RayTracingStage stage : stageOrder) {
         if (mShaders.find(stage) != mShaders.end()) {
             stageCreateInfos.push_back(vk::PipelineShaderStageCreateInfo()
                                            .setPName("main")
                                            .setModule(mShaders.at(stage))
                                            .setStage(rayTracingStageFlags.at(stage)));
+            if (stage == RayTracingStage::AnyHit) {
+                auto hitGroup = std::find_if(
+                    rayTracingGroupCreateInfos.begin(),
+                    rayTracingGroupCreateInfos.end(),
+                    [](const vk::RayTracingShaderGroupCreateInfoKHR& group) {
+                        return group.type == vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup;
+                    });
+                VKRT_ASSERT(hitGroup != rayTracingGroupCreateInfos.end());
+                hitGroup->setAnyHitShader(shaderIndex++);
+                continue;
+            }
             vk::RayTracingShaderGroupCreateInfoKHR groupCreateInfo =
                 vk::RayTracingShaderGroupCreateInfoKHR()
                     .setAnyHitShader(VK_SHADER_UNUSED_KHR)
@@ -94,6 +114,13 @@ Pipeline::Pipeline(
             if (stage == RayTracingStage::Hit) {
                 groupCreateInfo.setType(vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup);
                 groupCreateInfo.setClosestHitShader(shaderIndex);
+                closestHitShaderIndex = shaderIndex;
+                ++hitGroupCount;
+            } else if (stage == RayTracingStage::Intersection) {
+                groupCreateInfo.setType(vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup);
+                groupCreateInfo.setClosestHitShader(closestHitShaderIndex);
+                groupCreateInfo.setIntersectionShader(shaderIndex);
+                ++hitGroupCount;
             } else {
                 groupCreateInfo.setGeneralShader(shaderIndex);
                 groupCreateInfo.setType(vk::RayTracingShaderGroupTypeKHR::eGeneral);
@@ -143,21 +170,29 @@ Pipeline::Pipeline(
             vk::BufferUsageFlagBits::eShaderBindingTableKHR |
                 vk::BufferUsageFlagBits::eShaderDeviceAddress,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::ShaderBindingTable, "Pipeline ray generation table"});
         uint8_t* rayGenTableData = mRayGenTable->MapBuffer();
         std::copy_n(shaderHandleStorage.begin(), mHandleSize, rayGenTableData);
         mRayGenTable->UnmapBuffer();
     }
 
+    // Handles come tightly packed, records are placed at the aligned stride
     {
         mRayHitTable = mContext->GetDevice()->CreateBuffer(
-            mHandleSize,
+            mHandleSizeAligned * hitGroupCount,
             vk::BufferUsageFlagBits::eShaderBindingTableKHR |
                 vk::BufferUsageFlagBits::eShaderDeviceAddress,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::ShaderBindingTable, "Pipeline hit table"});
         uint8_t* rayHitTableData = mRayHitTable->MapBuffer();
-        std::copy_n(shaderHandleStorage.begin() + mHandleSizeAligned, mHandleSize, rayHitTableData);
+        for (uint32_t hitGroup = 0; hitGroup < hitGroupCount; ++hitGroup) {
+            std::copy_n(
+                shaderHandleStorage.begin() + mHandleSize * (1 + hitGroup),
+                mHandleSize,
+                rayHitTableData + mHandleSizeAligned * hitGroup);
+        }
         mRayHitTable->UnmapBuffer();
     }
 
@@ -171,16 +206,19 @@ Pipeline::Pipeline(
 
     {
         mRayMissTable = mContext->GetDevice()->CreateBuffer(
-            mHandleSize * missTableCount,
+            mHandleSizeAligned * missTableCount,
             vk::BufferUsageFlagBits::eShaderBindingTableKHR |
                 vk::BufferUsageFlagBits::eShaderDeviceAddress,
             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::ShaderBindingTable, "Pipeline miss table"});
         uint8_t* rayMissTableData = mRayMissTable->MapBuffer();
-        std::copy_n(
-            shaderHandleStorage.begin() + mHandleSizeAligned * missTableCount,
-            mHandleSize * missTableCount,
-            rayMissTableData);
+        for (uint32_t missGroup = 0; missGroup < missTableCount; ++missGroup) {
+            std::copy_n(
+                shaderHandleStorage.begin() + mHandleSize * (1 + hitGroupCount + missGroup),
+                mHandleSize,
+                rayMissTableData + mHandleSizeAligned * missGroup);
+        }
         mRayMissTable->UnmapBuffer();
     }
 
@@ -191,7 +229,7 @@ Pipeline::Pipeline(
                       .setStride(mHandleSizeAligned),
         .rayHit = vk::StridedDeviceAddressRegionKHR()
                       .setDeviceAddress(mRayHitTable->GetDeviceAddress())
-                      .setSize(mHandleSizeAligned)
+                      .setSize(mHandleSizeAligned * hitGroupCount)
                       .setStride(mHandleSizeAligned),
         .rayMiss = vk::StridedDeviceAddressRegionKHR()
                        .setDeviceAddress(mRayMissTable->GetDeviceAddress())
@@ -19,12 +19,16 @@ ProbeGrid::ProbeGrid(ScopedRefPtr<Context> context)
         verticalResolution,
         layerCount,
         vk::Format::eR16G16B16A16Sfloat,
-        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage);
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage,
+        nullptr,
+        "Probe grid");
 
     mProbeGridBuffer = mContext->GetDevice()->CreateBuffer(
         sizeof(ProbeGrid::UniformData),
         vk::BufferUsageFlagBits::eUniformBuffer,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        {},
+        {MemoryCategory::Uniform, "Probe grid"});
 }
 
 void ProbeGrid::UpdateData() {
@@ -4,17 +4,19 @@ namespace VKRT {
 RefCountPtr::RefCountPtr() : refCount(0) {}
 
 void RefCountPtr::AddRef() {
-    ++refCount;
+    refCount.fetch_add(1, std::memory_order_relaxed);
 }
 
 uint32_t RefCountPtr::Release() {
-    refCount--;
-    if (refCount == 0) {
-        delete this;
-        return 0;
-    } else {
-        return refCount;
+    const uint32_t remaining = refCount.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    if (remaining == 0) {
+        OnLastReference();
     }
+    return remaining;
+}
+
+void RefCountPtr::OnLastReference() {
+    delete this;
 }
 
 }  // namespace VKRT
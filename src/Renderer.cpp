@@ -1,11 +1,32 @@
 #include "Renderer.h"
 
+#include <array>
+
+#include "AllocationCounter.h"
+#include "BLASBuilder.h"
+#include "BLASCache.h"
+#include "BLASCompactor.h"
 #include "DebugUtils.h"
+#include "GeometryPool.h"
+#include "ResidencyManager.h"
+#include "ScratchAllocator.h"
 #include "Texture.h"
 
 namespace VKRT {
+
+enum TimestampQuery : uint32_t {
+    MainPassBegin = 0,
+    MainPassEnd,
+    TLASBuildBegin,
+    TLASBuildEnd,
+    TimestampQueryCount
+};
+
 Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
-    : mContext(context), mScene(scene) {
+    : mContext(context),
+      mScene(scene),
+      mFrameStatistics{},
+      mFrameIndex(0) {
     constexpr uint32_t MaxBoundTextures = 64;
     {
         std::vector<Pipeline::Descriptor> descriptors{
@@ -21,7 +42,8 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
                 .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eStorageBuffer,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eUniformBuffer,
                 .stageFlags =
@@ -31,13 +53,24 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
                 .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eSampler,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eStorageBuffer,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
+            Pipeline::Descriptor{
+                .type = vk::DescriptorType::eStorageBuffer,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
+            Pipeline::Descriptor{
+                .type = vk::DescriptorType::eStorageBuffer,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eSampledImage,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR,
                 .count = MaxBoundTextures,
                 .variableCount = true},
         };
@@ -47,6 +80,8 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
             {RayTracingStage::Hit, Resource::Id::HitShader},
             {RayTracingStage::Miss, Resource::Id::MissShader},
             {RayTracingStage::ShadowMiss, Resource::Id::ShadowMissShader},
+            {RayTracingStage::Intersection, Resource::Id::SphereIntersectionShader},
+            {RayTracingStage::AnyHit, Resource::Id::AlphaTestShader},
         };
 
         mMainPassPipeline = new Pipeline(context, descriptors, stages);
@@ -66,7 +101,8 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
                 .stageFlags = vk::ShaderStageFlagBits::eRaygenKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eStorageBuffer,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eUniformBuffer,
                 .stageFlags =
@@ -76,13 +112,24 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
                 .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eSampler,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eStorageBuffer,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR},
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
+            Pipeline::Descriptor{
+                .type = vk::DescriptorType::eStorageBuffer,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
+            Pipeline::Descriptor{
+                .type = vk::DescriptorType::eStorageBuffer,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR},
             Pipeline::Descriptor{
                 .type = vk::DescriptorType::eSampledImage,
-                .stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR,
+                .stageFlags =
+                    vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eAnyHitKHR,
                 .count = MaxBoundTextures,
                 .variableCount = true},
         };
@@ -92,16 +139,42 @@ Renderer::Renderer(ScopedRefPtr<Context> context, ScopedRefPtr<Scene> scene)
             {RayTracingStage::Hit, Resource::Id::ProbeHitShader},
             {RayTracingStage::Miss, Resource::Id::ProbeMissShader},
             {RayTracingStage::ShadowMiss, Resource::Id::ProbeShadowMissShader},
+            {RayTracingStage::Intersection, Resource::Id::SphereIntersectionShader},
+            {RayTracingStage::AnyHit, Resource::Id::AlphaTestShader},
         };
 
         mProbeUpdatePipeline = new Pipeline(context, descriptors, stages);
 
         mProbeGrid = new ProbeGrid(context);
+        // The grid doesn't move, written once rather than under the frames in flight
+        mProbeGrid->UpdateData();
     }
 
+    mSkinningPass = new SkinningPass(context);
+
     CreateStorageImage();
-    CreateUniformBuffer();
+    mFrames.resize(mContext->GetFramesInFlight());
+    for (Frame& frame : mFrames) {
+        frame.commandBuffer = mContext->GetDevice()->CreateCommandBuffer();
+        frame.acquireSemaphore = VKRT_ASSERT_VK(
+            mContext->GetDevice()->GetLogicalDevice().createSemaphore(vk::SemaphoreCreateInfo{}));
+        frame.ticket = 0;
+        frame.meshDescriptionVersion = 0;
+        CreateUniformBuffer(frame);
+    }
     CreateMaterialUniforms();
+
+    {
+        vk::QueryPoolCreateInfo queryPoolCreateInfo =
+            vk::QueryPoolCreateInfo()
+                .setQueryType(vk::QueryType::eTimestamp)
+                .setQueryCount(TimestampQueryCount * static_cast<uint32_t>(mFrames.size()));
+        mTimestampQueryPool = VKRT_ASSERT_VK(
+            mContext->GetDevice()->GetLogicalDevice().createQueryPool(queryPoolCreateInfo));
+        const vk::PhysicalDeviceLimits limits = mContext->GetDevice()->GetDeviceProperties().limits;
+        mTimestampPeriod = static_cast<double>(limits.timestampPeriod);
+        mTimestampMask = mContext->GetDevice()->GetTimestampMask();
+    }
 }
 
 void Renderer::CreateStorageImage() {
@@ -117,7 +190,9 @@ void Renderer::CreateStorageImage() {
         swapchainWidth,
         swapchainHeight,
         swapchainFormat,
-        vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eStorage);
+        vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eStorage,
+        nullptr,
+        "Render target");
 
     vk::CommandBuffer commandBuffer = mContext->GetDevice()->CreateCommandBuffer();
     VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
@@ -137,38 +212,38 @@ struct LightMetadata {
     glm::vec3 sunDir;
 };
 
-void Renderer::CreateUniformBuffer() {
+void Renderer::CreateUniformBuffer(Frame& frame) {
     {
-        mCameraUniformBuffer = mContext->GetDevice()->CreateBuffer(
+        frame.cameraUniformBuffer = mContext->GetDevice()->CreateBuffer(
             sizeof(UniformData),
             vk::BufferUsageFlagBits::eUniformBuffer,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            {},
+            {MemoryCategory::Uniform, "Camera"});
     }
 
     {
-        const std::vector<Mesh::Description> descriptions = mScene->GetDescriptions();
-        const size_t descriptionsBufferSize = sizeof(Mesh::Description) * descriptions.size();
-        mSceneUniformBuffer = mContext->GetDevice()->CreateBuffer(
-            descriptionsBufferSize,
+        const std::span<Mesh::Description> descriptions = mScene->GetDescriptions(mFrameArena);
+        frame.sceneUniformBuffer = mContext->GetDevice()->CreateBuffer(
+            descriptions.size_bytes(),
             vk::BufferUsageFlagBits::eStorageBuffer,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        uint8_t* buffer = mSceneUniformBuffer->MapBuffer();
-        std::copy_n(
-            reinterpret_cast<const uint8_t*>(descriptions.data()),
-            descriptionsBufferSize,
-            buffer);
-        mSceneUniformBuffer->UnmapBuffer();
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            {},
+            {MemoryCategory::Uniform, "Mesh descriptions"});
+        WriteMeshDescriptions(frame);
     }
 
     {
-        const std::vector<Light::Proxy> lightProxies = mScene->GetLightDescriptions();
+        const std::span<Light::Proxy> lightProxies = mScene->GetLightDescriptions(mFrameArena);
         {
-            mLightMetadataUniformBuffer = mContext->GetDevice()->CreateBuffer(
+            frame.lightMetadataUniformBuffer = mContext->GetDevice()->CreateBuffer(
                 sizeof(LightMetadata),
                 vk::BufferUsageFlagBits::eUniformBuffer,
                 vk::MemoryPropertyFlagBits::eHostVisible |
-                    vk::MemoryPropertyFlagBits::eHostCoherent);
-            uint8_t* buffer = mLightMetadataUniformBuffer->MapBuffer();
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                {},
+                {MemoryCategory::Uniform, "Light metadata"});
+            uint8_t* buffer = frame.lightMetadataUniformBuffer->MapBuffer();
             auto sunIt = std::find_if(
                 lightProxies.begin(),
                 lightProxies.end(),
@@ -180,22 +255,24 @@ void Renderer::CreateUniformBuffer() {
                 .sunDir = sunDirection,
             };
             std::copy_n(reinterpret_cast<const uint8_t*>(&data), sizeof(LightMetadata), buffer);
-            mLightMetadataUniformBuffer->UnmapBuffer();
+            frame.lightMetadataUniformBuffer->UnmapBuffer();
         }
 
         {
-            const size_t lightProxiesBufferSize = sizeof(Light::Proxy) * lightProxies.size();
-            mLightUniformBuffer = mContext->GetDevice()->CreateBuffer(
+            const size_t lightProxiesBufferSize = lightProxies.size_bytes();
+            frame.lightUniformBuffer = mContext->GetDevice()->CreateBuffer(
                 lightProxiesBufferSize,
                 vk::BufferUsageFlagBits::eStorageBuffer,
                 vk::MemoryPropertyFlagBits::eHostVisible |
-                    vk::MemoryPropertyFlagBits::eHostCoherent);
-            uint8_t* buffer = mLightUniformBuffer->MapBuffer();
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                {},
+                {MemoryCategory::Uniform, "Lights"});
+            uint8_t* buffer = frame.lightUniformBuffer->MapBuffer();
             std::copy_n(
                 reinterpret_cast<const uint8_t*>(lightProxies.data()),
                 lightProxiesBufferSize,
                 buffer);
-            mLightUniformBuffer->UnmapBuffer();
+            frame.lightUniformBuffer->UnmapBuffer();
         }
     }
 }
@@ -223,19 +300,19 @@ void Renderer::CreateMaterialUniforms() {
     }
 }
 
-void Renderer::UpdateCameraUniforms(Camera* camera) {
-    uint8_t* buffer = mCameraUniformBuffer->MapBuffer();
+void Renderer::UpdateCameraUniforms(Frame& frame, Camera* camera) {
+    uint8_t* buffer = frame.cameraUniformBuffer->MapBuffer();
     UniformData cameraMatrices{
         .viewInverse = glm::inverse(camera->GetViewTransform()),
         .projInverse = glm::inverse(camera->GetProjectionTransform())};
     std::copy_n(reinterpret_cast<uint8_t*>(&cameraMatrices), sizeof(UniformData), buffer);
-    mCameraUniformBuffer->UnmapBuffer();
+    frame.cameraUniformBuffer->UnmapBuffer();
 }
 
-void Renderer::UpdateLightUniforms() {
-    const std::vector<Light::Proxy> lightProxies = mScene->GetLightDescriptions();
+void Renderer::UpdateLightUniforms(Frame& frame) {
+    const std::span<Light::Proxy> lightProxies = mScene->GetLightDescriptions(mFrameArena);
     {
-        uint8_t* buffer = mLightMetadataUniformBuffer->MapBuffer();
+        uint8_t* buffer = frame.lightMetadataUniformBuffer->MapBuffer();
         auto sunIt =
             std::find_if(lightProxies.begin(), lightProxies.end(), [](const Light::Proxy& proxy) {
                 return proxy.type == Light::Type::Directional;
@@ -247,113 +324,144 @@ void Renderer::UpdateLightUniforms() {
             .sunDir = sunDirection,
         };
         std::copy_n(reinterpret_cast<const uint8_t*>(&data), sizeof(LightMetadata), buffer);
-        mLightMetadataUniformBuffer->UnmapBuffer();
+        frame.lightMetadataUniformBuffer->UnmapBuffer();
     }
 
     {
-        const size_t lightProxiesBufferSize = sizeof(Light::Proxy) * lightProxies.size();
-        if (lightProxiesBufferSize != mLightUniformBuffer->GetBufferSize()) {
-            mLightUniformBuffer = mContext->GetDevice()->CreateBuffer(
+        const size_t lightProxiesBufferSize = lightProxies.size_bytes();
+        if (lightProxiesBufferSize != frame.lightUniformBuffer->GetBufferSize()) {
+            frame.lightUniformBuffer = mContext->GetDevice()->CreateBuffer(
                 lightProxiesBufferSize,
                 vk::BufferUsageFlagBits::eUniformBuffer,
                 vk::MemoryPropertyFlagBits::eHostVisible |
-                    vk::MemoryPropertyFlagBits::eHostCoherent);
-            uint8_t* buffer = mLightUniformBuffer->MapBuffer();
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                {},
+                {MemoryCategory::Uniform, "Lights"});
+            uint8_t* buffer = frame.lightUniformBuffer->MapBuffer();
             std::copy_n(
                 reinterpret_cast<const uint8_t*>(lightProxies.data()),
                 lightProxiesBufferSize,
                 buffer);
-            mLightUniformBuffer->UnmapBuffer();
+            frame.lightUniformBuffer->UnmapBuffer();
             vk::WriteDescriptorSet lightUniformBufferWrite =
                 vk::WriteDescriptorSet()
-                    .setDstSet(mDescriptorSet)
+                    .setDstSet(frame.descriptorSet)
                     .setDstBinding(5)
                     .setDescriptorCount(1)
                     .setDescriptorType(vk::DescriptorType::eStorageBuffer)
-                    .setBufferInfo(mLightUniformBuffer->GetDescriptorInfo());
+                    .setBufferInfo(frame.lightUniformBuffer->GetDescriptorInfo());
             vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
             logicalDevice.updateDescriptorSets(lightUniformBufferWrite, nullptr);
         }
-        uint8_t* buffer = mLightUniformBuffer->MapBuffer();
+        uint8_t* buffer = frame.lightUniformBuffer->MapBuffer();
         std::copy_n(
             reinterpret_cast<const uint8_t*>(lightProxies.data()),
             lightProxiesBufferSize,
             buffer);
-        mLightUniformBuffer->UnmapBuffer();
+        frame.lightUniformBuffer->UnmapBuffer();
     }
 }
 
-void Renderer::UpdateMaterialUniforms(const Scene::SceneMaterials& materialInfo) {
+void Renderer::UpdateMaterialUniforms(Frame& frame, const Scene::SceneMaterials& materialInfo) {
     {
-        const size_t materialBufferSize =
-            sizeof(Scene::MaterialProxy) * materialInfo.materials.size();
-        if (mMaterialsBuffer == nullptr ||
-            materialBufferSize != mMaterialsBuffer->GetBufferSize()) {
-            mMaterialsBuffer = mContext->GetDevice()->CreateBuffer(
+        const size_t materialBufferSize = materialInfo.materials.size_bytes();
+        if (frame.materialsBuffer == nullptr ||
+            materialBufferSize != frame.materialsBuffer->GetBufferSize()) {
+            frame.materialsBuffer = mContext->GetDevice()->CreateBuffer(
                 materialBufferSize,
                 vk::BufferUsageFlagBits::eStorageBuffer,
                 vk::MemoryPropertyFlagBits::eHostVisible |
-                    vk::MemoryPropertyFlagBits::eHostCoherent);
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                {},
+                {MemoryCategory::Uniform, "Materials"});
         }
-        uint8_t* buffer = mMaterialsBuffer->MapBuffer();
+        uint8_t* buffer = frame.materialsBuffer->MapBuffer();
         std::copy_n(
             reinterpret_cast<const uint8_t*>(materialInfo.materials.data()),
             materialBufferSize,
             buffer);
-        mMaterialsBuffer->UnmapBuffer();
+        frame.materialsBuffer->UnmapBuffer();
     }
 }
 
-void Renderer::CreateDescriptors(const Scene::SceneMaterials& materialInfo) {
+void Renderer::ReadTimestamps(uint32_t frameSlot) {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
-    {
-        vk::DescriptorPoolCreateInfo poolCreateInfo =
-            vk::DescriptorPoolCreateInfo()
-                .setPoolSizes(mMainPassPipeline->GetDescriptorSizes())
-                .setMaxSets(1);
-        mDescriptorPool = VKRT_ASSERT_VK(logicalDevice.createDescriptorPool(poolCreateInfo));
-
-        std::vector<uint32_t> descriptorCounts{static_cast<uint32_t>(materialInfo.textures.size())};
-        vk::DescriptorSetVariableDescriptorCountAllocateInfo dynamicCountInfo =
-            vk::DescriptorSetVariableDescriptorCountAllocateInfo().setDescriptorCounts(
-                descriptorCounts);
-
-        vk::DescriptorSetAllocateInfo descriptorAllocateInfo =
-            vk::DescriptorSetAllocateInfo()
-                .setDescriptorPool(mDescriptorPool)
-                .setSetLayouts(mMainPassPipeline->GetDescriptorLayout())
-                .setPNext(&dynamicCountInfo);
-        mDescriptorSet = VKRT_ASSERT_VK(logicalDevice.allocateDescriptorSets(
-                                            descriptorAllocateInfo,
-                                            mContext->GetDevice()->GetDispatcher()))
-                             .front();
+    std::array<uint64_t, TimestampQueryCount> timestamps;
+    const vk::Result result = logicalDevice.getQueryPoolResults(
+        mTimestampQueryPool,
+        frameSlot * TimestampQueryCount,
+        TimestampQueryCount,
+        sizeof(timestamps),
+        timestamps.data(),
+        sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64);
+    if (result == vk::Result::eSuccess) {
+        // Masked again so a counter wrapping between the two still gives the elapsed ticks
+        const auto elapsedTicks = [&](TimestampQuery begin, TimestampQuery end) {
+            return static_cast<double>(
+                ((timestamps[end] & mTimestampMask) - (timestamps[begin] & mTimestampMask)) &
+                mTimestampMask);
+        };
+        const double mainPassNanoseconds =
+            elapsedTicks(MainPassBegin, MainPassEnd) * mTimestampPeriod;
+        const vk::Extent2D& imageSize = mContext->GetSwapchain()->GetExtent();
+        const double primaryRayCount = static_cast<double>(imageSize.width * imageSize.height);
+        mFrameStatistics.mainPassMilliseconds = mainPassNanoseconds / 1000000.0;
+        mFrameStatistics.tlasBuildMilliseconds =
+            elapsedTicks(TLASBuildBegin, TLASBuildEnd) * mTimestampPeriod / 1000000.0;
+        mFrameStatistics.primaryRaysPerSecond =
+            mainPassNanoseconds > 0.0 ? primaryRayCount / (mainPassNanoseconds / 1000000000.0)
+                                      : 0.0;
     }
+}
 
-    {
+void Renderer::CreateDescriptors(const Scene::SceneMaterials& materialInfo) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const uint32_t frameCount = static_cast<uint32_t>(mFrames.size());
+    // A set per frame in flight, sets in use by the device can't be updated
+    const auto createPool = [&](const Pipeline* pipeline) {
+        std::vector<vk::DescriptorPoolSize> poolSizes = pipeline->GetDescriptorSizes();
+        for (vk::DescriptorPoolSize& poolSize : poolSizes) {
+            poolSize.descriptorCount *= frameCount;
+        }
         vk::DescriptorPoolCreateInfo poolCreateInfo =
-            vk::DescriptorPoolCreateInfo()
-                .setPoolSizes(mProbeUpdatePipeline->GetDescriptorSizes())
-                .setMaxSets(1);
-        mProbeDescriptorPool = VKRT_ASSERT_VK(logicalDevice.createDescriptorPool(poolCreateInfo));
-
-        std::vector<uint32_t> descriptorCounts{static_cast<uint32_t>(materialInfo.textures.size())};
+            vk::DescriptorPoolCreateInfo().setPoolSizes(poolSizes).setMaxSets(frameCount);
+        return VKRT_ASSERT_VK(logicalDevice.createDescriptorPool(poolCreateInfo));
+    };
+    const auto allocateSets = [&](const Pipeline* pipeline, vk::DescriptorPool pool) {
+        std::vector<uint32_t> descriptorCounts(
+            frameCount,
+            static_cast<uint32_t>(materialInfo.textures.size()));
         vk::DescriptorSetVariableDescriptorCountAllocateInfo dynamicCountInfo =
             vk::DescriptorSetVariableDescriptorCountAllocateInfo().setDescriptorCounts(
                 descriptorCounts);
 
+        const std::vector<vk::DescriptorSetLayout> layouts(
+            frameCount,
+            pipeline->GetDescriptorLayout());
         vk::DescriptorSetAllocateInfo descriptorAllocateInfo =
             vk::DescriptorSetAllocateInfo()
-                .setDescriptorPool(mProbeDescriptorPool)
-                .setSetLayouts(mProbeUpdatePipeline->GetDescriptorLayout())
+                .setDescriptorPool(pool)
+                .setSetLayouts(layouts)
                 .setPNext(&dynamicCountInfo);
-        mProbeDescriptorSet = VKRT_ASSERT_VK(logicalDevice.allocateDescriptorSets(
-                                                 descriptorAllocateInfo,
-                                                 mContext->GetDevice()->GetDispatcher()))
-                                  .front();
+        return VKRT_ASSERT_VK(logicalDevice.allocateDescriptorSets(
+            descriptorAllocateInfo,
+            mContext->GetDevice()->GetDispatcher()));
+    };
+
+    mDescriptorPool = createPool(mMainPassPipeline);
+    const std::vector<vk::DescriptorSet> descriptorSets =
+        allocateSets(mMainPassPipeline, mDescriptorPool);
+    mProbeDescriptorPool = createPool(mProbeUpdatePipeline);
+    const std::vector<vk::DescriptorSet> probeDescriptorSets =
+        allocateSets(mProbeUpdatePipeline, mProbeDescriptorPool);
+    for (uint32_t frameSlot = 0; frameSlot < frameCount; ++frameSlot) {
+        mFrames[frameSlot].descriptorSet = descriptorSets[frameSlot];
+        mFrames[frameSlot].probeDescriptorSet = probeDescriptorSets[frameSlot];
     }
 }
 
-void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
+void Renderer::UpdateDescriptors(Frame& frame, const Scene::SceneMaterials& materialInfo) {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
 
     vk::WriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo =
@@ -361,7 +469,7 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
             mScene->GetTLAS());
     vk::WriteDescriptorSet accelerationStructureWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(0)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eAccelerationStructureKHR)
@@ -371,7 +479,7 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
                                                    .setImageView(mStorageTexture->GetImageView())
                                                    .setImageLayout(vk::ImageLayout::eGeneral);
     vk::WriteDescriptorSet imageWrite = vk::WriteDescriptorSet()
-                                            .setDstSet(mDescriptorSet)
+                                            .setDstSet(frame.descriptorSet)
                                             .setDstBinding(1)
                                             .setDescriptorCount(1)
                                             .setDescriptorType(vk::DescriptorType::eStorageImage)
@@ -379,39 +487,39 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
 
     vk::WriteDescriptorSet cameraUniformBufferWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(2)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-            .setBufferInfo(mCameraUniformBuffer->GetDescriptorInfo());
+            .setBufferInfo(frame.cameraUniformBuffer->GetDescriptorInfo());
 
     vk::WriteDescriptorSet sceneUniformBufferWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(3)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eStorageBuffer)
-            .setBufferInfo(mSceneUniformBuffer->GetDescriptorInfo());
+            .setBufferInfo(frame.sceneUniformBuffer->GetDescriptorInfo());
 
     vk::WriteDescriptorSet lightMetadataUniformBufferWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(4)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-            .setBufferInfo(mLightMetadataUniformBuffer->GetDescriptorInfo());
+            .setBufferInfo(frame.lightMetadataUniformBuffer->GetDescriptorInfo());
 
     vk::WriteDescriptorSet lightUniformBufferWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(5)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eStorageBuffer)
-            .setBufferInfo(mLightUniformBuffer->GetDescriptorInfo());
+            .setBufferInfo(frame.lightUniformBuffer->GetDescriptorInfo());
 
     auto sampler = vk::DescriptorImageInfo().setSampler(mTextureSampler);
     vk::WriteDescriptorSet samplerWrite = vk::WriteDescriptorSet()
-                                              .setDstSet(mDescriptorSet)
+                                              .setDstSet(frame.descriptorSet)
                                               .setDstBinding(6)
                                               .setDescriptorCount(1)
                                               .setDescriptorType(vk::DescriptorType::eSampler)
@@ -419,30 +527,50 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
 
     vk::WriteDescriptorSet materialsWrite =
         vk::WriteDescriptorSet()
-            .setDstSet(mDescriptorSet)
+            .setDstSet(frame.descriptorSet)
             .setDstBinding(7)
             .setDescriptorCount(1)
             .setDescriptorType(vk::DescriptorType::eStorageBuffer)
-            .setBufferInfo(mMaterialsBuffer->GetDescriptorInfo());
-
-    std::vector<vk::DescriptorImageInfo> imageInfos;
-    for (const Texture* texture : materialInfo.textures) {
-        imageInfos.push_back(vk::DescriptorImageInfo()
-                                 .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-                                 .setImageView(texture->GetImageView())
-                                 .setSampler(nullptr));
-    }
+            .setBufferInfo(frame.materialsBuffer->GetDescriptorInfo());
 
-    vk::WriteDescriptorSet texturesWrite = vk::WriteDescriptorSet()
-                                               .setDstSet(mDescriptorSet)
-                                               .setDstBinding(8)
-                                               .setDescriptorType(vk::DescriptorType::eSampledImage)
-                                               .setImageInfo(imageInfos)
-                                               .setDstArrayElement(0)
-                                               .setPBufferInfo(nullptr)
-                                               .setPTexelBufferView(nullptr);
+    GeometryPool* geometryPool = mContext->GetGeometryPool();
+    vk::WriteDescriptorSet verticesWrite =
+        vk::WriteDescriptorSet()
+            .setDstSet(frame.descriptorSet)
+            .setDstBinding(8)
+            .setDescriptorCount(1)
+            .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+            .setBufferInfo(geometryPool->GetVertexBuffer()->GetDescriptorInfo());
 
-    std::vector<vk::WriteDescriptorSet> writeDescriptorSets{
+    vk::WriteDescriptorSet indicesWrite =
+        vk::WriteDescriptorSet()
+            .setDstSet(frame.descriptorSet)
+            .setDstBinding(9)
+            .setDescriptorCount(1)
+            .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+            .setBufferInfo(geometryPool->GetIndexBuffer()->GetDescriptorInfo());
+
+    std::span<vk::DescriptorImageInfo> imageInfos =
+        mFrameArena.Allocate<vk::DescriptorImageInfo>(materialInfo.textures.size());
+    for (size_t index = 0; index < imageInfos.size(); ++index) {
+        imageInfos[index] = vk::DescriptorImageInfo()
+                                .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+                                .setImageView(materialInfo.textures[index]->GetImageView())
+                                .setSampler(nullptr);
+    }
+
+    vk::WriteDescriptorSet texturesWrite =
+        vk::WriteDescriptorSet()
+            .setDstSet(frame.descriptorSet)
+            .setDstBinding(10)
+            .setDescriptorType(vk::DescriptorType::eSampledImage)
+            .setDescriptorCount(static_cast<uint32_t>(imageInfos.size()))
+            .setPImageInfo(imageInfos.data())
+            .setDstArrayElement(0)
+            .setPBufferInfo(nullptr)
+            .setPTexelBufferView(nullptr);
+
+    const std::array writeDescriptorSets{
         accelerationStructureWrite,
         imageWrite,
         cameraUniformBufferWrite,
@@ -451,12 +579,14 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
         lightUniformBufferWrite,
         samplerWrite,
         materialsWrite,
+        verticesWrite,
+        indicesWrite,
         texturesWrite};
 
     logicalDevice.updateDescriptorSets(writeDescriptorSets, {});
 
     {
-        accelerationStructureWrite.setDstSet(mProbeDescriptorSet);
+        accelerationStructureWrite.setDstSet(frame.probeDescriptorSet);
 
         vk::DescriptorImageInfo storageImageInfo =
             vk::DescriptorImageInfo()
@@ -464,7 +594,7 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
                 .setImageLayout(vk::ImageLayout::eGeneral);
         vk::WriteDescriptorSet imageWrite =
             vk::WriteDescriptorSet()
-                .setDstSet(mProbeDescriptorSet)
+                .setDstSet(frame.probeDescriptorSet)
                 .setDstBinding(1)
                 .setDescriptorCount(1)
                 .setDescriptorType(vk::DescriptorType::eStorageImage)
@@ -472,20 +602,22 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
 
         vk::WriteDescriptorSet probeGridUniformBuffer =
             vk::WriteDescriptorSet()
-                .setDstSet(mProbeDescriptorSet)
+                .setDstSet(frame.probeDescriptorSet)
                 .setDstBinding(2)
                 .setDescriptorCount(1)
                 .setDescriptorType(vk::DescriptorType::eUniformBuffer)
                 .setBufferInfo(mProbeGrid->GetDescriptionBuffer()->GetDescriptorInfo());
 
-        sceneUniformBufferWrite.setDstSet(mProbeDescriptorSet);
-        lightMetadataUniformBufferWrite.setDstSet(mProbeDescriptorSet);
-        lightUniformBufferWrite.setDstSet(mProbeDescriptorSet);
-        samplerWrite.setDstSet(mProbeDescriptorSet);
-        materialsWrite.setDstSet(mProbeDescriptorSet);
-        texturesWrite.setDstSet(mProbeDescriptorSet);
+        sceneUniformBufferWrite.setDstSet(frame.probeDescriptorSet);
+        lightMetadataUniformBufferWrite.setDstSet(frame.probeDescriptorSet);
+        lightUniformBufferWrite.setDstSet(frame.probeDescriptorSet);
+        samplerWrite.setDstSet(frame.probeDescriptorSet);
+        materialsWrite.setDstSet(frame.probeDescriptorSet);
+        verticesWrite.setDstSet(frame.probeDescriptorSet);
+        indicesWrite.setDstSet(frame.probeDescriptorSet);
+        texturesWrite.setDstSet(frame.probeDescriptorSet);
 
-        std::vector<vk::WriteDescriptorSet> probeWriteDescriptorSets{
+        const std::array probeWriteDescriptorSets{
             accelerationStructureWrite,
             imageWrite,
             probeGridUniformBuffer,
@@ -494,30 +626,92 @@ void Renderer::UpdateDescriptors(const Scene::SceneMaterials& materialInfo) {
             lightUniformBufferWrite,
             samplerWrite,
             materialsWrite,
+            verticesWrite,
+            indicesWrite,
             texturesWrite};
 
         logicalDevice.updateDescriptorSets(probeWriteDescriptorSets, {});
     }
 }
 
+void Renderer::WriteMeshDescriptions(Frame& frame) {
+    const std::span<Mesh::Description> descriptions = mScene->GetDescriptions(mFrameArena);
+    uint8_t* buffer = frame.sceneUniformBuffer->MapBuffer();
+    std::copy_n(
+        reinterpret_cast<const uint8_t*>(descriptions.data()),
+        descriptions.size_bytes(),
+        buffer);
+    frame.sceneUniformBuffer->UnmapBuffer();
+    frame.meshDescriptionVersion = mContext->GetResidencyManager()->GetVersion();
+}
+
 void Renderer::Render(Camera* camera) {
-    mContext->GetSwapchain()->AcquireNextImage();
-    vk::CommandBuffer commandBuffer = mContext->GetDevice()->CreateCommandBuffer();
+    mFrameArena.Reset();
+    // The previous call waited for the frame that last used the slot
+    const uint32_t frameSlot = mContext->GetFrameSlot();
+    Frame& frame = mFrames[frameSlot];
+    const uint32_t firstQuery = frameSlot * TimestampQueryCount;
+    // Evictions and replaced structures are still referenced by what the frame records
+    mContext->GetDevice()->BeginRecording();
+    // Streaming allocates, it happens before the frame's allocations are counted
+    ResidencyManager* residency = mContext->GetResidencyManager();
+    residency->SetViewPosition(glm::vec3(glm::inverse(camera->GetViewTransform())[3]));
+    residency->Update();
+    if (residency->GetVersion() != frame.meshDescriptionVersion) {
+        WriteMeshDescriptions(frame);
+    }
+#ifdef VKRT_TRACK_ALLOCATIONS
+    const uint64_t allocationCount = GetThreadAllocationCount();
+#endif
+
+    mContext->GetSwapchain()->AcquireNextImage(frame.acquireSemaphore);
+    vk::CommandBuffer& commandBuffer = frame.commandBuffer;
     {
         VKRT_ASSERT_VK(commandBuffer.begin(vk::CommandBufferBeginInfo{}));
+        // The TLAS, build scratch, render target and probes are shared by every frame, the ones
+        // still in flight have to be done with them
+        const vk::MemoryBarrier frameBarrier =
+            vk::MemoryBarrier()
+                .setSrcAccessMask(vk::AccessFlagBits::eMemoryWrite)
+                .setDstAccessMask(
+                    vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAllCommands,
+            vk::PipelineStageFlagBits::eAllCommands,
+            {},
+            frameBarrier,
+            {},
+            {});
+        commandBuffer.resetQueryPool(mTimestampQueryPool, firstQuery, TimestampQueryCount);
 
         // Create and update all buffers and textures
         {
+            // Compacted structures have new addresses, the TLAS build below picks them up. Only
+            // sizes queried by earlier submissions are read, before new builds add queries
+            mContext->GetBLASCompactor()->RecordCompaction(commandBuffer);
+            // Serializes structures that are final after compaction into the disk cache
+            mContext->GetBLASCache()->RecordStores(commandBuffer);
+            // Queues the refits of the skinned meshes it deforms
+            mSkinningPass->Record(commandBuffer, mScene.Get());
+            mContext->GetBLASBuilder()->RecordBuilds(commandBuffer);
+            // Written once the BLAS builds before the barrier are done, so they aren't counted
+            commandBuffer.writeTimestamp(
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                mTimestampQueryPool,
+                firstQuery + TLASBuildBegin);
             mScene->Update(commandBuffer);
-            Scene::SceneMaterials materials = mScene->GetMaterialProxies();
-            UpdateMaterialUniforms(materials);
-            UpdateCameraUniforms(camera);
-            mProbeGrid->UpdateData();
-            UpdateLightUniforms();
-            if (!mDescriptorSet) {
+            commandBuffer.writeTimestamp(
+                vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                mTimestampQueryPool,
+                firstQuery + TLASBuildEnd);
+            Scene::SceneMaterials materials = mScene->GetMaterialProxies(mFrameArena);
+            UpdateMaterialUniforms(frame, materials);
+            UpdateCameraUniforms(frame, camera);
+            UpdateLightUniforms(frame);
+            if (!mDescriptorPool) {
                 CreateDescriptors(materials);
             }
-            UpdateDescriptors(materials);
+            UpdateDescriptors(frame, materials);
         }
 
         // Update all probes
@@ -537,7 +731,7 @@ void Renderer::Render(Camera* camera) {
                 vk::PipelineBindPoint::eRayTracingKHR,
                 mProbeUpdatePipeline->GetPipelineLayout(),
                 0,
-                mProbeDescriptorSet,
+                frame.probeDescriptorSet,
                 nullptr);
 
             const Pipeline::RayTracingTablesRef& tableRef = mProbeUpdatePipeline->GetTablesRef();
@@ -571,10 +765,14 @@ void Renderer::Render(Camera* camera) {
                 vk::PipelineBindPoint::eRayTracingKHR,
                 mMainPassPipeline->GetPipelineLayout(),
                 0,
-                mDescriptorSet,
+                frame.descriptorSet,
                 nullptr);
 
             const Pipeline::RayTracingTablesRef& tableRef = mMainPassPipeline->GetTablesRef();
+            commandBuffer.writeTimestamp(
+                vk::PipelineStageFlagBits::eTopOfPipe,
+                mTimestampQueryPool,
+                firstQuery + MainPassBegin);
             commandBuffer.traceRaysKHR(
                 tableRef.rayGen,
                 tableRef.rayMiss,
@@ -584,6 +782,10 @@ void Renderer::Render(Camera* camera) {
                 imageSize.height,
                 1,
                 mContext->GetDevice()->GetDispatcher());
+            commandBuffer.writeTimestamp(
+                vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                mTimestampQueryPool,
+                firstQuery + MainPassEnd);
         }
 
         // Copy redered image to swapchain
@@ -640,35 +842,62 @@ void Renderer::Render(Camera* camera) {
         VKRT_ASSERT_VK(commandBuffer.end());
     }
 
-    const vk::Queue& queue = mContext->GetDevice()->GetQueue();
-    vk::Fence fence = mContext->GetDevice()->CreateFence();
-
-    std::vector<vk::Semaphore> waitSemaphores{mContext->GetSwapchain()->GetPresentSemaphore()};
-    std::vector<vk::Semaphore> signalSemaphores{mContext->GetSwapchain()->GetRenderSemaphore()};
-    std::vector<vk::PipelineStageFlags> waitStages{vk::PipelineStageFlagBits::eAllCommands};
-    VKRT_ASSERT_VK(queue.submit(
+    const vk::Semaphore signalSemaphore = mContext->GetSwapchain()->GetRenderSemaphore();
+    const vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    frame.ticket = mContext->GetDevice()->Submit(
         vk::SubmitInfo()
             .setCommandBuffers(commandBuffer)
-            .setWaitSemaphores(waitSemaphores)
-            .setSignalSemaphores(signalSemaphores)
-            .setWaitDstStageMask(waitStages),
-        fence));
-    VKRT_ASSERT_VK(mContext->GetDevice()->GetLogicalDevice().waitForFences(
-        fence,
-        true,
-        std::numeric_limits<uint64_t>::max()));
+            .setWaitSemaphores(frame.acquireSemaphore)
+            .setSignalSemaphores(signalSemaphore)
+            .setWaitDstStageMask(waitStage));
+    const uint64_t ticket = frame.ticket;
+    mContext->GetDevice()->EndRecording(ticket);
+    mFrameStatistics.tlasRebuilt = mScene->WasTLASRebuilt();
+    mFrameStatistics.dirtyInstanceCount = mScene->GetDirtyInstanceCount();
 
     mContext->GetSwapchain()->Present();
 
-    mContext->GetDevice()->DestroyFence(fence);
-    mContext->GetDevice()->DestroyCommand(commandBuffer);
+    // The next frame reuses the slot of the oldest frame in flight. Waiting for it here rather than
+    // for this one lets the host work up to the next call overlap this frame on the device
+    const uint32_t nextFrameSlot = (frameSlot + 1) % static_cast<uint32_t>(mFrames.size());
+    Frame& nextFrame = mFrames[nextFrameSlot];
+    if (nextFrame.ticket != 0) {
+        mContext->GetDevice()->Wait(nextFrame.ticket);
+        nextFrame.ticket = 0;
+        ReadTimestamps(nextFrameSlot);
+    }
+    mContext->SetFrameSlot(nextFrameSlot);
+    // The next frame's barrier orders its builds after this one's, the others only release what
+    // completed submissions used
+    mContext->GetScratchAllocator()->Release();
+    mContext->GetBLASBuilder()->Release(ticket);
+    mContext->GetBLASCompactor()->Release(ticket);
+    mContext->GetBLASCache()->Release(ticket);
+    mContext->GetDevice()->CollectRetired();
+
+#ifdef VKRT_TRACK_ALLOCATIONS
+    // The first frames size the arena and the persistent buffers
+    constexpr uint64_t WarmUpFrameCount = 3;
+    VKRT_ASSERT_MSG(
+        mFrameIndex < WarmUpFrameCount || GetThreadAllocationCount() == allocationCount,
+        "Frame " << mFrameIndex << " allocated "
+                 << GetThreadAllocationCount() - allocationCount << " times on the heap");
+#endif
+    ++mFrameIndex;
 }
 
 Renderer::~Renderer() {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    // Frames may still be in flight
+    VKRT_ASSERT_VK(logicalDevice.waitIdle());
+    for (Frame& frame : mFrames) {
+        mContext->GetDevice()->DestroyCommand(frame.commandBuffer);
+        logicalDevice.destroySemaphore(frame.acquireSemaphore);
+    }
     logicalDevice.destroyDescriptorPool(mDescriptorPool);
     logicalDevice.destroyDescriptorPool(mProbeDescriptorPool);
     logicalDevice.destroySampler(mTextureSampler);
+    logicalDevice.destroyQueryPool(mTimestampQueryPool);
 }
 
 }  // namespace VKRT
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "ResidencyManager.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "Context.h"
+#include "DebugUtils.h"
+#include "Mesh.h"
+
+namespace VKRT {
+
+static constexpr float NotTouched = std::numeric_limits<float>::max();
+
+ResidencyManager::ResidencyManager(ScopedRefPtr<Context> context)
+    : mContext(context),
+      mBudget(0),
+      mStreamingDistance(std::numeric_limits<float>::max()),
+      mViewPosition(0.0f),
+      mFrame(0),
+      mVersion(0),
+      mNextEviction(0),
+      mResidentBytes(0),
+      mResidentMeshCount(0),
+      mEvictionCount(0),
+      mStreamCount(0) {}
+
+bool ResidencyManager::Register(Mesh* mesh, vk::DeviceSize size) {
+    VKRT_ASSERT(mesh->mResidencyIndex == NoEntry);
+    mesh->mResidencyIndex = static_cast<uint32_t>(mEntries.size());
+    mEntries.push_back(
+        Entry{.mesh = mesh, .size = size, .lastUsedFrame = mFrame, .distance = NotTouched});
+
+    // Loading fills the budget, the meshes past it wait until an instance needs them
+    if (mResidentBytes + size > mBudget) {
+        return false;
+    }
+    mResidentBytes += size;
+    ++mResidentMeshCount;
+    return true;
+}
+
+void ResidencyManager::Unregister(Mesh* mesh) {
+    const uint32_t index = mesh->mResidencyIndex;
+    VKRT_ASSERT(index < mEntries.size() && mEntries[index].mesh == mesh);
+    if (mesh->mResident) {
+        mResidentBytes -= std::min(mResidentBytes, mEntries[index].size);
+        --mResidentMeshCount;
+    }
+    mEntries[index] = mEntries.back();
+    mEntries[index].mesh->mResidencyIndex = index;
+    mEntries.pop_back();
+    mesh->mResidencyIndex = NoEntry;
+}
+
+void ResidencyManager::Touch(const Mesh* mesh, const glm::mat4& transform) {
+    if (mesh->mResidencyIndex == NoEntry) {
+        return;
+    }
+    Entry& entry = mEntries[mesh->mResidencyIndex];
+    // Conservative under non-uniform scale, the sphere grows with the largest axis
+    const float scale = std::max(
+        {glm::length(glm::vec3(transform[0])),
+         glm::length(glm::vec3(transform[1])),
+         glm::length(glm::vec3(transform[2]))});
+    const float distance = std::max(
+        glm::length(glm::vec3(transform[3]) - mViewPosition) - mesh->mBoundingRadius * scale,
+        0.0f);
+    entry.distance = std::min(entry.distance, distance);
+    if (distance <= mStreamingDistance) {
+        entry.lastUsedFrame = mFrame;
+    }
+}
+
+void ResidencyManager::Update() {
+    if (!IsEnabled()) {
+        return;
+    }
+
+    // Sizes change as structures are built and compacted, measured again every frame
+    mResidentBytes = 0;
+    mResidentMeshCount = 0;
+    mStreamQueue.clear();
+    mEvictionQueue.clear();
+    for (uint32_t index = 0; index < mEntries.size(); ++index) {
+        Entry& entry = mEntries[index];
+        if (entry.mesh->mResident) {
+            // Host builds create the structure late, the estimate holds until then
+            if (entry.mesh->mBLASBuffer != nullptr) {
+                entry.size = entry.mesh->GetResidentSize();
+            }
+            mResidentBytes += entry.size;
+            ++mResidentMeshCount;
+            if (entry.lastUsedFrame + EvictionDelayFrames < mFrame) {
+                mEvictionQueue.push_back(index);
+            }
+        } else if (entry.distance <= mStreamingDistance) {
+            mStreamQueue.push_back(index);
+        }
+    }
+
+    // Least recently used first, the largest of those free the most
+    std::sort(mEvictionQueue.begin(), mEvictionQueue.end(), [this](uint32_t a, uint32_t b) {
+        if (mEntries[a].lastUsedFrame != mEntries[b].lastUsedFrame) {
+            return mEntries[a].lastUsedFrame < mEntries[b].lastUsedFrame;
+        }
+        return mEntries[a].size > mEntries[b].size;
+    });
+    mNextEviction = 0;
+    std::sort(mStreamQueue.begin(), mStreamQueue.end(), [this](uint32_t a, uint32_t b) {
+        return mEntries[a].distance < mEntries[b].distance;
+    });
+
+    vk::DeviceSize streamedBytes = 0;
+    for (uint32_t index : mStreamQueue) {
+        Entry& entry = mEntries[index];
+        if (streamedBytes > 0 && streamedBytes + entry.size > MaxStreamBytesPerFrame) {
+            break;
+        }
+        // Meshes in use are never evicted, the farther wanted ones stay out
+        if (!MakeRoom(entry.size)) {
+            break;
+        }
+        entry.mesh->StreamIn();
+        mResidentBytes += entry.size;
+        ++mResidentMeshCount;
+        streamedBytes += entry.size;
+        ++mStreamCount;
+    }
+    if (streamedBytes > 0) {
+        ++mVersion;
+    }
+    // Structures that came out larger than estimated
+    MakeRoom(0);
+
+    for (Entry& entry : mEntries) {
+        entry.distance = NotTouched;
+    }
+    ++mFrame;
+}
+
+bool ResidencyManager::MakeRoom(vk::DeviceSize size) {
+    while (mResidentBytes + size > mBudget) {
+        if (mNextEviction == mEvictionQueue.size()) {
+            return false;
+        }
+        Evict(mEntries[mEvictionQueue[mNextEviction++]]);
+    }
+    return true;
+}
+
+void ResidencyManager::Evict(Entry& entry) {
+    // The structure and pool geometry are retired against the frames that may still trace them,
+    // their memory comes back once those complete
+    entry.mesh->Evict();
+    mResidentBytes -= std::min(mResidentBytes, entry.size);
+    --mResidentMeshCount;
+    ++mEvictionCount;
+}
+
+ResidencyManager::~ResidencyManager() {}
+
+}  // namespace VKRT
@@ -22,6 +22,10 @@ INCBIN(ProbeGenShader, "raytraceProbe.rgen.spv");
 INCBIN(ProbeHitShader, "raytraceProbe.rchit.spv");
 INCBIN(ProbeMissShader, "raytraceProbe.rmiss.spv");
 INCBIN(ProbeShadowMissShader, "raytraceProbeShadow.rmiss.spv");
+INCBIN(SkinningShader, "skinning.comp.spv");
+INCBIN(AlphaTestShader, "alphaTest.rahit.spv");
+INCBIN(SphereIntersectionShader, "sphere.rint.spv");
+INCBIN(InstancesShader, "instances.comp.spv");
 }  // namespace VKRT
 #endif
 
@@ -55,6 +59,18 @@ Resource ResourceLoader::Load(const Resource::Id& resourceId) {
         case Resource::Id::ProbeShadowMissShader:
             actualId = VKRT_RESOURCE_RAYTRACE_PROBE_SHADOW_MISS_SHADER;
             break;
+        case Resource::Id::SkinningShader:
+            actualId = VKRT_RESOURCE_SKINNING_SHADER;
+            break;
+        case Resource::Id::AlphaTestShader:
+            actualId = VKRT_RESOURCE_ALPHA_TEST_SHADER;
+            break;
+        case Resource::Id::SphereIntersectionShader:
+            actualId = VKRT_RESOURCE_SPHERE_INTERSECTION_SHADER;
+            break;
+        case Resource::Id::InstancesShader:
+            actualId = VKRT_RESOURCE_INSTANCES_SHADER;
+            break;
         default:
             return {nullptr, 0};
     }
@@ -106,6 +122,20 @@ Resource ResourceLoader::Load(const Resource::Id& resourceId) {
         case Resource::Id::ProbeShadowMissShader: {
             return Resource{.buffer = gProbeShadowMissShaderData, .size = gShadowMissShaderSize};
         } break;
+        case Resource::Id::SkinningShader: {
+            return Resource{.buffer = gSkinningShaderData, .size = gSkinningShaderSize};
+        } break;
+        case Resource::Id::AlphaTestShader: {
+            return Resource{.buffer = gAlphaTestShaderData, .size = gAlphaTestShaderSize};
+        } break;
+        case Resource::Id::SphereIntersectionShader: {
+            return Resource{
+                .buffer = gSphereIntersectionShaderData,
+                .size = gSphereIntersectionShaderSize};
+        } break;
+        case Resource::Id::InstancesShader: {
+            return Resource{.buffer = gInstancesShaderData, .size = gInstancesShaderSize};
+        } break;
         default:
             return {nullptr, 0};
     }
@@ -1,13 +1,28 @@
 #include "Scene.h"
 
+#include <algorithm>
+
 #include "DebugUtils.h"
+#include "ResidencyManager.h"
+#include "ScratchAllocator.h"
 
 #undef MemoryBarrier
 
 namespace VKRT {
 
 Scene::Scene(ScopedRefPtr<Context> context)
-    : mContext(context), mObjects(), mInstanceBuffer(nullptr), mTLASBuffer(nullptr) {}
+    : mContext(context),
+      mObjects(),
+      mTLASBuffer(nullptr),
+      mInstanceGenerator(nullptr),
+      mSphereAABBBuffer(nullptr),
+      mSphereBLASBuffer(nullptr),
+      mSphereBLASAddress(0),
+      mSphereBLASBuilt(false),
+      mRefitCount(0),
+      mAccumulatedMotion(0.0f),
+      mTLASRebuilt(false),
+      mDirtyInstanceCount(0) {}
 
 void Scene::AddObject(ScopedRefPtr<Object> object) {
     if (object != nullptr) {
@@ -21,236 +36,595 @@ void Scene::AddLight(ScopedRefPtr<Light> light) {
     }
 }
 
-std::vector<Mesh::Description> Scene::GetDescriptions() {
-    std::vector<Mesh::Description> descriptions;
-    for (const ScopedRefPtr<Object>& object : mObjects) {
-        std::vector<Mesh::Description> modelDescriptions = object->GetModel()->GetDescriptions();
-        descriptions.insert(descriptions.end(), modelDescriptions.begin(), modelDescriptions.end());
+uint32_t Scene::AddSphere(
+    const glm::vec3& center,
+    float radius,
+    ScopedRefPtr<Material> material) {
+    VKRT_ASSERT(material != nullptr);
+    if (!mSphereBLAS && !mContext->IsHostOnly()) {
+        CreateSphereBLAS();
     }
-    return descriptions;
+    // Spheres sharing a material share its slot, the custom index of their instances
+    auto it = std::find(mSphereMaterials.begin(), mSphereMaterials.end(), material);
+    if (it == mSphereMaterials.end()) {
+        it = mSphereMaterials.insert(mSphereMaterials.end(), material);
+    }
+    mSpheres.push_back(Sphere{
+        .center = center,
+        .radius = radius,
+        .materialIndex = static_cast<uint32_t>(it - mSphereMaterials.begin())});
+    mDirtySpheres.push_back(1);
+    return static_cast<uint32_t>(mSpheres.size() - 1);
 }
 
-std::vector<Light::Proxy> Scene::GetLightDescriptions() {
-    std::vector<Light::Proxy> proxies;
-    for (const ScopedRefPtr<Light>& light : mLights) {
-        proxies.push_back(light->GetProxy());
+void Scene::SetSphere(uint32_t sphereIndex, const glm::vec3& center, float radius) {
+    Sphere& sphere = mSpheres[sphereIndex];
+    sphere.center = center;
+    sphere.radius = radius;
+    mDirtySpheres[sphereIndex] = 1;
+}
+
+void Scene::SetDeviceInstanceGeneration(bool enabled) {
+    if (enabled == (mInstanceGenerator != nullptr)) {
+        return;
     }
-    return proxies;
+    VKRT_ASSERT(!mContext->IsHostOnly());
+    mInstanceGenerator = enabled ? new InstanceGenerator(mContext) : nullptr;
+    // The next update writes every instance again, in the new place
+    mInstanceStates.clear();
 }
 
-Scene::SceneMaterials Scene::GetMaterialProxies() {
-    // Gather textures first
-    std::vector<std::pair<ScopedRefPtr<Texture>, int32_t>> textureIndices;
-    int32_t currentTextureIndex = 0;
-    for (const ScopedRefPtr<Object>& object : mObjects) {
-        for (const ScopedRefPtr<Mesh>& mesh : object->GetModel()->GetMeshes()) {
-            const Material* material = mesh->GetMaterial();
-            std::vector<ScopedRefPtr<Texture>> meshTextures{
-                material->GetAlbedoTexture(),
-                material->GetRoughnessTexture()};
-            for (const ScopedRefPtr<Texture>& texture : meshTextures) {
-                if (texture != nullptr) {
-                    auto it = std::find_if(
-                        textureIndices.begin(),
-                        textureIndices.end(),
-                        [&texture](const auto& entry) { return entry.first == texture; });
-
-                    if (it == textureIndices.end()) {
-                        textureIndices.emplace_back(texture, currentTextureIndex);
-                        ++currentTextureIndex;
-                    }
-                }
-            }
+void Scene::Animate(float seconds) {
+    for (Object* object : mObjects) {
+        object->GetModel()->Animate(seconds);
+    }
+}
+
+uint32_t Scene::GetMeshCount() const {
+    uint32_t meshCount = 0;
+    for (const Object* object : mObjects) {
+        meshCount += static_cast<uint32_t>(object->GetModel()->GetMeshes().size());
+    }
+    return meshCount;
+}
+
+uint32_t Scene::GetGeometryCount() const {
+    uint32_t geometryCount = 0;
+    for (const Object* object : mObjects) {
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            geometryCount += mesh->GetGeometryCount();
         }
     }
+    return geometryCount + static_cast<uint32_t>(mSphereMaterials.size());
+}
 
-    // Gather materials and generate texture indices if applicable
-    std::vector<MaterialProxy> materials;
-    for (const ScopedRefPtr<Object>& object : mObjects) {
-        for (const ScopedRefPtr<Mesh>& mesh : object->GetModel()->GetMeshes()) {
-            const ScopedRefPtr<Material> material = mesh->GetMaterial();
-            MaterialProxy proxy{
-                .albedo = material->GetAlbedo(),
-                .roughness = material->GetRoughness(),
-                .metallic = material->GetMetallic(),
-                .indexOfRefraction = material->GetIndexOfRefraction(),
-                .albedoTextureIndex = -1,
-                .roughnessTextureIndex = -1,
-            };
-            {
-                const ScopedRefPtr<Texture> albedoTexture = material->GetAlbedoTexture();
-                auto albedoIt = std::find_if(
-                    textureIndices.begin(),
-                    textureIndices.end(),
-                    [&albedoTexture](const auto& entry) { return entry.first == albedoTexture; });
-                if (albedoIt != textureIndices.end()) {
-                    proxy.albedoTextureIndex = albedoIt->second;
-                }
+std::span<Mesh::Description> Scene::GetDescriptions(FrameArena& arena) {
+    std::span<Mesh::Description> descriptions =
+        arena.Allocate<Mesh::Description>(GetGeometryCount());
+    size_t index = 0;
+    for (const Object* object : mObjects) {
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            for (uint32_t geometryIndex = 0; geometryIndex < mesh->GetGeometryCount();
+                 ++geometryIndex) {
+                descriptions[index++] = mesh->GetDescription(geometryIndex);
             }
-            {
-                const ScopedRefPtr<Texture> roughnessTexture = material->GetRoughnessTexture();
-                auto roughnessIt = std::find_if(
-                    textureIndices.begin(),
-                    textureIndices.end(),
-                    [&roughnessTexture](const auto& entry) {
-                        return entry.first == roughnessTexture;
-                    });
-                if (roughnessIt != textureIndices.end()) {
-                    proxy.roughnessTextureIndex = roughnessIt->second;
-                }
-            }
-            materials.push_back(proxy);
         }
     }
+    // Sphere hits read no vertices
+    for (size_t sphereMaterial = 0; sphereMaterial < mSphereMaterials.size(); ++sphereMaterial) {
+        descriptions[index++] = Mesh::Description{.vertexOffset = 0, .indexOffset = 0};
+    }
+    return descriptions;
+}
+
+std::span<Light::Proxy> Scene::GetLightDescriptions(FrameArena& arena) {
+    std::span<Light::Proxy> proxies = arena.Allocate<Light::Proxy>(mLights.size());
+    for (size_t index = 0; index < mLights.size(); ++index) {
+        proxies[index] = mLights[index]->GetProxy();
+    }
+    return proxies;
+}
 
-    std::vector<ScopedRefPtr<Texture>> textures;
-    for (const auto& entry : textureIndices) {
-        textures.push_back(entry.first);
+Scene::SceneMaterials Scene::GetMaterialProxies(FrameArena& arena) {
+    const uint32_t geometryCount = GetGeometryCount();
+
+    // Gather textures first, indices in the bindless array are their position in the list
+    std::span<Texture*> textures = arena.Allocate<Texture*>(geometryCount * 2);
+    size_t textureCount = 0;
+    auto findOrAddTexture = [&textures, &textureCount](Texture* texture) -> int32_t {
+        if (texture == nullptr) {
+            return -1;
+        }
+        auto texturesEnd = textures.begin() + textureCount;
+        auto it = std::find(textures.begin(), texturesEnd, texture);
+        if (it == texturesEnd) {
+            textures[textureCount] = texture;
+            return static_cast<int32_t>(textureCount++);
+        }
+        return static_cast<int32_t>(it - textures.begin());
+    };
+
+    // Laid out like the descriptions, one per geometry
+    std::span<MaterialProxy> materials = arena.Allocate<MaterialProxy>(geometryCount);
+    size_t materialIndex = 0;
+    auto addMaterial = [&](const Material* material) {
+        materials[materialIndex++] = MaterialProxy{
+            .albedo = material->GetAlbedo(),
+            .roughness = material->GetRoughness(),
+            .metallic = material->GetMetallic(),
+            .indexOfRefraction = material->GetIndexOfRefraction(),
+            .albedoTextureIndex = findOrAddTexture(material->GetAlbedoTexture()),
+            .roughnessTextureIndex = findOrAddTexture(material->GetRoughnessTexture()),
+            .alphaCutoff = material->GetAlphaCutoff(),
+        };
+    };
+    for (const Object* object : mObjects) {
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            for (const Material* material : mesh->GetMaterials()) {
+                addMaterial(material);
+            }
+        }
+    }
+    for (const Material* material : mSphereMaterials) {
+        addMaterial(material);
     }
 
-    Scene::SceneMaterials sceneMaterials{
+    return SceneMaterials{
         .materials = materials,
-        .textures = textures,
+        .textures = textures.first(textureCount),
     };
-    return sceneMaterials;
 }
 
 void Scene::Update(vk::CommandBuffer& commandBuffer) {
-    bool isUpdate = mTLAS;
-    if (!mObjects.empty()) {
-        std::vector<vk::AccelerationStructureInstanceKHR> instances;
-        uint32_t index = 0;
-        for (const Object* object : mObjects) {
-            const glm::mat4& transform = glm::transpose(object->GetTransform());
-            VkTransformMatrixKHR transformMatrix =
-                *(reinterpret_cast<const VkTransformMatrixKHR*>(&transform));
-            for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
-                const bool isRefractive = mesh->GetMaterial()->GetIndexOfRefraction() > 0.0f;
-                instances.emplace_back(
+    mTLASRebuilt = false;
+    mDirtyInstanceCount = 0;
+    if (mObjects.empty() && mSpheres.empty()) {
+        return;
+    }
+    if (!mSpheres.empty() && !mSphereBLASBuilt) {
+        RecordSphereBLASBuild(commandBuffer);
+    }
+
+    const uint32_t instanceCount = GetMeshCount() + static_cast<uint32_t>(mSpheres.size());
+    // Objects then spheres, one transform each for the generator
+    const uint32_t transformCount = static_cast<uint32_t>(mObjects.size() + mSpheres.size());
+    // Added or removed instances change the primitive count, which a refit can't do
+    const bool instancesChanged =
+        instanceCount != mInstanceStates.size() ||
+        (mInstanceGenerator && (mInstanceGenerator->GetInstanceCount() != instanceCount ||
+                                mInstanceGenerator->GetTransformCount() != transformCount));
+    bool rebuild = !mTLAS || instancesChanged;
+    if (instancesChanged) {
+        mInstanceStates.resize(instanceCount);
+        for (InstanceBuffer& instanceBuffer : mInstanceBuffers) {
+            instanceBuffer.buffer->UnmapBuffer();
+        }
+        mInstanceBuffers.clear();
+        mInstances.clear();
+        if (mInstanceGenerator) {
+            mInstanceGenerator->Resize(transformCount, instanceCount);
+        } else {
+            // Stay mapped, each frame copies the records changed since its slot was last used
+            mInstances.resize(instanceCount);
+            for (uint32_t slot = 0; slot < mContext->GetFramesInFlight(); ++slot) {
+                ScopedRefPtr<VulkanBuffer> buffer = mContext->GetDevice()->CreateBuffer(
+                    instanceCount * sizeof(vk::AccelerationStructureInstanceKHR),
+                    vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                        vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+                    vk::MemoryPropertyFlagBits::eHostVisible |
+                        vk::MemoryPropertyFlagBits::eHostCoherent,
+                    vk::MemoryAllocateFlagBits::eDeviceAddress,
+                    {MemoryCategory::Instance, "Scene instances"});
+                mInstanceBuffers.push_back(InstanceBuffer{
+                    .buffer = buffer,
+                    .mapped = reinterpret_cast<vk::AccelerationStructureInstanceKHR*>(
+                        buffer->MapBuffer()),
+                    .firstDirty = instanceCount,
+                    .lastDirty = 0});
+            }
+        }
+    }
+    mObjectVersions.resize(mObjects.size(), NoVersion);
+
+    // With the generator, changed objects upload their transform and instances only upload
+    // their BLAS reference, mask and custom index when those change
+    const auto writeInstance = [this, instancesChanged](
+                                   uint32_t index,
+                                   uint32_t transformIndex,
+                                   const glm::mat4& transform,
+                                   const InstanceState& previous,
+                                   const vk::AccelerationStructureInstanceKHR& instance) {
+        if (!mInstanceGenerator) {
+            const glm::mat4 rows = glm::transpose(transform);
+            mInstances[index] = instance;
+            mInstances[index].setTransform(*reinterpret_cast<const VkTransformMatrixKHR*>(&rows));
+            return;
+        }
+        if (instancesChanged || previous.blasAddress != instance.accelerationStructureReference ||
+            previous.mask != instance.mask ||
+            previous.firstGeometry != instance.instanceCustomIndex) {
+            mInstanceGenerator->SetTemplate(
+                index,
+                InstanceGenerator::Template{
+                    .transformIndex = transformIndex,
+                    .customIndexAndMask = instance.instanceCustomIndex |
+                                          (static_cast<uint32_t>(instance.mask) << 24),
+                    .sbtOffsetAndFlags = instance.instanceShaderBindingTableRecordOffset |
+                                         (static_cast<uint32_t>(instance.flags) << 24),
+                    .padding = 0,
+                    .blasAddress = instance.accelerationStructureReference});
+        }
+    };
+
+    ResidencyManager* residency = mContext->GetResidencyManager();
+    float frameMotion = 0.0f;
+    uint32_t firstDirty = instanceCount;
+    uint32_t lastDirty = 0;
+    uint32_t index = 0;
+    // Instances point at their first geometry, hits add the geometry index to it
+    uint32_t firstGeometry = 0;
+    for (uint32_t objectIndex = 0; objectIndex < mObjects.size(); ++objectIndex) {
+        const Object* object = mObjects[objectIndex];
+        const bool objectChanged =
+            instancesChanged || object->GetVersion() != mObjectVersions[objectIndex];
+        mObjectVersions[objectIndex] = object->GetVersion();
+        // Objects without meshes have no instance reading their transform
+        if (objectChanged && mInstanceGenerator && !object->GetModel()->GetMeshes().empty()) {
+            mInstanceGenerator->SetTransform(objectIndex, object->GetTransform());
+        }
+
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            residency->Touch(mesh, object->GetTransform());
+            // Instances of evicted meshes stay in place, a null reference leaves them inactive
+            const vk::DeviceAddress blasAddress = mesh->IsTraceable() ? mesh->GetBLASAddress() : 0;
+            // Masks are per instance, the geometries of a mesh come from one primitive and share
+            // its material
+            uint32_t mask = 0;
+            for (const Material* material : mesh->GetMaterials()) {
+                const bool isRefractive = material->GetIndexOfRefraction() > 0.0f;
+                mask |= isRefractive ? Material::RefractiveMask : Material::OpaqueMask;
+            }
+            mask = blasAddress != 0 ? mask : 0;
+            InstanceState& state = mInstanceStates[index];
+            if (objectChanged || state.blasAddress != blasAddress || state.mask != mask ||
+                state.firstGeometry != firstGeometry) {
+                const glm::vec3 position = glm::vec3(object->GetTransform()[3]);
+                writeInstance(
+                    index,
+                    objectIndex,
+                    object->GetTransform(),
+                    state,
                     vk::AccelerationStructureInstanceKHR()
-                        .setTransform(transformMatrix)
-                        .setInstanceCustomIndex(index)
-                        .setAccelerationStructureReference(mesh->GetBLASAddress())
-                        .setMask(isRefractive ? Material::RefractiveMask : Material::OpaqueMask)
+                        .setInstanceCustomIndex(firstGeometry)
+                        .setAccelerationStructureReference(blasAddress)
+                        .setMask(mask)
                         .setInstanceShaderBindingTableRecordOffset(0)
                         .setFlags(vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable));
-                ++index;
+
+                // Compacted or relocated BLASes need a rebuild, a refit keeps the old references
+                if (!instancesChanged) {
+                    frameMotion = std::max(frameMotion, glm::length(position - state.position));
+                    rebuild = rebuild || state.blasAddress != blasAddress;
+                }
+                state = InstanceState{
+                    .position = position,
+                    .blasAddress = blasAddress,
+                    .mask = mask,
+                    .firstGeometry = firstGeometry};
+                firstDirty = std::min(firstDirty, index);
+                lastDirty = std::max(lastDirty, index);
+                ++mDirtyInstanceCount;
             }
+            ++index;
+            firstGeometry += mesh->GetGeometryCount();
+        }
+    }
+
+    for (uint32_t sphereIndex = 0; sphereIndex < mSpheres.size(); ++sphereIndex, ++index) {
+        const Sphere& sphere = mSpheres[sphereIndex];
+        const bool isRefractive =
+            mSphereMaterials[sphere.materialIndex]->GetIndexOfRefraction() > 0.0f;
+        const uint32_t mask = isRefractive ? Material::RefractiveMask : Material::OpaqueMask;
+        const uint32_t materialSlot = firstGeometry + sphere.materialIndex;
+        InstanceState& state = mInstanceStates[index];
+        const bool sphereChanged = instancesChanged || mDirtySpheres[sphereIndex] != 0;
+        if (!sphereChanged && state.mask == mask && state.firstGeometry == materialSlot) {
+            continue;
         }
+        mDirtySpheres[sphereIndex] = 0;
 
-        const size_t instanceDataSize =
-            instances.size() * sizeof(vk::AccelerationStructureInstanceKHR);
-        mInstanceBuffer = mContext->GetDevice()->CreateBuffer(
-            instanceDataSize,
-            vk::BufferUsageFlagBits::eShaderDeviceAddress |
-                vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
-        uint8_t* instanceData = mInstanceBuffer->MapBuffer();
-        std::copy_n(reinterpret_cast<uint8_t*>(instances.data()), instanceDataSize, instanceData);
-        mInstanceBuffer->UnmapBuffer();
-        const vk::DeviceAddress instanceBufferAddress = mInstanceBuffer->GetDeviceAddress();
-
-        vk::AccelerationStructureGeometryInstancesDataKHR instancesData =
-            vk::AccelerationStructureGeometryInstancesDataKHR().setArrayOfPointers(false).setData(
-                instanceBufferAddress);
-        vk::AccelerationStructureGeometryKHR accelerationStructureGeometry =
-            vk::AccelerationStructureGeometryKHR()
-                .setGeometryType(vk::GeometryTypeKHR::eInstances)
-                .setFlags(vk::GeometryFlagBitsKHR::eOpaque)
-                .setGeometry(instancesData);
-
-        vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo =
-            vk::AccelerationStructureBuildGeometryInfoKHR()
-                .setType(vk::AccelerationStructureTypeKHR::eTopLevel)
-                .setFlags(
-                    vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
-                    vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate)
-                .setMode(
-                    isUpdate ? vk::BuildAccelerationStructureModeKHR::eUpdate
-                             : vk::BuildAccelerationStructureModeKHR::eBuild)
-                .setGeometries(accelerationStructureGeometry);
-
-        uint32_t instanceCount = static_cast<uint32_t>(instances.size());
-        vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
-        vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo =
-            logicalDevice.getAccelerationStructureBuildSizesKHR(
-                vk::AccelerationStructureBuildTypeKHR::eDevice,
-                accelerationStructureBuildGeometryInfo,
-                instanceCount,
-                mContext->GetDevice()->GetDispatcher());
-
-        if (!isUpdate) {
-            mTLASBuffer = mContext->GetDevice()->CreateBuffer(
-                buildSizesInfo.accelerationStructureSize,
-                vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
-                    vk::BufferUsageFlagBits::eShaderDeviceAddress,
-                vk::MemoryPropertyFlagBits::eDeviceLocal,
-                vk::MemoryAllocateFlagBits::eDeviceAddress);
-
-            vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
-                vk::AccelerationStructureCreateInfoKHR()
-                    .setBuffer(mTLASBuffer->GetBufferHandle())
-                    .setSize(buildSizesInfo.accelerationStructureSize)
-                    .setType(vk::AccelerationStructureTypeKHR::eTopLevel);
-            mTLAS = VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
-                accelerationStructureCreateInfo,
-                nullptr,
-                mContext->GetDevice()->GetDispatcher()));
+        // The shared BLAS holds the unit sphere, the instance scales and places it
+        const glm::mat4 transform = glm::mat4(
+            glm::vec4(sphere.radius, 0.0f, 0.0f, 0.0f),
+            glm::vec4(0.0f, sphere.radius, 0.0f, 0.0f),
+            glm::vec4(0.0f, 0.0f, sphere.radius, 0.0f),
+            glm::vec4(sphere.center, 1.0f));
+        const uint32_t transformIndex = static_cast<uint32_t>(mObjects.size()) + sphereIndex;
+        if (sphereChanged && mInstanceGenerator) {
+            mInstanceGenerator->SetTransform(transformIndex, transform);
         }
+        writeInstance(
+            index,
+            transformIndex,
+            transform,
+            state,
+            vk::AccelerationStructureInstanceKHR()
+                .setInstanceCustomIndex(materialSlot)
+                .setAccelerationStructureReference(mSphereBLASAddress)
+                .setMask(mask)
+                .setInstanceShaderBindingTableRecordOffset(SphereHitGroupOffset));
+        if (!instancesChanged) {
+            frameMotion = std::max(frameMotion, glm::length(sphere.center - state.position));
+        }
+        state = InstanceState{
+            .position = sphere.center,
+            .blasAddress = mSphereBLASAddress,
+            .mask = mask,
+            .firstGeometry = materialSlot};
+        firstDirty = std::min(firstDirty, index);
+        lastDirty = std::max(lastDirty, index);
+        ++mDirtyInstanceCount;
+    }
+
+    // Nothing moved, last frame's TLAS is still valid
+    if (mDirtyInstanceCount == 0 && !rebuild) {
+        if (mInstanceGenerator) {
+            mInstanceGenerator->DiscardWrites();
+        }
+        return;
+    }
+    InstanceBuffer* instanceBuffer = nullptr;
+    if (mInstanceGenerator) {
+        mInstanceGenerator->Record(commandBuffer);
+    } else {
+        // The other slots catch up on these records when their frame comes
+        for (InstanceBuffer& slotBuffer : mInstanceBuffers) {
+            slotBuffer.firstDirty = std::min(slotBuffer.firstDirty, firstDirty);
+            slotBuffer.lastDirty = std::max(slotBuffer.lastDirty, lastDirty);
+        }
+        instanceBuffer = &mInstanceBuffers[mContext->GetFrameSlot()];
+        if (instanceBuffer->firstDirty <= instanceBuffer->lastDirty) {
+            const uint32_t first = instanceBuffer->firstDirty;
+            const uint32_t count = instanceBuffer->lastDirty - first + 1;
+            std::copy_n(mInstances.begin() + first, count, instanceBuffer->mapped + first);
+            instanceBuffer->buffer->FlushBuffer(
+                first * sizeof(vk::AccelerationStructureInstanceKHR),
+                count * sizeof(vk::AccelerationStructureInstanceKHR));
+            instanceBuffer->firstDirty = instanceCount;
+            instanceBuffer->lastDirty = 0;
+        }
+    }
+
+    mAccumulatedMotion += frameMotion;
+    rebuild = rebuild || mRefitCount >= MaxRefitCount ||
+              mAccumulatedMotion > RebuildMotionThreshold;
 
-        mScratchBuffer = mContext->GetDevice()->CreateBuffer(
-            buildSizesInfo.buildScratchSize,
-            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+    vk::AccelerationStructureGeometryInstancesDataKHR instancesData =
+        vk::AccelerationStructureGeometryInstancesDataKHR().setArrayOfPointers(false).setData(
+            mInstanceGenerator ? mInstanceGenerator->GetInstanceAddress()
+                               : instanceBuffer->buffer->GetDeviceAddress());
+    vk::AccelerationStructureGeometryKHR accelerationStructureGeometry =
+        vk::AccelerationStructureGeometryKHR()
+            .setGeometryType(vk::GeometryTypeKHR::eInstances)
+            .setFlags(vk::GeometryFlagBitsKHR::eOpaque)
+            .setGeometry(instancesData);
+
+    // Builds and refits must agree on the flags, eAllowUpdate included
+    const vk::BuildAccelerationStructureFlagsKHR buildFlags =
+        vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+        vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+    vk::AccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo =
+        vk::AccelerationStructureBuildGeometryInfoKHR()
+            .setType(vk::AccelerationStructureTypeKHR::eTopLevel)
+            .setFlags(buildFlags)
+            .setGeometries(accelerationStructureGeometry);
+
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    vk::AccelerationStructureBuildSizesInfoKHR buildSizesInfo =
+        logicalDevice.getAccelerationStructureBuildSizesKHR(
+            vk::AccelerationStructureBuildTypeKHR::eDevice,
+            accelerationStructureBuildGeometryInfo,
+            instanceCount,
+            mContext->GetDevice()->GetDispatcher());
+
+    if (!mTLASBuffer ||
+        mTLASBuffer->GetBufferSize() < buildSizesInfo.accelerationStructureSize) {
+        // Only reached on rebuilds after instances were added, frames in flight may still trace
+        // the old structure. Its buffer is retired along with the last reference to it
+        mContext->GetDevice()->RetireAccelerationStructure(mTLAS);
+        mTLASBuffer = mContext->GetDevice()->CreateBuffer(
+            buildSizesInfo.accelerationStructureSize,
+            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress,
             vk::MemoryPropertyFlagBits::eDeviceLocal,
-            vk::MemoryAllocateFlagBits::eDeviceAddress);
-
-        vk::AccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo =
-            vk::AccelerationStructureBuildGeometryInfoKHR()
-                .setType(vk::AccelerationStructureTypeKHR::eTopLevel)
-                .setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
-                .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
-                .setDstAccelerationStructure(mTLAS)
-                .setGeometries(accelerationStructureGeometry)
-                .setScratchData(mScratchBuffer->GetDeviceAddress())
-                .setSrcAccelerationStructure(isUpdate ? mTLAS : nullptr);
-
-        vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo =
-            vk::AccelerationStructureBuildRangeInfoKHR()
-                .setPrimitiveCount(instanceCount)
-                .setPrimitiveOffset(0)
-                .setFirstVertex(0)
-                .setTransformOffset(0);
-
-        commandBuffer.buildAccelerationStructuresKHR(
-            accelerationBuildGeometryInfo,
-            &accelerationStructureBuildRangeInfo,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::AccelerationStructure, "Scene TLAS"});
+
+        vk::AccelerationStructureCreateInfoKHR accelerationStructureCreateInfo =
+            vk::AccelerationStructureCreateInfoKHR()
+                .setBuffer(mTLASBuffer->GetBufferHandle())
+                .setSize(buildSizesInfo.accelerationStructureSize)
+                .setType(vk::AccelerationStructureTypeKHR::eTopLevel);
+        mTLAS = VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
+            accelerationStructureCreateInfo,
+            nullptr,
+            mContext->GetDevice()->GetDispatcher()));
+
+        vk::AccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo =
+            vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(mTLAS);
+        mTLASAddress = logicalDevice.getAccelerationStructureAddressKHR(
+            accelerationDeviceAddressInfo,
             mContext->GetDevice()->GetDispatcher());
+    }
 
-        vk::MemoryBarrier barrier =
-            vk::MemoryBarrier()
-                .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
-                .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
-
-        commandBuffer.pipelineBarrier(
-            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
-            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
-            {},
-            barrier,
-            {},
-            {});
-
-        if (!isUpdate) {
-            vk::AccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo =
-                vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(mTLAS);
-            mTLASAddress = logicalDevice.getAccelerationStructureAddressKHR(
-                accelerationDeviceAddressInfo,
-                mContext->GetDevice()->GetDispatcher());
-        }
+    // Released by the renderer after the frame is submitted
+    const vk::DeviceAddress scratchAddress = mContext->GetScratchAllocator()->Allocate(
+        rebuild ? buildSizesInfo.buildScratchSize : buildSizesInfo.updateScratchSize);
+
+    accelerationStructureBuildGeometryInfo
+        .setMode(
+            rebuild ? vk::BuildAccelerationStructureModeKHR::eBuild
+                    : vk::BuildAccelerationStructureModeKHR::eUpdate)
+        .setSrcAccelerationStructure(rebuild ? nullptr : mTLAS)
+        .setDstAccelerationStructure(mTLAS)
+        .setScratchData(scratchAddress);
+
+    vk::AccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo =
+        vk::AccelerationStructureBuildRangeInfoKHR()
+            .setPrimitiveCount(instanceCount)
+            .setPrimitiveOffset(0)
+            .setFirstVertex(0)
+            .setTransformOffset(0);
+
+    commandBuffer.buildAccelerationStructuresKHR(
+        accelerationStructureBuildGeometryInfo,
+        &accelerationStructureBuildRangeInfo,
+        mContext->GetDevice()->GetDispatcher());
+
+    vk::MemoryBarrier barrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+        {},
+        barrier,
+        {},
+        {});
+
+    if (rebuild) {
+        mRefitCount = 0;
+        mAccumulatedMotion = 0.0f;
+    } else {
+        ++mRefitCount;
+    }
+    mTLASRebuilt = rebuild;
+}
+
+static vk::AccelerationStructureGeometryKHR GetSphereGeometry(vk::DeviceAddress aabbAddress) {
+    return vk::AccelerationStructureGeometryKHR()
+        .setGeometryType(vk::GeometryTypeKHR::eAabbs)
+        .setFlags(vk::GeometryFlagBitsKHR::eOpaque)
+        .setGeometry(vk::AccelerationStructureGeometryAabbsDataKHR()
+                         .setData(aabbAddress)
+                         .setStride(sizeof(vk::AabbPositionsKHR)));
+}
+
+void Scene::CreateSphereBLAS() {
+    // Filled by the build's command buffer, no upload of its own
+    mSphereAABBBuffer = mContext->GetDevice()->CreateBuffer(
+        sizeof(vk::AabbPositionsKHR),
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::Geometry, "Unit sphere box"});
+
+    const vk::AccelerationStructureGeometryKHR geometry =
+        GetSphereGeometry(mSphereAABBBuffer->GetDeviceAddress());
+    const vk::AccelerationStructureBuildGeometryInfoKHR buildInfo =
+        vk::AccelerationStructureBuildGeometryInfoKHR()
+            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+            .setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
+            .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+            .setGeometries(geometry);
+
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const uint32_t primitiveCount = 1;
+    mSphereBLASSizes = logicalDevice.getAccelerationStructureBuildSizesKHR(
+        vk::AccelerationStructureBuildTypeKHR::eDevice,
+        buildInfo,
+        primitiveCount,
+        mContext->GetDevice()->GetDispatcher());
+    mSphereBLASBuffer = mContext->GetDevice()->CreateBuffer(
+        mSphereBLASSizes.accelerationStructureSize,
+        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        vk::MemoryAllocateFlagBits::eDeviceAddress,
+        {MemoryCategory::AccelerationStructure, "Unit sphere BLAS"});
+    mSphereBLAS = VKRT_ASSERT_VK(logicalDevice.createAccelerationStructureKHR(
+        vk::AccelerationStructureCreateInfoKHR()
+            .setBuffer(mSphereBLASBuffer->GetBufferHandle())
+            .setSize(mSphereBLASSizes.accelerationStructureSize)
+            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel),
+        nullptr,
+        mContext->GetDevice()->GetDispatcher()));
+    mSphereBLASAddress = logicalDevice.getAccelerationStructureAddressKHR(
+        vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(mSphereBLAS),
+        mContext->GetDevice()->GetDispatcher());
+}
+
+void Scene::RecordSphereBLASBuild(vk::CommandBuffer& commandBuffer) {
+    const vk::AabbPositionsKHR unitBox(-1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f);
+    commandBuffer.updateBuffer(
+        mSphereAABBBuffer->GetBufferHandle(),
+        0,
+        sizeof(unitBox),
+        &unitBox);
+    const vk::MemoryBarrier uploadBarrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        {},
+        uploadBarrier,
+        {},
+        {});
+
+    const vk::AccelerationStructureGeometryKHR geometry =
+        GetSphereGeometry(mSphereAABBBuffer->GetDeviceAddress());
+    const vk::AccelerationStructureBuildGeometryInfoKHR buildInfo =
+        vk::AccelerationStructureBuildGeometryInfoKHR()
+            .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+            .setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace)
+            .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+            .setGeometries(geometry)
+            .setDstAccelerationStructure(mSphereBLAS)
+            .setScratchData(
+                mContext->GetScratchAllocator()->Allocate(mSphereBLASSizes.buildScratchSize));
+    const vk::AccelerationStructureBuildRangeInfoKHR range =
+        vk::AccelerationStructureBuildRangeInfoKHR().setPrimitiveCount(1);
+    commandBuffer.buildAccelerationStructuresKHR(
+        buildInfo,
+        &range,
+        mContext->GetDevice()->GetDispatcher());
+    mSphereBLASBuilt = true;
+
+    // The TLAS build that follows references it
+    const vk::MemoryBarrier barrier =
+        vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+        {},
+        barrier,
+        {},
+        {});
+}
+
+void Scene::OnLastReference() {
+    if (mContext->IsHostOnly()) {
+        RefCountPtr::OnLastReference();
+        return;
     }
+    mContext->GetDevice()->Retire(this);
 }
 
 Scene::~Scene() {
+    if (mContext->IsHostOnly()) {
+        return;
+    }
+    for (InstanceBuffer& instanceBuffer : mInstanceBuffers) {
+        instanceBuffer.buffer->UnmapBuffer();
+    }
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     if (mTLAS) {
         logicalDevice.destroyAccelerationStructureKHR(
@@ -258,6 +632,12 @@ Scene::~Scene() {
             nullptr,
             mContext->GetDevice()->GetDispatcher());
     }
+    if (mSphereBLAS) {
+        logicalDevice.destroyAccelerationStructureKHR(
+            mSphereBLAS,
+            nullptr,
+            mContext->GetDevice()->GetDispatcher());
+    }
 }
 
 }  // namespace VKRT
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "SceneAnalyzer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#include "DebugUtils.h"
+#include "Model.h"
+#include "Object.h"
+#include "nlohmann/json.hpp"
+
+namespace VKRT {
+
+bool SceneAnalyzer::Budget::Load(const std::string& path, Budget& budget) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    const nlohmann::json json = nlohmann::json::parse(file, nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        return false;
+    }
+    budget.maxMeshSAHCost = json.value("maxMeshSAHCost", budget.maxMeshSAHCost);
+    budget.maxSceneSAHCost = json.value("maxSceneSAHCost", budget.maxSceneSAHCost);
+    budget.maxSliverFraction = json.value("maxSliverFraction", budget.maxSliverFraction);
+    budget.maxInstanceOverlap = json.value("maxInstanceOverlap", budget.maxInstanceOverlap);
+    budget.maxBLASBytes = json.value("maxBLASBytes", budget.maxBLASBytes);
+    return true;
+}
+
+SceneAnalyzer::SceneAnalyzer(ScopedRefPtr<Scene> scene, const Budget& budget)
+    : mScene(scene), mBudget(budget), mReport{} {}
+
+SceneAnalyzer::MeshReport SceneAnalyzer::AnalyzeMesh(const Mesh* mesh, BoundingBox& bounds) const {
+    MeshReport report{
+        .name = mesh->GetName(),
+        .buildPolicy = Mesh::GetBuildPolicyName(mesh->GetBuildPolicy()),
+        .geometryCount = mesh->GetGeometryCount(),
+        .triangleCount = mesh->GetTriangleCount(),
+        .alphaTestedTriangleCount = 0,
+        .instanceCount = 0,
+        .blasBytes = mesh->GetBLASSize(),
+        .blasBytesEstimated = false,
+        .compactionSavedBytes = mesh->GetCompactionSavedBytes(),
+        .referenceNodeCount = 0,
+        .sahCost = 0.0f,
+        .minTriangleArea = 0.0f,
+        .meanTriangleArea = 0.0f,
+        .maxTriangleArea = 0.0f,
+        .degenerateTriangleCount = 0,
+        .sliverTriangleCount = 0,
+    };
+    bounds = BoundingBox();
+    const std::vector<Mesh::Primitive>& primitives = mesh->GetHostPrimitives();
+    if (primitives.empty()) {
+        VKRT_LOG("No host geometry for " << mesh->GetName() << ", retain host data before loading");
+        return report;
+    }
+
+    std::vector<BoundingBox> boxes;
+    boxes.reserve(mesh->GetTriangleCount());
+    double areaSum = 0.0;
+    float minArea = FLT_MAX;
+    float maxArea = 0.0f;
+    for (const Mesh::Primitive& primitive : primitives) {
+        if (primitive.alphaTested) {
+            report.alphaTestedTriangleCount += static_cast<uint32_t>(primitive.indices.size());
+        }
+        for (const glm::uvec3& triangle : primitive.indices) {
+            const glm::vec3& p0 = primitive.vertices[triangle.x].position;
+            const glm::vec3& p1 = primitive.vertices[triangle.y].position;
+            const glm::vec3& p2 = primitive.vertices[triangle.z].position;
+            const float area = 0.5f * glm::length(glm::cross(p1 - p0, p2 - p0));
+            const float longestEdgeSquared = std::max(
+                {glm::dot(p1 - p0, p1 - p0),
+                 glm::dot(p2 - p1, p2 - p1),
+                 glm::dot(p0 - p2, p0 - p2)});
+            if (area == 0.0f) {
+                ++report.degenerateTriangleCount;
+            } else if (longestEdgeSquared > SliverAspectRatio * 2.0f * area) {
+                // The height on the longest edge is 2 * area / edge
+                ++report.sliverTriangleCount;
+            }
+            areaSum += area;
+            minArea = std::min(minArea, area);
+            maxArea = std::max(maxArea, area);
+
+            BoundingBox& box = boxes.emplace_back();
+            box.Extend(p0);
+            box.Extend(p1);
+            box.Extend(p2);
+        }
+    }
+    if (boxes.empty()) {
+        return report;
+    }
+    report.minTriangleArea = minArea;
+    report.meanTriangleArea = static_cast<float>(areaSum / boxes.size());
+    report.maxTriangleArea = maxArea;
+
+    BVH4 bvh;
+    bvh.Build(boxes);
+    report.referenceNodeCount = bvh.GetNodeCount();
+    if (report.blasBytes == 0) {
+        report.blasBytes = report.referenceNodeCount * EstimatedNodeBytes +
+                           static_cast<uint64_t>(boxes.size()) * EstimatedTriangleBytes;
+        report.blasBytesEstimated = true;
+    }
+    report.sahCost = bvh.GetSAHCost(TraversalCost, IntersectionCost);
+    bounds = bvh.GetBounds();
+    return report;
+}
+
+const SceneAnalyzer::Report& SceneAnalyzer::Analyze() {
+    mReport = Report{};
+
+    // Meshes are analyzed once however many objects share them
+    std::unordered_map<const Mesh*, size_t> meshIndices;
+    std::vector<BoundingBox> meshBounds;
+    const std::vector<ScopedRefPtr<Object>>& objects = mScene->GetObjects();
+    for (uint32_t objectIndex = 0; objectIndex < objects.size(); ++objectIndex) {
+        const Object* object = objects[objectIndex];
+        for (const Mesh* mesh : object->GetModel()->GetMeshes()) {
+            auto [it, inserted] = meshIndices.emplace(mesh, mReport.meshes.size());
+            if (inserted) {
+                mReport.meshes.push_back(AnalyzeMesh(mesh, meshBounds.emplace_back()));
+            }
+            ++mReport.meshes[it->second].instanceCount;
+
+            // Meshes without host geometry keep an empty box and are left out below
+            const BoundingBox& bounds = meshBounds[it->second];
+            BoundingBox worldBounds;
+            if (bounds.min.x <= bounds.max.x) {
+                for (uint32_t corner = 0; corner < 8; ++corner) {
+                    const glm::vec3 point(
+                        (corner & 1) != 0 ? bounds.max.x : bounds.min.x,
+                        (corner & 2) != 0 ? bounds.max.y : bounds.min.y,
+                        (corner & 4) != 0 ? bounds.max.z : bounds.min.z);
+                    worldBounds.Extend(
+                        glm::vec3(object->GetTransform() * glm::vec4(point, 1.0f)));
+                }
+            }
+            mReport.instances.push_back(InstanceReport{
+                .isSphere = false,
+                .objectIndex = objectIndex,
+                .meshName = mesh->GetName(),
+                .bounds = worldBounds,
+                .overlap = 0.0f,
+                .overlappingInstanceCount = 0,
+            });
+        }
+    }
+    // Each sphere is an instance of the shared AABB BLAS, bounded by its world box
+    const std::vector<Scene::Sphere>& spheres = mScene->GetSpheres();
+    for (uint32_t sphereIndex = 0; sphereIndex < spheres.size(); ++sphereIndex) {
+        const Scene::Sphere& sphere = spheres[sphereIndex];
+        BoundingBox worldBounds;
+        worldBounds.Extend(sphere.center - sphere.radius);
+        worldBounds.Extend(sphere.center + sphere.radius);
+        mReport.instances.push_back(InstanceReport{
+            .isSphere = true,
+            .objectIndex = sphereIndex,
+            .meshName = "",
+            .bounds = worldBounds,
+            .overlap = 0.0f,
+            .overlappingInstanceCount = 0,
+        });
+    }
+
+    // Pairwise, instance counts stay small enough next to the triangle work above
+    std::vector<BoundingBox> instanceBounds;
+    for (InstanceReport& instance : mReport.instances) {
+        const float area = instance.bounds.GetHalfArea();
+        if (area <= 0.0f) {
+            continue;
+        }
+        instanceBounds.push_back(instance.bounds);
+        for (const InstanceReport& other : mReport.instances) {
+            if (&other == &instance) {
+                continue;
+            }
+            BoundingBox intersection;
+            intersection.min = glm::max(instance.bounds.min, other.bounds.min);
+            intersection.max = glm::min(instance.bounds.max, other.bounds.max);
+            if (glm::any(glm::greaterThan(intersection.min, intersection.max))) {
+                continue;
+            }
+            instance.overlap += intersection.GetHalfArea() / area;
+            ++instance.overlappingInstanceCount;
+        }
+    }
+    BVH4 instanceBVH;
+    instanceBVH.Build(instanceBounds);
+    mReport.sceneSAHCost = instanceBVH.GetSAHCost(TraversalCost, IntersectionCost);
+
+    CheckBudgets();
+    // Costs weighted by how often the mesh is traced
+    std::stable_sort(
+        mReport.meshes.begin(),
+        mReport.meshes.end(),
+        [](const MeshReport& a, const MeshReport& b) {
+            return a.sahCost * a.instanceCount > b.sahCost * b.instanceCount;
+        });
+    std::stable_sort(
+        mReport.instances.begin(),
+        mReport.instances.end(),
+        [](const InstanceReport& a, const InstanceReport& b) { return a.overlap > b.overlap; });
+    return mReport;
+}
+
+void SceneAnalyzer::CheckBudgets() {
+    const auto check =
+        [this](std::vector<std::string>& exceeded, auto value, auto limit, const char* name) {
+            if (limit > 0 && value > limit) {
+                exceeded.push_back(name);
+                ++mReport.exceededBudgetCount;
+            }
+        };
+    for (MeshReport& mesh : mReport.meshes) {
+        const float sliverFraction = mesh.triangleCount > 0
+                                         ? static_cast<float>(mesh.sliverTriangleCount) /
+                                               static_cast<float>(mesh.triangleCount)
+                                         : 0.0f;
+        check(mesh.exceededBudgets, mesh.sahCost, mBudget.maxMeshSAHCost, "maxMeshSAHCost");
+        check(mesh.exceededBudgets, sliverFraction, mBudget.maxSliverFraction, "maxSliverFraction");
+        check(mesh.exceededBudgets, mesh.blasBytes, mBudget.maxBLASBytes, "maxBLASBytes");
+    }
+    for (InstanceReport& instance : mReport.instances) {
+        check(
+            instance.exceededBudgets,
+            instance.overlap,
+            mBudget.maxInstanceOverlap,
+            "maxInstanceOverlap");
+    }
+    check(
+        mReport.exceededBudgets,
+        mReport.sceneSAHCost,
+        mBudget.maxSceneSAHCost,
+        "maxSceneSAHCost");
+}
+
+std::string SceneAnalyzer::ToJson() const {
+    nlohmann::json report;
+    report["withinBudget"] = IsWithinBudget();
+    report["exceededBudgetCount"] = mReport.exceededBudgetCount;
+    report["budget"] = nlohmann::json{
+        {"maxMeshSAHCost", mBudget.maxMeshSAHCost},
+        {"maxSceneSAHCost", mBudget.maxSceneSAHCost},
+        {"maxSliverFraction", mBudget.maxSliverFraction},
+        {"maxInstanceOverlap", mBudget.maxInstanceOverlap},
+        {"maxBLASBytes", mBudget.maxBLASBytes},
+    };
+    report["scene"] = nlohmann::json{
+        {"sahCost", mReport.sceneSAHCost},
+        {"instanceCount", mReport.instances.size()},
+        {"meshCount", mReport.meshes.size()},
+        {"exceededBudgets", mReport.exceededBudgets},
+    };
+
+    nlohmann::json meshes = nlohmann::json::array();
+    for (const MeshReport& mesh : mReport.meshes) {
+        meshes.push_back(nlohmann::json{
+            {"name", mesh.name},
+            {"buildPolicy", mesh.buildPolicy},
+            {"geometryCount", mesh.geometryCount},
+            {"triangleCount", mesh.triangleCount},
+            {"alphaTestedTriangleCount", mesh.alphaTestedTriangleCount},
+            {"instanceCount", mesh.instanceCount},
+            {"blasBytes", mesh.blasBytes},
+            {"blasBytesEstimated", mesh.blasBytesEstimated},
+            {"compactionSavedBytes", mesh.compactionSavedBytes},
+            {"referenceNodeCount", mesh.referenceNodeCount},
+            {"sahCost", mesh.sahCost},
+            {"triangleArea",
+             {{"min", mesh.minTriangleArea},
+              {"mean", mesh.meanTriangleArea},
+              {"max", mesh.maxTriangleArea}}},
+            {"degenerateTriangleCount", mesh.degenerateTriangleCount},
+            {"sliverTriangleCount", mesh.sliverTriangleCount},
+            {"exceededBudgets", mesh.exceededBudgets},
+        });
+    }
+    report["meshes"] = meshes;
+
+    nlohmann::json instances = nlohmann::json::array();
+    for (const InstanceReport& instance : mReport.instances) {
+        instances.push_back(nlohmann::json{
+            {instance.isSphere ? "sphere" : "object", instance.objectIndex},
+            {"mesh", instance.meshName},
+            {"min", {instance.bounds.min.x, instance.bounds.min.y, instance.bounds.min.z}},
+            {"max", {instance.bounds.max.x, instance.bounds.max.y, instance.bounds.max.z}},
+            {"overlap", instance.overlap},
+            {"overlappingInstanceCount", instance.overlappingInstanceCount},
+            {"exceededBudgets", instance.exceededBudgets},
+        });
+    }
+    report["instances"] = instances;
+
+    return report.dump(4);
+}
+
+bool SceneAnalyzer::WriteReport(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << ToJson();
+    return file.good();
+}
+
+}  // namespace VKRT
@@ -0,0 +1,64 @@
+#include "ScratchAllocator.h"
+
+#include <algorithm>
+
+#include "Context.h"
+#include "DebugUtils.h"
+
+namespace VKRT {
+
+static vk::DeviceSize AlignUp(vk::DeviceSize value, vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+ScratchAllocator::ScratchAllocator(ScopedRefPtr<Context> context)
+    : mContext(context), mBuffer(nullptr), mOffset(0), mPeakUsage(0) {
+    mAlignment = std::max<vk::DeviceSize>(
+        mContext->GetDevice()
+            ->GetAccelerationStructureProperties()
+            .minAccelerationStructureScratchOffsetAlignment,
+        1);
+}
+
+vk::DeviceAddress ScratchAllocator::Allocate(vk::DeviceSize size) {
+    vk::DeviceSize offset = mBuffer != nullptr ? GetAlignedOffset(mOffset) : 0;
+    if (mBuffer == nullptr || offset + size > mBuffer->GetBufferSize()) {
+        // Earlier regions of this submission stay in the old buffer, the new one is sized so the
+        // whole submission fits next time
+        if (mBuffer != nullptr) {
+            mRetiredBuffers.push_back(mBuffer);
+        }
+        // The buffer's own address is only as aligned as its memory, one alignment more leaves
+        // room to align the first region whatever address it gets
+        const vk::DeviceSize capacity = AlignUp(mOffset + size, mAlignment) + mAlignment;
+        mBuffer = mContext->GetDevice()->CreateBuffer(
+            capacity,
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryPropertyFlagBits::eDeviceLocal,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::Scratch, "Scratch pool"});
+        offset = GetAlignedOffset(mOffset);
+    }
+    mOffset = offset + size;
+    mPeakUsage = std::max(mPeakUsage, mOffset);
+    return mBuffer->GetDeviceAddress() + offset;
+}
+
+vk::DeviceSize ScratchAllocator::GetAlignedOffset(vk::DeviceSize offset) const {
+    // The alignment applies to the device address, not the offset in the buffer
+    const vk::DeviceAddress bufferAddress = mBuffer->GetDeviceAddress();
+    return AlignUp(bufferAddress + offset, mAlignment) - bufferAddress;
+}
+
+void ScratchAllocator::Release() {
+    mRetiredBuffers.clear();
+    mOffset = 0;
+}
+
+vk::DeviceSize ScratchAllocator::GetCapacity() const {
+    return mBuffer != nullptr ? mBuffer->GetBufferSize() : 0;
+}
+
+ScratchAllocator::~ScratchAllocator() {}
+
+}  // namespace VKRT
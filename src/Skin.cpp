@@ -0,0 +1,147 @@
+#include "Skin.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Context.h"
+#include "DebugUtils.h"
+
+namespace VKRT {
+
+Skin::Skin(
+    ScopedRefPtr<Context> context,
+    const std::vector<Node>& nodes,
+    const std::vector<uint32_t>& joints,
+    const std::vector<glm::mat4>& inverseBindMatrices,
+    const std::vector<Channel>& channels)
+    : mContext(context),
+      mNodes(nodes),
+      mGlobalTransforms(nodes.size(), glm::mat4(1.0f)),
+      mJoints(joints),
+      mInverseBindMatrices(inverseBindMatrices),
+      mChannels(channels),
+      mDuration(0.0f),
+      mTime(-1.0f),
+      mVersion(0),
+      mJointMatricesSlot(0) {
+    VKRT_ASSERT(mInverseBindMatrices.size() == mJoints.size());
+
+    std::vector<uint32_t> depths(mNodes.size(), 0);
+    for (uint32_t nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex) {
+        for (int32_t parent = mNodes[nodeIndex].parent; parent >= 0;
+             parent = mNodes[parent].parent) {
+            ++depths[nodeIndex];
+        }
+        mNodeOrder.push_back(nodeIndex);
+    }
+    std::stable_sort(mNodeOrder.begin(), mNodeOrder.end(), [&](uint32_t a, uint32_t b) {
+        return depths[a] < depths[b];
+    });
+
+    for (const Channel& channel : mChannels) {
+        if (!channel.times.empty()) {
+            mDuration = std::max(mDuration, channel.times.back());
+        }
+    }
+
+    // Host only contexts skin nothing on the device, the joint matrices aren't uploaded
+    const uint32_t slotCount = mContext->IsHostOnly() ? 0 : mContext->GetFramesInFlight();
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+        ScopedRefPtr<VulkanBuffer> buffer = mContext->GetDevice()->CreateBuffer(
+            std::max<size_t>(mJoints.size(), 1) * sizeof(glm::mat4),
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            vk::MemoryAllocateFlagBits::eDeviceAddress,
+            {MemoryCategory::Uniform, "Skin joint matrices"});
+        mMappedJointMatrices.push_back(reinterpret_cast<glm::mat4*>(buffer->MapBuffer()));
+        mJointMatrices.push_back(buffer);
+    }
+    SetTime(0.0f);
+}
+
+void Skin::SetTime(float seconds) {
+    const float time = mDuration > 0.0f ? std::fmod(seconds, mDuration) : 0.0f;
+    if (time == mTime) {
+        return;
+    }
+    mTime = time;
+
+    for (const Channel& channel : mChannels) {
+        Node& node = mNodes[channel.node];
+        const glm::vec4 value = Sample(channel, time);
+        switch (channel.path) {
+            case Path::Translation:
+                node.translation = glm::vec3(value);
+                break;
+            case Path::Rotation:
+                node.rotation = glm::quat(value.w, value.x, value.y, value.z);
+                break;
+            case Path::Scale:
+                node.scale = glm::vec3(value);
+                break;
+        }
+    }
+    UpdateJointMatrices();
+    ++mVersion;
+}
+
+glm::vec4 Skin::Sample(const Channel& channel, float time) const {
+    if (channel.times.empty()) {
+        return glm::vec4(0.0f);
+    }
+    const auto next = std::upper_bound(channel.times.begin(), channel.times.end(), time);
+    if (next == channel.times.begin()) {
+        return channel.values.front();
+    }
+    if (next == channel.times.end()) {
+        return channel.values.back();
+    }
+    const size_t nextIndex = static_cast<size_t>(next - channel.times.begin());
+    const glm::vec4& previousValue = channel.values[nextIndex - 1];
+    if (channel.step) {
+        return previousValue;
+    }
+    const float previousTime = channel.times[nextIndex - 1];
+    const float factor = (time - previousTime) / (channel.times[nextIndex] - previousTime);
+    const glm::vec4& nextValue = channel.values[nextIndex];
+    if (channel.path == Path::Rotation) {
+        const glm::quat rotation = glm::slerp(
+            glm::quat(previousValue.w, previousValue.x, previousValue.y, previousValue.z),
+            glm::quat(nextValue.w, nextValue.x, nextValue.y, nextValue.z),
+            factor);
+        return glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+    }
+    return glm::mix(previousValue, nextValue, factor);
+}
+
+void Skin::UpdateJointMatrices() {
+    for (uint32_t nodeIndex : mNodeOrder) {
+        const Node& node = mNodes[nodeIndex];
+        const glm::mat4 local = glm::translate(glm::mat4(1.0f), node.translation) *
+                                glm::mat4_cast(node.rotation) *
+                                glm::scale(glm::mat4(1.0f), node.scale);
+        mGlobalTransforms[nodeIndex] =
+            node.parent >= 0 ? mGlobalTransforms[node.parent] * local : local;
+    }
+    if (mMappedJointMatrices.empty()) {
+        return;
+    }
+    // The copy of the next frame, the frame that last skinned with it has completed
+    mJointMatricesSlot = mContext->GetFrameSlot();
+    glm::mat4* jointMatrices = mMappedJointMatrices[mJointMatricesSlot];
+    for (size_t jointIndex = 0; jointIndex < mJoints.size(); ++jointIndex) {
+        jointMatrices[jointIndex] =
+            mGlobalTransforms[mJoints[jointIndex]] * mInverseBindMatrices[jointIndex];
+    }
+}
+
+Skin::~Skin() {
+    for (VulkanBuffer* buffer : mJointMatrices) {
+        buffer->UnmapBuffer();
+    }
+}
+
+}  // namespace VKRT
@@ -0,0 +1,103 @@
+#include "SkinningPass.h"
+
+#include "Context.h"
+#include "DebugUtils.h"
+#include "GeometryPool.h"
+#include "Mesh.h"
+#include "ResourceLoader.h"
+#include "Scene.h"
+
+#undef MemoryBarrier
+
+namespace VKRT {
+
+SkinningPass::SkinningPass(ScopedRefPtr<Context> context) : mContext(context) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+
+    Resource shaderResource = ResourceLoader::Load(Resource::Id::SkinningShader);
+    vk::ShaderModuleCreateInfo shaderCreateInfo =
+        vk::ShaderModuleCreateInfo()
+            .setCodeSize(shaderResource.size * sizeof(uint8_t))
+            .setPCode(reinterpret_cast<const uint32_t*>(shaderResource.buffer));
+    mShader = VKRT_ASSERT_VK(logicalDevice.createShaderModule(shaderCreateInfo));
+    ResourceLoader::CleanUp(shaderResource);
+
+    const vk::PushConstantRange pushConstantRange =
+        vk::PushConstantRange()
+            .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+            .setOffset(0)
+            .setSize(sizeof(Parameters));
+    vk::PipelineLayoutCreateInfo layoutCreateInfo =
+        vk::PipelineLayoutCreateInfo().setPushConstantRanges(pushConstantRange);
+    mLayout = VKRT_ASSERT_VK(logicalDevice.createPipelineLayout(layoutCreateInfo));
+
+    vk::ComputePipelineCreateInfo pipelineCreateInfo =
+        vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                          .setStage(vk::ShaderStageFlagBits::eCompute)
+                          .setModule(mShader)
+                          .setPName("main"))
+            .setLayout(mLayout);
+    mPipeline = VKRT_ASSERT_VK(logicalDevice.createComputePipeline({}, pipelineCreateInfo));
+}
+
+void SkinningPass::Record(vk::CommandBuffer commandBuffer, Scene* scene) {
+    GeometryPool* geometryPool = mContext->GetGeometryPool();
+    bool hasDispatches = false;
+    for (const Object* object : scene->GetObjects()) {
+        for (Mesh* mesh : object->GetModel()->GetMeshes()) {
+            const Skin* skin = mesh->mSkin.Get();
+            // Objects sharing a model share its meshes, they are skinned once
+            if (skin == nullptr || mesh->mSkinnedVersion == skin->GetVersion()) {
+                continue;
+            }
+            if (!hasDispatches) {
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, mPipeline);
+                hasDispatches = true;
+            }
+
+            // Skinned meshes have a single geometry
+            const GeometryPool::Allocation& geometry = mesh->mGeometries[0];
+            const Parameters parameters{
+                .sourceVertices = geometryPool->GetVertexAddress(geometry.vertexOffset),
+                .targetVertices = geometryPool->GetVertexAddress(mesh->mSkinnedVertexOffset),
+                .influences = mesh->mInfluenceBuffer->GetDeviceAddress(),
+                .jointMatrices = skin->GetJointMatricesAddress(),
+                .vertexCount = geometry.vertexCount};
+            commandBuffer.pushConstants(
+                mLayout,
+                vk::ShaderStageFlagBits::eCompute,
+                0,
+                sizeof(Parameters),
+                &parameters);
+            const uint32_t groupCount = (geometry.vertexCount + WorkgroupSize - 1) / WorkgroupSize;
+            commandBuffer.dispatch(groupCount, 1, 1);
+            mesh->mSkinnedVersion = skin->GetVersion();
+            mesh->Rebuild();
+        }
+    }
+
+    if (hasDispatches) {
+        // Build inputs are shader reads of the build stage, the hit shaders read normals too
+        const vk::MemoryBarrier barrier = vk::MemoryBarrier()
+                                              .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                                              .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR |
+                vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+            {},
+            barrier,
+            {},
+            {});
+    }
+}
+
+SkinningPass::~SkinningPass() {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    logicalDevice.destroyPipeline(mPipeline);
+    logicalDevice.destroyPipelineLayout(mLayout);
+    logicalDevice.destroyShaderModule(mShader);
+}
+
+}  // namespace VKRT
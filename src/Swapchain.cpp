@@ -86,34 +86,37 @@ Swapchain::Swapchain(ScopedRefPtr<Context> context) : mContext(context), mCurren
         ScopedRefPtr<Texture> texture =
             new Texture(mContext, surfaceExtent.width, surfaceExtent.height, mFormat, {}, image);
         mImages.emplace_back(texture);
+        mRenderSemaphores.push_back(
+            VKRT_ASSERT_VK(logicalDevice.createSemaphore(vk::SemaphoreCreateInfo{})));
     }
-
-    mPresentSemaphore = VKRT_ASSERT_VK(logicalDevice.createSemaphore(vk::SemaphoreCreateInfo{}));
-    mRenderSemaphore = VKRT_ASSERT_VK(logicalDevice.createSemaphore(vk::SemaphoreCreateInfo{}));
 }
 
-void Swapchain::AcquireNextImage() {
+void Swapchain::AcquireNextImage(vk::Semaphore acquireSemaphore) {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     mCurrentImageIndex = VKRT_ASSERT_VK(logicalDevice.acquireNextImageKHR(
         mSwapchainHandle,
         std::numeric_limits<uint64_t>::max(),
-        mPresentSemaphore));
+        acquireSemaphore));
 }
 
 void Swapchain::Present() {
-    vk::PresentInfoKHR presentInfo = vk::PresentInfoKHR()
-                                         .setSwapchains(mSwapchainHandle)
-                                         .setImageIndices(mCurrentImageIndex)
-                                         .setWaitSemaphores(mRenderSemaphore);
+    vk::PresentInfoKHR presentInfo =
+        vk::PresentInfoKHR()
+            .setSwapchains(mSwapchainHandle)
+            .setImageIndices(mCurrentImageIndex)
+            .setWaitSemaphores(mRenderSemaphores[mCurrentImageIndex]);
     const vk::Queue& queue = mContext->GetDevice()->GetQueue();
     VKRT_ASSERT_VK(queue.presentKHR(presentInfo));
 }
 
 Swapchain::~Swapchain() {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
-    logicalDevice.destroySemaphore(mRenderSemaphore);
-    logicalDevice.destroySemaphore(mPresentSemaphore);
+    for (vk::Semaphore semaphore : mRenderSemaphores) {
+        logicalDevice.destroySemaphore(semaphore);
+    }
     mImages.clear();
+    // Image views have to go before the swapchain images do
+    mContext->GetDevice()->FlushRetired();
     logicalDevice.destroySwapchainKHR(mSwapchainHandle);
 }
 }  // namespace VKRT
\ No newline at end of file
@@ -13,7 +13,8 @@ Texture::Texture(
     uint32_t layers,
     vk::Format format,
     vk::ImageUsageFlags usageFlags,
-    vk::Image image)
+    vk::Image image,
+    const std::string& name)
     : mContext(context),
       mImage(image),
       ownsImage(true),
@@ -21,6 +22,9 @@ Texture::Texture(
       mHeight(height),
       mLayers(layers) {
     ownsImage = !image;
+    if (mContext->IsHostOnly()) {
+        return;
+    }
 
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
 
@@ -41,7 +45,9 @@ Texture::Texture(
         vk::MemoryRequirements imageMemReq = logicalDevice.getImageMemoryRequirements(mImage);
         mMemory = mContext->GetDevice()->AllocateMemory(
             vk::MemoryPropertyFlagBits::eDeviceLocal,
-            imageMemReq);
+            imageMemReq,
+            {},
+            {MemoryCategory::Texture, name});
         VKRT_ASSERT_VK(logicalDevice.bindImageMemory(mImage, mMemory, 0));
     }
 
@@ -66,8 +72,9 @@ Texture::Texture(
     uint32_t height,
     vk::Format format,
     vk::ImageUsageFlags usageFlags,
-    vk::Image image)
-    : Texture(context, width, height, 1, format, usageFlags, image) {}
+    vk::Image image,
+    const std::string& name)
+    : Texture(context, width, height, 1, format, usageFlags, image, name) {}
 
 Texture::Texture(
     ScopedRefPtr<Context> context,
@@ -75,18 +82,29 @@ Texture::Texture(
     uint32_t height,
     vk::Format format,
     const uint8_t* buffer,
-    size_t bufferSize)
+    size_t bufferSize,
+    const std::string& name)
     : Texture(
           context,
           width,
           height,
           format,
-          vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled) {
+          vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+          nullptr,
+          name) {
+    if (mContext->RetainsHostData() && format == vk::Format::eR8G8B8A8Unorm) {
+        mHostPixels.assign(buffer, buffer + bufferSize);
+    }
+    if (mContext->IsHostOnly()) {
+        return;
+    }
     ScopedRefPtr<VulkanBuffer> stagingBuffer = VulkanBuffer::Create(
         mContext,
         bufferSize,
         vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        {},
+        {MemoryCategory::Staging, name});
     uint8_t* stagingData = stagingBuffer->MapBuffer();
     std::copy_n(buffer, bufferSize, stagingData);
     stagingBuffer->UnmapBuffer();
@@ -125,7 +143,9 @@ Texture::Texture(
         vk::PipelineStageFlagBits::eAllCommands);
 
     VKRT_ASSERT_VK(commandBuffer.end());
-    mContext->GetDevice()->SubmitCommandAndFlush(commandBuffer);
+    // Not waited for, the staging buffer is retired past the upload and later submissions are
+    // ordered after the transition
+    mContext->GetDevice()->SubmitCommand(commandBuffer);
     mContext->GetDevice()->DestroyCommand(commandBuffer);
 }
 
@@ -176,12 +196,23 @@ void Texture::SetImageLayout(
     commandBuffer.pipelineBarrier(srcStageMask, dstStageMask, {}, {}, {}, imageBarrier);
 }
 
+void Texture::OnLastReference() {
+    if (mContext->IsHostOnly()) {
+        RefCountPtr::OnLastReference();
+        return;
+    }
+    mContext->GetDevice()->Retire(this);
+}
+
 Texture::~Texture() {
+    if (mContext->IsHostOnly()) {
+        return;
+    }
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     logicalDevice.destroyImageView(mImageView);
     if (ownsImage) {
         logicalDevice.destroyImage(mImage);
-        logicalDevice.freeMemory(mMemory);
+        mContext->GetDevice()->FreeMemory(mMemory);
     }
 }
 
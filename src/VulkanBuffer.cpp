@@ -10,7 +10,8 @@ ScopedRefPtr<VulkanBuffer> VulkanBuffer::Create(
     const vk::DeviceSize& size,
     const vk::BufferUsageFlags& usageFlags,
     const vk::MemoryPropertyFlags& memoryFlags,
-    const vk::MemoryAllocateFlags& memoryAllocateFlags) {
+    const vk::MemoryAllocateFlags& memoryAllocateFlags,
+    const MemoryTag& tag) {
     const vk::Device& logicalDevice = context->GetDevice()->GetLogicalDevice();
     const vk::BufferCreateInfo bufferCreateInfo = vk::BufferCreateInfo()
                                                       .setSize(size)
@@ -20,37 +21,78 @@ ScopedRefPtr<VulkanBuffer> VulkanBuffer::Create(
 
     const vk::MemoryRequirements memoryRequirements =
         logicalDevice.getBufferMemoryRequirements(bufferHandle);
-    const vk::DeviceMemory memoryHandle =
-        context->GetDevice()->AllocateMemory(memoryFlags, memoryRequirements, memoryAllocateFlags);
+    const MemoryAllocation allocation = context->GetDevice()->AllocateBufferMemory(
+        memoryFlags,
+        memoryRequirements,
+        memoryAllocateFlags,
+        tag);
 
-    VKRT_ASSERT_VK(logicalDevice.bindBufferMemory(bufferHandle, memoryHandle, 0));
+    VKRT_ASSERT_VK(
+        logicalDevice.bindBufferMemory(bufferHandle, allocation.memory, allocation.offset));
 
-    const vk::DescriptorBufferInfo bufferInfo =
-        vk::DescriptorBufferInfo().setBuffer(bufferHandle).setOffset(0).setRange(size);
-
-    return new VulkanBuffer(context, size, bufferHandle, memoryHandle, bufferInfo);
+    ScopedRefPtr<VulkanBuffer> buffer =
+        new VulkanBuffer(context, size, usageFlags, bufferHandle, allocation);
+    if (allocation.blockId != MemoryAllocation::DedicatedBlock) {
+        context->GetDevice()->GetMemoryAllocator()->SetOwner(allocation, buffer);
+    }
+    return buffer;
 }
 
 VulkanBuffer::VulkanBuffer(
     ScopedRefPtr<Context> context,
     vk::DeviceSize size,
+    vk::BufferUsageFlags usageFlags,
     vk::Buffer bufferHandle,
-    vk::DeviceMemory memoryHandle,
-    vk::DescriptorBufferInfo descriptorInfo)
+    const MemoryAllocation& allocation)
     : mContext(context),
       mSize(size),
+      mUsageFlags(usageFlags),
       mBufferHandle(bufferHandle),
-      mMemoryHandle(memoryHandle),
-      mDescriptorInfo(descriptorInfo) {}
+      mAllocation(allocation),
+      mDescriptorInfo(
+          vk::DescriptorBufferInfo().setBuffer(bufferHandle).setOffset(0).setRange(size)),
+      mRelocationListener(nullptr) {}
 
 uint8_t* VulkanBuffer::MapBuffer() {
     const vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
-    return static_cast<uint8_t*>(VKRT_ASSERT_VK(logicalDevice.mapMemory(mMemoryHandle, 0, mSize)));
+    return static_cast<uint8_t*>(
+        VKRT_ASSERT_VK(logicalDevice.mapMemory(mAllocation.memory, mAllocation.offset, mSize)));
 }
 
 void VulkanBuffer::UnmapBuffer() {
     const vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
-    logicalDevice.unmapMemory(mMemoryHandle);
+    logicalDevice.unmapMemory(mAllocation.memory);
+}
+
+void VulkanBuffer::FlushBuffer(vk::DeviceSize offset, vk::DeviceSize size) {
+    const vk::MemoryPropertyFlags memoryFlags =
+        mContext->GetDevice()->GetMemoryTypeFlags(mAllocation.memoryTypeIndex);
+    if (!(memoryFlags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+        // Ranges have to be aligned to the atom size, or reach the end of the allocation
+        const vk::DeviceSize atomSize =
+            mContext->GetDevice()->GetDeviceProperties().limits.nonCoherentAtomSize;
+        const vk::DeviceSize begin = (mAllocation.offset + offset) / atomSize * atomSize;
+        vk::DeviceSize flushSize = VK_WHOLE_SIZE;
+        if (size != VK_WHOLE_SIZE) {
+            const vk::DeviceSize end =
+                (mAllocation.offset + offset + size + atomSize - 1) / atomSize * atomSize;
+            if (end < mAllocation.offset + mAllocation.size) {
+                flushSize = end - begin;
+            }
+        }
+        const vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+        const vk::MappedMemoryRange memoryRange = vk::MappedMemoryRange()
+                                                      .setMemory(mAllocation.memory)
+                                                      .setOffset(begin)
+                                                      .setSize(flushSize);
+        VKRT_ASSERT_VK(logicalDevice.flushMappedMemoryRanges(memoryRange));
+    }
+}
+
+bool VulkanBuffer::IsHostVisible() const {
+    const vk::MemoryPropertyFlags memoryFlags =
+        mContext->GetDevice()->GetMemoryTypeFlags(mAllocation.memoryTypeIndex);
+    return static_cast<bool>(memoryFlags & vk::MemoryPropertyFlagBits::eHostVisible);
 }
 
 vk::DeviceAddress VulkanBuffer::GetDeviceAddress() {
@@ -60,10 +102,58 @@ vk::DeviceAddress VulkanBuffer::GetDeviceAddress() {
     return logicalDevice.getBufferAddress(bufferAddressInfo);
 }
 
+bool VulkanBuffer::IsMovable() const {
+    if (mAllocation.blockId == MemoryAllocation::DedicatedBlock) {
+        return false;
+    }
+    const bool hasBoundObjects =
+        static_cast<bool>(mUsageFlags & vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR);
+    return !hasBoundObjects || mRelocationListener != nullptr;
+}
+
+vk::Buffer VulkanBuffer::CreateHandle(const MemoryAllocation& allocation) {
+    const vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    const vk::BufferCreateInfo bufferCreateInfo = vk::BufferCreateInfo()
+                                                      .setSize(mSize)
+                                                      .setUsage(mUsageFlags)
+                                                      .setSharingMode(vk::SharingMode::eExclusive);
+    const vk::Buffer bufferHandle = VKRT_ASSERT_VK(logicalDevice.createBuffer(bufferCreateInfo));
+    VKRT_ASSERT_VK(
+        logicalDevice.bindBufferMemory(bufferHandle, allocation.memory, allocation.offset));
+    return bufferHandle;
+}
+
+void VulkanBuffer::RecordRelocation(vk::CommandBuffer commandBuffer, vk::Buffer newBufferHandle) {
+    if (mRelocationListener != nullptr) {
+        mRelocationListener->RecordRelocation(commandBuffer, this, newBufferHandle);
+        return;
+    }
+    const vk::BufferCopy copyRegion =
+        vk::BufferCopy().setSrcOffset(0).setDstOffset(0).setSize(mSize);
+    commandBuffer.copyBuffer(mBufferHandle, newBufferHandle, copyRegion);
+}
+
+void VulkanBuffer::CompleteRelocation(
+    vk::Buffer newBufferHandle,
+    const MemoryAllocation& allocation) {
+    vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
+    logicalDevice.destroyBuffer(mBufferHandle);
+    mBufferHandle = newBufferHandle;
+    mAllocation = allocation;
+    mDescriptorInfo.setBuffer(mBufferHandle);
+    if (mRelocationListener != nullptr) {
+        mRelocationListener->OnRelocated(this);
+    }
+}
+
+void VulkanBuffer::OnLastReference() {
+    mContext->GetDevice()->Retire(this);
+}
+
 VulkanBuffer::~VulkanBuffer() {
     vk::Device& logicalDevice = mContext->GetDevice()->GetLogicalDevice();
     logicalDevice.destroyBuffer(mBufferHandle);
-    logicalDevice.freeMemory(mMemoryHandle);
+    mContext->GetDevice()->FreeBufferMemory(mAllocation);
 }
 
 }  // namespace VKRT
\ No newline at end of file
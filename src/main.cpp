@@ -1,10 +1,20 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 
+#include "BLASBuilder.h"
+#include "BLASCache.h"
+#include "BLASCompactor.h"
 #include "Camera.h"
 #include "Context.h"
+#include "CpuRenderer.h"
 #include "DebugUtils.h"
+#include "Device.h"
+#include "HostBLASBuilder.h"
 #include "Renderer.h"
+#include "ResidencyManager.h"
 #include "Scene.h"
+#include "SceneAnalyzer.h"
 #include "Window.h"
 
 struct Timer {
@@ -22,174 +32,363 @@ struct Timer {
     std::chrono::steady_clock::time_point beginTime;
 };
 
+struct MemorySnapshotListener : public VKRT::InputEventListener {
+    void OnKeyPressed(int key) override {
+        if (key == GLFW_KEY_F12) {
+            snapshotRequested = true;
+        }
+    }
+
+    bool snapshotRequested = false;
+};
+
+static constexpr uint64_t DefragmentationBytesPerFrame = 8 * 1024 * 1024;
+// Past this, instances stop keeping their mesh resident when streaming is on
+static constexpr float ResidencyStreamingDistance = 60.0f;
+static constexpr uint32_t DefaultFramesInFlight = 2;
+// Resolution of the CPU rendered frame, there is no window to take it from
+static constexpr uint32_t HeadlessWidth = 1280;
+static constexpr uint32_t HeadlessHeight = 720;
+
+static void WriteMemorySnapshot(VKRT::Device* device, const std::string& path) {
+    if (device->WriteMemorySnapshot(path)) {
+        VKRT_LOG("Memory snapshot written to " << path);
+    } else {
+        VKRT_LOG("Couldn't write memory snapshot to " << path);
+    }
+}
+
 int main() {
     using namespace VKRT;
-    auto [windowResult, window] = Window::Create();
-    VKRT_ASSERT_MSG(windowResult == Result::Success, "Couldn't create window");
-    if (windowResult == Result::Success) {
-        auto [contextResult, context] = window->CreateContext();
+    int exitCode = 0;
+    // Traces a single frame on the CPU into this image instead of running the renderer
+    const char* cpuImagePath = std::getenv("VKRT_CPU_RENDER");
+    // Writes the acceleration structure report here and exits, failing over budget
+    const char* analysisPath = std::getenv("VKRT_ANALYZE");
+    // No window or device for these, the scene is only loaded into host memory
+    const bool headless = cpuImagePath != nullptr || analysisPath != nullptr;
+    ScopedRefPtr<Window> window;
+    ScopedRefPtr<Context> context;
+    if (headless) {
+        context = new Context();
+    } else {
+        auto [windowResult, createdWindow] = Window::Create();
+        VKRT_ASSERT_MSG(windowResult == Result::Success, "Couldn't create window");
+        if (windowResult != Result::Success) {
+            return 1;
+        }
+        window = createdWindow;
+        auto [contextResult, createdContext] = window->CreateContext();
         VKRT_ASSERT_MSG(contextResult == Result::Success, "No compatible GPU found");
-        if (contextResult == Result::Success) {
-            ScopedRefPtr<Scene> scene = new Scene(context);
+        if (contextResult != Result::Success) {
+            return 1;
+        }
+        context = createdContext;
+    }
+
+    if (!headless) {
+        // Frames recorded ahead of the device, 1 waits for every frame
+        const char* framesInFlight = std::getenv("VKRT_FRAMES_IN_FLIGHT");
+        context->SetFramesInFlight(
+            framesInFlight != nullptr
+                ? std::clamp<uint32_t>(
+                      static_cast<uint32_t>(std::strtoul(framesInFlight, nullptr, 10)),
+                      1,
+                      Context::MaxFramesInFlight)
+                : DefaultFramesInFlight);
+        // Set to build static meshes on the CPU worker threads instead of the device
+        context->GetHostBLASBuilder()->SetEnabled(std::getenv("VKRT_HOST_BLAS_BUILDS") != nullptr);
+        // Set to a number of megabytes to stream static meshes in and out under that budget
+        const char* residencyBudget = std::getenv("VKRT_RESIDENCY_BUDGET_MB");
+        if (residencyBudget != nullptr) {
+            ResidencyManager* residency = context->GetResidencyManager();
+            residency->SetBudget(std::strtoull(residencyBudget, nullptr, 10) * 1024 * 1024);
+            residency->SetStreamingDistance(ResidencyStreamingDistance);
+        }
+    }
+
+    // Everything holding device objects is released before the context is destroyed
+    {
+        ScopedRefPtr<Scene> scene = new Scene(context);
 #if defined(VKRT_PLATFORM_WINDOWS)
-            std::string userDir = std::getenv("USERPROFILE");
+        std::string userDir = std::getenv("USERPROFILE");
 #elif defined(VKRT_PLATFORM_LINUX)
-            std::string userDir = std::getenv("HOME");
+        std::string userDir = std::getenv("HOME");
 #endif
-            ScopedRefPtr<Model> helmetModel =
-                Model::Load(context, userDir + "/assets/DamagedHelmet.glb");
-            ScopedRefPtr<Model> sponzaModel =
-                Model::Load(context, userDir + "/assets/sponza_b.gltf");
-            ScopedRefPtr<Model> venusModel = Model::Load(context, userDir + "/assets/venus.gltf");
-            ScopedRefPtr<Model> deerModel = Model::Load(context, userDir + "/assets/deer.gltf");
-
-            std::vector<ScopedRefPtr<Model>> cubes{
-                Model::Load(context, userDir + "/assets/cube.gltf"),
-                Model::Load(context, userDir + "/assets/cube.gltf"),
-                Model::Load(context, userDir + "/assets/cube.gltf"),
-            };
-
-            std::vector<ScopedRefPtr<Model>> spheres{
-                Model::Load(context, userDir + "/assets/sphere.gltf"),
-                Model::Load(context, userDir + "/assets/sphere.gltf"),
-                Model::Load(context, userDir + "/assets/sphere.gltf"),
-            };
-
-            std::for_each(
-                venusModel->GetMeshes().begin(),
-                venusModel->GetMeshes().end(),
-                [](Mesh* mesh) {
-                    mesh->GetMaterial()->SetMetallic(1.0f);
-                    mesh->GetMaterial()->SetRoughness(0.0f);
-                });
-
-            std::for_each(
-                deerModel->GetMeshes().begin(),
-                deerModel->GetMeshes().end(),
-                [](Mesh* mesh) { mesh->GetMaterial()->SetIndexOfRefraction(1.5f); });
-
-            std::for_each(
-                cubes[0]->GetMeshes().begin(),
-                cubes[0]->GetMeshes().end(),
-                [](Mesh* mesh) {
-                    mesh->GetMaterial()->SetAlbedo(glm::vec3(0.0f, 0.0f, 1.0f));
-                    mesh->GetMaterial()->SetRoughness(0.5f);
-                });
-
-            std::for_each(
-                cubes[1]->GetMeshes().begin(),
-                cubes[1]->GetMeshes().end(),
-                [](Mesh* mesh) {
-                    mesh->GetMaterial()->SetMetallic(0.8f);
-                    mesh->GetMaterial()->SetRoughness(0.0f);
-                });
-
-            std::for_each(
-                cubes[2]->GetMeshes().begin(),
-                cubes[2]->GetMeshes().end(),
-                [](Mesh* mesh) { mesh->GetMaterial()->SetIndexOfRefraction(1.3f); });
-
-            std::for_each(
-                spheres[0]->GetMeshes().begin(),
-                spheres[0]->GetMeshes().end(),
-                [](Mesh* mesh) {
-                    mesh->GetMaterial()->SetAlbedo(glm::vec3(0.2f, 0.6f, 0.3f));
-                    mesh->GetMaterial()->SetRoughness(0.8f);
-                });
-
-            std::for_each(
-                spheres[1]->GetMeshes().begin(),
-                spheres[1]->GetMeshes().end(),
-                [](Mesh* mesh) {
-                    mesh->GetMaterial()->SetMetallic(1.0f);
-                    mesh->GetMaterial()->SetRoughness(0.0f);
-                });
-
-            std::for_each(
-                spheres[2]->GetMeshes().begin(),
-                spheres[2]->GetMeshes().end(),
-                [](Mesh* mesh) { mesh->GetMaterial()->SetIndexOfRefraction(1.8f); });
-
-            ScopedRefPtr<Camera> camera = new Camera(window);
-            camera->SetTranslation(glm::vec3(-2.0f, -4.0f, 0.0f));
-            camera->SetRotation(glm::vec3(0.0f, 180.0f, 0.0f));
-
-            ScopedRefPtr<DirectionalLight> light = new DirectionalLight();
-            light->SetIntensity(0.8f);
-
-            ScopedRefPtr<PointLight> pointLight = new PointLight();
-            pointLight->SetIntensity(30.0f);
-            pointLight->SetPosition(glm::vec3(0.0f, 80.3f, -3.0f));
-
-            ScopedRefPtr<Object> helmet = new Object(helmetModel);
-            helmet->SetTranslation(glm::vec3(4.0f, 3.0f, 0.0f));
-            helmet->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
-            helmet->SetScale(glm::vec3(1.5f));
-
-            ScopedRefPtr<Object> deer = new Object(deerModel);
-            deer->SetTranslation(glm::vec3(-4.0f, 3.0f, 0.0f));
-            deer->SetScale(glm::vec3(.7f));
-
-            ScopedRefPtr<Object> venus = new Object(venusModel);
-            venus->SetTranslation(glm::vec3(0.0f, 3.0f, 0.0f));
-            venus->SetScale(glm::vec3(0.5f));
-            venus->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
-
-            ScopedRefPtr<Object> sponza = new Object(sponzaModel);
-            sponza->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
-            sponza->SetScale(glm::vec3(0.03f));
-
-            float offset = 0.0f;
-            for (const auto& cube : cubes) {
-                ScopedRefPtr<Object> cubeObject = new Object(cube);
-                cubeObject->SetTranslation(glm::vec3(-20.0f, 2.0f, 2.0f - offset));
-                cubeObject->SetScale(glm::vec3(0.3f));
-                cubeObject->Rotate(glm::vec3(0.0f, offset * 20, 0.0f));
-                scene->AddObject(cubeObject);
-                offset += 3.0f;
+        ScopedRefPtr<Model> helmetModel =
+            Model::Load(context, userDir + "/assets/DamagedHelmet.glb");
+        ScopedRefPtr<Model> sponzaModel =
+            Model::Load(context, userDir + "/assets/sponza_b.gltf");
+        ScopedRefPtr<Model> venusModel = Model::Load(context, userDir + "/assets/venus.gltf");
+        ScopedRefPtr<Model> deerModel = Model::Load(context, userDir + "/assets/deer.gltf");
+
+        std::vector<ScopedRefPtr<Model>> cubes{
+            Model::Load(context, userDir + "/assets/cube.gltf"),
+            Model::Load(context, userDir + "/assets/cube.gltf"),
+            Model::Load(context, userDir + "/assets/cube.gltf"),
+        };
+
+        // Analytic, they need no mesh of their own
+        std::vector<ScopedRefPtr<Material>> sphereMaterials{
+            new Material(glm::vec3(0.2f, 0.6f, 0.3f), 0.8f, 0.0f, -1.0f),
+            new Material(glm::vec3(0.5f), 0.0f, 1.0f, -1.0f),
+            new Material(glm::vec3(0.5f), 1.0f, 0.0f, 1.8f),
+        };
+        if (!headless) {
+            // Every mesh BLAS in one submission
+            context->GetBLASBuilder()->Flush();
+            VKRT_LOG(
+                "BLAS cache: " << context->GetBLASCache()->GetLoadCount()
+                               << " structures loaded from disk");
+            if (context->GetHostBLASBuilder()->GetBuildCount() > 0) {
+                VKRT_LOG(
+                    "BLAS host builds: " << context->GetHostBLASBuilder()->GetBuildCount()
+                                         << " structures, "
+                                         << context->GetHostBLASBuilder()->GetTriangleCount()
+                                         << " triangles in "
+                                         << context->GetHostBLASBuilder()->GetMilliseconds()
+                                         << "ms");
+            }
+        }
+
+        for (Material* material : venusModel->GetMaterials()) {
+            material->SetMetallic(1.0f);
+            material->SetRoughness(0.0f);
+        }
+
+        for (Material* material : deerModel->GetMaterials()) {
+            material->SetIndexOfRefraction(1.5f);
+        }
+
+        for (Material* material : cubes[0]->GetMaterials()) {
+            material->SetAlbedo(glm::vec3(0.0f, 0.0f, 1.0f));
+            material->SetRoughness(0.5f);
+        }
+
+        for (Material* material : cubes[1]->GetMaterials()) {
+            material->SetMetallic(0.8f);
+            material->SetRoughness(0.0f);
+        }
+
+        for (Material* material : cubes[2]->GetMaterials()) {
+            material->SetIndexOfRefraction(1.3f);
+        }
+
+        ScopedRefPtr<Camera> camera =
+            headless ? new Camera(static_cast<double>(HeadlessWidth) / HeadlessHeight)
+                     : new Camera(window);
+        camera->SetTranslation(glm::vec3(-2.0f, -4.0f, 0.0f));
+        camera->SetRotation(glm::vec3(0.0f, 180.0f, 0.0f));
+
+        ScopedRefPtr<DirectionalLight> light = new DirectionalLight();
+        light->SetIntensity(0.8f);
+
+        ScopedRefPtr<PointLight> pointLight = new PointLight();
+        pointLight->SetIntensity(30.0f);
+        pointLight->SetPosition(glm::vec3(0.0f, 80.3f, -3.0f));
+
+        ScopedRefPtr<Object> helmet = new Object(helmetModel);
+        helmet->SetTranslation(glm::vec3(4.0f, 3.0f, 0.0f));
+        helmet->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
+        helmet->SetScale(glm::vec3(1.5f));
+
+        ScopedRefPtr<Object> deer = new Object(deerModel);
+        deer->SetTranslation(glm::vec3(-4.0f, 3.0f, 0.0f));
+        deer->SetScale(glm::vec3(.7f));
+
+        ScopedRefPtr<Object> venus = new Object(venusModel);
+        venus->SetTranslation(glm::vec3(0.0f, 3.0f, 0.0f));
+        venus->SetScale(glm::vec3(0.5f));
+        venus->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
+
+        ScopedRefPtr<Object> sponza = new Object(sponzaModel);
+        sponza->Rotate(glm::vec3(90.0f, 0.0f, 0.0f));
+        sponza->SetScale(glm::vec3(0.03f));
+
+        float offset = 0.0f;
+        for (const auto& cube : cubes) {
+            ScopedRefPtr<Object> cubeObject = new Object(cube);
+            cubeObject->SetTranslation(glm::vec3(-20.0f, 2.0f, 2.0f - offset));
+            cubeObject->SetScale(glm::vec3(0.3f));
+            cubeObject->Rotate(glm::vec3(0.0f, offset * 20, 0.0f));
+            scene->AddObject(cubeObject);
+            offset += 3.0f;
+        }
+
+        offset = 0.0f;
+        for (const ScopedRefPtr<Material>& material : sphereMaterials) {
+            scene->AddSphere(glm::vec3(-20.0f, 4.0f, 2.0f - offset), 0.75f, material);
+            offset += 3.0f;
+        }
+
+        scene->AddObject(helmet);
+        scene->AddObject(venus);
+        scene->AddObject(deer);
+        scene->AddObject(sponza);
+
+        scene->AddLight(light);
+        scene->AddLight(pointLight);
+        if (!headless) {
+            // Set to expand the TLAS instances with a compute pass
+            scene->SetDeviceInstanceGeneration(std::getenv("VKRT_DEVICE_INSTANCES") != nullptr);
+        }
+
+        if (cpuImagePath != nullptr) {
+            ScopedRefPtr<CpuRenderer> cpuRenderer = new CpuRenderer(scene);
+            cpuRenderer->Update();
+            cpuRenderer->Render(
+                glm::inverse(camera->GetViewTransform()),
+                glm::inverse(camera->GetProjectionTransform()),
+                HeadlessWidth,
+                HeadlessHeight);
+            const CpuRenderer::Statistics& cpuStatistics = cpuRenderer->GetStatistics();
+            VKRT_LOG(
+                "CPU BVH build: " << cpuStatistics.buildMilliseconds << "ms, render: "
+                                  << cpuStatistics.renderMilliseconds << "ms, "
+                                  << cpuStatistics.rayCount /
+                                         cpuStatistics.renderMilliseconds / 1000.0
+                                  << " Mrays/s");
+            if (cpuRenderer->WriteImage(cpuImagePath)) {
+                VKRT_LOG("CPU frame written to " << cpuImagePath);
+            }
+        }
+
+        if (analysisPath != nullptr) {
+            SceneAnalyzer::Budget budget;
+            const char* budgetPath = std::getenv("VKRT_ANALYZE_BUDGET");
+            if (budgetPath != nullptr && !SceneAnalyzer::Budget::Load(budgetPath, budget)) {
+                VKRT_LOG("Couldn't read analysis budget " << budgetPath);
+                exitCode = 1;
+            }
+            SceneAnalyzer analyzer(scene, budget);
+            analyzer.Analyze();
+            if (!analyzer.WriteReport(analysisPath)) {
+                VKRT_LOG("Couldn't write analysis report to " << analysisPath);
+                exitCode = 1;
+            }
+            VKRT_LOG(
+                "Analysis: " << analyzer.GetReport().exceededBudgetCount
+                             << " budgets exceeded, report written to " << analysisPath);
+            if (!analyzer.IsWithinBudget()) {
+                exitCode = 1;
             }
+        }
+
+        if (headless) {
+            return exitCode;
+        }
 
-            offset = 0.0f;
-            for (const auto& sphere : spheres) {
-                ScopedRefPtr<Object> object = new Object(sphere);
-                object->SetTranslation(glm::vec3(-20.0f, 4.0f, 2.0f - offset));
-                object->SetScale(glm::vec3(0.75f));
-                scene->AddObject(object);
-                offset += 3.0f;
+        ScopedRefPtr<Renderer> renderer = new Renderer(context, scene);
+        MemorySnapshotListener memorySnapshotListener;
+        window->GetInputManager()->Subscribe(&memorySnapshotListener);
+        Timer timer;
+        double elapsedSeconds = 0.0;
+        double totalSeconds = 0.0;
+        double statisticsSeconds = 0.0;
+        double mainPassMilliseconds = 0.0;
+        double primaryRaysPerSecond = 0.0;
+        double tlasBuildMilliseconds = 0.0;
+        uint32_t tlasRebuildCount = 0;
+        uint64_t dirtyInstanceCount = 0;
+        uint32_t statisticsFrameCount = 0;
+        while (window->Update()) {
+            timer.Start();
+            {
+                light->SetDirection(
+                    glm::normalize(glm::vec3(0.2f, -1.0f, 0.2 * cos(totalSeconds / 2.0f))));
+                pointLight->SetPosition(glm::vec3(-35.0f, 3.0f, 5.5f * cos(totalSeconds)));
+                helmet->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
+                venus->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
+                deer->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
+                deer->SetTranslation(glm::vec3(4.0f, 3.0f, 2.0f * cos(totalSeconds)));
+                camera->Update(elapsedSeconds);
+                scene->Animate(static_cast<float>(totalSeconds));
+                renderer->Render(camera);
+                // Waits for the frames in flight when anything moves
+                context->GetDevice()->GetMemoryAllocator()->Defragment(
+                    DefragmentationBytesPerFrame);
             }
+            elapsedSeconds = timer.ElapsedSeconds();
+            totalSeconds += elapsedSeconds;
 
-            scene->AddObject(helmet);
-            scene->AddObject(venus);
-            scene->AddObject(deer);
-            scene->AddObject(sponza);
-
-            scene->AddLight(light);
-            scene->AddLight(pointLight);
-
-            ScopedRefPtr<Renderer> renderer = new Renderer(context, scene);
-            Timer timer;
-            double elapsedSeconds = 0.0;
-            double totalSeconds = 0.0;
-            while (window->Update()) {
-                timer.Start();
-                {
-                    light->SetDirection(
-                        glm::normalize(glm::vec3(0.2f, -1.0f, 0.2 * cos(totalSeconds / 2.0f))));
-                    pointLight->SetPosition(glm::vec3(-35.0f, 3.0f, 5.5f * cos(totalSeconds)));
-                    helmet->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
-                    venus->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
-                    deer->Rotate(glm::vec3(0.0f, elapsedSeconds * 30.0f, 0.0f));
-                    deer->SetTranslation(glm::vec3(4.0f, 3.0f, 2.0f * cos(totalSeconds)));
-                    camera->Update(elapsedSeconds);
-                    renderer->Render(camera);
+            const Renderer::FrameStatistics& statistics = renderer->GetFrameStatistics();
+            mainPassMilliseconds += statistics.mainPassMilliseconds;
+            primaryRaysPerSecond += statistics.primaryRaysPerSecond;
+            tlasBuildMilliseconds += statistics.tlasBuildMilliseconds;
+            tlasRebuildCount += statistics.tlasRebuilt ? 1 : 0;
+            dirtyInstanceCount += statistics.dirtyInstanceCount;
+            ++statisticsFrameCount;
+            statisticsSeconds += elapsedSeconds;
+            if (statisticsSeconds > 5.0) {
+                VKRT_LOG(
+                    "Main pass: " << mainPassMilliseconds / statisticsFrameCount << "ms, "
+                                  << primaryRaysPerSecond / statisticsFrameCount / 1000000.0
+                                  << " Mrays/s (primary)");
+                VKRT_LOG(
+                    "TLAS: " << tlasBuildMilliseconds / statisticsFrameCount << "ms, "
+                             << tlasRebuildCount << " rebuilds in " << statisticsFrameCount
+                             << " frames, "
+                             << dirtyInstanceCount / statisticsFrameCount << "/"
+                             << scene->GetInstanceCount()
+                             << " instances written per frame");
+                const MemoryAllocator::Statistics memoryStatistics =
+                    context->GetDevice()->GetMemoryAllocator()->GetStatistics();
+                VKRT_LOG(
+                    "Device memory: " << memoryStatistics.usedBytes / (1024 * 1024) << "/"
+                                      << memoryStatistics.committedBytes / (1024 * 1024)
+                                      << "MB in " << memoryStatistics.blockCount
+                                      << " blocks, fragmentation "
+                                      << memoryStatistics.fragmentation << ", "
+                                      << memoryStatistics.moveCount << " moves");
+                VKRT_LOG(
+                    "BLAS compaction saved "
+                    << context->GetBLASCompactor()->GetSavedBytes() / (1024 * 1024) << "MB, "
+                    << context->GetBLASCache()->GetStoreCount() << " written to the cache");
+                const ResidencyManager* residency = context->GetResidencyManager();
+                if (residency->IsEnabled()) {
+                    VKRT_LOG(
+                        "Residency: " << residency->GetResidentBytes() / (1024 * 1024) << "/"
+                                      << residency->GetBudget() / (1024 * 1024) << "MB, "
+                                      << residency->GetResidentMeshCount() << "/"
+                                      << residency->GetMeshCount() << " meshes, "
+                                      << residency->GetEvictionCount() << " evictions, "
+                                      << residency->GetStreamCount() << " streamed in");
+                }
+                for (uint32_t policyIndex = 0;
+                     policyIndex < static_cast<uint32_t>(Mesh::BuildPolicy::Count);
+                     ++policyIndex) {
+                    const Mesh::BuildPolicy buildPolicy =
+                        static_cast<Mesh::BuildPolicy>(policyIndex);
+                    const BLASBuilder::Statistics& buildStatistics =
+                        context->GetBLASBuilder()->GetStatistics(buildPolicy);
+                    if (buildStatistics.buildCount + buildStatistics.refitCount == 0) {
+                        continue;
+                    }
+                    VKRT_LOG(
+                        "BLAS " << Mesh::GetBuildPolicyName(buildPolicy) << ": "
+                                << buildStatistics.buildCount << " builds, "
+                                << buildStatistics.refitCount << " refits, "
+                                << buildStatistics.triangleCount << " triangles in "
+                                << buildStatistics.milliseconds << "ms total");
                 }
-                elapsedSeconds = timer.ElapsedSeconds();
-                totalSeconds += elapsedSeconds;
+                statisticsSeconds = 0.0;
+                mainPassMilliseconds = 0.0;
+                primaryRaysPerSecond = 0.0;
+                tlasBuildMilliseconds = 0.0;
+                tlasRebuildCount = 0;
+                dirtyInstanceCount = 0;
+                statisticsFrameCount = 0;
+            }
+
+            if (memorySnapshotListener.snapshotRequested) {
+                WriteMemorySnapshot(context->GetDevice(), "memory_snapshot.json");
+                memorySnapshotListener.snapshotRequested = false;
             }
         }
-        if (context != nullptr) {
-            window->DestroyContext();
-        }
+        WriteMemorySnapshot(context->GetDevice(), "memory_snapshot_exit.json");
+        WriteMemorySnapshot(context->GetDevice(), "memory_snapshot_exit.csv");
+        window->GetInputManager()->Unsuscribe(&memorySnapshotListener);
     }
-    return 0;
-}
\ No newline at end of file
+    window->DestroyContext();
+    return exitCode;
+}